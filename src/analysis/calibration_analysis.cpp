@@ -0,0 +1,238 @@
+#include "calibration_analysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+struct PendingStep {
+  StepResult result;
+  bool end_known = false;
+};
+
+double WrapAngle(double angle) {
+  return std::remainder(angle, 2 * M_PI);
+}
+
+void FinishStep(PendingStep* pending) {
+  StepResult& result = pending->result;
+  for (int i = 0; i < 3; i++) {
+    result.force[i] /= result.sample_count;
+    result.torque[i] /= result.sample_count;
+  }
+  ElevationAzimuth(result.force, &result.elevation_deg, &result.azimuth_deg);
+}
+
+}
+
+void ElevationAzimuth(const double force[3], double* elevation_deg, double* azimuth_deg) {
+  const double x = force[0];
+  const double y = force[1];
+  const double z = force[2];
+  *elevation_deg = std::atan2(std::sqrt(x * x + y * y), -z) * 180 / M_PI;
+  *azimuth_deg = std::atan2(y, x) * 180 / M_PI;
+}
+
+int ProcessSteps(const StepOptions& options,
+                 const MotorLogSource& motor_log,
+                 const ForceLogSource& force_log,
+                 const std::function<void (const StepResult&)>& step) {
+  const double settle = options.transient_duration;
+  const double lead = 0.5 * options.transient_duration;
+
+  std::deque<PendingStep> steps;
+  bool motor_done = false;
+  bool have_first = false;
+  int64_t first_time_ns = 0;
+  int32_t id = 0;
+  double motor_time = -std::numeric_limits<double>::infinity();
+
+  // Read the motor log until it reaches @p time, starting a new step
+  // at every command change.
+  auto advance_motor = [&](double time) {
+    MotorLogRecord record;
+    while (!motor_done && motor_time < time) {
+      if (!motor_log(&record)) {
+        motor_done = true;
+        if (!steps.empty() && !steps.back().end_known) {
+          steps.back().result.end_time = motor_time;
+          steps.back().end_known = true;
+        }
+        break;
+      }
+      if (!have_first) {
+        have_first = true;
+        first_time_ns = record.timestamp_ns;
+        id = record.id;
+      }
+      if (record.id != id) { continue; }
+      const double record_time =
+          (record.timestamp_ns - first_time_ns) * 1e-9 - options.startup_time;
+      if (record_time < 0.0) { continue; }
+      motor_time = record_time;
+
+      const StepResult* last = steps.empty() ? nullptr : &steps.back().result;
+      if (last != nullptr &&
+          last->velocity_command == record.velocity_command &&
+          last->amplitude_command == record.amplitude_command &&
+          last->phase_command == record.phase_command) {
+        continue;
+      }
+      if (!steps.empty()) {
+        steps.back().result.end_time = motor_time;
+        steps.back().end_known = true;
+      }
+      PendingStep next;
+      next.result.velocity_command = record.velocity_command;
+      next.result.amplitude_command = record.amplitude_command;
+      next.result.phase_command = record.phase_command;
+      next.result.start_time = motor_time;
+      steps.push_back(next);
+    }
+  };
+
+  int count = 0;
+  auto finish_front = [&]() {
+    PendingStep& front = steps.front();
+    if (front.result.sample_count > 0) {
+      FinishStep(&front);
+      step(front.result);
+      count++;
+    }
+    steps.pop_front();
+  };
+
+  ForceSample sample;
+  while (force_log(&sample)) {
+    if (sample.time < 0.0) { continue; }
+
+    // Once the motor log has passed the end of this sample's window,
+    // or ended, it is known which step, if any, the sample is in.
+    advance_motor(sample.time + lead);
+    if (motor_done && steps.empty()) { break; }
+
+    // The force log is in time order, so steps which end before this
+    // sample are complete.
+    while (!steps.empty() && steps.front().end_known &&
+           sample.time >= steps.front().result.end_time - lead) {
+      finish_front();
+    }
+    if (steps.empty()) {
+      if (motor_done) { break; }
+      continue;
+    }
+
+    StepResult& current = steps.front().result;
+    if (sample.time < current.start_time + settle) { continue; }
+    current.sample_count++;
+    for (int i = 0; i < 3; i++) {
+      current.force[i] += sample.force[i];
+      current.torque[i] += sample.torque[i];
+    }
+  }
+
+  // Read the rest of the motor log, so that the final step's end time
+  // is known.
+  advance_motor(std::numeric_limits<double>::infinity());
+  while (!steps.empty()) {
+    finish_front();
+  }
+  return count;
+}
+
+CalibrationFit::CalibrationFit(const Options& options) : options_(options) {}
+
+void CalibrationFit::Add(const StepResult& step) {
+  step_count_++;
+
+  const double v = step.velocity_command;
+  const double v2 = v * v;
+  const double force = std::sqrt(step.force[0] * step.force[0] +
+                                 step.force[1] * step.force[1] +
+                                 step.force[2] * step.force[2]);
+  v4_ += v2 * v2;
+  v2_force_ += v2 * force;
+
+  const double amplitude = step.amplitude_command;
+  if (amplitude > 0.0) {
+    elevation_count_++;
+    amplitude2_ += amplitude * amplitude;
+    amplitude_elevation_ += amplitude * step.elevation_deg;
+  }
+
+  if (amplitude > options_.phase_amplitude_threshold) {
+    // The phase which gives zero azimuth, unwrapped around the first
+    // step so that offsets near +-pi do not split.
+    const double offset = step.phase_command - step.azimuth_deg * M_PI / 180;
+    if (phase_count_ == 0) {
+      phase_reference_ = WrapAngle(offset);
+    }
+    const double unwrapped = phase_reference_ + WrapAngle(offset - phase_reference_);
+    phase_count_++;
+    double power = 1.0;
+    for (int i = 0; i < 5; i++) {
+      v_powers_[i] += power;
+      if (i < 3) { offset_v_powers_[i] += unwrapped * power; }
+      power *= v;
+    }
+  }
+}
+
+CalibrationModel CalibrationFit::Solve(const CalibrationModel& base) const {
+  if (!(v4_ > 0.0) || elevation_count_ == 0 || phase_count_ == 0) {
+    throw std::runtime_error(
+        "too few calibration steps, the fits need steps with nonzero velocity "
+        "and with amplitude above the phase amplitude threshold");
+  }
+
+  CalibrationModel model = base;
+  model.thrust_coefficient = v2_force_ / v4_;
+  model.elevation_coefficient = amplitude_elevation_ / amplitude2_;
+
+  // With fewer distinct velocities than terms, the higher order terms
+  // are left at zero.
+  double p[3] = {};
+  for (int terms = 3; terms > 0; terms--) {
+    if (SolvePhaseFit(terms, p)) { break; }
+  }
+  for (int i = 0; i < 3; i++) {
+    model.phase_offset[i] = p[i];
+  }
+  return model;
+}
+
+bool CalibrationFit::SolvePhaseFit(int terms, double* p) const {
+  // Normal equations for offset = sum p[i] v^i, solved by Gaussian
+  // elimination with partial pivoting.
+  double a[3][4];
+  for (int row = 0; row < terms; row++) {
+    for (int column = 0; column < terms; column++) {
+      a[row][column] = v_powers_[row + column];
+    }
+    a[row][3] = offset_v_powers_[row];
+  }
+  for (int column = 0; column < terms; column++) {
+    int pivot = column;
+    for (int row = column + 1; row < terms; row++) {
+      if (std::abs(a[row][column]) > std::abs(a[pivot][column])) { pivot = row; }
+    }
+    // Relative to the diagonal before elimination, which is positive.
+    if (!(std::abs(a[pivot][column]) > 1e-9 * v_powers_[2 * column])) {
+      return false;
+    }
+    for (int k = 0; k < 4; k++) { std::swap(a[column][k], a[pivot][k]); }
+    for (int row = column + 1; row < terms; row++) {
+      const double factor = a[row][column] / a[column][column];
+      for (int k = column; k < 4; k++) { a[row][k] -= factor * a[column][k]; }
+    }
+  }
+  for (int row = terms - 1; row >= 0; row--) {
+    double sum = a[row][3];
+    for (int k = row + 1; k < terms; k++) { sum -= a[row][k] * p[k]; }
+    p[row] = sum / a[row][row];
+  }
+  return true;
+}
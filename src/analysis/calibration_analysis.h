@@ -0,0 +1,113 @@
+#ifndef CALIBRATION_ANALYSIS_H
+#define CALIBRATION_ANALYSIS_H
+
+#include <functional>
+
+#include "force_log.h"
+#include "../controller/calibration_table.h"
+#include "../logging/motor_log_record.h"
+
+/// @file
+///
+/// Turns a calibration run, the motor log and the force/torque log,
+/// into a CalibrationModel.
+///
+/// Both logs are streamed in a single pass.  The motor log is split
+/// into steps where the velocity, amplitude or phase command changes,
+/// and the force samples within each step, excluding the transient
+/// after the change, are averaged.  Only the steps that can still
+/// receive samples are kept in memory.
+
+struct StepOptions {
+  // Motor log records before this many seconds are ignored.  Time zero
+  // of the force log is at the end of the startup time.
+  double startup_time = 1.0;
+
+  // Force samples are averaged from this long after the command
+  // changes until half of this before the next change.
+  double transient_duration = 0.2;
+};
+
+/// The mean thrust vector measured during one command step.
+struct StepResult {
+  float velocity_command = 0.0f;
+  float amplitude_command = 0.0f;
+  float phase_command = 0.0f;
+
+  // Seconds after the startup time.
+  double start_time = 0.0;
+  double end_time = 0.0;
+
+  int sample_count = 0;
+  double force[3] = {};
+  double torque[3] = {};
+
+  // Angle of the force from -Z, and its direction about Z from X.
+  double elevation_deg = 0.0;
+  double azimuth_deg = 0.0;
+};
+
+/// Elevation and azimuth in degrees of a force in the NED frame, where
+/// a nominal thrust is along -Z.
+void ElevationAzimuth(const double force[3], double* elevation_deg, double* azimuth_deg);
+
+using MotorLogSource = std::function<bool (MotorLogRecord*)>;
+using ForceLogSource = std::function<bool (ForceSample*)>;
+
+/// Segment one calibration run and call @p step for every step with
+/// at least one force sample, in time order.  Only records from the
+/// first servo in the motor log are used.  Returns the number of
+/// steps.
+int ProcessSteps(const StepOptions& options,
+                 const MotorLogSource& motor_log,
+                 const ForceLogSource& force_log,
+                 const std::function<void (const StepResult&)>& step);
+
+/// Least squares fits of the CalibrationModel relationships,
+/// accumulated one step at a time:
+///
+///   |force| = thrust_coefficient * velocity^2, over all steps
+///   elevation = elevation_coefficient * amplitude, over amplitude > 0
+///   phase - azimuth = quadratic in velocity, over amplitude above
+///                     phase_amplitude_threshold, as the azimuth is
+///                     poorly defined at small elevations.  Lower order
+///                     if there are fewer than three velocities.
+class CalibrationFit {
+ public:
+  struct Options {
+    float phase_amplitude_threshold = 0.15f;
+  };
+
+  CalibrationFit(const Options& options);
+
+  void Add(const StepResult& step);
+
+  /// Returns @p base with the fitted coefficients.  Throws
+  /// std::runtime_error if there are too few steps to fit.
+  CalibrationModel Solve(const CalibrationModel& base) const;
+
+  int step_count() const { return step_count_; }
+
+ private:
+  bool SolvePhaseFit(int terms, double* p) const;
+
+  const Options options_;
+  int step_count_ = 0;
+
+  // thrust
+  double v4_ = 0.0;
+  double v2_force_ = 0.0;
+
+  // elevation
+  int elevation_count_ = 0;
+  double amplitude2_ = 0.0;
+  double amplitude_elevation_ = 0.0;
+
+  // phase: sums of v^0..v^4, and of the offset times v^0..v^2
+  int phase_count_ = 0;
+  double phase_reference_ = 0.0;
+  double v_powers_[5] = {};
+  double offset_v_powers_[3] = {};
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "calibration_planner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// The standardized residual of @p y, zero until the fit has residual
+// degrees of freedom.
+template <size_t N>
+double Standardized(const RecursiveLeastSquares<N>& fit, double residual) {
+  const double variance = fit.residual_variance();
+  if (!(variance > 0.0)) { return 0.0; }
+  return std::abs(residual) / std::sqrt(variance);
+}
+
+template <size_t N>
+double RelativeInterval(const RecursiveLeastSquares<N>& fit) {
+  return fit.interval95(0) / std::abs(fit.coefficient(0));
+}
+
+}
+
+CalibrationPlanner::CalibrationPlanner(CalibrationController* controller, OnlineCalibration* fit,
+                                       const Options& options)
+    : controller_(controller), fit_(fit), options_(options) {
+  if (!(options_.step_velocity > 0.0f && options_.min_velocity <= options_.max_velocity &&
+        options_.step_amplitude > 0.0f && options_.max_amplitude >= 0.0f &&
+        !options_.phases.empty())) {
+    throw std::invalid_argument("The calibration planner grid is empty");
+  }
+  if (controller_->step_count() != 0) {
+    throw std::invalid_argument("The calibration planner needs a controller without steps");
+  }
+
+  for (float v = options_.min_velocity; v <= options_.max_velocity + 1e-4f;
+       v += options_.step_velocity) {
+    for (float a = 0.0f; a <= options_.max_amplitude + 1e-6f; a += options_.step_amplitude) {
+      for (float phase : options_.phases) {
+        Point point;
+        point.velocity = v;
+        point.amplitude = a;
+        point.phase = phase;
+        candidates_.push_back(point);
+      }
+    }
+  }
+  state_.resize(candidates_.size());
+
+  const std::vector<Point> points = seed();
+  const size_t steps = std::max<size_t>(points.size(), options_.max_steps);
+  controller_->reserve_steps(steps);
+  steps_.reserve(steps);
+  for (const Point& point : points) {
+    state_[Find(point.velocity, point.amplitude, point.phase)].visits++;
+    controller_->append_step(point.velocity, point.amplitude, point.phase);
+    planned_++;
+  }
+  fit_->set_step_callback([this](const StepResult& step) { AddStep(step); });
+}
+
+std::vector<CalibrationPlanner::Point> CalibrationPlanner::seed() const {
+  // The grid is ordered by velocity, then amplitude, then phase.
+  const Point& first = candidates_.front();
+  const Point& last = candidates_.back();
+  const float middle = (first.velocity + last.velocity) / 2;
+  float middle_velocity = first.velocity;
+  for (const Point& point : candidates_) {
+    if (std::abs(point.velocity - middle) < std::abs(middle_velocity - middle)) {
+      middle_velocity = point.velocity;
+    }
+  }
+  const float phase = options_.phases.front();
+  const float amplitude = last.amplitude;
+
+  std::vector<Point> points;
+  const auto add = [&](float velocity, float amplitude) {
+    for (const Point& point : points) {
+      if (point.velocity == velocity && point.amplitude == amplitude) { return; }
+    }
+    Point point;
+    point.velocity = velocity;
+    point.amplitude = amplitude;
+    point.phase = phase;
+    points.push_back(point);
+  };
+  add(first.velocity, 0.0f);
+  add(last.velocity, 0.0f);
+  add(first.velocity, amplitude);
+  add(middle_velocity, amplitude);
+  add(last.velocity, amplitude);
+  return points;
+}
+
+int CalibrationPlanner::Find(float velocity, float amplitude, float phase) const {
+  for (size_t i = 0; i < candidates_.size(); i++) {
+    const Point& point = candidates_[i];
+    if (point.velocity == velocity && point.amplitude == amplitude && point.phase == phase) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void CalibrationPlanner::AddStep(const StepResult& step) {
+  if (steps_.size() < steps_.capacity()) {
+    steps_.push_back(step);
+  }
+}
+
+void CalibrationPlanner::initialize(std::vector<MoteusInterface::ServoCommand>* commands) {
+  fit_->initialize(commands);
+}
+
+bool CalibrationPlanner::run(const ControlTime& time,
+                             const std::vector<MoteusInterface::ServoReply>& status,
+                             std::vector<MoteusInterface::ServoCommand>* output) {
+  const bool stop = fit_->run(time, status, output);
+  // Keep one step queued behind the one running.
+  if (!stop && !done_ && controller_->current_step() + 1 >= controller_->step_count()) {
+    Point point;
+    if (Next(&point)) {
+      controller_->append_step(point.velocity, point.amplitude, point.phase);
+    } else {
+      done_ = true;
+    }
+  }
+  return stop;
+}
+
+bool CalibrationPlanner::thrust_converged() const {
+  const auto& fit = fit_->thrust_fit();
+  return fit.count() > 1 && RelativeInterval(fit) <= options_.thrust_tolerance;
+}
+
+bool CalibrationPlanner::elevation_converged() const {
+  if (candidates_.back().amplitude <= 0.0f) { return true; }
+  const auto& fit = fit_->elevation_fit();
+  return fit.count() > 1 && RelativeInterval(fit) <= options_.elevation_tolerance;
+}
+
+bool CalibrationPlanner::phase_converged() const {
+  const float threshold = fit_->options().phase_amplitude_threshold;
+  if (candidates_.back().amplitude <= threshold) { return true; }
+  const auto& fit = fit_->phase_fit();
+  if (fit.count() <= 3) { return false; }
+  const double t = StudentT95(fit.count() - 3);
+  for (const Point& point : candidates_) {
+    double x[3];
+    OnlineCalibration::PhaseRegressors(point.velocity, x);
+    if (t * std::sqrt(fit.residual_variance() * fit.Leverage(x)) > options_.phase_tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CalibrationPlanner::converged() const {
+  return thrust_converged() && elevation_converged() && phase_converged();
+}
+
+bool CalibrationPlanner::Next(Point* point) {
+  if (planned_ >= options_.max_steps || converged()) {
+    return false;
+  }
+  const auto& thrust = fit_->thrust_fit();
+  const auto& elevation = fit_->elevation_fit();
+  const auto& phase = fit_->phase_fit();
+  const float threshold = fit_->options().phase_amplitude_threshold;
+
+  // The largest standardized residual of the steps at each candidate,
+  // against the latest fits.
+  for (auto& state : state_) { state.residual = 0.0; }
+  for (const StepResult& step : steps_) {
+    const int index = Find(step.velocity_command, step.amplitude_command, step.phase_command);
+    if (index < 0) { continue; }
+    const double v = step.velocity_command;
+    const double force = std::sqrt(step.force[0] * step.force[0] +
+                                   step.force[1] * step.force[1] +
+                                   step.force[2] * step.force[2]);
+    double residual = Standardized(thrust, force - thrust.Predict({v * v}));
+    if (step.amplitude_command > 0.0f) {
+      const double amplitude = step.amplitude_command;
+      residual = std::max(residual,
+                          Standardized(elevation, step.elevation_deg - elevation.Predict({amplitude})));
+    }
+    if (step.amplitude_command > threshold) {
+      double x[3];
+      OnlineCalibration::PhaseRegressors(v, x);
+      const double offset = step.phase_command - step.azimuth_deg * M_PI / 180;
+      residual = std::max(residual, Standardized(
+          phase, std::remainder(offset - phase.Predict(x), 2 * M_PI)));
+    }
+    state_[index].residual = std::max(state_[index].residual, residual);
+  }
+
+  const bool fit_thrust = !thrust_converged();
+  const bool fit_elevation = !elevation_converged();
+  const bool fit_phase = !phase_converged();
+  int best = -1;
+  double best_score = -1.0;
+  for (size_t i = 0; i < candidates_.size(); i++) {
+    const Point& candidate = candidates_[i];
+    const double v = candidate.velocity;
+    const double amplitude = candidate.amplitude;
+
+    double information = 0.0;
+    if (fit_thrust) {
+      information += std::log1p(thrust.Leverage({v * v}));
+    }
+    if (fit_elevation && amplitude > 0.0) {
+      information += std::log1p(elevation.Leverage({amplitude}));
+    }
+    if (fit_phase && amplitude > threshold) {
+      double x[3];
+      OnlineCalibration::PhaseRegressors(v, x);
+      information += std::log1p(phase.Leverage(x));
+    }
+    double score = information / (1 + state_[i].visits);
+
+    // Next to a step where the models fit badly.
+    double residual = 0.0;
+    for (size_t j = 0; j < candidates_.size(); j++) {
+      if (candidates_[j].amplitude == candidate.amplitude &&
+          std::abs(candidates_[j].velocity - candidate.velocity) <= options_.step_velocity * 1.01f) {
+        residual = std::max(residual, state_[j].residual);
+      }
+    }
+    score += options_.residual_weight * std::max(0.0, residual - options_.residual_threshold);
+
+    if (score > best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+
+  *point = candidates_[best];
+  state_[best].visits++;
+  planned_++;
+  return true;
+}
@@ -0,0 +1,116 @@
+#ifndef CALIBRATION_PLANNER_H
+#define CALIBRATION_PLANNER_H
+
+#include <vector>
+
+#include "online_calibration.h"
+
+/// Chooses the calibration steps one at a time from the fits so far,
+/// instead of running the whole grid of generateThrustVectorSequence.
+///
+/// The candidates are the same grid, of velocity, amplitude from zero
+/// and phase.  The session starts with seed() steps, which determine
+/// every fit.  Then, while each step runs, the next is the candidate
+/// which adds the most information to the fits not yet within their
+/// tolerances, the sum of log(1 + leverage) over them, see
+/// RecursiveLeastSquares.  This is a sequential D-optimal design, which
+/// for these models favors the ends of the velocity and amplitude
+/// ranges.  So that the plan still covers the ranges, and finds where
+/// the models do not fit, the information of a candidate is divided by
+/// one plus its visits, and a candidate next to a step whose residual
+/// is more than residual_threshold standard deviations gains
+/// residual_weight per standard deviation beyond.
+///
+/// The session ends once every fit is within its tolerance, or after
+/// max_steps.  The thrust and elevation tolerances are relative 95%
+/// confidence intervals, and the phase tolerance is the largest 95%
+/// interval of the predicted phase offset over the velocity range.
+///
+/// Wraps an OnlineCalibration, whose step callback it uses, and whose
+/// CalibrationController must be in settling mode and have no steps of
+/// its own.  Each step is chosen before the one before it has been
+/// fitted, as the controller needs it as soon as that step ends.  A
+/// planner runs one session, and nothing is allocated while it runs.
+///
+/// Next() runs inside run(), on the control thread, once per step, in
+/// O(candidates^2 + steps * candidates).  With the default 35
+/// candidates that is about 12 us on an x86 development machine, so the
+/// cycle it runs in is that much longer; a much finer grid, or a
+/// slower CPU, should plan on another thread instead.
+class CalibrationPlanner : public Controller {
+ public:
+  struct Options {
+    float min_velocity = 50.0;
+    float max_velocity = 80.0;
+    float step_velocity = 5.0;
+    float max_amplitude = 0.35;
+    float step_amplitude = 0.08;
+    std::vector<float> phases = {0.0f};
+
+    int max_steps = 70;
+
+    double thrust_tolerance = 0.01;
+    double elevation_tolerance = 0.02;
+    double phase_tolerance = 0.05;  // rad
+
+    double residual_threshold = 2.0;
+    double residual_weight = 0.5;
+  };
+
+  struct Point {
+    float velocity = 0.0f;
+    float amplitude = 0.0f;
+    float phase = 0.0f;
+  };
+
+  /// Queues the seed steps on @p controller.  Throws
+  /// std::invalid_argument if the grid is empty.
+  CalibrationPlanner(CalibrationController* controller, OnlineCalibration* fit,
+                     const Options& options);
+
+  void initialize(std::vector<MoteusInterface::ServoCommand>* commands) override;
+  bool run(const ControlTime& time,
+           const std::vector<MoteusInterface::ServoReply>& status,
+           std::vector<MoteusInterface::ServoCommand>* output) override;
+  const moteus::FrameCodec* frame_codec() const override { return fit_->frame_codec(); }
+
+  /// The first steps: both ends of the velocity range at zero and at
+  /// the largest amplitude, and the middle velocity at the largest
+  /// amplitude, for the quadratic phase fit.
+  std::vector<Point> seed() const;
+
+  /// Chooses the next step, false once the fits are within their
+  /// tolerances or max_steps are planned.
+  bool Next(Point* point);
+
+  /// Whether every fit is within its tolerance.
+  bool converged() const;
+
+  const std::vector<Point>& candidates() const { return candidates_; }
+
+ private:
+  struct Candidate {
+    int visits = 0;
+    // The largest standardized residual of the steps at this point.
+    double residual = 0.0;
+  };
+
+  void AddStep(const StepResult& step);
+  int Find(float velocity, float amplitude, float phase) const;
+  bool thrust_converged() const;
+  bool elevation_converged() const;
+  bool phase_converged() const;
+
+  CalibrationController* const controller_;
+  OnlineCalibration* const fit_;
+  const Options options_;
+
+  std::vector<Point> candidates_;
+  std::vector<Candidate> state_;
+  // The fitted steps, to compute residuals against the latest fit.
+  std::vector<StepResult> steps_;
+  int planned_ = 0;
+  bool done_ = false;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "force_log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const char* const kColumnNames[6] = {
+  "Force X (N)", "Force Y (N)", "Force Z (N)",
+  "Torque X (N-m)", "Torque Y (N-m)", "Torque Z (N-m)",
+};
+
+// Splits a line on commas, removing surrounding quotes and spaces.
+void SplitFields(const std::string& line, std::vector<std::string>* fields) {
+  fields->clear();
+  size_t begin = 0;
+  while (true) {
+    const size_t end = line.find(',', begin);
+    std::string field = line.substr(begin, end == std::string::npos ? end : end - begin);
+    const size_t first = field.find_first_not_of(" \t\r\"");
+    const size_t last = field.find_last_not_of(" \t\r\"");
+    fields->push_back(first == std::string::npos ? "" : field.substr(first, last - first + 1));
+    if (end == std::string::npos) { break; }
+    begin = end + 1;
+  }
+}
+
+// Parses the value of a "Name = value" header field, returning false
+// if @p field is not @p name.
+bool ParseSetting(const std::string& field, const std::string& name, double* value) {
+  if (field.compare(0, name.size(), name) != 0) { return false; }
+  const size_t separator = field.find('=', name.size());
+  if (separator == std::string::npos) { return false; }
+  char* end = nullptr;
+  const char* text = field.c_str() + separator + 1;
+  *value = std::strtod(text, &end);
+  if (end == text) {
+    throw std::runtime_error("invalid force log setting: " + field);
+  }
+  return true;
+}
+
+}
+
+ForceLogReader::ForceLogReader(std::istream& input, bool inverted)
+    : input_(input), inverted_(inverted) {
+  if (!std::getline(input_, line_)) {
+    throw std::runtime_error("empty force log");
+  }
+
+  std::vector<std::string> fields;
+  SplitFields(line_, &fields);
+  double frequency = 0.0;
+  double averaging = 0.0;
+  for (size_t i = 0; i < fields.size(); i++) {
+    for (int j = 0; j < 6; j++) {
+      if (fields[i] == kColumnNames[j]) {
+        columns_[j] = static_cast<int>(i);
+        column_count_ = std::max(column_count_, columns_[j] + 1);
+      }
+    }
+    ParseSetting(fields[i], "Frequency", &frequency);
+    ParseSetting(fields[i], "Averaging Level", &averaging);
+    ParseSetting(fields[i], "Force Time Offset", &time_offset_);
+  }
+
+  for (int j = 0; j < 6; j++) {
+    if (columns_[j] < 0) {
+      throw std::runtime_error(std::string("force log has no column ") + kColumnNames[j]);
+    }
+  }
+  if (!(frequency > 0.0) || !(averaging > 0.0)) {
+    throw std::runtime_error("force log header has no Frequency or Averaging Level");
+  }
+  sample_rate_ = frequency / averaging;
+}
+
+bool ForceLogReader::Next(ForceSample* sample) {
+  do {
+    if (!std::getline(input_, line_)) { return false; }
+  } while (line_.empty() || line_ == "\r");
+
+  // Parse the row in place, only the force and torque columns are
+  // converted.
+  double values[6] = {};
+  const char* text = line_.c_str();
+  for (int column = 0; column < column_count_; column++) {
+    while (*text == ' ' || *text == '"') { text++; }
+    for (int j = 0; j < 6; j++) {
+      if (columns_[j] != column) { continue; }
+      char* end = nullptr;
+      values[j] = std::strtod(text, &end);
+      if (end == text) {
+        throw std::runtime_error("malformed force log row: " + line_);
+      }
+    }
+    while (*text != ',' && *text != '\0') { text++; }
+    if (*text == '\0' && column + 1 < column_count_) {
+      throw std::runtime_error("force log row has too few columns: " + line_);
+    }
+    text++;
+  }
+
+  sample->time = index_ / sample_rate_ - time_offset_;
+  index_++;
+
+  // NWU rotated 180 degrees, to NED.
+  sample->force[0] = -values[0];
+  sample->force[1] = values[1];
+  sample->force[2] = -values[2];
+  if (inverted_) {
+    sample->force[1] = -sample->force[1];
+    sample->force[2] = -sample->force[2];
+  }
+  for (int i = 0; i < 3; i++) {
+    sample->torque[i] = values[3 + i];
+  }
+  return true;
+}
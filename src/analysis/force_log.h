@@ -0,0 +1,54 @@
+#ifndef FORCE_LOG_H
+#define FORCE_LOG_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+
+/// One force/torque measurement, in the NED frame of the rotor.
+struct ForceSample {
+  // Seconds, with the force time offset applied.
+  double time = 0.0;
+  float force[3] = {};   // N
+  float torque[3] = {};  // N-m
+};
+
+/// Reads the CSV written by the ATI force/torque sensor software one
+/// sample at a time.
+///
+/// The first line names the columns, and also carries the settings
+/// "Frequency = N", "Averaging Level = N" and, once the logs have been
+/// synchronized, "Force Time Offset = x".  Samples are taken at
+/// Frequency / Averaging Level, and the time of sample i is
+/// i / rate - offset.
+///
+/// The sensor is mounted 180 degrees about Z from NED, so X and Z
+/// forces are negated.  For an inverted rotor, Z and Y are negated as
+/// well.
+class ForceLogReader {
+ public:
+  /// Throws std::runtime_error if a force or torque column or the
+  /// sample rate settings are missing from the header.
+  ForceLogReader(std::istream& input, bool inverted);
+
+  /// Returns false at the end of the log.  Throws std::runtime_error
+  /// for a malformed row.
+  bool Next(ForceSample* sample);
+
+  /// Samples per second.
+  double sample_rate() const { return sample_rate_; }
+  double time_offset() const { return time_offset_; }
+
+ private:
+  std::istream& input_;
+  const bool inverted_;
+  std::string line_;
+  // The column of each of Force X, Y, Z and Torque X, Y, Z.
+  int columns_[6] = {-1, -1, -1, -1, -1, -1};
+  int column_count_ = 0;
+  double sample_rate_ = 0.0;
+  double time_offset_ = 0.0;
+  int64_t index_ = 0;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "online_calibration.h"
+
+constexpr double OnlineCalibration::kPhaseVelocityScale;
+
+OnlineCalibration::OnlineCalibration(CalibrationController* controller, const Options& options,
+                                     const ForceLogSource& force_log,
+                                     const PublishCallback& publish)
+    : controller_(controller),
+      options_(options),
+      force_log_(force_log),
+      publish_(publish),
+      thrust_(options.thrust_prior),
+      elevation_(options.elevation_prior),
+      phase_(options.phase_prior) {}
+
+void OnlineCalibration::Reset() {
+  started_ = false;
+  sample_ = ForceSample();
+  have_sample_ = false;
+  finished_steps_ = 0;
+  step_start_ = 0.0;
+  sample_count_ = 0;
+  for (int i = 0; i < 3; i++) {
+    force_[i] = 0.0;
+    torque_[i] = 0.0;
+  }
+  step_count_ = 0;
+  thrust_ = RecursiveLeastSquares<1>(options_.thrust_prior);
+  elevation_ = RecursiveLeastSquares<1>(options_.elevation_prior);
+  phase_ = RecursiveLeastSquares<3>(options_.phase_prior);
+  phase_reference_ = 0.0;
+}
+
+void OnlineCalibration::initialize(std::vector<MoteusInterface::ServoCommand>* commands) {
+  Reset();
+  controller_->initialize(commands);
+}
+
+bool OnlineCalibration::run(const ControlTime& time,
+                            const std::vector<MoteusInterface::ServoReply>& status,
+                            std::vector<MoteusInterface::ServoCommand>* output) {
+  const bool stop = controller_->run(time, status, output);
+  if (!started_) {
+    start_time_ = time.now;
+    started_ = true;
+  }
+  const double step_time = std::chrono::duration<double>(time.now - start_time_).count() -
+      controller_->startup_sequence_length();
+  const double lead = options_.transient_duration / 2;
+
+  const auto& steps = controller_->steps();
+  for (; finished_steps_ < steps.size(); finished_steps_++) {
+    const CalibrationStep& step = steps[finished_steps_];
+    Consume(step.end_time - lead);
+    FinishStep(step);
+  }
+  Consume(step_time - lead);
+
+  if (stop && publish_) {
+    publish_(estimate());
+  }
+  return stop;
+}
+
+void OnlineCalibration::Consume(double until) {
+  while (true) {
+    if (!have_sample_) {
+      if (!force_log_ || !force_log_(&sample_)) { return; }
+      have_sample_ = true;
+    }
+    if (sample_.time > until) { return; }
+    have_sample_ = false;
+
+    // Samples in the transient, or of a step which already ended.
+    if (sample_.time < step_start_ + options_.transient_duration) { continue; }
+    sample_count_++;
+    for (int i = 0; i < 3; i++) {
+      force_[i] += sample_.force[i];
+      torque_[i] += sample_.torque[i];
+    }
+  }
+}
+
+void OnlineCalibration::FinishStep(const CalibrationStep& step) {
+  const int sample_count = sample_count_;
+  step_start_ = step.end_time;
+  sample_count_ = 0;
+  if (sample_count == 0) {
+    return;
+  }
+
+  StepResult result;
+  result.velocity_command = step.velocity;
+  result.amplitude_command = step.amplitude;
+  result.phase_command = step.phase;
+  result.start_time = step.start_time;
+  result.end_time = step.end_time;
+  result.sample_count = sample_count;
+  for (int i = 0; i < 3; i++) {
+    result.force[i] = force_[i] / sample_count;
+    result.torque[i] = torque_[i] / sample_count;
+    force_[i] = 0.0;
+    torque_[i] = 0.0;
+  }
+  ElevationAzimuth(result.force, &result.elevation_deg, &result.azimuth_deg);
+
+  step_count_++;
+  const double v = result.velocity_command;
+  const double force = std::sqrt(result.force[0] * result.force[0] +
+                                 result.force[1] * result.force[1] +
+                                 result.force[2] * result.force[2]);
+  thrust_.Add({v * v}, force);
+  if (result.amplitude_command > 0.0) {
+    elevation_.Add({static_cast<double>(result.amplitude_command)}, result.elevation_deg);
+  }
+  if (result.amplitude_command > options_.phase_amplitude_threshold) {
+    // The phase which gives zero azimuth, as in CalibrationFit.
+    const double offset = result.phase_command - result.azimuth_deg * M_PI / 180;
+    if (phase_.count() == 0) {
+      phase_reference_ = std::remainder(offset, 2 * M_PI);
+    }
+    double x[3];
+    PhaseRegressors(v, x);
+    phase_.Add(x, phase_reference_ + std::remainder(offset - phase_reference_, 2 * M_PI));
+  }
+  if (step_callback_) { step_callback_(result); }
+}
+
+CalibrationEstimate OnlineCalibration::estimate() const {
+  CalibrationEstimate estimate;
+  estimate.step_count = step_count_;
+  estimate.thrust_steps = thrust_.count();
+  estimate.thrust_coefficient = thrust_.coefficient(0);
+  estimate.thrust_interval = thrust_.interval95(0);
+  estimate.elevation_steps = elevation_.count();
+  estimate.elevation_coefficient = elevation_.coefficient(0);
+  estimate.elevation_interval = elevation_.interval95(0);
+  estimate.phase_steps = phase_.count();
+  double scale = 1.0;
+  for (int i = 0; i < 3; i++) {
+    estimate.phase_offset[i] = phase_.coefficient(i) / scale;
+    estimate.phase_interval[i] = phase_.interval95(i) / scale;
+    scale *= kPhaseVelocityScale;
+  }
+  return estimate;
+}
+
+CalibrationModel OnlineCalibration::Apply(const CalibrationModel& base) const {
+  CalibrationModel model = base;
+  if (thrust_.count() > 0) {
+    model.thrust_coefficient = thrust_.coefficient(0);
+  }
+  if (elevation_.count() > 0) {
+    model.elevation_coefficient = elevation_.coefficient(0);
+  }
+  if (phase_.count() > 3) {
+    const CalibrationEstimate fit = estimate();
+    for (int i = 0; i < 3; i++) {
+      model.phase_offset[i] = fit.phase_offset[i];
+    }
+  }
+  return model;
+}
@@ -0,0 +1,144 @@
+#ifndef ONLINE_CALIBRATION_H
+#define ONLINE_CALIBRATION_H
+
+#include <cmath>
+#include <functional>
+
+#include "calibration_analysis.h"
+#include "recursive_least_squares.h"
+#include "../controller/calibration_controller.h"
+
+/// The coefficients fitted so far, each with half the width of its 95%
+/// confidence interval, infinite until there are at least two steps.
+struct CalibrationEstimate {
+  int step_count = 0;
+
+  int thrust_steps = 0;
+  double thrust_coefficient = 0.0;
+  double thrust_interval = INFINITY;
+
+  int elevation_steps = 0;
+  double elevation_coefficient = 0.0;
+  double elevation_interval = INFINITY;
+
+  // phase_offset of CalibrationModel, finite intervals once there are
+  // more than three steps.
+  int phase_steps = 0;
+  double phase_offset[3] = {};
+  double phase_interval[3] = {INFINITY, INFINITY, INFINITY};
+};
+
+/// Fits the thrust and elevation relationships of CalibrationModel while
+/// a CalibrationController runs, so that a session ends with a model
+/// without the offline analysis.
+///
+/// Runs the wrapped controller unchanged.  Each cycle, the force samples
+/// up to the current time are taken from a ForceLogSource, which may be
+/// a log replayed in time or a live sensor that returns false while no
+/// new sample is available.  Its time must be zero at the end of the
+/// startup sequence, as for ProcessSteps.  As there, the samples of a
+/// step are averaged from transient_duration after its start until half
+/// of that before its end, and samples which arrive later than that are
+/// dropped.  When the controller completes a step, its mean updates
+///
+///   |force| = thrust_coefficient * velocity^2, over all steps
+///   elevation = elevation_coefficient * amplitude, over amplitude > 0
+///   phase - azimuth = quadratic in velocity, over amplitude above
+///                     phase_amplitude_threshold
+///
+/// by recursive least squares, which gives the same coefficients as
+/// CalibrationFit, except that the phase fit is not reduced in order
+/// when there are fewer than three velocities.  Nothing is allocated
+/// while running.
+class OnlineCalibration : public Controller {
+ public:
+  struct Options {
+    double transient_duration = 0.2;
+
+    // Prior variances of the coefficients, see RecursiveLeastSquares,
+    // far wider than any rotor's.
+    double thrust_prior = 1e-2;
+    double elevation_prior = 1e6;
+    // Of the phase offset coefficients in velocity / kPhaseVelocityScale.
+    double phase_prior = 1e6;
+
+    float phase_amplitude_threshold = 0.15f;
+  };
+
+  // The phase offset is fitted in velocity / kPhaseVelocityScale, so
+  // that its regressors are of similar size.
+  static constexpr double kPhaseVelocityScale = 100.0;
+
+  using PublishCallback = std::function<void (const CalibrationEstimate&)>;
+
+  /// @p publish is called with the final estimate when @p controller
+  /// ends the session.
+  OnlineCalibration(CalibrationController* controller, const Options& options,
+                    const ForceLogSource& force_log, const PublishCallback& publish);
+
+  void initialize(std::vector<MoteusInterface::ServoCommand>* commands) override;
+  bool run(const ControlTime& time,
+           const std::vector<MoteusInterface::ServoReply>& status,
+           std::vector<MoteusInterface::ServoCommand>* output) override;
+  const moteus::FrameCodec* frame_codec() const override {
+    return controller_->frame_codec();
+  }
+
+  CalibrationEstimate estimate() const;
+
+  /// @p base with the fitted coefficients, those without steps, or
+  /// with no more phase steps than coefficients, are left as they are.
+  CalibrationModel Apply(const CalibrationModel& base) const;
+
+  /// The fits themselves, for planning, see CalibrationPlanner.
+  const Options& options() const { return options_; }
+  const RecursiveLeastSquares<1>& thrust_fit() const { return thrust_; }
+  const RecursiveLeastSquares<1>& elevation_fit() const { return elevation_; }
+  const RecursiveLeastSquares<3>& phase_fit() const { return phase_; }
+  static void PhaseRegressors(double velocity, double (&x)[3]) {
+    const double s = velocity / kPhaseVelocityScale;
+    x[0] = 1.0;
+    x[1] = s;
+    x[2] = s * s;
+  }
+
+  /// The mean force of every step which had samples, as it is added.
+  void set_step_callback(const std::function<void (const StepResult&)>& step) {
+    step_callback_ = step;
+  }
+
+ private:
+  void Reset();
+  // Average the samples up to @p until into the step in progress.
+  void Consume(double until);
+  void FinishStep(const CalibrationStep& step);
+
+  CalibrationController* const controller_;
+  const Options options_;
+  const ForceLogSource force_log_;
+  const PublishCallback publish_;
+  std::function<void (const StepResult&)> step_callback_;
+
+  bool started_ = false;
+  std::chrono::steady_clock::time_point start_time_;
+
+  // The next force sample, once read.
+  ForceSample sample_;
+  bool have_sample_ = false;
+
+  // The step in progress, in seconds after the startup sequence.
+  size_t finished_steps_ = 0;
+  double step_start_ = 0.0;
+  int sample_count_ = 0;
+  double force_[3] = {};
+  double torque_[3] = {};
+
+  int step_count_ = 0;
+  RecursiveLeastSquares<1> thrust_;
+  RecursiveLeastSquares<1> elevation_;
+  RecursiveLeastSquares<3> phase_;
+  // The phase offsets are unwrapped around the first.
+  double phase_reference_ = 0.0;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "pwm_log.h"
+
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+PwmLogReader::PwmLogReader(std::istream& input) : input_(input) {
+  if (!std::getline(input_, line_)) {
+    throw std::runtime_error("empty PWM log");
+  }
+  if (!line_.empty() && line_.back() == '\r') { line_.pop_back(); }
+
+  std::istringstream header(line_);
+  std::string field;
+  std::getline(header, field, ',');
+  if (field == "Timestamp_us") {
+    timestamp_scale_ = 1000;
+  } else if (field != "Timestamp") {
+    throw std::runtime_error("PWM log does not start with a timestamp column: " + line_);
+  }
+  while (std::getline(header, field, ',')) {
+    if (field != "Pin" + std::to_string(channel_count_)) {
+      throw std::runtime_error("unexpected PWM log column: " + field);
+    }
+    channel_count_++;
+  }
+}
+
+bool PwmLogReader::Next(PwmSample* sample) {
+  do {
+    if (!std::getline(input_, line_)) { return false; }
+  } while (line_.empty() || line_ == "\r");
+
+  const char* text = line_.c_str();
+  char* end = nullptr;
+  const long long timestamp = std::strtoll(text, &end, 10);
+  if (end == text) {
+    throw std::runtime_error("malformed PWM log row: " + line_);
+  }
+  sample->timestamp_ns = timestamp * timestamp_scale_;
+
+  sample->pulse_widths.resize(channel_count_);
+  for (size_t channel = 0; channel < channel_count_; channel++) {
+    if (*end != ',') {
+      throw std::runtime_error("PWM log row has too few columns: " + line_);
+    }
+    text = end + 1;
+    sample->pulse_widths[channel] = std::strtof(text, &end);
+    if (end == text) {
+      throw std::runtime_error("malformed PWM log row: " + line_);
+    }
+  }
+  return true;
+}
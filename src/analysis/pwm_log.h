@@ -0,0 +1,40 @@
+#ifndef PWM_LOG_H
+#define PWM_LOG_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+/// One row of a PWM input log.
+struct PwmSample {
+  int64_t timestamp_ns = 0;
+  // Microseconds, one per Pin column.
+  std::vector<float> pulse_widths;
+};
+
+/// Reads the CSV written by the PWM input test, e.g. logs/pwm_data,
+/// one sample at a time.
+///
+/// The header is a timestamp column followed by Pin0, Pin1, ...
+/// "Timestamp_us" is in microseconds, from the pigpio tick, and
+/// "Timestamp" in nanoseconds since the epoch.
+class PwmLogReader {
+ public:
+  /// Throws std::runtime_error if the header is not a PWM log header.
+  PwmLogReader(std::istream& input);
+
+  /// Returns false at the end of the log.  Throws std::runtime_error
+  /// for a malformed row.
+  bool Next(PwmSample* sample);
+
+  size_t channel_count() const { return channel_count_; }
+
+ private:
+  std::istream& input_;
+  std::string line_;
+  size_t channel_count_ = 0;
+  int64_t timestamp_scale_ = 1;
+};
+
+#endif
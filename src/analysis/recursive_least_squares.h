@@ -0,0 +1,121 @@
+#ifndef RECURSIVE_LEAST_SQUARES_H
+#define RECURSIVE_LEAST_SQUARES_H
+
+#include <cmath>
+#include <cstddef>
+
+/// Two sided 95% quantile of Student's t distribution with
+/// @p degrees_of_freedom, for confidence intervals.  Infinite for
+/// none.
+inline double StudentT95(int degrees_of_freedom) {
+  static const double kTable[30] = {
+      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (degrees_of_freedom < 1) { return INFINITY; }
+  if (degrees_of_freedom <= 30) { return kTable[degrees_of_freedom - 1]; }
+  // The first terms of the Cornish-Fisher expansion about the normal
+  // quantile, within 1e-3 from here on.
+  const double z = 1.959964;
+  const double v = degrees_of_freedom;
+  return z + (z * z * z + z) / (4 * v) +
+      (5 * std::pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * v * v);
+}
+
+/// Least squares fit of y = theta . x, updated one observation at a
+/// time in O(N^2) without allocation.
+///
+/// P, the parameter covariance over the residual variance, starts at
+/// initial_covariance * I, a prior of zero with that variance.  The
+/// estimate is that of ordinary least squares as long as
+/// initial_covariance is large against 1 / sum(x_i^2), but it should
+/// be no larger than needed: the first update of P loses about
+/// log10(initial_covariance * x^2) of its digits.
+/// The sum of squared residuals is updated alongside, so the parameter
+/// standard errors, and confidence intervals, are available at any
+/// time.
+template <size_t N>
+class RecursiveLeastSquares {
+ public:
+  explicit RecursiveLeastSquares(double initial_covariance) {
+    for (size_t i = 0; i < N; i++) {
+      theta_[i] = 0.0;
+      for (size_t j = 0; j < N; j++) {
+        p_[i][j] = i == j ? initial_covariance : 0.0;
+      }
+    }
+  }
+
+  void Add(const double (&x)[N], double y) {
+    // k = P x / (1 + x' P x)
+    double px[N];
+    double xpx = 0.0;
+    for (size_t i = 0; i < N; i++) {
+      px[i] = 0.0;
+      for (size_t j = 0; j < N; j++) { px[i] += p_[i][j] * x[j]; }
+      xpx += x[i] * px[i];
+    }
+    const double denominator = 1.0 + xpx;
+
+    const double error = y - Predict(x);
+
+    for (size_t i = 0; i < N; i++) {
+      theta_[i] += px[i] / denominator * error;
+    }
+    // P -= P x x' P / (1 + x' P x), P is symmetric.
+    for (size_t i = 0; i < N; i++) {
+      for (size_t j = 0; j < N; j++) {
+        p_[i][j] -= px[i] * px[j] / denominator;
+      }
+    }
+    // The a priori error scaled this way is the increase of the sum of
+    // squared residuals of the least squares fit.
+    residual_sum_ += error * error / denominator;
+    count_++;
+  }
+
+  size_t count() const { return count_; }
+  double coefficient(size_t i) const { return theta_[i]; }
+
+  double Predict(const double (&x)[N]) const {
+    double y = 0.0;
+    for (size_t i = 0; i < N; i++) { y += theta_[i] * x[i]; }
+    return y;
+  }
+
+  /// x' P x, the variance of Predict(x) over the residual variance.
+  /// log(1 + Leverage(x)) is the information an observation at x would
+  /// add to the fit.
+  double Leverage(const double (&x)[N]) const {
+    double leverage = 0.0;
+    for (size_t i = 0; i < N; i++) {
+      for (size_t j = 0; j < N; j++) { leverage += x[i] * p_[i][j] * x[j]; }
+    }
+    return leverage;
+  }
+
+  /// The variance of the residuals, estimated with N degrees of freedom
+  /// removed.  NaN until there are more observations than parameters.
+  double residual_variance() const {
+    if (count_ <= N) { return NAN; }
+    return residual_sum_ / (count_ - N);
+  }
+
+  double standard_error(size_t i) const {
+    return std::sqrt(residual_variance() * p_[i][i]);
+  }
+
+  /// Half the width of the 95% confidence interval of coefficient(i).
+  double interval95(size_t i) const {
+    if (count_ <= N) { return INFINITY; }
+    return StudentT95(static_cast<int>(count_ - N)) * standard_error(i);
+  }
+
+ private:
+  double theta_[N];
+  double p_[N][N];
+  double residual_sum_ = 0.0;
+  size_t count_ = 0;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "replay.h"
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "../logging/latency_histogram.h"
+#include "../motor_control/pi3hat_moteus_interface.h"
+
+ReplayPulseWidths::ReplayPulseWidths(std::vector<unsigned int> channels)
+    : channels_(std::move(channels)) {}
+
+void ReplayPulseWidths::Set(const PwmSample& sample) {
+  for (size_t column = 0; column < sample.pulse_widths.size(); column++) {
+    // Columns without a channel are ignored.
+    if (!channels_.empty() && column >= channels_.size()) { break; }
+    const unsigned int channel = channels_.empty() ? column : channels_[column];
+    if (channel >= values_.size()) { values_.resize(channel + 1); }
+    values_[channel] = sample.pulse_widths[column];
+  }
+}
+
+float ReplayPulseWidths::pulse_width(unsigned int channel) const {
+  return channel < values_.size() ? values_[channel] : 0.0f;
+}
+
+namespace {
+
+// Reads a log ahead of the virtual time, which starts at the log's
+// first record plus an offset.
+template <typename Record>
+class LogCursor {
+ public:
+  LogCursor(const std::function<bool (Record*)>& next, int64_t offset_ns)
+      : next_(next), offset_ns_(offset_ns) {
+    pending_ = next_ && next_(&record_);
+    start_ns_ = record_.timestamp_ns;
+  }
+
+  bool done() const { return !pending_; }
+  int64_t start_ns() const { return start_ns_; }
+
+  // Calls @p apply for every record up to @p time_ns.
+  template <typename Apply>
+  uint64_t Advance(int64_t time_ns, Apply apply) {
+    uint64_t count = 0;
+    while (pending_ && record_.timestamp_ns - start_ns_ + offset_ns_ <= time_ns) {
+      apply(record_);
+      count++;
+      pending_ = next_(&record_);
+    }
+    return count;
+  }
+
+ private:
+  const std::function<bool (Record*)>& next_;
+  const int64_t offset_ns_;
+  Record record_;
+  bool pending_ = false;
+  int64_t start_ns_ = 0;
+};
+
+}
+
+ReplayStats ReplayController(Controller* controller,
+                             const std::vector<std::pair<int, int>>& servo_bus_map,
+                             const ReplayOptions& options,
+                             const MotorLogSource& motor_log,
+                             const PwmLogSource& pwm_log,
+                             ReplayPulseWidths* pulse_widths,
+                             const std::function<void (const MotorLogRecord&)>& command) {
+  const int64_t period_ns = std::llround(options.period_s * 1e9);
+  if (period_ns <= 0) {
+    throw std::invalid_argument("The replay period must be positive");
+  }
+  const int64_t duration_ns = std::llround(options.duration_s * 1e9);
+
+  LogCursor<MotorLogRecord> motor(motor_log, 0);
+  LogCursor<PwmSample> pwm(pwm_log, std::llround(options.pwm_offset_s * 1e9));
+  if (motor.done() && pwm.done() && duration_ns <= 0) {
+    throw std::invalid_argument("Nothing to replay, give a log or a duration");
+  }
+  const int64_t start_ns = !motor.done() ? motor.start_ns() : pwm.start_ns();
+
+  const moteus::ServoSlotTable slots(servo_bus_map);
+  std::vector<MoteusInterface::ServoCommand> commands(servo_bus_map.size());
+  std::vector<MoteusInterface::ServoReply> replies(servo_bus_map.size());
+  for (size_t i = 0; i < servo_bus_map.size(); i++) {
+    commands[i].id = replies[i].id = servo_bus_map[i].first;
+    commands[i].bus = replies[i].bus = servo_bus_map[i].second;
+  }
+  controller->initialize(&commands);
+
+  const auto apply_reply = [&](const MotorLogRecord& record) {
+    const int slot = slots.find(record.id, record.bus);
+    if (slot < 0) { return; }
+    MoteusInterface::ServoReply& reply = replies[slot];
+    reply.valid = true;
+    reply.result.mode = static_cast<moteus::Mode>(record.mode);
+    reply.result.velocity = record.velocity;
+    reply.result.torque = record.torque;
+    reply.result.control_velocity = record.control_velocity;
+    reply.result.temperature = record.temperature;
+    reply.result.voltage = record.voltage;
+  };
+  const auto apply_pwm = [&](const PwmSample& sample) {
+    if (pulse_widths) { pulse_widths->Set(sample); }
+  };
+
+  // The controller runs in the virtual time of the logs.
+  const std::chrono::steady_clock::time_point start{std::chrono::nanoseconds(start_ns)};
+  VirtualControlClock clock(std::chrono::nanoseconds(period_ns), start);
+  ReplayStats stats;
+  LatencyHistogram controller_histogram;
+  for (int64_t time_ns = 0;
+       duration_ns > 0 ? time_ns < duration_ns : !(motor.done() && pwm.done());
+       time_ns += period_ns) {
+    stats.motor_records += motor.Advance(time_ns, apply_reply);
+    stats.pwm_samples += pwm.Advance(time_ns, apply_pwm);
+
+    const auto pre_controller = std::chrono::steady_clock::now();
+    const bool stop = controller->run(clock.tick(), replies, &commands);
+    const int64_t controller_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - pre_controller).count();
+    controller_histogram.Record(controller_ns);
+    stats.controller_ns += controller_ns;
+    stats.cycles++;
+
+    for (size_t slot = 0; slot < commands.size(); slot++) {
+      const MoteusInterface::ServoCommand& servo_command = commands[slot];
+      const moteus::QueryResult& result = replies[slot].result;
+      MotorLogRecord record;
+      record.timestamp_ns = start_ns + time_ns;
+      record.id = servo_command.id;
+      record.bus = servo_command.bus;
+      record.mode = static_cast<int32_t>(servo_command.mode);
+      record.velocity = result.velocity;
+      record.torque = result.torque;
+      record.control_velocity = result.control_velocity;
+      record.velocity_command = servo_command.position.velocity;
+      record.amplitude_command = servo_command.position.sinusoidal_amplitude;
+      record.phase_command = servo_command.position.sinusoidal_phase;
+      record.temperature = result.temperature;
+      record.voltage = result.voltage;
+      command(record);
+    }
+    if (stop) { break; }
+  }
+
+  LatencyHistogram::Snapshot snapshot;
+  controller_histogram.Read(&snapshot);
+  stats.controller_p99_ns = snapshot.Percentile(0.99);
+  stats.controller_max_ns = snapshot.max;
+  return stats;
+}
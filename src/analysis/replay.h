@@ -0,0 +1,81 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "pwm_log.h"
+#include "../controller/controller.h"
+#include "../controller/thrust_vector_controller.h"
+#include "../logging/motor_log_record.h"
+
+/// @file
+///
+/// Runs a Controller against recorded logs in virtual time, as fast as
+/// the CPU allows, to see what it would have commanded without
+/// spinning any rotors.
+///
+/// The control loop is simulated at a fixed period.  Both logs are
+/// aligned to start at virtual time zero, and each cycle the
+/// controller sees the newest motor log record of each servo as its
+/// reply, and the newest PWM sample as its pulse widths.  The same
+/// logs and options always give the same commands.
+
+struct ReplayOptions {
+  // The control period in virtual seconds.
+  double period_s = 0.001;
+  // Added to the PWM log time, after the alignment.
+  double pwm_offset_s = 0.0;
+  // Stop after this many virtual seconds, or at the end of both logs
+  // if zero.
+  double duration_s = 0.0;
+};
+
+struct ReplayStats {
+  uint64_t cycles = 0;
+  uint64_t motor_records = 0;
+  uint64_t pwm_samples = 0;
+  // The wall time spent in Controller::run.
+  int64_t controller_ns = 0;
+  int64_t controller_p99_ns = 0;
+  int64_t controller_max_ns = 0;
+};
+
+/// The pulse widths of the newest PWM sample, zero before the first.
+class ReplayPulseWidths : public PulseWidthSource {
+ public:
+  /// Column i of the PWM log is channel @p channels[i], or channel i
+  /// if @p channels is empty.
+  explicit ReplayPulseWidths(std::vector<unsigned int> channels = {});
+
+  void Set(const PwmSample& sample);
+
+  float pulse_width(unsigned int channel) const override;
+
+ private:
+  const std::vector<unsigned int> channels_;
+  std::vector<float> values_;
+};
+
+using MotorLogSource = std::function<bool (MotorLogRecord*)>;
+using PwmLogSource = std::function<bool (PwmSample*)>;
+
+/// Replays the logs through @p controller, whose servos are @p
+/// servo_bus_map.  Either log may be empty, the PWM samples are given
+/// to @p pulse_widths.  @p command is called for every servo every
+/// cycle with the commanded mode, velocity, amplitude and phase, and
+/// the state of the servo's newest reply, timestamped in the motor
+/// log's time, or else the PWM log's.  Stops early if the controller
+/// asks to.  Throws std::invalid_argument if there is nothing to
+/// replay and no duration.
+ReplayStats ReplayController(Controller* controller,
+                             const std::vector<std::pair<int, int>>& servo_bus_map,
+                             const ReplayOptions& options,
+                             const MotorLogSource& motor_log,
+                             const PwmLogSource& pwm_log,
+                             ReplayPulseWidths* pulse_widths,
+                             const std::function<void (const MotorLogRecord&)>& command);
+
+#endif
@@ -0,0 +1,132 @@
+// Measures the time to encode command frames and decode replies for
+// the controllers' frame format, with the generic Emit functions and
+// ParseQueryResult, the BatchFrameEncoder and the StaticFrameCodec.
+//
+// Usage: frame_codec_benchmark [iterations] [servos]
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../controller/sinusoidal_frame_format.h"
+#include "../motor_control/moteus_batch_encoder.h"
+
+using namespace mjbots::moteus;
+
+// Keeps the compiler from discarding the results.
+volatile double sink = 0.0;
+
+template <typename Function>
+double per_frame_ns(int iterations, int servos, Function function) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        function(i);
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(elapsed) / iterations / servos;
+}
+
+void print(const std::string& name, double ns) {
+    std::cout << std::left << std::setw(24) << name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(10) << ns << std::endl;
+}
+
+int main(int argc, char** argv) {
+    const int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+    const int servos = argc > 2 ? std::stoi(argv[2]) : 8;
+    const FrameFormat format = SinusoidalFrameFormat::format();
+
+    std::vector<PositionCommand> commands(servos);
+    PositionCommandArrays arrays;
+    arrays.resize(servos);
+    for (int i = 0; i < servos; i++) {
+        commands[i].velocity = 40.0 + i;
+        commands[i].sinusoidal_amplitude = 0.01 * i;
+        commands[i].sinusoidal_phase = 0.3 * i - 1.0;
+        arrays.Set(i, commands[i]);
+    }
+    std::vector<CanFrame> frames(servos);
+
+    // Replies laid out as the simulation and the servos send them.
+    std::vector<CanFrame> replies(servos);
+    for (int i = 0; i < servos; i++) {
+        WriteCanFrame writer(&replies[i]);
+        writer.Write<int8_t>(Multiplex::kReplyBase | 0x04 | 0x01);
+        writer.Write<int8_t>(Register::kMode);
+        writer.Write<int16_t>(static_cast<int16_t>(Mode::kSinusoidal));
+        writer.Write<int8_t>(Multiplex::kReplyBase | 0x0c | 0x01);
+        writer.Write<int8_t>(Register::kVelocity);
+        writer.WriteVelocity(40.0 + i, Resolution::kFloat);
+        writer.Write<int8_t>(Multiplex::kReplyBase | 0x04 | 0x01);
+        writer.Write<int8_t>(Register::kTorque);
+        writer.WriteTorque(0.1 * i, Resolution::kInt16);
+        writer.Write<int8_t>(Multiplex::kReplyBase);
+        writer.Write<int8_t>(4);
+        writer.Write<int8_t>(Register::kRezeroState);
+        writer.Write<int8_t>(0);
+        writer.WriteVoltage(24.0, Resolution::kInt8);
+        writer.WriteTemperature(30.0f, Resolution::kInt8);
+        writer.Write<int8_t>(0);
+        writer.Write<int8_t>(Multiplex::kReplyBase | 0x0c | 0x01);
+        writer.Write<int8_t>(Register::kControlVelocity);
+        writer.WriteVelocity(40.0 + i, Resolution::kFloat);
+        QueryResult result;
+        if (!SinusoidalFrameCodec::Decode(replies[i].data, replies[i].size, &result)) {
+            std::cerr << "reply layout does not match the format" << std::endl;
+            return 1;
+        }
+    }
+
+    const double generic_encode = per_frame_ns(iterations, servos, [&](int iteration) {
+        for (int i = 0; i < servos; i++) {
+            frames[i].size = 0;
+            WriteCanFrame writer(&frames[i]);
+            BatchFrameEncoder::EmitCommand(&writer, commands[i], format);
+            EmitQueryCommand(&writer, format.query);
+        }
+        sink = sink + frames[iteration % servos].data[8];
+    });
+
+    const BatchFrameEncoder batch(format);
+    const double batch_encode = per_frame_ns(iterations, servos, [&](int iteration) {
+        batch.Encode(arrays, frames.data());
+        sink = sink + frames[iteration % servos].data[8];
+    });
+
+    const double static_encode = per_frame_ns(iterations, servos, [&](int iteration) {
+        for (int i = 0; i < servos; i++) {
+            SinusoidalFrameCodec::Encode(commands[i], frames[i].data, &frames[i].size);
+        }
+        sink = sink + frames[iteration % servos].data[8];
+    });
+
+    const double generic_decode = per_frame_ns(iterations, servos, [&](int) {
+        double sum = 0.0;
+        for (int i = 0; i < servos; i++) {
+            sum += ParseQueryResult(replies[i].data, replies[i].size).velocity;
+        }
+        sink = sink + sum;
+    });
+
+    const double static_decode = per_frame_ns(iterations, servos, [&](int) {
+        double sum = 0.0;
+        QueryResult result;
+        for (int i = 0; i < servos; i++) {
+            SinusoidalFrameCodec::Decode(replies[i].data, replies[i].size, &result);
+            sum += result.velocity;
+        }
+        sink = sink + sum;
+    });
+
+    std::cout << "Per frame, " << servos << " servos, " << iterations << " cycles\n";
+    std::cout << std::left << std::setw(24) << "[ns]" << std::right
+              << std::setw(10) << "mean" << "\n";
+    print("generic encode", generic_encode);
+    print("batch encode", batch_encode);
+    print("static encode", static_encode);
+    print("generic decode", generic_decode);
+    print("static decode", static_decode);
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Measures how long it takes to hand a cycle to the CAN thread and get
+// the result back, with a transport that does no work.  The previous
+// promise/future and mutex/condition variable implementation is
+// reproduced here as a baseline.
+//
+// Usage: handoff_benchmark [iterations] [main_cpu] [can_cpu]
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "../logging/latency_histogram.h"
+#include "../motor_control/pi3hat_moteus_interface.h"
+
+using namespace mjbots;
+using MoteusInterface = moteus::Pi3HatMoteusInterface;
+
+class NullTransport : public moteus::CanTransport {
+public:
+    pi3hat::Pi3Hat::Output Cycle(const pi3hat::Pi3Hat::Input& /*input*/) override {
+        return {};
+    }
+};
+
+// The handoff as it was before the completion slot: a mutex and
+// condition variable to start the cycle, and a heap allocated promise
+// inside a std::function to finish it.
+class LegacyInterface {
+public:
+    using CallbackFunction = std::function<void (const MoteusInterface::Output&)>;
+
+    LegacyInterface(int cpu)
+        : cpu_(cpu),
+          thread_(std::bind(&LegacyInterface::CHILD_Run, this)) {}
+
+    ~LegacyInterface() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            condition_.notify_one();
+        }
+        thread_.join();
+    }
+
+    void Cycle(CallbackFunction callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callback_ = std::move(callback);
+        active_ = true;
+        condition_.notify_all();
+    }
+
+private:
+    void CHILD_Run() {
+        moteus::ConfigureCpuAffinity(cpu_);
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                // The original did not check this before waiting, and
+                // could miss the shutdown notification.
+                if (done_) { return; }
+                if (!active_) {
+                    condition_.wait(lock);
+                    if (done_) { return; }
+                    if (!active_) { continue; }
+                }
+            }
+
+            MoteusInterface::Output output;
+            output.transport_time = std::chrono::nanoseconds(0);
+            CallbackFunction callback_copy;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                active_ = false;
+                std::swap(callback_copy, callback_);
+            }
+            callback_copy(output);
+        }
+    }
+
+    const int cpu_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool active_ = false;
+    bool done_ = false;
+    CallbackFunction callback_;
+    std::thread thread_;
+};
+
+int64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void run_legacy(int iterations, int can_cpu, LatencyHistogram* histogram) {
+    LegacyInterface interface(can_cpu);
+    for (int i = 0; i < iterations; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        auto promise = std::make_shared<std::promise<MoteusInterface::Output>>();
+        interface.Cycle([promise](const MoteusInterface::Output& output) {
+            promise->set_value(output);
+        });
+        promise->get_future().get();
+        histogram->Record(elapsed_ns(start));
+    }
+}
+
+void run_slot(int iterations, int can_cpu, moteus::WaitStrategy strategy,
+              LatencyHistogram* histogram, LatencyHistogram* wakeup) {
+    MoteusInterface::Options options;
+    options.cpu = -1;
+    options.can_wait.strategy = strategy;
+    options.completion_wait.strategy = strategy;
+    options.transport_factory = [can_cpu]() {
+        // The interface only pins with realtime priority, which would
+        // need root.  Pin here instead.
+        moteus::ConfigureCpuAffinity(can_cpu);
+        return std::unique_ptr<moteus::CanTransport>(new NullTransport());
+    };
+    MoteusInterface interface(options);
+    MoteusInterface::Data data;
+    for (int i = 0; i < iterations; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        interface.Start(data);
+        const auto output = interface.Wait();
+        histogram->Record(elapsed_ns(start));
+        wakeup->Record(output.wakeup_time.count());
+    }
+}
+
+void print(const std::string& name, const LatencyHistogram& histogram) {
+    LatencyHistogram::Snapshot snapshot;
+    histogram.Read(&snapshot);
+    std::cout << std::left << std::setw(24) << name << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << snapshot.Percentile(0.5) * 1e-3
+              << std::setw(10) << snapshot.Percentile(0.99) * 1e-3
+              << std::setw(10) << snapshot.Percentile(0.999) * 1e-3
+              << std::setw(10) << snapshot.max * 1e-3 << std::endl;
+}
+
+void print_header(const std::string& title) {
+    std::cout << title << "\n";
+    std::cout << std::left << std::setw(24) << "[us]" << std::right
+              << std::setw(10) << "p50" << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9" << std::setw(10) << "max" << "\n";
+}
+
+struct Strategy {
+    const char* name;
+    moteus::WaitStrategy strategy;
+    // Strategies which spin need a core for each thread to be measured
+    // meaningfully.
+    bool needs_two_cores;
+};
+
+int main(int argc, char** argv) {
+    const int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+    const int main_cpu = argc > 2 ? std::stoi(argv[2]) : -1;
+    const int can_cpu = argc > 3 ? std::stoi(argv[3]) : -1;
+    moteus::ConfigureCpuAffinity(main_cpu);
+    const bool two_cores = std::thread::hardware_concurrency() >= 2;
+
+    const Strategy strategies[] = {
+        {"block", moteus::WaitStrategy::kBlock, false},
+        {"spin then block", moteus::WaitStrategy::kSpinThenBlock, true},
+        {"spin", moteus::WaitStrategy::kSpin, true},
+        {"spin yield", moteus::WaitStrategy::kSpinYield, true},
+        {"spin wait for event", moteus::WaitStrategy::kSpinWaitForEvent, true},
+    };
+    const int strategy_count = sizeof(strategies) / sizeof(strategies[0]);
+
+    LatencyHistogram legacy;
+    run_legacy(iterations, can_cpu, &legacy);
+
+    LatencyHistogram round_trip[strategy_count];
+    LatencyHistogram wakeup[strategy_count];
+    for (int i = 0; i < strategy_count; i++) {
+        if (strategies[i].needs_two_cores && !two_cores) { continue; }
+        run_slot(iterations, can_cpu, strategies[i].strategy,
+                 &round_trip[i], &wakeup[i]);
+    }
+
+    print_header("Round trip handoff latency over " +
+                 std::to_string(iterations) + " cycles");
+    print("promise/future", legacy);
+    for (int i = 0; i < strategy_count; i++) {
+        if (strategies[i].needs_two_cores && !two_cores) {
+            std::cout << strategies[i].name << ": skipped, needs two cores\n";
+            continue;
+        }
+        print(strategies[i].name, round_trip[i]);
+    }
+
+    print_header("\nCAN thread wake-up latency");
+    for (int i = 0; i < strategy_count; i++) {
+        if (strategies[i].needs_two_cores && !two_cores) { continue; }
+        print(strategies[i].name, wakeup[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Measures the cycle time of the thrust vector controller and the CAN
+// thread against the rotor count, with a SimulatedTransport which adds
+// no latency, so only the host side work is measured.  The rotors are
+// spread over the buses by balance_buses.
+//
+// Usage: rotor_scaling_benchmark [cycles]
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../controller/thrust_vector_controller.h"
+#include "../logging/latency_histogram.h"
+#include "../motor_control/simulated_transport.h"
+
+using namespace mjbots;
+
+// Every rotor is armed, with a setpoint which changes each cycle.
+class SweepSource : public PulseWidthSource {
+public:
+    float pulse_width(unsigned int channel) const override {
+        return 1000 + (channel * 37 + cycle * 7) % 1000;
+    }
+
+    uint32_t cycle = 0;
+};
+
+struct Result {
+    double controller_us = 0.0;
+    double cycle_us = 0.0;
+    int64_t cycle_p99_ns = 0;
+    int max_per_bus = 0;
+};
+
+Result measure(int rotor_count, int cycles) {
+    std::vector<RotorConfig> rotors(rotor_count);
+    for (int i = 0; i < rotor_count; i++) {
+        rotors[i].servo_id = i + 1;
+        rotors[i].thrust_channel = 3 * i;
+        rotors[i].elevation_channel = 3 * i + 1;
+        rotors[i].azimuth_channel = 3 * i + 2;
+    }
+    SweepSource source;
+    ThrustVectorController controller(rotors, &source);
+
+    Result result;
+    int load[6] = {};
+    for (const auto& servo : controller.servo_bus_map()) {
+        result.max_per_bus = std::max(result.max_per_bus, ++load[servo.second]);
+    }
+
+    const moteus::ServoSlotTable slots(controller.servo_bus_map());
+    std::vector<MoteusInterface::ServoCommand> commands(rotor_count);
+    for (int i = 0; i < rotor_count; i++) {
+        commands[i].id = controller.servo_bus_map()[i].first;
+        commands[i].bus = controller.servo_bus_map()[i].second;
+    }
+    controller.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(rotor_count);
+    std::vector<MoteusInterface::ServoReply> saved_replies(rotor_count);
+
+    MoteusInterface::Data data;
+    data.commands = {commands.data(), commands.size()};
+    data.replies = {replies.data(), replies.size()};
+    data.slots = &slots;
+    data.codec = controller.frame_codec();
+
+    MoteusInterface::Options options;
+    options.transport_factory = []() {
+        moteus::SimulatedTransport::Options sim_options;
+        sim_options.latency_us = 0.0;
+        sim_options.jitter_us = 0.0;
+        return std::unique_ptr<moteus::CanTransport>(
+            new moteus::SimulatedTransport(sim_options));
+    };
+    MoteusInterface interface(options);
+
+    LatencyHistogram cycle_histogram;
+    std::chrono::nanoseconds controller_total{0};
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < cycles; i++) {
+        const auto cycle_start = std::chrono::steady_clock::now();
+        source.cycle = i;
+        controller.run(ControlTime(), saved_replies, &commands);
+        controller_total += std::chrono::steady_clock::now() - cycle_start;
+
+        interface.Start(data);
+        interface.Wait();
+        std::copy(replies.begin(), replies.end(), saved_replies.begin());
+        cycle_histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - cycle_start).count());
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    LatencyHistogram::Snapshot snapshot;
+    cycle_histogram.Read(&snapshot);
+    result.controller_us = std::chrono::duration<double, std::micro>(controller_total).count() / cycles;
+    result.cycle_us = std::chrono::duration<double, std::micro>(elapsed).count() / cycles;
+    result.cycle_p99_ns = snapshot.Percentile(0.99);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    const int cycles = argc > 1 ? std::stoi(argv[1]) : 20000;
+
+    std::cout << std::left << std::setw(10) << "rotors" << std::right
+              << std::setw(12) << "per bus"
+              << std::setw(16) << "controller us"
+              << std::setw(14) << "cycle us"
+              << std::setw(14) << "cycle p99" << "\n";
+    for (const int rotor_count : {1, 2, 4, 8, 12, 16, 24, 32}) {
+        const Result result = measure(rotor_count, cycles);
+        std::cout << std::left << std::setw(10) << rotor_count << std::right
+                  << std::setw(12) << result.max_per_bus
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(16) << result.controller_us
+                  << std::setw(14) << result.cycle_us
+                  << std::setw(14) << result.cycle_p99_ns / 1000.0 << std::endl;
+    }
+    return 0;
+}
@@ -1,62 +1,65 @@
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <iostream>
 #include <vector>
 #include "calibration_controller.h"
 
 
-CalibrationController::CalibrationController(std::vector<float> velocity, std::vector<float> amplitude, std::vector<float> phase, float experiment_length, float startup_sequence_length)
-    : velocity_(velocity), amplitude_(amplitude), phase_(phase), experiment_length_(experiment_length), startup_sequence_length_(startup_sequence_length)
+namespace
+{
+void check_sequence(const std::vector<float> &velocity, const std::vector<float> &amplitude,
+                    const std::vector<float> &phase)
 {
-    if (!(velocity_.size() == amplitude_.size() && amplitude_.size() == phase_.size()))
+    if (!(velocity.size() == amplitude.size() && amplitude.size() == phase.size()))
     {
         throw std::invalid_argument("Velocit, amplitude and phase vectors must be same length");
     }
+}
+}
+
+CalibrationController::CalibrationController(std::vector<float> velocity, std::vector<float> amplitude, std::vector<float> phase, float experiment_length, float startup_sequence_length)
+    : velocity_(velocity), amplitude_(amplitude), phase_(phase), experiment_length_(experiment_length), startup_sequence_length_(startup_sequence_length),
+      detector_(settling_options_.detector)
+{
+    check_sequence(velocity_, amplitude_, phase_);
+    steps_.reserve(velocity_.size());
+};
+
+CalibrationController::CalibrationController(std::vector<float> velocity, std::vector<float> amplitude, std::vector<float> phase, const SettlingOptions &settling, float startup_sequence_length)
+    : velocity_(velocity), amplitude_(amplitude), phase_(phase), experiment_length_(settling.max_step_length * velocity.size()),
+      startup_sequence_length_(startup_sequence_length), settling_(true), settling_options_(settling),
+      detector_(settling.detector)
+{
+    check_sequence(velocity_, amplitude_, phase_);
+    if (!(settling.min_step_length >= 0 && settling.min_step_length <= settling.max_step_length))
+    {
+        throw std::invalid_argument("Minimum step length must be between 0 and the maximum step length");
+    }
+    steps_.reserve(velocity_.size());
 };
 
 void CalibrationController::initialize(std::vector<MoteusInterface::ServoCommand> *commands)
 {
-    cycle_count_ = 0;
-    moteus::PositionResolution res;
-    res.position = moteus::Resolution::kInt8;
-    res.velocity = moteus::Resolution::kFloat;
-    res.feedforward_torque = moteus::Resolution::kIgnore;
-    res.sinusoidal_amplitude = moteus::Resolution::kInt16;
-    res.sinusoidal_phase = moteus::Resolution::kInt16;
-    res.kp_scale = moteus::Resolution::kIgnore;
-    res.kd_scale = moteus::Resolution::kIgnore;
-    res.maximum_torque = moteus::Resolution::kIgnore;
-    res.stop_position = moteus::Resolution::kIgnore;
-    res.watchdog_timeout = moteus::Resolution::kIgnore;
-
-    moteus::QueryCommand query_cmd;
-    query_cmd.mode = moteus::Resolution::kInt16;
-    query_cmd.position = moteus::Resolution::kIgnore;
-    query_cmd.velocity = moteus::Resolution::kFloat;
-    query_cmd.torque = moteus::Resolution::kInt16;
-    query_cmd.q_current = moteus::Resolution::kIgnore;
-    query_cmd.d_current = moteus::Resolution::kIgnore;
-    query_cmd.rezero_state = moteus::Resolution::kInt8;
-    query_cmd.voltage = moteus::Resolution::kInt8;
-    query_cmd.temperature = moteus::Resolution::kInt8;
-    query_cmd.fault = moteus::Resolution::kInt8;
-    query_cmd.control_velocity = moteus::Resolution::kFloat;
+    started_ = false;
+    step_index_ = 0;
+    step_start_ = 0.0;
+    steps_.clear();
+    detector_.reset();
+    constexpr moteus::FrameFormat format = SinusoidalFrameFormat::format();
 
     for (auto &cmd : *commands)
     {
-        cmd.resolution = res;
-        cmd.query = query_cmd;
+        cmd.resolution = format.resolution;
+        cmd.query = format.query;
     }
-    start_time_ = std::chrono::steady_clock::now();
 }
 
-moteus::QueryResult CalibrationController::get(const std::vector<MoteusInterface::ServoReply> &replies, int id, int bus)
+moteus::QueryResult CalibrationController::get(const std::vector<MoteusInterface::ServoReply> &replies, size_t slot)
 {
-    for (const auto &item : replies)
+    if (slot < replies.size() && replies[slot].valid)
     {
-        if (item.id == id && item.bus == bus)
-        {
-            return item.result;
-        }
+        return replies[slot].result;
     }
     return {};
 }
@@ -91,38 +94,143 @@ void CalibrationController::startup_sequence_run(MoteusInterface::ServoCommand *
 
 void CalibrationController::multi_sequence_run(MoteusInterface::ServoCommand *command, float elapsed_seconds)
 {
-    float elapsed_fraction = elapsed_seconds / experiment_length_;
-    int command_index = int(elapsed_fraction * velocity_.size());
+    const size_t command_index = fixed_step_index(elapsed_seconds);
 
     // Do command
     apply_constant_command(command, velocity_[command_index], amplitude_[command_index], phase_[command_index]);
     return;
 }
 
-bool CalibrationController::run(const std::vector<MoteusInterface::ServoReply> &status,
+size_t CalibrationController::fixed_step_index(float elapsed_seconds) const
+{
+    float elapsed_fraction = elapsed_seconds / experiment_length_;
+    // The fraction can round up to 1 at the very end.
+    return std::min(size_t(elapsed_fraction * velocity_.size()), velocity_.size() - 1);
+}
+
+void CalibrationController::end_step(double end_time, bool settled)
+{
+    CalibrationStep step;
+    step.index = step_index_;
+    step.velocity = velocity_[step_index_];
+    step.amplitude = amplitude_[step_index_];
+    step.phase = phase_[step_index_];
+    step.start_time = step_start_;
+    step.end_time = end_time;
+    step.settled = settled;
+    steps_.push_back(step);
+    step_start_ = end_time;
+}
+
+bool CalibrationController::settling_run(const std::vector<MoteusInterface::ServoReply> &status,
+                                         MoteusInterface::ServoCommand *command,
+                                         std::chrono::steady_clock::time_point now, double step_seconds)
+{
+    // The replies reflect the command of the previous cycles, the
+    // detector window excludes the transient after a change.
+    detector_.add(now, get(status, settling_options_.slot));
+
+    const double dwell = step_seconds - step_start_;
+    const bool settled = dwell >= settling_options_.min_step_length && detector_.settled();
+    if (settled || dwell >= settling_options_.max_step_length)
+    {
+        end_step(step_seconds, settled);
+        detector_.reset();
+        step_index_++;
+        if (step_index_ == velocity_.size())
+        {
+            return true;
+        }
+    }
+    apply_constant_command(command, velocity_[step_index_], amplitude_[step_index_], phase_[step_index_]);
+    return false;
+}
+
+void CalibrationController::append_step(float velocity, float amplitude, float phase)
+{
+    if (!settling_)
+    {
+        throw std::logic_error("Steps can only be appended in settling mode");
+    }
+    velocity_.push_back(velocity);
+    amplitude_.push_back(amplitude);
+    phase_.push_back(phase);
+    experiment_length_ = settling_options_.max_step_length * velocity_.size();
+}
+
+void CalibrationController::reserve_steps(size_t count)
+{
+    velocity_.reserve(count);
+    amplitude_.reserve(count);
+    phase_.reserve(count);
+    steps_.reserve(count);
+}
+
+void CalibrationController::write_steps(std::ostream &output, int64_t system_offset_ns) const
+{
+    // The step times count from the end of the startup sequence.
+    const int64_t steps_start_ns = system_offset_ns +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(start_time_.time_since_epoch()).count() +
+        std::llround(startup_sequence_length_ * 1e9);
+    const auto timestamp_ns = [&](double seconds) {
+        return steps_start_ns + std::llround(seconds * 1e9);
+    };
+
+    output << "Step,VelocityCommand,AmplitudeCommand,PhaseCommand,StartTime,EndTime,"
+           << "StartTimestamp,EndTimestamp,Settled\n";
+    for (const auto &step : steps_)
+    {
+        output << step.index << "," << step.velocity << "," << step.amplitude << ","
+               << step.phase << "," << step.start_time << "," << step.end_time << ","
+               << timestamp_ns(step.start_time) << "," << timestamp_ns(step.end_time) << ","
+               << (step.settled ? 1 : 0) << "\n";
+    }
+}
+
+bool CalibrationController::run(const ControlTime &time,
+                                 const std::vector<MoteusInterface::ServoReply> &status,
                                  std::vector<MoteusInterface::ServoCommand> *output)
 {
     bool stop = false;
-    auto now = std::chrono::steady_clock::now();
-    std::chrono::duration<double> elapsed = now - start_time_;
+    if (!started_)
+    {
+        start_time_ = time.now;
+        started_ = true;
+    }
+    std::chrono::duration<double> elapsed = time.now - start_time_;
 
     // Calibration only controls first motor
     auto &first_out = output->at(0); 
 
+    const double step_seconds = elapsed.count() - startup_sequence_length_;
     if (elapsed.count() < startup_sequence_length_)
     {
         // Startup sequence
         // Makes sure that the hinged rotor folds out more gracefully
         startup_sequence_run(&first_out, velocity_[0], elapsed.count());
     }
-    else if (elapsed.count() - startup_sequence_length_ < experiment_length_)
+    else if (settling_)
     {
-        multi_sequence_run(&first_out, elapsed.count() - startup_sequence_length_);
+        return settling_run(status, &first_out, time.now, step_seconds);
+    }
+    else if (step_seconds < experiment_length_)
+    {
+        const size_t index = fixed_step_index(step_seconds);
+        if (index != step_index_)
+        {
+            end_step(step_seconds, false);
+            step_index_ = index;
+        }
+        multi_sequence_run(&first_out, step_seconds);
     }
 
-    if (elapsed.count() - startup_sequence_length_ > experiment_length_)
+    if (step_seconds > experiment_length_)
     {
         stop = true;
+        if (steps_.empty() || steps_.back().index != step_index_)
+        {
+            end_step(step_seconds, false);
+        }
     }
     else
     {
@@ -1,35 +1,115 @@
 #ifndef CALIBRATION_CONTROLLER_H
 #define CALIBRATION_CONTROLLER_H
 
+#include <ostream>
+#include <vector>
+
 #include "../motor_control/moteus_protocol.h"
 #include "../motor_control/pi3hat_moteus_interface.h"
 #include "controller.h"
+#include "sinusoidal_frame_format.h"
+#include "steady_state_detector.h"
 
 using namespace mjbots;
 using MoteusInterface = moteus::Pi3HatMoteusInterface;
 
+/// One command step as it was run.
+struct CalibrationStep {
+    size_t index = 0;
+    float velocity = 0.0f;
+    float amplitude = 0.0f;
+    float phase = 0.0f;
+    // Seconds after the startup sequence, the time base of the
+    // calibration analysis.
+    double start_time = 0.0;
+    double end_time = 0.0;
+    // Whether the step ended because the rotor settled, rather than at
+    // its fixed or maximum length.
+    bool settled = false;
+};
+
 class CalibrationController : public Controller
 {
 public:
+    /// Ends each step once the rotor has settled, see
+    /// SteadyStateDetector, instead of after a fixed length.
+    struct SettlingOptions {
+        // Seconds, a step lasts at least min_step_length and at most
+        // max_step_length, whether or not the rotor settled.  The
+        // calibration analysis skips 0.2 s after each change and 0.1 s
+        // before the next, so the minimum leaves 0.2 s of force samples.
+        float min_step_length = 0.5;
+        float max_step_length = 1.5;
+        SteadyStateDetector::Options detector;
+        // The servo whose replies are watched, see ServoSlotTable.
+        size_t slot = 0;
+
+        SettlingOptions() {}
+    };
+
+    /// Every step lasts experiment_length / the number of steps.
     CalibrationController(std::vector<float> velocity, std::vector<float> amplitude, std::vector<float> phase,
                            float experiment_length, float startup_sequence_length = 1.0);
+    CalibrationController(std::vector<float> velocity, std::vector<float> amplitude, std::vector<float> phase,
+                           const SettlingOptions &settling, float startup_sequence_length = 1.0);
     void initialize(std::vector<MoteusInterface::ServoCommand> *commands);
+    // The reply in the given slot, see ServoSlotTable, or a default
+    // result if that servo did not reply.
     moteus::QueryResult get(const std::vector<MoteusInterface::ServoReply> &replies,
-                            int id, int bus);
+                            size_t slot);
     float value_sweep(float start_value, float end_value, float elapsed_seconds, float end_time_seconds);
     void apply_constant_command(MoteusInterface::ServoCommand *command, float velocity, float amplitude, float phase);
     void startup_sequence_run(MoteusInterface::ServoCommand *command, float velocity, float elapsed_seconds);
     void multi_sequence_run(MoteusInterface::ServoCommand *command, float elapsed_seconds);
-    bool run(const std::vector<MoteusInterface::ServoReply> &status,
+    bool run(const ControlTime &time,
+             const std::vector<MoteusInterface::ServoReply> &status,
              std::vector<MoteusInterface::ServoCommand> *output);
+    const moteus::FrameCodec* frame_codec() const { return &SinusoidalFrameCodec::codec(); }
+
+    /// Queue another step, in settling mode, where the session ends
+    /// when the queued steps run out, so that a planner can choose each
+    /// step while the one before runs.  Does not allocate up to
+    /// reserve_steps().
+    void append_step(float velocity, float amplitude, float phase);
+    void reserve_steps(size_t count);
+    size_t step_count() const { return velocity_.size(); }
+    /// The step being run, step_count() once all have run.
+    size_t current_step() const { return step_index_; }
+
+    /// Seconds from the first run until the first step.
+    float startup_sequence_length() const { return startup_sequence_length_; }
+
+    /// The steps run so far, complete ones only.
+    const std::vector<CalibrationStep> &steps() const { return steps_; }
+    /// Write steps() as CSV.  StartTimestamp and EndTimestamp are
+    /// nanoseconds on the system_clock, as the motor log's, which is
+    /// @p system_offset_ns ahead of steady_clock, see
+    /// MoteusMotorControl::system_offset_ns().
+    void write_steps(std::ostream &output, int64_t system_offset_ns) const;
 
 private:
+    size_t fixed_step_index(float elapsed_seconds) const;
+    bool settling_run(const std::vector<MoteusInterface::ServoReply> &status,
+                      MoteusInterface::ServoCommand *command,
+                      std::chrono::steady_clock::time_point now, double step_seconds);
+    void end_step(double end_time, bool settled);
+
     std::vector<float> velocity_;
     std::vector<float> amplitude_;
     std::vector<float> phase_;
     float experiment_length_;
     float startup_sequence_length_;
-    int cycle_count_;
-    std::chrono::time_point<std::chrono::steady_clock> start_time_;
+    // The sequence starts at the first run.
+    bool started_ = false;
+    std::chrono::steady_clock::time_point start_time_;
+
+    bool settling_ = false;
+    SettlingOptions settling_options_;
+    SteadyStateDetector detector_;
+    // The step being run and when it started, in seconds after the
+    // startup sequence.
+    size_t step_index_ = 0;
+    double step_start_ = 0.0;
+    std::vector<CalibrationStep> steps_;
 };
 #endif
\ No newline at end of file
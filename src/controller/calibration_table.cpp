@@ -0,0 +1,160 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "calibration_table.h"
+
+namespace {
+
+float clamp_value(float value, float min_value, float max_value) {
+    return std::max(min_value, std::min(value, max_value));
+}
+
+std::string trim(const std::string& text) {
+    const auto begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    const auto end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+float parse_float(const std::string& key, std::istream& input) {
+    float value = 0.0f;
+    if (!(input >> value)) {
+        throw std::runtime_error("Invalid value for calibration key " + key);
+    }
+    return value;
+}
+
+}
+
+CalibrationModel load_calibration_model(const std::string& filename) {
+    std::ifstream input(filename);
+    if (!input) {
+        throw std::runtime_error("Could not open calibration file " + filename);
+    }
+
+    CalibrationModel model;
+    std::string line;
+    while (std::getline(input, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const auto separator = line.find('=');
+        if (separator == std::string::npos) {
+            throw std::runtime_error("Invalid calibration line: " + line);
+        }
+        const std::string key = trim(line.substr(0, separator));
+        std::istringstream values(line.substr(separator + 1));
+
+        if (key == "thrust_coefficient") {
+            model.thrust_coefficient = parse_float(key, values);
+        } else if (key == "elevation_coefficient") {
+            model.elevation_coefficient = parse_float(key, values);
+        } else if (key == "phase_offset") {
+            // Unspecified higher order terms are zero.
+            for (auto& coefficient : model.phase_offset) {
+                coefficient = 0.0f;
+            }
+            model.phase_offset[0] = parse_float(key, values);
+            for (int i = 1; i < 3 && (values >> std::ws, !values.eof()); i++) {
+                model.phase_offset[i] = parse_float(key, values);
+            }
+        } else if (key == "min_thrust") {
+            model.min_thrust = parse_float(key, values);
+        } else if (key == "max_thrust") {
+            model.max_thrust = parse_float(key, values);
+        } else if (key == "max_elevation") {
+            model.max_elevation = parse_float(key, values);
+        } else if (key == "max_velocity") {
+            model.max_velocity = parse_float(key, values);
+        } else if (key == "max_amplitude") {
+            model.max_amplitude = parse_float(key, values);
+        }
+    }
+
+    if (!(model.thrust_coefficient > 0.0f) || !(model.elevation_coefficient > 0.0f)) {
+        throw std::runtime_error("Calibration coefficients must be positive in " + filename);
+    }
+    return model;
+}
+
+void save_calibration_model(const std::string& filename, const CalibrationModel& model) {
+    std::ofstream output(filename);
+    if (!output) {
+        throw std::runtime_error("Could not write calibration file " + filename);
+    }
+    output.precision(9);
+    output << "# thrust [N] = thrust_coefficient * velocity^2\n"
+           << "thrust_coefficient = " << model.thrust_coefficient << "\n"
+           << "# elevation [deg] = elevation_coefficient * amplitude\n"
+           << "elevation_coefficient = " << model.elevation_coefficient << "\n"
+           << "# phase [rad] = azimuth + p0 + p1 * velocity + p2 * velocity^2\n"
+           << "phase_offset = " << model.phase_offset[0] << " "
+           << model.phase_offset[1] << " " << model.phase_offset[2] << "\n"
+           << "min_thrust = " << model.min_thrust << "\n"
+           << "max_thrust = " << model.max_thrust << "\n"
+           << "# radians\n"
+           << "max_elevation = " << model.max_elevation << "\n"
+           << "max_velocity = " << model.max_velocity << "\n"
+           << "max_amplitude = " << model.max_amplitude << "\n";
+}
+
+RotorCommand CalibrationTable::evaluate(const CalibrationModel& model,
+                                        float thrust, float elevation, float azimuth) {
+    thrust = clamp_value(thrust, model.min_thrust, model.max_thrust);
+    elevation = clamp_value(elevation, 0.0f, model.max_elevation);
+    azimuth = clamp_value(azimuth, -M_PI, M_PI);
+
+    // Velocity is always positive, the motor driver handles direction.
+    const float min_velocity = std::sqrt(model.min_thrust / model.thrust_coefficient);
+    const float velocity = clamp_value(std::sqrt(thrust / model.thrust_coefficient),
+                                       min_velocity, model.max_velocity);
+    const float amplitude = clamp_value(
+        (elevation * 180 / M_PI) / model.elevation_coefficient, 0.0f, model.max_amplitude);
+    const float phase = azimuth + model.phase_offset[0] +
+        model.phase_offset[1] * velocity +
+        model.phase_offset[2] * velocity * velocity;
+    return {velocity, amplitude, phase};
+}
+
+CalibrationTable::Axis CalibrationTable::make_axis(float min, float max, int count) {
+    if (count < 2 || !(max > min)) {
+        throw std::invalid_argument("A calibration table axis needs two distinct nodes");
+    }
+    Axis axis;
+    axis.min = min;
+    axis.scale = (count - 1) / (max - min);
+    axis.count = count;
+    return axis;
+}
+
+CalibrationTable::CalibrationTable(const CalibrationModel& model, const Size& size)
+    : model_(model),
+      size_(size),
+      thrust_axis_(make_axis(std::sqrt(model.min_thrust), std::sqrt(model.max_thrust),
+                             size.thrust)),
+      elevation_axis_(make_axis(0.0f, model.max_elevation, size.elevation)),
+      azimuth_axis_(make_axis(-M_PI, M_PI, size.azimuth))
+{
+    const size_t count = static_cast<size_t>(size.thrust) * size.elevation * size.azimuth;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 64, count * sizeof(Node)) != 0) {
+        throw std::bad_alloc();
+    }
+    nodes_.reset(static_cast<Node*>(memory));
+
+    Node* node = nodes_.get();
+    for (int t = 0; t < size.thrust; t++) {
+        for (int e = 0; e < size.elevation; e++) {
+            for (int a = 0; a < size.azimuth; a++) {
+                const float root_thrust = thrust_axis_.value(t);
+                const RotorCommand command = evaluate(
+                    model, root_thrust * root_thrust, elevation_axis_.value(e),
+                    azimuth_axis_.value(a));
+                *node++ = {command.velocity, command.amplitude, command.phase, 0.0f};
+            }
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef CALIBRATION_TABLE_H
+#define CALIBRATION_TABLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+/// The fitted relationships between motor commands and the thrust
+/// vector of one rotor, as produced by the calibration analysis.
+///
+///   thrust [N]      = thrust_coefficient * velocity^2
+///   elevation [deg] = elevation_coefficient * amplitude
+///   phase [rad]     = azimuth + phase_offset[0] + phase_offset[1] * velocity
+///                     + phase_offset[2] * velocity^2
+///
+/// The defaults are the constants PWMInputController used before
+/// calibration files existed.
+struct CalibrationModel {
+    float thrust_coefficient = 0.0015;
+    float elevation_coefficient = 65.0;
+    float phase_offset[3] = {static_cast<float>(M_PI / 2), 0.0f, 0.0f};
+
+    // Range of the table inputs.
+    float min_thrust = 0.5;
+    float max_thrust = 10.0;
+    float max_elevation = 15 * M_PI / 180;
+
+    // Commands are limited to these.
+    float max_velocity = 90.0;
+    float max_amplitude = 0.2;
+};
+
+/// Read a CalibrationModel from a text file of "key = value" lines.
+/// Lines starting with '#' are ignored, as are unknown keys, and
+/// missing keys keep their default.  phase_offset takes up to three
+/// space separated values.  Throws std::runtime_error if the file
+/// cannot be read or a value is malformed.
+CalibrationModel load_calibration_model(const std::string& filename);
+
+/// Write @p model in the format read by load_calibration_model.
+void save_calibration_model(const std::string& filename, const CalibrationModel& model);
+
+struct RotorCommand {
+    float velocity;
+    float amplitude;
+    float phase;
+};
+
+/// A dense lookup table from a thrust vector to motor commands.
+///
+/// The table is sampled on a regular sqrt(thrust) x elevation x azimuth
+/// grid when constructed, and lookup() interpolates trilinearly between
+/// the eight surrounding nodes.  Inputs are clamped to the grid, so
+/// lookup has the same cost for any input, with no branches and no
+/// allocation.  The azimuth axis spans [-pi, pi], and the phase is not
+/// wrapped, so that it interpolates smoothly.
+///
+/// Velocity is linear in sqrt(thrust), and amplitude in elevation, so
+/// they are exact between nodes, except in a cell where a command
+/// limit is reached.  So is the phase, if phase_offset is constant in
+/// velocity, as in the default model.  A calibrated phase offset which
+/// is quadratic in velocity is interpolated with an error of at most
+/// phase_offset[2] * dv^2 / 4, for a velocity step dv between nodes.
+class CalibrationTable {
+public:
+    struct Size {
+        int thrust = 32;
+        int elevation = 16;
+        int azimuth = 33;
+    };
+
+    explicit CalibrationTable(const CalibrationModel& model)
+        : CalibrationTable(model, Size()) {}
+    CalibrationTable(const CalibrationModel& model, const Size& size);
+
+    RotorCommand lookup(float thrust, float elevation, float azimuth) const {
+        const Axis::Position t = thrust_axis_.locate(std::sqrt(thrust));
+        const Axis::Position e = elevation_axis_.locate(elevation);
+        const Axis::Position a = azimuth_axis_.locate(azimuth);
+
+        const size_t stride_e = size_.azimuth;
+        const size_t stride_t = size_.elevation * stride_e;
+        const Node* n000 = &nodes_[t.index * stride_t + e.index * stride_e + a.index];
+        const Node* n100 = n000 + stride_t;
+
+        // Interpolate along azimuth, then elevation, then thrust.
+        const Node c00 = lerp(n000[0], n000[1], a.fraction);
+        const Node c01 = lerp(n000[stride_e], n000[stride_e + 1], a.fraction);
+        const Node c10 = lerp(n100[0], n100[1], a.fraction);
+        const Node c11 = lerp(n100[stride_e], n100[stride_e + 1], a.fraction);
+        const Node c0 = lerp(c00, c01, e.fraction);
+        const Node c1 = lerp(c10, c11, e.fraction);
+        const Node result = lerp(c0, c1, t.fraction);
+        return {result.velocity, result.amplitude, result.phase};
+    }
+
+    /// The commands @p model gives for a thrust vector, without the
+    /// table.
+    static RotorCommand evaluate(const CalibrationModel& model,
+                                 float thrust, float elevation, float azimuth);
+
+    const CalibrationModel& model() const { return model_; }
+
+private:
+    // One node fills a quarter of a cache line, and never straddles one.
+    struct Node {
+        float velocity;
+        float amplitude;
+        float phase;
+        float unused;
+    };
+
+    struct Axis {
+        struct Position {
+            size_t index;
+            float fraction;
+        };
+
+        float min = 0.0f;
+        float scale = 0.0f;  // nodes per unit
+        int count = 0;
+
+        float value(int index) const { return min + index / scale; }
+
+        Position locate(float x) const {
+            // The argument order makes NaN clamp to the lower bound.
+            const float position = std::min(std::max(0.0f, (x - min) * scale),
+                                            static_cast<float>(count - 1));
+            // The last cell is used for the upper bound itself, so the
+            // index never reaches count - 1.
+            const size_t index = std::min(static_cast<int>(position), count - 2);
+            return {index, position - index};
+        }
+    };
+
+    static Axis make_axis(float min, float max, int count);
+
+    static Node lerp(const Node& a, const Node& b, float fraction) {
+        return {a.velocity + (b.velocity - a.velocity) * fraction,
+                a.amplitude + (b.amplitude - a.amplitude) * fraction,
+                a.phase + (b.phase - a.phase) * fraction,
+                0.0f};
+    }
+
+    struct FreeDeleter {
+        void operator()(Node* nodes) const { std::free(nodes); }
+    };
+
+    CalibrationModel model_;
+    Size size_;
+    Axis thrust_axis_;
+    Axis elevation_axis_;
+    Axis azimuth_axis_;
+    std::unique_ptr<Node[], FreeDeleter> nodes_;
+};
+
+#endif
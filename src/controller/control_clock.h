@@ -0,0 +1,70 @@
+#ifndef CONTROL_CLOCK_H
+#define CONTROL_CLOCK_H
+
+#include <chrono>
+
+/// When a control cycle runs.  The loop reads its clock once per cycle
+/// and hands the same ControlTime to the controller, so controllers
+/// never read a clock themselves and can run in virtual time.
+struct ControlTime {
+    // Monotonic, steady_clock or virtual.
+    std::chrono::steady_clock::time_point now;
+    // Since the previous cycle, zero in the first.
+    std::chrono::nanoseconds dt{0};
+};
+
+class ControlClock {
+public:
+    virtual ~ControlClock() {}
+
+    /// The time of the next control cycle.
+    virtual ControlTime tick() = 0;
+};
+
+/// Reads steady_clock once per tick.
+class SteadyControlClock : public ControlClock {
+public:
+    ControlTime tick() override {
+        return advance(std::chrono::steady_clock::now());
+    }
+
+    /// A tick at @p now, for a loop which already read the clock.
+    ControlTime advance(std::chrono::steady_clock::time_point now) {
+        ControlTime time;
+        time.now = now;
+        if (last_ != std::chrono::steady_clock::time_point()) {
+            time.dt = now - last_;
+        }
+        last_ = now;
+        return time;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last_;
+};
+
+/// Advances a fixed period per tick without reading any clock, so a
+/// controller can be run as fast as the CPU allows.
+class VirtualControlClock : public ControlClock {
+public:
+    explicit VirtualControlClock(std::chrono::nanoseconds period,
+                                 std::chrono::steady_clock::time_point start =
+                                     std::chrono::steady_clock::time_point())
+        : period_(period), next_(start) {}
+
+    ControlTime tick() override {
+        ControlTime time;
+        time.now = next_;
+        time.dt = first_ ? std::chrono::nanoseconds(0) : period_;
+        first_ = false;
+        next_ += period_;
+        return time;
+    }
+
+private:
+    const std::chrono::nanoseconds period_;
+    std::chrono::steady_clock::time_point next_;
+    bool first_ = true;
+};
+
+#endif
@@ -1,15 +1,26 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
+#include <vector>
+
 #include "../motor_control/moteus_protocol.h"
+#include "../motor_control/pi3hat_moteus_interface.h"
+#include "control_clock.h"
 using namespace mjbots;
 using MoteusInterface = moteus::Pi3HatMoteusInterface;
 
 class Controller {
 public:
-    virtual bool run(const std::vector<MoteusInterface::ServoReply>& status,
-                std::vector<MoteusInterface::ServoCommand>* output) = 0;
+    /// Called once per control cycle at @p time, see ControlTime.
+    /// Returns true to stop the loop.
+    virtual bool run(const ControlTime& time,
+                     const std::vector<MoteusInterface::ServoReply>& status,
+                     std::vector<MoteusInterface::ServoCommand>* output) = 0;
     virtual void initialize(std::vector<MoteusInterface::ServoCommand>* commands) = 0;
+
+    /// A codec for the frame format the controller commands, if it is
+    /// fixed at compile time, see StaticFrameCodec.
+    virtual const moteus::FrameCodec* frame_codec() const { return nullptr; }
 };
 
 #endif
\ No newline at end of file
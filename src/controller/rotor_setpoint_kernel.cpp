@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "rotor_setpoint_kernel.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ROTOR_SETPOINT_KERNEL_NEON 1
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#define ROTOR_SETPOINT_KERNEL_SSE 1
+#endif
+
+namespace {
+
+// The pulse width range, mapped onto each field's range.
+constexpr float kInMin = 1000.0f;
+constexpr float kInRange = 2000.0f - 1000.0f;
+
+}
+
+RotorSetpointKernel::RotorSetpointKernel(const std::vector<Rotor>& rotors) {
+    const float pi = M_PI;
+    for (const auto& rotor : rotors) {
+        const float out_min[kFieldCount] = {rotor.min_thrust, 0.0f, -pi};
+        const float out_max[kFieldCount] = {rotor.max_thrust, rotor.max_elevation, pi};
+        for (int field = 0; field < kFieldCount; field++) {
+            out_min_[field].push_back(out_min[field]);
+            out_range_[field].push_back(out_max[field] - out_min[field]);
+            high_[field].push_back(out_max[field]);
+        }
+        sign_.push_back(rotor.mirror_azimuth ? -1.0f : 1.0f);
+    }
+}
+
+void RotorSetpointKernel::map(const RotorSetpointArrays& pulse_widths,
+                              RotorSetpointArrays* setpoints) const {
+    if (pulse_widths.size() != size() || setpoints->size() != size()) {
+        throw std::invalid_argument("There must be one setpoint per rotor");
+    }
+    map_field(kThrust, pulse_widths.thrust.data(), setpoints->thrust.data());
+    map_field(kElevation, pulse_widths.elevation.data(), setpoints->elevation.data());
+    map_field(kAzimuth, pulse_widths.azimuth.data(), setpoints->azimuth.data());
+}
+
+void RotorSetpointKernel::map_scalar(const RotorSetpointArrays& pulse_widths,
+                                     RotorSetpointArrays* setpoints) const {
+    if (pulse_widths.size() != size() || setpoints->size() != size()) {
+        throw std::invalid_argument("There must be one setpoint per rotor");
+    }
+    map_field_scalar(kThrust, 0, pulse_widths.thrust.data(), setpoints->thrust.data());
+    map_field_scalar(kElevation, 0, pulse_widths.elevation.data(), setpoints->elevation.data());
+    map_field_scalar(kAzimuth, 0, pulse_widths.azimuth.data(), setpoints->azimuth.data());
+}
+
+const char* RotorSetpointKernel::isa() {
+#if defined(ROTOR_SETPOINT_KERNEL_NEON)
+    return "neon";
+#elif defined(ROTOR_SETPOINT_KERNEL_SSE)
+    return "sse";
+#else
+    return "scalar";
+#endif
+}
+
+float RotorSetpointKernel::map_value(Field field, size_t index, float pulse_width) const {
+    const float out_min = out_min_[field][index];
+    float value = (pulse_width - kInMin) * out_range_[field][index] / kInRange + out_min;
+    value = std::max(out_min, std::min(value, high_[field][index]));
+    if (field == kAzimuth) {
+        value *= sign_[index];
+    }
+    return value;
+}
+
+void RotorSetpointKernel::map_field_scalar(Field field, size_t begin, const float* pulse_widths,
+                                           float* result) const {
+    for (size_t i = begin; i < size(); i++) {
+        result[i] = map_value(field, i, pulse_widths[i]);
+    }
+}
+
+void RotorSetpointKernel::map_field(Field field, const float* pulse_widths, float* result) const {
+    const float* out_min = out_min_[field].data();
+    const float* out_range = out_range_[field].data();
+    const float* low = out_min;
+    const float* high = high_[field].data();
+    size_t i = 0;
+
+    // Each step is the scalar one, and the operands of the min and max
+    // are in the order which selects the same one as std::min and
+    // std::max when they are equal or one is NaN.
+#if defined(ROTOR_SETPOINT_KERNEL_NEON)
+    const float32x4_t in_min = vdupq_n_f32(kInMin);
+    const float32x4_t in_range = vdupq_n_f32(kInRange);
+    for (; i + 4 <= size(); i += 4) {
+        float32x4_t value = vaddq_f32(
+            vdivq_f32(vmulq_f32(vsubq_f32(vld1q_f32(pulse_widths + i), in_min),
+                                vld1q_f32(out_range + i)),
+                      in_range),
+            vld1q_f32(out_min + i));
+        const float32x4_t high_value = vld1q_f32(high + i);
+        value = vbslq_f32(vcltq_f32(high_value, value), high_value, value);
+        const float32x4_t low_value = vld1q_f32(low + i);
+        value = vbslq_f32(vcltq_f32(low_value, value), value, low_value);
+        if (field == kAzimuth) {
+            value = vmulq_f32(value, vld1q_f32(sign_.data() + i));
+        }
+        vst1q_f32(result + i, value);
+    }
+#elif defined(ROTOR_SETPOINT_KERNEL_SSE)
+    const __m128 in_min = _mm_set1_ps(kInMin);
+    const __m128 in_range = _mm_set1_ps(kInRange);
+    for (; i + 4 <= size(); i += 4) {
+        __m128 value = _mm_add_ps(
+            _mm_div_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(pulse_widths + i), in_min),
+                                  _mm_loadu_ps(out_range + i)),
+                       in_range),
+            _mm_loadu_ps(out_min + i));
+        value = _mm_min_ps(_mm_loadu_ps(high + i), value);
+        value = _mm_max_ps(value, _mm_loadu_ps(low + i));
+        if (field == kAzimuth) {
+            value = _mm_mul_ps(value, _mm_loadu_ps(sign_.data() + i));
+        }
+        _mm_storeu_ps(result + i, value);
+    }
+#endif
+
+    map_field_scalar(field, i, pulse_widths, result);
+}
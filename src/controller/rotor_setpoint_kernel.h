@@ -0,0 +1,86 @@
+#ifndef ROTOR_SETPOINT_KERNEL_H
+#define ROTOR_SETPOINT_KERNEL_H
+
+#include <cstddef>
+#include <vector>
+
+/// The setpoint of each rotor, one array per field.
+struct RotorSetpointArrays {
+    void resize(size_t size) {
+        thrust.resize(size);
+        elevation.resize(size);
+        azimuth.resize(size);
+    }
+
+    size_t size() const { return thrust.size(); }
+
+    std::vector<float> thrust;
+    std::vector<float> elevation;
+    std::vector<float> azimuth;
+};
+
+/// Maps the RC pulse widths of all rotors to their thrust vector
+/// setpoints in one pass.  Each pulse width in [1000, 2000] us is
+/// mapped linearly onto the rotor's range, and the result is clamped
+/// to it:
+///
+///   thrust    in [min_thrust, max_thrust]
+///   elevation in [0, max_elevation]
+///   azimuth   in [-pi, pi], negated afterwards if mirror_azimuth
+///
+/// Each field of four rotors is computed at once (SSE, NEON), with the
+/// same operations in the same order as the scalar reference, and the
+/// clamp selects exactly like std::max(lo, std::min(value, hi)), so
+/// the results are bit identical for any input, including NaN,
+/// infinities and signed zeros.  NEON is only
+/// used on AArch64, as 32 bit NEON has no division.
+class RotorSetpointKernel {
+public:
+    struct Rotor {
+        float min_thrust = 0.0f;
+        float max_thrust = 0.0f;
+        float max_elevation = 0.0f;
+        bool mirror_azimuth = false;
+    };
+
+    enum Field {
+        kThrust,
+        kElevation,
+        kAzimuth,
+        kFieldCount,
+    };
+
+    RotorSetpointKernel() = default;
+    explicit RotorSetpointKernel(const std::vector<Rotor>& rotors);
+
+    size_t size() const { return out_min_[0].size(); }
+
+    /// Map @p pulse_widths, in microseconds, to @p setpoints.  Both
+    /// must have size() entries.
+    void map(const RotorSetpointArrays& pulse_widths, RotorSetpointArrays* setpoints) const;
+
+    /// The same, one rotor at a time, as a reference for map().
+    void map_scalar(const RotorSetpointArrays& pulse_widths, RotorSetpointArrays* setpoints) const;
+
+    /// The name of the vector instruction set map() uses.
+    static const char* isa();
+
+    /// @p field of rotor @p index for one pulse width, as map_scalar()
+    /// computes it.
+    float map_value(Field field, size_t index, float pulse_width) const;
+
+private:
+    void map_field(Field field, const float* pulse_widths, float* result) const;
+    void map_field_scalar(Field field, size_t begin, const float* pulse_widths,
+                          float* result) const;
+
+    // Per field and rotor: the output range, which is also what the
+    // value is clamped to, and for the azimuth the sign it is
+    // multiplied by.
+    std::vector<float> out_min_[kFieldCount];
+    std::vector<float> out_range_[kFieldCount];
+    std::vector<float> high_[kFieldCount];
+    std::vector<float> sign_;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SINUSOIDAL_FRAME_FORMAT_H
+#define SINUSOIDAL_FRAME_FORMAT_H
+
+#include "../motor_control/moteus_protocol.h"
+
+/// The command and query resolutions used by both controllers.  These
+/// are fixed at compile time, so that the CAN thread can encode and
+/// decode frames with a StaticFrameCodec.
+struct SinusoidalFrameFormat {
+    static constexpr mjbots::moteus::FrameFormat format() {
+        using mjbots::moteus::Resolution;
+        mjbots::moteus::FrameFormat result;
+        result.mode = mjbots::moteus::Mode::kSinusoidal;
+
+        auto& res = result.resolution;
+        res.position = Resolution::kInt8;
+        res.velocity = Resolution::kFloat;
+        res.feedforward_torque = Resolution::kIgnore;
+        res.sinusoidal_amplitude = Resolution::kInt16;
+        res.sinusoidal_phase = Resolution::kInt16;
+        res.kp_scale = Resolution::kIgnore;
+        res.kd_scale = Resolution::kIgnore;
+        res.maximum_torque = Resolution::kIgnore;
+        res.stop_position = Resolution::kIgnore;
+        res.watchdog_timeout = Resolution::kIgnore;
+
+        auto& query = result.query;
+        query.mode = Resolution::kInt16;
+        query.position = Resolution::kIgnore;
+        query.velocity = Resolution::kFloat;
+        query.torque = Resolution::kInt16;
+        query.q_current = Resolution::kIgnore;
+        query.d_current = Resolution::kIgnore;
+        query.rezero_state = Resolution::kInt8;
+        query.voltage = Resolution::kInt8;
+        query.temperature = Resolution::kInt8;
+        query.fault = Resolution::kInt8;
+        query.control_velocity = Resolution::kFloat;
+        return result;
+    }
+};
+
+using SinusoidalFrameCodec = mjbots::moteus::StaticFrameCodec<SinusoidalFrameFormat>;
+
+#endif
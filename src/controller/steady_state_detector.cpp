@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "steady_state_detector.h"
+
+SteadyStateDetector::SteadyStateDetector(const Options &options)
+    : options_(options),
+      window_s_(std::chrono::duration<double>(options.window).count()),
+      samples_(options.capacity)
+{
+    if (options_.capacity < 2 || options_.min_samples < 2 ||
+        options_.min_samples > options_.capacity || window_s_ <= 0.0)
+    {
+        throw std::invalid_argument("Steady state window must hold at least two samples");
+    }
+}
+
+void SteadyStateDetector::reset()
+{
+    oldest_ = 0;
+    count_ = 0;
+    started_ = false;
+    newest_time_ = 0.0;
+    sum_t_ = 0.0;
+    sum_tt_ = 0.0;
+    for (int i = 0; i < kSignalCount; i++)
+    {
+        sum_y_[i] = 0.0;
+        sum_yy_[i] = 0.0;
+        sum_ty_[i] = 0.0;
+    }
+}
+
+void SteadyStateDetector::add(std::chrono::steady_clock::time_point time,
+                              const mjbots::moteus::QueryResult &result)
+{
+    const double values[kSignalCount] = {result.velocity, result.control_velocity, result.torque};
+    add(time, values);
+}
+
+void SteadyStateDetector::add(std::chrono::steady_clock::time_point time,
+                              const double values[kSignalCount])
+{
+    for (int i = 0; i < kSignalCount; i++)
+    {
+        if (!std::isfinite(values[i]))
+        {
+            return;
+        }
+    }
+    if (!started_)
+    {
+        start_ = time;
+        started_ = true;
+    }
+    const double t = std::chrono::duration<double>(time - start_).count();
+
+    // Keep only the samples within the window of this one.
+    while (count_ > 0 && (count_ == samples_.size() ||
+                          samples_[oldest_].time <= t - window_s_))
+    {
+        remove_oldest();
+    }
+
+    Sample &sample = samples_[(oldest_ + count_) % samples_.size()];
+    sample.time = t;
+    sum_t_ += t;
+    sum_tt_ += t * t;
+    for (int i = 0; i < kSignalCount; i++)
+    {
+        const double y = values[i];
+        sample.values[i] = y;
+        sum_y_[i] += y;
+        sum_yy_[i] += y * y;
+        sum_ty_[i] += t * y;
+    }
+    count_++;
+    newest_time_ = t;
+}
+
+void SteadyStateDetector::remove_oldest()
+{
+    const Sample &sample = samples_[oldest_];
+    const double t = sample.time;
+    sum_t_ -= t;
+    sum_tt_ -= t * t;
+    for (int i = 0; i < kSignalCount; i++)
+    {
+        const double y = sample.values[i];
+        sum_y_[i] -= y;
+        sum_yy_[i] -= y * y;
+        sum_ty_[i] -= t * y;
+    }
+    oldest_ = (oldest_ + 1) % samples_.size();
+    count_--;
+}
+
+bool SteadyStateDetector::settled() const
+{
+    // The window must have been filled since the last reset, otherwise a
+    // few early samples could look steady.
+    if (count_ < options_.min_samples || newest_time_ < window_s_)
+    {
+        return false;
+    }
+    for (int i = 0; i < kSignalCount; i++)
+    {
+        const Signal signal = static_cast<Signal>(i);
+        if (deviation(signal) > options_.max_deviation[i] ||
+            std::abs(slope(signal)) * window_s_ > options_.max_drift[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+double SteadyStateDetector::mean(Signal signal) const
+{
+    return count_ > 0 ? sum_y_[signal] / count_ : 0.0;
+}
+
+double SteadyStateDetector::deviation(Signal signal) const
+{
+    if (count_ < 2)
+    {
+        return 0.0;
+    }
+    const double mean = sum_y_[signal] / count_;
+    // Rounding in the running sums can make a constant signal's
+    // variance slightly negative.
+    return std::sqrt(std::max(0.0, sum_yy_[signal] / count_ - mean * mean));
+}
+
+double SteadyStateDetector::slope(Signal signal) const
+{
+    const double n = count_;
+    const double denominator = n * sum_tt_ - sum_t_ * sum_t_;
+    if (count_ < 2 || denominator <= 0.0)
+    {
+        return 0.0;
+    }
+    return (n * sum_ty_[signal] - sum_t_ * sum_y_[signal]) / denominator;
+}
@@ -0,0 +1,94 @@
+#ifndef STEADY_STATE_DETECTOR_H
+#define STEADY_STATE_DETECTOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "../motor_control/moteus_protocol.h"
+
+/// Decides online whether a rotor has settled after a command change,
+/// from the velocity, control velocity and torque replies.
+///
+/// The samples of a trailing window are kept in a ring, along with
+/// running sums, so that each sample costs O(1) and nothing is
+/// allocated after construction.  The rotor is settled when the window
+/// has been filled since the last reset, and for every signal
+///
+///   - the standard deviation over the window is at most max_deviation,
+///   - the least squares slope times the window length, the drift of
+///     the mean across the window, is at most max_drift.
+///
+/// In sinusoidal mode the velocity and torque ripple once per
+/// revolution, so the deviation limits must allow for the ripple of
+/// the largest amplitude.  A limit of infinity disables its test.
+class SteadyStateDetector {
+public:
+    enum Signal {
+        kVelocity,
+        kControlVelocity,
+        kTorque,
+        kSignalCount
+    };
+
+    struct Options {
+        std::chrono::nanoseconds window{std::chrono::milliseconds(150)};
+        // Samples kept at most, the window is shorter if it holds more.
+        size_t capacity = 1024;
+        // Fewer samples than this are never settled.
+        size_t min_samples = 16;
+
+        // rev/s, rev/s and Nm
+        double max_deviation[kSignalCount] = {2.0, 0.5, 0.15};
+        double max_drift[kSignalCount] = {0.5, 0.1, 0.05};
+
+        Options() {}
+    };
+
+    explicit SteadyStateDetector(const Options& options = Options());
+
+    /// Forget all samples, e.g. when the command changes.
+    void reset();
+
+    /// Add the reply received at @p time.  Replies where any of the
+    /// signals is not finite, e.g. when the servo is stopped, are
+    /// ignored.
+    void add(std::chrono::steady_clock::time_point time, const mjbots::moteus::QueryResult& result);
+    void add(std::chrono::steady_clock::time_point time, const double values[kSignalCount]);
+
+    bool settled() const;
+
+    size_t size() const { return count_; }
+    double mean(Signal signal) const;
+    double deviation(Signal signal) const;
+    /// Per second.
+    double slope(Signal signal) const;
+
+private:
+    struct Sample {
+        // Seconds since the first sample after the last reset.
+        double time;
+        double values[kSignalCount];
+    };
+
+    void remove_oldest();
+
+    const Options options_;
+    const double window_s_;
+
+    std::vector<Sample> samples_;
+    size_t oldest_ = 0;
+    size_t count_ = 0;
+    bool started_ = false;
+    std::chrono::steady_clock::time_point start_;
+    double newest_time_ = 0.0;
+
+    // Running sums over the samples in the window.
+    double sum_t_ = 0.0;
+    double sum_tt_ = 0.0;
+    double sum_y_[kSignalCount] = {};
+    double sum_yy_[kSignalCount] = {};
+    double sum_ty_[kSignalCount] = {};
+};
+
+#endif
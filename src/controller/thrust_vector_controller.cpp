@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include "thrust_vector_controller.h"
+
+namespace {
+
+std::vector<RotorSetpointKernel::Rotor> kernel_rotors(
+    const std::vector<RotorConfig>& rotors,
+    const std::vector<std::shared_ptr<const CalibrationTable>>& tables) {
+    std::vector<RotorSetpointKernel::Rotor> result(rotors.size());
+    for (size_t i = 0; i < rotors.size(); i++) {
+        const CalibrationModel& model = tables[i]->model();
+        result[i].min_thrust = model.min_thrust;
+        result[i].max_thrust = model.max_thrust;
+        result[i].max_elevation = model.max_elevation;
+        result[i].mirror_azimuth = rotors[i].mirror_azimuth;
+    }
+    return result;
+}
+
+void apply_motor_command(MoteusInterface::ServoCommand *command, const RotorCommand &rotor_command)
+{
+    command->mode = moteus::Mode::kSinusoidal;
+    command->position.position = std::numeric_limits<double>::quiet_NaN();
+    command->position.maximum_torque = std::numeric_limits<double>::quiet_NaN();
+    command->position.velocity = rotor_command.velocity;
+    command->position.sinusoidal_amplitude = rotor_command.amplitude;
+    command->position.sinusoidal_phase = rotor_command.phase;
+}
+
+}
+
+void balance_buses(std::vector<RotorConfig>* rotors) {
+    int load[5] = {};
+    for (const auto& rotor : *rotors) {
+        if (rotor.bus >= 1 && rotor.bus <= 4) {
+            load[rotor.bus]++;
+        }
+    }
+    for (auto& rotor : *rotors) {
+        if (rotor.bus != 0) {
+            continue;
+        }
+        int bus = 1;
+        for (int candidate = 2; candidate <= 4; candidate++) {
+            if (load[candidate] < load[bus]) {
+                bus = candidate;
+            }
+        }
+        rotor.bus = bus;
+        load[bus]++;
+    }
+}
+
+ThrustVectorController::ThrustVectorController(std::vector<RotorConfig> rotors,
+                                               PulseWidthSource* source)
+    : rotors_(std::move(rotors)), source_(source)
+{
+    if (rotors_.empty()) {
+        throw std::invalid_argument("At least one rotor is required");
+    }
+    balance_buses(&rotors_);
+
+    std::map<std::string, std::shared_ptr<const CalibrationTable>> tables;
+    for (const auto& rotor : rotors_) {
+        auto& table = tables[rotor.calibration_file];
+        if (!table) {
+            table = std::make_shared<const CalibrationTable>(
+                rotor.calibration_file.empty() ?
+                CalibrationModel() : load_calibration_model(rotor.calibration_file));
+        }
+        tables_.push_back(table);
+    }
+
+    kernel_ = RotorSetpointKernel(kernel_rotors(rotors_, tables_));
+    pulse_widths_.resize(rotors_.size());
+    setpoints_.resize(rotors_.size());
+}
+
+std::vector<std::pair<int, int>> ThrustVectorController::servo_bus_map() const {
+    std::vector<std::pair<int, int>> result;
+    for (const auto& rotor : rotors_) {
+        result.push_back({rotor.servo_id, rotor.bus});
+    }
+    return result;
+}
+
+RotorCommand ThrustVectorController::command(size_t index, float thrust_us,
+                                             float elevation_us, float azimuth_us) const {
+    // The kernel clamps all values to their bounds in case of bad or
+    // unexpected pwm values, and the calibration table gives velocity,
+    // amplitude and phase, within their bounds.
+    return tables_[index]->lookup(
+        kernel_.map_value(RotorSetpointKernel::kThrust, index, thrust_us),
+        kernel_.map_value(RotorSetpointKernel::kElevation, index, elevation_us),
+        kernel_.map_value(RotorSetpointKernel::kAzimuth, index, azimuth_us));
+}
+
+void ThrustVectorController::initialize(std::vector<MoteusInterface::ServoCommand> *commands) {
+    if (commands->size() != rotors_.size()) {
+        throw std::logic_error("There must be one servo per rotor, see servo_bus_map()");
+    }
+    constexpr moteus::FrameFormat format = SinusoidalFrameFormat::format();
+
+    for (auto &cmd : *commands)
+    {
+        cmd.resolution = format.resolution;
+        cmd.query = format.query;
+    }
+}
+
+bool ThrustVectorController::run(const ControlTime & /*time*/,
+                                 const std::vector<MoteusInterface::ServoReply> & /*status*/,
+                                 std::vector<MoteusInterface::ServoCommand> *output) {
+    source_->sample();
+
+    // Check if disarmed
+    for (const auto& rotor : rotors_) {
+        if (source_->pulse_width(rotor.thrust_channel) < kDisarmedPulseWidth) {
+            for (auto& cmd : *output) {
+                cmd.mode = moteus::Mode::kStopped;
+            }
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < rotors_.size(); i++) {
+        const RotorConfig& rotor = rotors_[i];
+        pulse_widths_.thrust[i] = source_->pulse_width(rotor.thrust_channel);
+        pulse_widths_.elevation[i] = source_->pulse_width(rotor.elevation_channel);
+        pulse_widths_.azimuth[i] = source_->pulse_width(rotor.azimuth_channel);
+    }
+    kernel_.map(pulse_widths_, &setpoints_);
+
+    // The table lookups stay per rotor, as each may have its own table.
+    for (size_t i = 0; i < rotors_.size(); i++) {
+        apply_motor_command(&(*output)[i],
+                            tables_[i]->lookup(setpoints_.thrust[i], setpoints_.elevation[i],
+                                               setpoints_.azimuth[i]));
+    }
+    return false;
+}
@@ -0,0 +1,94 @@
+#ifndef THRUST_VECTOR_CONTROLLER_H
+#define THRUST_VECTOR_CONTROLLER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../motor_control/moteus_protocol.h"
+#include "../motor_control/pi3hat_moteus_interface.h"
+#include "controller.h"
+#include "calibration_table.h"
+#include "rotor_setpoint_kernel.h"
+#include "sinusoidal_frame_format.h"
+
+using namespace mjbots;
+using MoteusInterface = moteus::Pi3HatMoteusInterface;
+
+/// Where the thrust vector setpoints come from, as RC pulse widths in
+/// microseconds: 1000 to 2000, and below 970 on a thrust channel when
+/// disarmed.
+class PulseWidthSource {
+public:
+    virtual ~PulseWidthSource() {}
+
+    /// Called once at the start of each control cycle, before any
+    /// pulse_width().  A source whose channels are written together can
+    /// take a consistent snapshot of them here.
+    virtual void sample() {}
+    virtual float pulse_width(unsigned int channel) const = 0;
+};
+
+/// One thrust vectoring rotor.
+struct RotorConfig {
+    int servo_id = 1;
+    // The pi3hat CAN bus, 1 to 5, or 0 to have one chosen by
+    // balance_buses().
+    int bus = 0;
+    // The input channels of the setpoint.
+    unsigned int thrust_channel = 0;
+    unsigned int elevation_channel = 0;
+    unsigned int azimuth_channel = 0;
+    // A calibration model file, see calibration_table.h.  The default
+    // model is used if empty.
+    std::string calibration_file;
+    // A rotor spinning the other way can use the same calibration with
+    // its azimuth mirrored.
+    bool mirror_azimuth = false;
+};
+
+/// Put each rotor without a bus on the one of CAN 1-4 with the fewest
+/// rotors so far, so that the per bus load is balanced.
+void balance_buses(std::vector<RotorConfig>* rotors);
+
+/// Maps the thrust vector setpoint of each rotor to sinusoidal motor
+/// commands through its calibration table.  The pulse widths of all
+/// rotors are mapped to setpoints at once by a RotorSetpointKernel.
+/// Rotor i is servo i of servo_bus_map().  If any rotor is disarmed,
+/// all are stopped.
+class ThrustVectorController : public Controller
+{
+public:
+    static constexpr float kDisarmedPulseWidth = 970;
+
+    /// Rotors without a bus are balanced, see balance_buses().
+    /// @p source must outlive the controller.
+    ThrustVectorController(std::vector<RotorConfig> rotors, PulseWidthSource* source);
+
+    /// The (id, bus) of each rotor's servo, for MoteusMotorControl.
+    std::vector<std::pair<int, int>> servo_bus_map() const;
+    const std::vector<RotorConfig>& rotors() const { return rotors_; }
+
+    /// The command of rotor @p index for the given pulse widths.
+    RotorCommand command(size_t index, float thrust_us, float elevation_us,
+                         float azimuth_us) const;
+
+    void initialize(std::vector<MoteusInterface::ServoCommand> *commands);
+    bool run(const ControlTime &time,
+             const std::vector<MoteusInterface::ServoReply> &status,
+             std::vector<MoteusInterface::ServoCommand> *output);
+    const moteus::FrameCodec* frame_codec() const { return &SinusoidalFrameCodec::codec(); }
+
+private:
+    std::vector<RotorConfig> rotors_;
+    PulseWidthSource* source_;
+    // Rotors with the same calibration file share a table.
+    std::vector<std::shared_ptr<const CalibrationTable>> tables_;
+    RotorSetpointKernel kernel_;
+    RotorSetpointArrays pulse_widths_;
+    RotorSetpointArrays setpoints_;
+};
+
+#endif
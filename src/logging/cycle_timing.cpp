@@ -0,0 +1,104 @@
+#include "cycle_timing.h"
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "../motor_control/realtime.h"
+
+CycleTiming::CycleTiming(const Options& options)
+    : options_(options) {
+  if (options_.report_period.count() > 0) {
+    thread_ = std::thread(std::bind(&CycleTiming::CHILD_Run, this));
+  }
+}
+
+CycleTiming::~CycleTiming() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    condition_.notify_one();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  LatencyHistogram::Snapshot snapshots[kStageCount];
+  for (int i = 0; i < kStageCount; i++) {
+    histograms_[i].Read(&snapshots[i]);
+  }
+  std::cout << "\nCycle timing summary\n";
+  Print(std::cout, snapshots, skipped());
+}
+
+const char* CycleTiming::StageName(Stage stage) {
+  switch (stage) {
+    case kWakeup: return "wakeup";
+    case kReplyWait: return "reply wait";
+    case kReplyAge: return "reply age";
+    case kController: return "controller";
+    case kCanWakeup: return "can wakeup";
+    case kCanCycle: return "can cycle";
+    case kServoReply: return "servo reply";
+    case kSleepMargin: return "sleep margin";
+    case kStageCount: break;
+  }
+  return "unknown";
+}
+
+void CycleTiming::Print(std::ostream& stream,
+                        const LatencyHistogram::Snapshot* snapshots,
+                        uint64_t skipped) {
+  // Format everything first, so that the output of other threads is
+  // not interleaved with the table.
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << std::left << std::setw(14) << "[us]" << std::right
+      << std::setw(10) << "count"
+      << std::setw(10) << "p50"
+      << std::setw(10) << "p99"
+      << std::setw(10) << "p99.9"
+      << std::setw(10) << "max" << "\n";
+  for (int i = 0; i < kStageCount; i++) {
+    const auto& snapshot = snapshots[i];
+    out << std::left << std::setw(14) << StageName(static_cast<Stage>(i))
+        << std::right
+        << std::setw(10) << snapshot.count
+        << std::setw(10) << snapshot.Percentile(0.5) * 1e-3
+        << std::setw(10) << snapshot.Percentile(0.99) * 1e-3
+        << std::setw(10) << snapshot.Percentile(0.999) * 1e-3
+        << std::setw(10) << snapshot.max * 1e-3 << "\n";
+  }
+  out << "skipped cycles: " << skipped << "\n";
+  stream << out.str() << std::flush;
+}
+
+void CycleTiming::CHILD_Run() {
+  mjbots::moteus::ConfigureCpuAffinity(options_.cpu);
+
+  // Snapshots are allocated once, rather than for every report.
+  LatencyHistogram::Snapshot previous[kStageCount];
+  LatencyHistogram::Snapshot current[kStageCount];
+  LatencyHistogram::Snapshot interval[kStageCount];
+  uint64_t previous_skipped = 0;
+
+  auto next_report = std::chrono::steady_clock::now() + options_.report_period;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait_until(lock, next_report, [&]() { return done_; });
+      if (done_) { return; }
+    }
+    next_report += options_.report_period;
+
+    for (int i = 0; i < kStageCount; i++) {
+      histograms_[i].Read(&current[i]);
+      interval[i].Difference(current[i], previous[i]);
+      std::swap(previous[i], current[i]);
+    }
+    const uint64_t skipped_now = skipped();
+    Print(std::cout, interval, skipped_now - previous_skipped);
+    previous_skipped = skipped_now;
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef CYCLE_TIMING_H
+#define CYCLE_TIMING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+
+#include "latency_histogram.h"
+
+/// Latency instrumentation for the realtime control loop.
+///
+/// The control loop records the duration of each stage of every
+/// cycle into a LatencyHistogram.  A background reporter thread
+/// prints p50/p99/p99.9/max for the last reporting period, and a
+/// summary of the whole run is printed when this is destroyed.
+class CycleTiming {
+ public:
+  enum Stage {
+    // How late the loop woke up, relative to the cycle deadline.
+    kWakeup,
+    // In the pipelined loop, how long it waited for the CAN cycle in
+    // flight before running the controller.
+    kReplyWait,
+    // From the start of the CAN cycle whose replies the controller
+    // used, until it ran.
+    kReplyAge,
+    // Time spent in Controller::run.
+    kController,
+    // From starting a CAN cycle until the CAN thread woke up for it.
+    kCanWakeup,
+    // The SPI and CAN round trip, measured on the CAN thread.
+    kCanCycle,
+    // From the start of the CAN cycle until each servo's reply was
+    // received, once per servo.
+    kServoReply,
+    // How long the loop slept before the next cycle.  Small values
+    // mean the period is close to not being achievable.
+    kSleepMargin,
+    kStageCount,
+  };
+
+  struct Options {
+    // Nothing is reported while running if zero.
+    std::chrono::milliseconds report_period{1000};
+
+    // The reporter thread is pinned to this core if non-negative.
+    int cpu = -1;
+  };
+
+  CycleTiming(const Options& options);
+  ~CycleTiming();
+
+  CycleTiming(const CycleTiming&) = delete;
+  CycleTiming& operator=(const CycleTiming&) = delete;
+
+  /// Safe to call from the realtime thread.
+  void Record(Stage stage, std::chrono::nanoseconds duration) {
+    histograms_[stage].Record(duration.count());
+  }
+
+  /// Count cycles whose deadline passed before they could start.
+  /// Safe to call from the realtime thread.
+  void RecordSkipped(int count) {
+    skipped_.store(skipped_.load(std::memory_order_relaxed) + count,
+                   std::memory_order_relaxed);
+  }
+
+  const LatencyHistogram& histogram(Stage stage) const {
+    return histograms_[stage];
+  }
+
+  uint64_t skipped() const { return skipped_.load(std::memory_order_relaxed); }
+
+  static const char* StageName(Stage stage);
+
+  /// Print one line per stage for the given snapshots.
+  static void Print(std::ostream& stream,
+                    const LatencyHistogram::Snapshot* snapshots,
+                    uint64_t skipped);
+
+ private:
+  void CHILD_Run();
+
+  const Options options_;
+  LatencyHistogram histograms_[kStageCount];
+  std::atomic<uint64_t> skipped_{0};
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool done_ = false;
+  std::thread thread_;
+};
+
+#endif
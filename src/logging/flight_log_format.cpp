@@ -0,0 +1,359 @@
+#include "flight_log_format.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace flight_log {
+
+const std::array<Column, kMotorColumnCount> kMotorColumns = {{
+  {"Time", ColumnEncoding::kTimestampNs},
+  {"ID", ColumnEncoding::kInteger},
+  {"Bus", ColumnEncoding::kInteger},
+  {"Mode", ColumnEncoding::kInteger},
+  {"Velocity", ColumnEncoding::kFixedPoint},
+  {"Torque", ColumnEncoding::kFixedPoint},
+  {"ControlVelocity", ColumnEncoding::kFixedPoint},
+  {"VelocityCommand", ColumnEncoding::kFixedPoint},
+  {"AmplitudeCommand", ColumnEncoding::kFixedPoint},
+  {"PhaseCommand", ColumnEncoding::kFixedPoint},
+  {"Temperature", ColumnEncoding::kFixedPoint},
+  {"Voltage", ColumnEncoding::kFixedPoint},
+}};
+
+namespace {
+
+enum ColumnIndex {
+  kTime = 0,
+  kId = 1,
+  kBus = 2,
+};
+
+// Non-finite values are mapped onto reserved fixed point values.
+constexpr int64_t kFixedNaN = std::numeric_limits<int64_t>::min();
+constexpr int64_t kFixedNegInf = std::numeric_limits<int64_t>::min() + 1;
+constexpr int64_t kFixedPosInf = std::numeric_limits<int64_t>::max();
+constexpr double kFixedLimit = 9.0e18;
+
+int64_t ToFixed(float value) {
+  if (std::isnan(value)) { return kFixedNaN; }
+  const double scaled = static_cast<double>(value) * kFixedPointScale;
+  if (scaled >= kFixedLimit) { return kFixedPosInf; }
+  if (scaled <= -kFixedLimit) { return kFixedNegInf; }
+  return std::llround(scaled);
+}
+
+float FromFixed(int64_t value) {
+  if (value == kFixedNaN) { return std::numeric_limits<float>::quiet_NaN(); }
+  if (value == kFixedPosInf) { return std::numeric_limits<float>::infinity(); }
+  if (value == kFixedNegInf) { return -std::numeric_limits<float>::infinity(); }
+  return static_cast<float>(value / kFixedPointScale);
+}
+
+std::array<int64_t, kMotorColumnCount> ToColumns(const MotorLogRecord& r) {
+  return {{
+    r.timestamp_ns,
+    r.id,
+    r.bus,
+    r.mode,
+    ToFixed(r.velocity),
+    ToFixed(r.torque),
+    ToFixed(r.control_velocity),
+    ToFixed(r.velocity_command),
+    ToFixed(r.amplitude_command),
+    ToFixed(r.phase_command),
+    ToFixed(r.temperature),
+    ToFixed(r.voltage),
+  }};
+}
+
+MotorLogRecord FromColumns(const std::array<int64_t, kMotorColumnCount>& c) {
+  MotorLogRecord r;
+  r.timestamp_ns = c[0];
+  r.id = static_cast<int32_t>(c[1]);
+  r.bus = static_cast<int32_t>(c[2]);
+  r.mode = static_cast<int32_t>(c[3]);
+  r.velocity = FromFixed(c[4]);
+  r.torque = FromFixed(c[5]);
+  r.control_velocity = FromFixed(c[6]);
+  r.velocity_command = FromFixed(c[7]);
+  r.amplitude_command = FromFixed(c[8]);
+  r.phase_command = FromFixed(c[9]);
+  r.temperature = FromFixed(c[10]);
+  r.voltage = FromFixed(c[11]);
+  return r;
+}
+
+void WriteVarint(std::vector<uint8_t>* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(value));
+}
+
+bool ReadVarint(const std::vector<uint8_t>& in, size_t* offset, size_t end,
+                uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*offset >= end) { return false; }
+    const uint8_t byte = in[(*offset)++];
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Deltas are taken with wrapping arithmetic so that the reserved
+// values used for non-finite numbers round trip.
+uint64_t ZigZagDelta(int64_t value, int64_t previous) {
+  const int64_t delta = static_cast<int64_t>(
+      static_cast<uint64_t>(value) - static_cast<uint64_t>(previous));
+  return (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+}
+
+int64_t ApplyZigZagDelta(uint64_t zigzag, int64_t previous) {
+  const uint64_t delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+  return static_cast<int64_t>(static_cast<uint64_t>(previous) + delta);
+}
+
+void WriteU16(std::vector<uint8_t>* out, uint16_t value) {
+  out->push_back(value & 0xff);
+  out->push_back((value >> 8) & 0xff);
+}
+
+void WriteU32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+uint32_t ReadU32(const uint8_t* in) {
+  return static_cast<uint32_t>(in[0]) |
+      (static_cast<uint32_t>(in[1]) << 8) |
+      (static_cast<uint32_t>(in[2]) << 16) |
+      (static_cast<uint32_t>(in[3]) << 24);
+}
+
+uint16_t ReadU16(std::istream& input) {
+  uint8_t data[2] = {};
+  input.read(reinterpret_cast<char*>(data), sizeof(data));
+  return data[0] | (data[1] << 8);
+}
+
+}
+
+Encoder::Encoder() {
+  block_.reserve(kMaxBlockSize);
+  scratch_.reserve(kMaxBlockSize);
+  Reset();
+}
+
+std::vector<uint8_t> Encoder::FileHeader() {
+  std::vector<uint8_t> result(std::begin(kFileMagic), std::end(kFileMagic));
+  WriteU16(&result, kVersion);
+  WriteU16(&result, kMotorColumnCount);
+  for (const auto& column : kMotorColumns) {
+    const size_t name_size = std::strlen(column.name);
+    result.push_back(static_cast<uint8_t>(column.encoding));
+    result.push_back(static_cast<uint8_t>(name_size));
+    result.insert(result.end(), column.name, column.name + name_size);
+  }
+  return result;
+}
+
+namespace {
+
+// The value each column is delta coded against.  A servo seen for the
+// first time in a block is predicted to share the time of the
+// previous record, as all servos are queried in the same cycle.
+std::array<int64_t, kMotorColumnCount> Predict(
+    const std::map<std::pair<int32_t, int32_t>, ServoState>& servos,
+    const std::pair<int32_t, int32_t>& key, int64_t last_time) {
+  const auto it = servos.find(key);
+  if (it == servos.end()) {
+    std::array<int64_t, kMotorColumnCount> result = {};
+    result[kTime] = last_time;
+    return result;
+  }
+  auto result = it->second.values;
+  result[kTime] += it->second.time_step;
+  return result;
+}
+
+void Update(ServoState* state, bool seen,
+            const std::array<int64_t, kMotorColumnCount>& values) {
+  state->time_step = seen ? values[kTime] - state->values[kTime] : 0;
+  state->values = values;
+}
+
+}
+
+bool Encoder::Append(const MotorLogRecord& record) {
+  const auto values = ToColumns(record);
+  const auto key = std::make_pair(record.id, record.bus);
+  const auto previous = Predict(servos_, key, last_time_);
+
+  uint64_t changed = 0;
+  for (size_t i = 0; i < kMotorColumnCount; i++) {
+    if (i == kId || i == kBus) { continue; }
+    if (values[i] != previous[i]) { changed |= (1u << i); }
+  }
+
+  scratch_.clear();
+  WriteVarint(&scratch_, static_cast<uint32_t>(record.id));
+  WriteVarint(&scratch_, static_cast<uint32_t>(record.bus));
+  WriteVarint(&scratch_, changed);
+  for (size_t i = 0; i < kMotorColumnCount; i++) {
+    if (changed & (1u << i)) {
+      WriteVarint(&scratch_, ZigZagDelta(values[i], previous[i]));
+    }
+  }
+
+  // The type byte plus at most two bytes of length.
+  if (block_.size() + 3 + scratch_.size() > kMaxBlockSize) {
+    return false;
+  }
+
+  block_.push_back(static_cast<uint8_t>(RecordType::kMotor));
+  WriteVarint(&block_, scratch_.size());
+  block_.insert(block_.end(), scratch_.begin(), scratch_.end());
+
+  const bool seen = servos_.count(key) != 0;
+  Update(&servos_[key], seen, values);
+  last_time_ = values[kTime];
+  record_count_++;
+  return true;
+}
+
+const std::vector<uint8_t>& Encoder::block() {
+  WriteU32(&block_[0], kBlockMagic);
+  WriteU32(&block_[4], block_.size() - kBlockHeaderSize);
+  return block_;
+}
+
+void Encoder::Reset() {
+  block_.assign(kBlockHeaderSize, 0);
+  record_count_ = 0;
+  last_time_ = 0;
+  servos_.clear();
+}
+
+Reader::Reader(std::istream& input) : input_(input) {
+  char magic[sizeof(kFileMagic)] = {};
+  input_.read(magic, sizeof(magic));
+  if (!input_ || std::memcmp(magic, kFileMagic, sizeof(magic)) != 0) {
+    throw std::runtime_error("Not a flight log");
+  }
+
+  const auto version = ReadU16(input_);
+  if (version != kVersion) {
+    throw std::runtime_error(
+        "Unsupported flight log version " + std::to_string(version));
+  }
+
+  const auto column_count = ReadU16(input_);
+  if (!input_ || column_count != kMotorColumnCount) {
+    throw std::runtime_error("Flight log schema does not match");
+  }
+  for (const auto& column : kMotorColumns) {
+    uint8_t encoding_and_size[2] = {};
+    input_.read(reinterpret_cast<char*>(encoding_and_size), 2);
+    std::string name(encoding_and_size[1], '\0');
+    input_.read(&name[0], name.size());
+    if (!input_ ||
+        encoding_and_size[0] != static_cast<uint8_t>(column.encoding) ||
+        name != column.name) {
+      throw std::runtime_error("Flight log schema does not match");
+    }
+  }
+}
+
+bool Reader::ReadBlock() {
+  uint8_t header[kBlockHeaderSize] = {};
+  input_.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (input_.gcount() == 0) { return false; }
+
+  const uint32_t size = ReadU32(&header[4]);
+  if (input_.gcount() != sizeof(header) ||
+      ReadU32(&header[0]) != kBlockMagic ||
+      size > kMaxBlockSize - kBlockHeaderSize) {
+    truncated_ = true;
+    return false;
+  }
+
+  block_.resize(size);
+  input_.read(reinterpret_cast<char*>(block_.data()), size);
+  if (static_cast<size_t>(input_.gcount()) != size) {
+    truncated_ = true;
+    return false;
+  }
+
+  offset_ = 0;
+  last_time_ = 0;
+  servos_.clear();
+  return true;
+}
+
+bool Reader::Next(MotorLogRecord* record) {
+  while (true) {
+    if (offset_ >= block_.size()) {
+      if (truncated_ || !ReadBlock()) { return false; }
+      continue;
+    }
+
+    const auto type = static_cast<RecordType>(block_[offset_++]);
+    uint64_t size = 0;
+    if (!ReadVarint(block_, &offset_, block_.size(), &size) ||
+        offset_ + size > block_.size()) {
+      truncated_ = true;
+      return false;
+    }
+    const size_t end = offset_ + size;
+
+    if (type != RecordType::kMotor) {
+      // Skip records we do not understand.
+      offset_ = end;
+      continue;
+    }
+
+    uint64_t id = 0;
+    uint64_t bus = 0;
+    uint64_t changed = 0;
+    if (!ReadVarint(block_, &offset_, end, &id) ||
+        !ReadVarint(block_, &offset_, end, &bus) ||
+        !ReadVarint(block_, &offset_, end, &changed)) {
+      truncated_ = true;
+      return false;
+    }
+
+    const auto key = std::make_pair(static_cast<int32_t>(id),
+                                    static_cast<int32_t>(bus));
+    auto values = Predict(servos_, key, last_time_);
+    values[kId] = key.first;
+    values[kBus] = key.second;
+    for (size_t i = 0; i < kMotorColumnCount; i++) {
+      if ((changed & (1u << i)) == 0) { continue; }
+      uint64_t delta = 0;
+      if (!ReadVarint(block_, &offset_, end, &delta)) {
+        truncated_ = true;
+        return false;
+      }
+      values[i] = ApplyZigZagDelta(delta, values[i]);
+    }
+    offset_ = end;
+
+    const bool seen = servos_.count(key) != 0;
+    Update(&servos_[key], seen, values);
+    last_time_ = values[kTime];
+
+    *record = FromColumns(values);
+    return true;
+  }
+}
+
+}
@@ -0,0 +1,132 @@
+#ifndef FLIGHT_LOG_FORMAT_H
+#define FLIGHT_LOG_FORMAT_H
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "motor_log_record.h"
+
+/// @file
+///
+/// Compact binary format for the motor log written by
+/// MoteusMotorControl.
+///
+/// A file starts with a header holding a magic string, the format
+/// version and a schema listing every column with its encoding.  It
+/// is followed by a sequence of blocks, each at most kMaxBlockSize
+/// bytes:
+///
+///   block:  uint32 kBlockMagic, uint32 payload size, payload
+///   record: uint8 type, varint payload size, payload
+///
+/// Every block can be decoded on its own, so a crash or power loss
+/// only loses the block that was being filled.  Records carry a type
+/// and length so that readers can skip record types they do not know.
+///
+/// A motor record stores the servo id and bus, a bitmask of the
+/// columns that changed, and then a zigzag varint delta for each
+/// changed column, each against the previous record for the same
+/// servo in the block.  Time is coded against a prediction that
+/// assumes the servo is queried at a constant rate, so only the loop
+/// jitter needs to be stored.  Float columns are stored in fixed point
+/// with the same 1e-5 resolution that the CSV log uses.
+
+namespace flight_log {
+
+constexpr char kFileMagic[8] = {'T', 'V', 'C', 'L', 'O', 'G', '\r', '\n'};
+constexpr uint16_t kVersion = 1;
+constexpr uint32_t kBlockMagic = 0x42435654;  // "TVCB"
+constexpr size_t kBlockHeaderSize = 8;
+constexpr size_t kMaxBlockSize = 4096;
+constexpr double kFixedPointScale = 100000.0;
+
+enum class RecordType : uint8_t {
+  kMotor = 1,
+};
+
+enum class ColumnEncoding : uint8_t {
+  kTimestampNs = 0,
+  kInteger = 1,
+  kFixedPoint = 2,
+};
+
+struct Column {
+  const char* name;
+  ColumnEncoding encoding;
+};
+
+/// The columns of a motor record, in the order they appear in the
+/// CSV log.  ID and Bus identify the servo and are always present,
+/// the remaining columns are delta coded.
+constexpr size_t kMotorColumnCount = 12;
+extern const std::array<Column, kMotorColumnCount> kMotorColumns;
+
+/// The per-servo state used for delta coding within a block.
+struct ServoState {
+  std::array<int64_t, kMotorColumnCount> values = {};
+  int64_t time_step = 0;
+};
+
+/// Builds blocks of encoded records.  Not thread safe, this is
+/// intended to be used from the log writer thread.
+class Encoder {
+ public:
+  Encoder();
+
+  /// The file header, to be written once before any block.
+  static std::vector<uint8_t> FileHeader();
+
+  /// Append a record to the current block.  Returns false, without
+  /// consuming the record, if the current block is full.  In that
+  /// case, write out block() and call Reset() before trying again.
+  bool Append(const MotorLogRecord& record);
+
+  /// The current block, including its header, ready to be written.
+  const std::vector<uint8_t>& block();
+
+  bool empty() const { return record_count_ == 0; }
+
+  /// Start a new, empty block.
+  void Reset();
+
+ private:
+  std::vector<uint8_t> block_;
+  std::vector<uint8_t> scratch_;
+  size_t record_count_ = 0;
+  int64_t last_time_ = 0;
+  std::map<std::pair<int32_t, int32_t>, ServoState> servos_;
+};
+
+/// Reads a binary flight log one record at a time.
+class Reader {
+ public:
+  /// Throws std::runtime_error if the stream does not start with a
+  /// valid header.
+  Reader(std::istream& input);
+
+  /// Returns false at the end of the log.  A truncated final block
+  /// is treated as the end of the log, see truncated().
+  bool Next(MotorLogRecord* record);
+
+  /// True if the log ended part way through a block.
+  bool truncated() const { return truncated_; }
+
+ private:
+  bool ReadBlock();
+
+  std::istream& input_;
+  std::vector<uint8_t> block_;
+  size_t offset_ = 0;
+  bool truncated_ = false;
+  int64_t last_time_ = 0;
+  std::map<std::pair<int32_t, int32_t>, ServoState> servos_;
+};
+
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// A log-linear latency histogram, in the style of HdrHistogram.
+///
+/// Values below 2^kSubBucketBits nanoseconds are counted exactly.
+/// Above that, each power of two range is split into
+/// 2^(kSubBucketBits - 1) linear buckets, so any recorded value is
+/// reproduced to within about 3%.  Values of 2^kMaxBits ns (about 18
+/// minutes) or more are counted in the last bucket.
+///
+/// Record() may be called from one realtime thread.  It never blocks
+/// or allocates, and only touches a few atomics without any read-
+/// modify-write.  Any other thread may Read() a snapshot concurrently.
+class LatencyHistogram {
+ public:
+  enum {
+    kSubBucketBits = 6,
+    kSubBucketCount = 1 << kSubBucketBits,
+    kSubBucketHalf = kSubBucketCount / 2,
+    kMaxBits = 40,
+    kBucketCount = kSubBucketCount + (kMaxBits - kSubBucketBits) * kSubBucketHalf,
+  };
+
+  /// A copy of the counts, which can be queried.
+  struct Snapshot {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(kBucketCount);
+    uint64_t count = 0;
+    int64_t max = 0;
+
+    /// The value at or below which @p fraction of all values lie, as
+    /// the highest value equivalent to its bucket.  Returns 0 if
+    /// empty.
+    int64_t Percentile(double fraction) const {
+      if (count == 0) { return 0; }
+      const uint64_t target = std::max<uint64_t>(
+          1, static_cast<uint64_t>(fraction * count + 0.5));
+      uint64_t total = 0;
+      for (size_t i = 0; i < counts.size(); i++) {
+        total += counts[i];
+        if (total >= target) {
+          return std::min(HighestEquivalentValue(i), max);
+        }
+      }
+      return max;
+    }
+
+    /// Make this the difference between @p later and @p earlier,
+    /// which must be from the same histogram.  The maximum is then
+    /// only known to bucket precision.
+    void Difference(const Snapshot& later, const Snapshot& earlier) {
+      count = later.count - earlier.count;
+      max = 0;
+      for (size_t i = 0; i < counts.size(); i++) {
+        counts[i] = later.counts[i] - earlier.counts[i];
+        if (counts[i]) {
+          max = std::min(HighestEquivalentValue(i), later.max);
+        }
+      }
+    }
+  };
+
+  LatencyHistogram() {
+    for (auto& count : counts_) {
+      count.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  /// Count one value.  Negative values are counted as 0.
+  void Record(int64_t value_ns) {
+    const uint64_t value = value_ns < 0 ? 0 : static_cast<uint64_t>(value_ns);
+    Increment(&counts_[BucketIndex(value)], std::memory_order_relaxed);
+    Increment(&count_, std::memory_order_release);
+    if (static_cast<int64_t>(value) > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  void Read(Snapshot* snapshot) const {
+    // The total is read first, so that it never exceeds the sum of
+    // the bucket counts.
+    snapshot->count = count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < kBucketCount; i++) {
+      snapshot->counts[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+    snapshot->max = max_.load(std::memory_order_relaxed);
+  }
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < kSubBucketCount) { return value; }
+    const uint64_t limit = (1ull << kMaxBits) - 1;
+    if (value > limit) { value = limit; }
+
+    const int msb = 63 - __builtin_clzll(value);
+    const int shift = msb - (kSubBucketBits - 1);
+    const uint64_t mantissa = value >> shift;
+    return kSubBucketCount + (shift - 1) * kSubBucketHalf +
+        (mantissa - kSubBucketHalf);
+  }
+
+  static int64_t LowestEquivalentValue(size_t index) {
+    if (index < kSubBucketCount) { return index; }
+    const size_t offset = index - kSubBucketCount;
+    const int shift = offset / kSubBucketHalf + 1;
+    const uint64_t mantissa = offset % kSubBucketHalf + kSubBucketHalf;
+    return static_cast<int64_t>(mantissa << shift);
+  }
+
+  static int64_t HighestEquivalentValue(size_t index) {
+    if (index < kSubBucketCount) { return index; }
+    const int shift = (index - kSubBucketCount) / kSubBucketHalf + 1;
+    return LowestEquivalentValue(index) + (int64_t(1) << shift) - 1;
+  }
+
+ private:
+  // There is a single writer, so a read-modify-write is not required.
+  static void Increment(std::atomic<uint64_t>* value, std::memory_order order) {
+    value->store(value->load(std::memory_order_relaxed) + 1, order);
+  }
+
+  std::atomic<uint64_t> counts_[kBucketCount];
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> max_{0};
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include "motor_log_csv.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "date.h"
+
+using namespace date;
+
+namespace {
+
+const char kMotorLogCsvHeader[] =
+    "Time,ID,Bus,Mode,Velocity,Torque,ControlVelocity,"
+    "VelocityCommand,AmplitudeCommand,PhaseCommand,"
+    "Temperature,Voltage";
+
+}
+
+void WriteMotorLogCsvHeader(std::ostream& out) {
+  out.precision(5);
+  out << std::fixed;
+  out << kMotorLogCsvHeader << "\n";
+}
+
+void WriteMotorLogCsvRow(std::ostream& out, const MotorLogRecord& record) {
+  const std::chrono::system_clock::time_point timestamp{
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::nanoseconds(record.timestamp_ns))};
+
+  out << timestamp << ","
+      << record.id << ","
+      << record.bus << ","
+      << record.mode << ","
+      << record.velocity << ","
+      << record.torque << ","
+      << record.control_velocity << ","
+      << record.velocity_command << ","
+      << record.amplitude_command << ","
+      << record.phase_command << ","
+      << record.temperature << ","
+      << record.voltage << "\n";
+}
+
+namespace {
+
+// Parses "YYYY-MM-DD hh:mm:ss.fffffffff", as written by date.h for a
+// system_clock time point, into nanoseconds since the epoch.
+bool ParseTimestamp(const char* text, const char** end, int64_t* timestamp_ns) {
+  int year = 0;
+  unsigned month = 0, day = 0, hours = 0, minutes = 0, seconds = 0;
+  int consumed = 0;
+  if (std::sscanf(text, "%d-%u-%u %u:%u:%u%n", &year, &month, &day,
+                  &hours, &minutes, &seconds, &consumed) != 6) {
+    return false;
+  }
+  text += consumed;
+
+  int64_t fraction_ns = 0;
+  if (*text == '.') {
+    text++;
+    int64_t scale = 1000000000;
+    for (; *text >= '0' && *text <= '9'; text++) {
+      scale /= 10;
+      fraction_ns += (*text - '0') * scale;
+    }
+  }
+
+  const sys_days days = year_month_day{date::year{year}, date::month{month}, date::day{day}};
+  *timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      days.time_since_epoch() + std::chrono::hours(hours) +
+      std::chrono::minutes(minutes) + std::chrono::seconds(seconds)).count() +
+      fraction_ns;
+  *end = text;
+  return true;
+}
+
+template <typename T>
+bool ParseField(const char* text, const char** end, T* value);
+
+template <>
+bool ParseField(const char* text, const char** end, int32_t* value) {
+  char* field_end = nullptr;
+  *value = static_cast<int32_t>(std::strtol(text, &field_end, 10));
+  *end = field_end;
+  return field_end != text;
+}
+
+template <>
+bool ParseField(const char* text, const char** end, float* value) {
+  char* field_end = nullptr;
+  *value = std::strtof(text, &field_end);
+  *end = field_end;
+  return field_end != text;
+}
+
+// Parses a comma followed by a field.
+template <typename T>
+bool ParseNextField(const char** text, T* value) {
+  if (**text != ',') { return false; }
+  return ParseField(*text + 1, text, value);
+}
+
+}
+
+MotorLogCsvReader::MotorLogCsvReader(std::istream& input) : input_(input) {
+  if (!std::getline(input_, line_)) {
+    throw std::runtime_error("empty motor log");
+  }
+  if (!line_.empty() && line_.back() == '\r') { line_.pop_back(); }
+  if (line_ != kMotorLogCsvHeader) {
+    throw std::runtime_error("not a motor log, unexpected header: " + line_);
+  }
+}
+
+bool MotorLogCsvReader::Next(MotorLogRecord* record) {
+  do {
+    if (!std::getline(input_, line_)) { return false; }
+  } while (line_.empty() || line_ == "\r");
+
+  const char* text = line_.c_str();
+  const bool valid =
+      ParseTimestamp(text, &text, &record->timestamp_ns) &&
+      ParseNextField(&text, &record->id) &&
+      ParseNextField(&text, &record->bus) &&
+      ParseNextField(&text, &record->mode) &&
+      ParseNextField(&text, &record->velocity) &&
+      ParseNextField(&text, &record->torque) &&
+      ParseNextField(&text, &record->control_velocity) &&
+      ParseNextField(&text, &record->velocity_command) &&
+      ParseNextField(&text, &record->amplitude_command) &&
+      ParseNextField(&text, &record->phase_command) &&
+      ParseNextField(&text, &record->temperature) &&
+      ParseNextField(&text, &record->voltage);
+  if (!valid) {
+    throw std::runtime_error("malformed motor log row: " + line_);
+  }
+  return true;
+}
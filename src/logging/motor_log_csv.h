@@ -0,0 +1,34 @@
+#ifndef MOTOR_LOG_CSV_H
+#define MOTOR_LOG_CSV_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include "motor_log_record.h"
+
+/// Writes the header of the CSV motor log, and configures @p out to
+/// format numbers the way the rows expect.
+void WriteMotorLogCsvHeader(std::ostream& out);
+
+/// Writes one row of the CSV motor log.  This is the layout read by
+/// scripts/analyze_thrust_vectoring.py.
+void WriteMotorLogCsvRow(std::ostream& out, const MotorLogRecord& record);
+
+/// Reads a CSV motor log one row at a time.
+class MotorLogCsvReader {
+ public:
+  /// Throws std::runtime_error if the stream does not start with the
+  /// header written by WriteMotorLogCsvHeader.
+  MotorLogCsvReader(std::istream& input);
+
+  /// Returns false at the end of the log.  Throws std::runtime_error
+  /// for a malformed row.
+  bool Next(MotorLogRecord* record);
+
+ private:
+  std::istream& input_;
+  std::string line_;
+};
+
+#endif
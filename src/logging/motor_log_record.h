@@ -0,0 +1,24 @@
+#ifndef MOTOR_LOG_RECORD_H
+#define MOTOR_LOG_RECORD_H
+
+#include <cstdint>
+
+/// One row of the motor log, as produced by the control loop for each
+/// servo reply.  This is plain old data so that it can be copied into
+/// the ring buffer without allocation or formatting.
+struct MotorLogRecord {
+  int64_t timestamp_ns = 0;  // system_clock, nanoseconds since epoch
+  int32_t id = 0;
+  int32_t bus = 0;
+  int32_t mode = 0;
+  float velocity = 0.0f;
+  float torque = 0.0f;
+  float control_velocity = 0.0f;
+  float velocity_command = 0.0f;
+  float amplitude_command = 0.0f;
+  float phase_command = 0.0f;
+  float temperature = 0.0f;
+  float voltage = 0.0f;
+};
+
+#endif
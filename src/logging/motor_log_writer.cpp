@@ -0,0 +1,144 @@
+#include "motor_log_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+#include "flight_log_format.h"
+#include "motor_log_csv.h"
+#include "../motor_control/realtime.h"
+
+namespace {
+
+/// Write all of @p size bytes, retrying on short writes.  Returns
+/// false on error.
+bool WriteAll(int fd, const uint8_t* data, size_t size) {
+  while (size) {
+    const ssize_t r = ::write(fd, data, size);
+    if (r < 0) {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+    data += r;
+    size -= r;
+  }
+  return true;
+}
+
+}
+
+MotorLogWriter::MotorLogWriter(const Options& options)
+    : options_(options),
+      queue_(options.capacity),
+      thread_(std::bind(&MotorLogWriter::CHILD_Run, this)) {}
+
+MotorLogWriter::~MotorLogWriter() {
+  done_.store(true, std::memory_order_release);
+  thread_.join();
+
+  if (dropped()) {
+    std::cerr << "Motor log dropped " << dropped() << " records\n";
+  }
+}
+
+bool MotorLogWriter::Push(const MotorLogRecord& record) {
+  if (!queue_.TryPush(record)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void MotorLogWriter::CHILD_Run() {
+  mjbots::moteus::ConfigureCpuAffinity(options_.cpu);
+
+  switch (options_.format) {
+    case Format::kBinary: {
+      CHILD_WriteBinary();
+      break;
+    }
+    case Format::kCsv: {
+      CHILD_WriteCsv();
+      break;
+    }
+  }
+}
+
+void MotorLogWriter::CHILD_WriteCsv() {
+  std::ofstream output_file(options_.filename);
+  if (!output_file) {
+    std::cerr << "Could not open motor log " << options_.filename << "\n";
+  }
+  WriteMotorLogCsvHeader(output_file);
+
+  MotorLogRecord record;
+  while (true) {
+    // Read done_ before draining, so that everything pushed before
+    // the destructor ran is written out on the final pass.
+    const bool done = done_.load(std::memory_order_acquire);
+    while (queue_.TryPop(&record)) {
+      WriteMotorLogCsvRow(output_file, record);
+    }
+    if (done) { break; }
+
+    std::this_thread::sleep_for(options_.poll_period);
+  }
+}
+
+void MotorLogWriter::CHILD_WriteBinary() {
+  const int fd = ::open(options_.filename.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "Could not open motor log " << options_.filename
+              << " : " << ::strerror(errno) << "\n";
+  }
+
+  bool write_ok = true;
+  auto write = [&](const std::vector<uint8_t>& data) {
+    if (fd >= 0 && write_ok && !WriteAll(fd, data.data(), data.size())) {
+      std::cerr << "Error writing motor log : " << ::strerror(errno) << "\n";
+      write_ok = false;
+    }
+  };
+
+  write(flight_log::Encoder::FileHeader());
+
+  // Blocks are streamed out as soon as they fill up, so memory use
+  // stays bounded no matter how long the flight is.
+  flight_log::Encoder encoder;
+  auto last_flush = std::chrono::steady_clock::now();
+  auto flush = [&]() {
+    write(encoder.block());
+    encoder.Reset();
+    last_flush = std::chrono::steady_clock::now();
+  };
+
+  MotorLogRecord record;
+  while (true) {
+    const bool done = done_.load(std::memory_order_acquire);
+    while (queue_.TryPop(&record)) {
+      if (!encoder.Append(record)) {
+        flush();
+        encoder.Append(record);
+      }
+    }
+    if (!encoder.empty() &&
+        (done ||
+         std::chrono::steady_clock::now() - last_flush >= options_.flush_period)) {
+      flush();
+    }
+    if (done) { break; }
+
+    std::this_thread::sleep_for(options_.poll_period);
+  }
+
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef MOTOR_LOG_WRITER_H
+#define MOTOR_LOG_WRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "motor_log_record.h"
+#include "spsc_ring_buffer.h"
+
+/// Writes MotorLogRecords to disk from a background thread.
+///
+/// Push() is intended to be called from the realtime control loop.  It
+/// only copies the record into a preallocated ring buffer.  All
+/// formatting and file IO takes place on the writer thread, which
+/// should be pinned to a core not used by the control or CAN threads.
+class MotorLogWriter {
+ public:
+  enum class Format {
+    // The compact block based format described in flight_log_format.h.
+    // Convert it to CSV with the log_convert tool.
+    kBinary,
+    // The CSV layout read by the analysis scripts.
+    kCsv,
+  };
+
+  struct Options {
+    std::string filename;
+    Format format = Format::kBinary;
+
+    // Number of records which can be queued before Push() starts
+    // dropping them.  Must be a power of two.
+    size_t capacity = 1 << 14;
+
+    // The writer thread is pinned to this core if non-negative.  It
+    // does not run with realtime priority.
+    int cpu = -1;
+
+    // How long the writer thread sleeps when it finds the queue empty.
+    std::chrono::milliseconds poll_period{10};
+
+    // In the binary format, a partially filled block is written out
+    // after this long.  This bounds how much data a crash can lose.
+    std::chrono::milliseconds flush_period{500};
+  };
+
+  MotorLogWriter(const Options& options);
+  ~MotorLogWriter();
+
+  MotorLogWriter(const MotorLogWriter&) = delete;
+  MotorLogWriter& operator=(const MotorLogWriter&) = delete;
+
+  /// Queue a record for writing.  Safe to call from one realtime
+  /// thread, never blocks or allocates.  Returns false if the record
+  /// had to be dropped because the queue was full.
+  bool Push(const MotorLogRecord& record);
+
+  /// Number of records dropped because the writer fell behind.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  void CHILD_Run();
+  void CHILD_WriteCsv();
+  void CHILD_WriteBinary();
+
+  const Options options_;
+  SpscRingBuffer<MotorLogRecord> queue_;
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<bool> done_{false};
+  std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+/// A fixed capacity, lock-free queue for exactly one producer thread
+/// and one consumer thread.
+///
+/// All storage is allocated in the constructor, so pushing and
+/// popping never allocate and never enter the kernel.  This makes it
+/// suitable for handing data off from a realtime thread.  T should be
+/// trivially copyable.
+template <typename T>
+class SpscRingBuffer {
+ public:
+  /// @p capacity must be a power of two.
+  explicit SpscRingBuffer(size_t capacity)
+      : buffer_(capacity), mask_(capacity - 1) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+      throw std::invalid_argument("SpscRingBuffer capacity must be a power of two");
+    }
+  }
+
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+  /// Only call from the producer thread.  Returns false, without
+  /// blocking, if the queue is full.
+  bool TryPush(const T& value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_cache_ > mask_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head - tail_cache_ > mask_) { return false; }
+    }
+    buffer_[head & mask_] = value;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Only call from the consumer thread.  Returns false if the queue
+  /// is empty.
+  bool TryPop(T* value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_cache_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail == head_cache_) { return false; }
+    }
+    *value = buffer_[tail & mask_];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /// Approximate number of queued items, usable from either thread.
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+        tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::vector<T> buffer_;
+  const size_t mask_;
+
+  // The producer and consumer indices are padded onto separate cache
+  // lines so that the two threads do not false share.  Each side keeps
+  // a cached copy of the other's index to avoid touching its line on
+  // every operation.  Padding is used rather than alignas, as over
+  // aligned new is not available before C++17.
+  static constexpr size_t kCacheLine = 64;
+
+  char pad0_[kCacheLine];
+  std::atomic<size_t> head_{0};
+  size_t tail_cache_ = 0;
+  char pad1_[kCacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  std::atomic<size_t> tail_{0};
+  size_t head_cache_ = 0;
+  char pad2_[kCacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
@@ -1,5 +1,7 @@
 #include <sys/mman.h>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "motor_control/moteus_motor_control.h"
 #include "controller/calibration_controller.h"
@@ -57,14 +59,47 @@ int main(int argc, char **argv) {
     }
 	float step_length = 1.5;
 
+	// End each step once the rotor has settled, between min_step_length
+	// and step_length, instead of after step_length.
+	bool settle_steps = true;
+	CalibrationController::SettlingOptions settling;
+	settling.min_step_length = 0.5;
+	settling.max_step_length = step_length;
+
 	float experiment_length_seconds = step_length * velocities.size();
-	std::cout << "Experiment length: " << experiment_length_seconds << std::endl;
+	std::cout << "Experiment length: " << (settle_steps ? "at most " : "")
+			  << experiment_length_seconds << std::endl;
 
 	// Lock memory for the whole process.
 	LockMemory();
-	CalibrationController controller(velocities, amplitudes, phases, experiment_length_seconds);
+	std::unique_ptr<CalibrationController> controller;
+	if (settle_steps) {
+		controller.reset(new CalibrationController(velocities, amplitudes, phases, settling));
+	} else {
+		controller.reset(new CalibrationController(velocities, amplitudes, phases, experiment_length_seconds));
+	}
 	MoteusMotorControl motor_controller(main_cpu, can_cpu, period_s,
                     					servo_bus_map, "logs/test.csv");
-	motor_controller.run(&controller);
+	motor_controller.run(controller.get());
+
+	// The boundaries of every step, next to the motor log, and on its
+	// clock.
+	if (motor_controller.log_file().empty()) {
+		return 0;
+	}
+	const std::string steps_filename =
+		motor_controller.log_file().substr(0, motor_controller.log_file().rfind(".tvlog")) + "-steps.csv";
+	std::ofstream steps_file(steps_filename);
+	if (!steps_file) {
+		std::cerr << "Could not open " << steps_filename << std::endl;
+		return 1;
+	}
+	controller->write_steps(steps_file, motor_controller.system_offset_ns());
+	steps_file.close();
+	if (!steps_file) {
+		std::cerr << "Could not write " << steps_filename << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << controller->steps().size() << " steps to " << steps_filename << std::endl;
 	return 0;
 }
@@ -0,0 +1,131 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "analysis/calibration_analysis.h"
+#include "logging/flight_log_format.h"
+#include "logging/motor_log_csv.h"
+
+// Fits a calibration model from one or more calibration runs, each a
+// motor log (.tvlog or .csv) and the force/torque log recorded with it.
+// This replaces the fit in scripts/fit_and_plot_combined_datasets.py.
+
+void PrintUsage(const char *name) {
+	std::cerr << "Usage: " << name << " [options] <output.cal> <motor_log> <force_log>"
+			  << " [<motor_log> <force_log> ...]\n"
+			  << "  --startup-time <s>    ignore the start of the motor log (default 1.0)\n"
+			  << "  --transient <s>       settling time after a command change (default 0.2)\n"
+			  << "  --inverted            the rotor is mounted inverted\n"
+			  << "  --steps <steps.csv>   also write the mean of every step" << std::endl;
+}
+
+bool EndsWith(const std::string &text, const std::string &suffix) {
+	return text.size() >= suffix.size() &&
+		   text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+	StepOptions step_options;
+	bool inverted = false;
+	std::string steps_filename;
+	std::vector<std::string> arguments;
+	for (int i = 1; i < argc; i++) {
+		const std::string argument = argv[i];
+		const bool has_value = i + 1 < argc;
+		if (argument == "--startup-time" && has_value) {
+			step_options.startup_time = std::atof(argv[++i]);
+		} else if (argument == "--transient" && has_value) {
+			step_options.transient_duration = std::atof(argv[++i]);
+		} else if (argument == "--inverted") {
+			inverted = true;
+		} else if (argument == "--steps" && has_value) {
+			steps_filename = argv[++i];
+		} else if (argument.compare(0, 2, "--") == 0) {
+			PrintUsage(argv[0]);
+			return 1;
+		} else {
+			arguments.push_back(argument);
+		}
+	}
+	if (arguments.size() < 3 || arguments.size() % 2 != 1) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	const std::string output_filename = arguments[0];
+
+	std::ofstream steps_file;
+	if (!steps_filename.empty()) {
+		steps_file.open(steps_filename);
+		if (!steps_file) {
+			std::cerr << "Could not open " << steps_filename << std::endl;
+			return 1;
+		}
+		steps_file << "VelocityCommand,AmplitudeCommand,PhaseCommand,StartTime,EndTime,Samples,"
+				   << "ForceX,ForceY,ForceZ,TorqueX,TorqueY,TorqueZ,Elevation,Azimuth\n";
+	}
+
+	CalibrationFit fit{CalibrationFit::Options()};
+	for (size_t i = 1; i < arguments.size(); i += 2) {
+		const std::string &motor_filename = arguments[i];
+		const std::string &force_filename = arguments[i + 1];
+		try {
+			std::ifstream motor_file(motor_filename, std::ios::binary);
+			if (!motor_file) {
+				throw std::runtime_error("could not open " + motor_filename);
+			}
+			std::ifstream force_file(force_filename);
+			if (!force_file) {
+				throw std::runtime_error("could not open " + force_filename);
+			}
+
+			MotorLogSource motor_log;
+			std::unique_ptr<flight_log::Reader> binary_reader;
+			std::unique_ptr<MotorLogCsvReader> csv_reader;
+			if (EndsWith(motor_filename, ".tvlog")) {
+				binary_reader.reset(new flight_log::Reader(motor_file));
+				motor_log = [&](MotorLogRecord *record) { return binary_reader->Next(record); };
+			} else {
+				csv_reader.reset(new MotorLogCsvReader(motor_file));
+				motor_log = [&](MotorLogRecord *record) { return csv_reader->Next(record); };
+			}
+			ForceLogReader force_reader(force_file, inverted);
+
+			const int steps = ProcessSteps(
+				step_options, motor_log,
+				[&](ForceSample *sample) { return force_reader.Next(sample); },
+				[&](const StepResult &step) {
+					fit.Add(step);
+					if (steps_file.is_open()) {
+						steps_file << step.velocity_command << "," << step.amplitude_command << ","
+								   << step.phase_command << "," << step.start_time << ","
+								   << step.end_time << "," << step.sample_count << ","
+								   << step.force[0] << "," << step.force[1] << "," << step.force[2] << ","
+								   << step.torque[0] << "," << step.torque[1] << "," << step.torque[2] << ","
+								   << step.elevation_deg << "," << step.azimuth_deg << "\n";
+					}
+				});
+			std::cout << motor_filename << ": " << steps << " steps" << std::endl;
+		} catch (const std::exception &e) {
+			std::cerr << motor_filename << ", " << force_filename << ": " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	try {
+		const CalibrationModel model = fit.Solve(CalibrationModel());
+		save_calibration_model(output_filename, model);
+		std::cout << "thrust [N] = " << model.thrust_coefficient << " * velocity^2\n"
+				  << "elevation [deg] = " << model.elevation_coefficient << " * amplitude\n"
+				  << "phase offset [rad] = " << model.phase_offset[0] << " + "
+				  << model.phase_offset[1] << " * velocity + "
+				  << model.phase_offset[2] << " * velocity^2\n"
+				  << "Wrote " << output_filename << std::endl;
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
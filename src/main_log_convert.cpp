@@ -0,0 +1,56 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "logging/flight_log_format.h"
+#include "logging/motor_log_csv.h"
+
+// Converts a binary motor log written by MoteusMotorControl into the
+// CSV layout used by the analysis scripts.
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <log.tvlog> [output.csv]" << std::endl;
+		return 1;
+	}
+
+	const std::string input_filename = argv[1];
+	std::string output_filename;
+	if (argc > 2) {
+		output_filename = argv[2];
+	} else {
+		const auto extension = input_filename.rfind(".tvlog");
+		output_filename = input_filename.substr(0, extension) + ".csv";
+	}
+
+	std::ifstream input_file(input_filename, std::ios::binary);
+	if (!input_file) {
+		std::cerr << "Could not open " << input_filename << std::endl;
+		return 1;
+	}
+	std::ofstream output_file(output_filename);
+	if (!output_file) {
+		std::cerr << "Could not open " << output_filename << std::endl;
+		return 1;
+	}
+
+	try {
+		flight_log::Reader reader(input_file);
+		WriteMotorLogCsvHeader(output_file);
+
+		size_t count = 0;
+		MotorLogRecord record;
+		while (reader.Next(&record)) {
+			WriteMotorLogCsvRow(output_file, record);
+			count++;
+		}
+
+		std::cout << "Wrote " << count << " records to " << output_filename << std::endl;
+		if (reader.truncated()) {
+			std::cerr << "Warning: " << input_filename
+					  << " ends with a partial block, which was skipped" << std::endl;
+		}
+	} catch (const std::exception &e) {
+		std::cerr << input_filename << ": " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "analysis/online_calibration.h"
+#include "analysis/replay.h"
+#include "controller/calibration_controller.h"
+#include "controller/thrust_vector_controller.h"
+#include "controller/thrust_vector_sequence_generator.h"
+#include "logging/flight_log_format.h"
+#include "logging/motor_log_csv.h"
+
+// Runs a controller against a recorded motor log (.tvlog or .csv) and
+// PWM log in virtual time, and writes the commands it produces as a
+// CSV motor log, with the commanded mode in the Mode column.
+
+void PrintUsage(const char *name) {
+	std::cerr << "Usage: " << name << " [options] <output.csv>\n"
+			  << "  --motor-log <log>       replies, a .tvlog or .csv motor log\n"
+			  << "  --pwm-log <log.csv>     pulse widths, a PWM input log\n"
+			  << "  --controller <name>     thrust_vector (default) or calibration\n"
+			  << "  --settle                end calibration steps once the logged replies settle\n"
+			  << "  --force-log <log.csv>   fit the calibration model online from a synchronized\n"
+			  << "                          force/torque log, see calibration_analysis\n"
+			  << "  --inverted              the force/torque log is of an inverted rotor\n"
+			  << "  --fit <file>            write the online fit, on top of --calibration\n"
+			  << "  --calibration <file>    calibration model of the thrust vector controller\n"
+			  << "  --pins <p,p,p,...>      thrust, elevation and azimuth pin of each rotor\n"
+			  << "                          (default 2,4,6,3,27,25)\n"
+			  << "  --pwm-pins <p,...>      the pin of each PWM log column (default 2,3,4,27,6,25)\n"
+			  << "  --period <s>            control period (default 0.001)\n"
+			  << "  --pwm-offset <s>        PWM log time offset from the motor log (default 0)\n"
+			  << "  --duration <s>          replay length (default the end of the logs)" << std::endl;
+}
+
+bool EndsWith(const std::string &text, const std::string &suffix) {
+	return text.size() >= suffix.size() &&
+		   text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::vector<unsigned int> ParseList(const std::string &text) {
+	std::vector<unsigned int> values;
+	std::istringstream stream(text);
+	std::string value;
+	while (std::getline(stream, value, ',')) {
+		values.push_back(std::stoul(value));
+	}
+	return values;
+}
+
+int main(int argc, char **argv) {
+	ReplayOptions options;
+	std::string motor_filename;
+	std::string pwm_filename;
+	std::string controller_name = "thrust_vector";
+	std::string calibration_file;
+	bool settle_steps = false;
+	std::string force_filename;
+	bool inverted = false;
+	std::string fit_filename;
+	std::vector<unsigned int> pins = {2, 4, 6, 3, 27, 25};
+	std::vector<unsigned int> pwm_pins = {2, 3, 4, 27, 6, 25};
+	std::vector<std::string> arguments;
+	try {
+		for (int i = 1; i < argc; i++) {
+			const std::string argument = argv[i];
+			const bool has_value = i + 1 < argc;
+			if (argument == "--motor-log" && has_value) {
+				motor_filename = argv[++i];
+			} else if (argument == "--pwm-log" && has_value) {
+				pwm_filename = argv[++i];
+			} else if (argument == "--controller" && has_value) {
+				controller_name = argv[++i];
+			} else if (argument == "--settle") {
+				settle_steps = true;
+			} else if (argument == "--force-log" && has_value) {
+				force_filename = argv[++i];
+			} else if (argument == "--inverted") {
+				inverted = true;
+			} else if (argument == "--fit" && has_value) {
+				fit_filename = argv[++i];
+			} else if (argument == "--calibration" && has_value) {
+				calibration_file = argv[++i];
+			} else if (argument == "--pins" && has_value) {
+				pins = ParseList(argv[++i]);
+			} else if (argument == "--pwm-pins" && has_value) {
+				pwm_pins = ParseList(argv[++i]);
+			} else if (argument == "--period" && has_value) {
+				options.period_s = std::atof(argv[++i]);
+			} else if (argument == "--pwm-offset" && has_value) {
+				options.pwm_offset_s = std::atof(argv[++i]);
+			} else if (argument == "--duration" && has_value) {
+				options.duration_s = std::atof(argv[++i]);
+			} else if (argument.compare(0, 2, "--") == 0) {
+				PrintUsage(argv[0]);
+				return 1;
+			} else {
+				arguments.push_back(argument);
+			}
+		}
+	} catch (const std::exception &) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	if (arguments.size() != 1 || pins.empty() || pins.size() % 3 != 0 ||
+		(!force_filename.empty() && controller_name != "calibration") ||
+		(!fit_filename.empty() && force_filename.empty())) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	const std::string output_filename = arguments[0];
+
+	try {
+		ReplayPulseWidths pulse_widths(pwm_pins);
+		std::unique_ptr<Controller> controller;
+		std::vector<std::pair<int, int>> servo_bus_map;
+		std::ifstream force_file;
+		std::unique_ptr<ForceLogReader> force_reader;
+		std::unique_ptr<OnlineCalibration> online;
+		if (controller_name == "thrust_vector") {
+			// The rotors of main_thrust_vector_controller.cpp.
+			std::vector<RotorConfig> rotors(pins.size() / 3);
+			for (size_t i = 0; i < rotors.size(); i++) {
+				rotors[i].servo_id = i + 1;
+				rotors[i].bus = 3;
+				rotors[i].thrust_channel = pins[3 * i];
+				rotors[i].elevation_channel = pins[3 * i + 1];
+				rotors[i].azimuth_channel = pins[3 * i + 2];
+				rotors[i].calibration_file = calibration_file;
+				rotors[i].mirror_azimuth = i % 2 == 1;
+			}
+			ThrustVectorController *thrust_vector = new ThrustVectorController(rotors, &pulse_widths);
+			controller.reset(thrust_vector);
+			servo_bus_map = thrust_vector->servo_bus_map();
+		} else if (controller_name == "calibration") {
+			// The sequence of main_calibration.cpp.
+			std::vector<float> velocities;
+			std::vector<float> amplitudes;
+			std::vector<float> phases;
+			generateThrustVectorSequence(50.0, 80.0, 5.0, 0.0, 0.35, 0.08, 0.0, 0.0, 1.0, true,
+										 velocities, amplitudes, phases);
+			const float step_length = 1.5;
+			CalibrationController *calibration;
+			if (settle_steps) {
+				CalibrationController::SettlingOptions settling;
+				settling.max_step_length = step_length;
+				calibration = new CalibrationController(velocities, amplitudes, phases, settling);
+			} else {
+				calibration = new CalibrationController(velocities, amplitudes, phases,
+														step_length * velocities.size());
+			}
+			controller.reset(calibration);
+			servo_bus_map = {{3, 3}};
+
+			if (!force_filename.empty()) {
+				force_file.open(force_filename);
+				if (!force_file) {
+					throw std::runtime_error("could not open " + force_filename);
+				}
+				force_reader.reset(new ForceLogReader(force_file, inverted));
+				online.reset(new OnlineCalibration(
+					calibration, OnlineCalibration::Options(),
+					[&](ForceSample *sample) { return force_reader->Next(sample); },
+					OnlineCalibration::PublishCallback()));
+			}
+		} else {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		MotorLogSource motor_log;
+		std::ifstream motor_file;
+		std::unique_ptr<flight_log::Reader> binary_reader;
+		std::unique_ptr<MotorLogCsvReader> csv_reader;
+		if (!motor_filename.empty()) {
+			motor_file.open(motor_filename, std::ios::binary);
+			if (!motor_file) {
+				throw std::runtime_error("could not open " + motor_filename);
+			}
+			if (EndsWith(motor_filename, ".tvlog")) {
+				binary_reader.reset(new flight_log::Reader(motor_file));
+				motor_log = [&](MotorLogRecord *record) { return binary_reader->Next(record); };
+			} else {
+				csv_reader.reset(new MotorLogCsvReader(motor_file));
+				motor_log = [&](MotorLogRecord *record) { return csv_reader->Next(record); };
+			}
+		}
+
+		PwmLogSource pwm_log;
+		std::ifstream pwm_file;
+		std::unique_ptr<PwmLogReader> pwm_reader;
+		if (!pwm_filename.empty()) {
+			pwm_file.open(pwm_filename);
+			if (!pwm_file) {
+				throw std::runtime_error("could not open " + pwm_filename);
+			}
+			pwm_reader.reset(new PwmLogReader(pwm_file));
+			pwm_log = [&](PwmSample *sample) { return pwm_reader->Next(sample); };
+		}
+
+		std::ofstream output_file(output_filename);
+		if (!output_file) {
+			throw std::runtime_error("could not open " + output_filename);
+		}
+		WriteMotorLogCsvHeader(output_file);
+
+		const ReplayStats stats = ReplayController(
+			online ? online.get() : controller.get(), servo_bus_map, options, motor_log, pwm_log, &pulse_widths,
+			[&](const MotorLogRecord &record) { WriteMotorLogCsvRow(output_file, record); });
+
+		std::cout << "Replayed " << stats.cycles << " cycles, "
+				  << stats.cycles * options.period_s << " s, from "
+				  << stats.motor_records << " motor log records and "
+				  << stats.pwm_samples << " PWM samples\n"
+				  << "Controller mean " << stats.controller_ns / std::max<uint64_t>(stats.cycles, 1)
+				  << " ns, p99 " << stats.controller_p99_ns
+				  << " ns, max " << stats.controller_max_ns << " ns\n"
+				  << "Wrote " << output_filename << std::endl;
+
+		if (online) {
+			const CalibrationEstimate estimate = online->estimate();
+			std::cout << "Online fit of " << estimate.step_count << " steps, 95% intervals\n"
+					  << "thrust_coefficient = " << estimate.thrust_coefficient
+					  << " +- " << estimate.thrust_interval << "\n"
+					  << "elevation_coefficient = " << estimate.elevation_coefficient
+					  << " +- " << estimate.elevation_interval << "\n"
+					  << "phase_offset =";
+			for (int i = 0; i < 3; i++) {
+				std::cout << " " << estimate.phase_offset[i] << " +- " << estimate.phase_interval[i];
+			}
+			std::cout << std::endl;
+			if (!fit_filename.empty()) {
+				const CalibrationModel base = calibration_file.empty()
+					? CalibrationModel() : load_calibration_model(calibration_file);
+				save_calibration_model(fit_filename, online->Apply(base));
+				std::cout << "Wrote " << fit_filename << std::endl;
+			}
+		}
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "setpoint/shared_memory_setpoints.h"
+
+// Stands in for a flight controller bridge: publishes fixed pulse
+// widths into a setpoint segment at a fixed rate.
+//
+// Usage: setpoint_writer [name] [rate_hz] [seconds] [pulse width ...]
+//
+// Channel i gets the i-th pulse width, all channels are 1500 us
+// without any. The writer runs until killed with 0 seconds.
+int main(int argc, char **argv) {
+	std::string name = "/thrust_vector_setpoints";
+	float rate_hz = 1000;
+	float seconds = 0;
+	if (argc > 1)
+	{
+		name = argv[1];
+	}
+	if (argc > 2)
+	{
+		rate_hz = std::stof(argv[2]);
+	}
+	if (argc > 3)
+	{
+		seconds = std::stof(argv[3]);
+	}
+	std::vector<float> values;
+	for (int i = 4; i < argc; i++)
+	{
+		values.push_back(std::stof(argv[i]));
+	}
+	if (values.empty())
+	{
+		values.assign(shared_setpoints::kChannelCount, 1500);
+	}
+
+	SharedMemorySetpointWriter writer(name);
+	std::cout << "Writing " << values.size() << " channels to " << name
+			  << " at " << rate_hz << " Hz" << std::endl;
+
+	const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(1.0 / rate_hz));
+	const auto start = std::chrono::steady_clock::now();
+	auto next = start;
+	while (seconds <= 0 || std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds))
+	{
+		writer.write(values.data(), values.size());
+		next += period;
+		std::this_thread::sleep_until(next);
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "motor_control/moteus_motor_control.h"
+#include "motor_control/simulated_transport.h"
+#include "controller/calibration_controller.h"
+
+// Runs another controller, and records when each cycle happened.
+class TimingController : public Controller
+{
+public:
+	TimingController(Controller *controller, size_t max_cycles)
+		: controller_(controller)
+	{
+		cycle_times_.reserve(max_cycles);
+	}
+
+	void initialize(std::vector<MoteusInterface::ServoCommand> *commands)
+	{
+		controller_->initialize(commands);
+	}
+
+	bool run(const ControlTime &time,
+			 const std::vector<MoteusInterface::ServoReply> &status,
+			 std::vector<MoteusInterface::ServoCommand> *output)
+	{
+		if (cycle_times_.size() < cycle_times_.capacity())
+		{
+			cycle_times_.push_back(time.now);
+		}
+		return controller_->run(time, status, output);
+	}
+
+	const moteus::FrameCodec *frame_codec() const
+	{
+		return controller_->frame_codec();
+	}
+
+	void report(float period_s) const
+	{
+		if (cycle_times_.size() < 2)
+		{
+			std::cout << "Not enough cycles to report" << std::endl;
+			return;
+		}
+		std::vector<double> periods_us;
+		for (size_t i = 1; i < cycle_times_.size(); i++)
+		{
+			periods_us.push_back(std::chrono::duration<double, std::micro>(
+				cycle_times_[i] - cycle_times_[i - 1]).count());
+		}
+		double sum = 0.0;
+		for (const auto period : periods_us)
+		{
+			sum += period;
+		}
+		std::sort(periods_us.begin(), periods_us.end());
+		const auto percentile = [&](double p) {
+			return periods_us[static_cast<size_t>(p * (periods_us.size() - 1))];
+		};
+		std::cout << "Cycles: " << cycle_times_.size()
+				  << ", target period: " << period_s * 1e6 << " us" << std::endl;
+		std::cout << "Period mean: " << sum / periods_us.size()
+				  << " us, p50: " << percentile(0.5)
+				  << " us, p99: " << percentile(0.99)
+				  << " us, max: " << periods_us.back() << " us" << std::endl;
+	}
+
+private:
+	Controller *controller_;
+	std::vector<std::chrono::steady_clock::time_point> cycle_times_;
+};
+
+int main(int argc, char **argv) {
+	// The simulation does not need any particular CPU, so nothing is
+	// pinned and no realtime priority is requested.
+	int main_cpu = -1;
+	int can_cpu = -1;
+	float period_s = 0.0003;
+	std::vector<std::pair<int, int>> servo_bus_map = {{3,3}};
+	float experiment_length_seconds = 2.0;
+	if (argc > 1)
+	{
+		experiment_length_seconds = std::stof(argv[1]);
+	}
+	// Pass "pipelined" to wait for fresh replies before each
+	// controller run.
+	MotorControlLoopOptions loop_options;
+	if (argc > 2)
+	{
+		loop_options.pipelined = std::string(argv[2]) == "pipelined";
+	}
+
+	std::vector<float> velocities = {50.0, 60.0, 70.0, 80.0};
+	std::vector<float> amplitudes = {0.0, 0.1, 0.2, 0.3};
+	std::vector<float> phases = {0.0, 0.0, 0.0, 0.0};
+	float startup_sequence_length = 0.5;
+
+	CalibrationController calibration(velocities, amplitudes, phases,
+									  experiment_length_seconds, startup_sequence_length);
+	const size_t max_cycles = static_cast<size_t>(
+		(experiment_length_seconds + startup_sequence_length) / period_s * 2) + 100;
+	TimingController controller(&calibration, max_cycles);
+
+	MoteusMotorControl motor_controller(
+		main_cpu, can_cpu, period_s, servo_bus_map, "", -1,
+		[]() {
+			return std::unique_ptr<moteus::CanTransport>(
+				new moteus::SimulatedTransport());
+		}, {}, loop_options);
+	motor_controller.run(&controller);
+	controller.report(period_s);
+	return 0;
+}
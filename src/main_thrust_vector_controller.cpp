@@ -1,8 +1,11 @@
 #include <sys/mman.h>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "motor_control/moteus_motor_control.h"
-#include "controller/pwm_input_controller.h"
+#include "controller/thrust_vector_controller.h"
+#include "pwm/pwm_inputs.h"
+#include "setpoint/shared_memory_setpoints.h"
 #include "controller/thrust_vector_sequence_generator.h"
 
 void LockMemory()
@@ -24,24 +27,64 @@ int main(int argc, char **argv) {
 	int main_cpu = 3;
 	int can_cpu = 2;
 	float period_s = 0.001;
-	std::vector<std::pair<int, int>> servo_bus_map = {{1,3},{2,3}};
-
-	
-	int pin_motor1_thrust = 2;
-	int pin_motor2_thrust = 3;
-	int pin_motor1_elevation = 4;
-	int pin_motor2_elevation = 27;
-	int pin_motor1_azimuth = 6;
-	int pin_motor2_azimuth = 25;
-
-	PWMInputController controller(pin_motor1_thrust, pin_motor2_thrust, pin_motor1_elevation, 
-								  pin_motor2_elevation, pin_motor1_azimuth, pin_motor2_azimuth/*,
-								  "logs/pwm_data/test_pwm_controller.csv"*/);
+
+	// Optional calibration file, see calibration_table.h. The default
+	// model is used without one.
+	std::string calibration_file = argc > 1 ? argv[1] : "";
+
+	// Each rotor has its servo, input pins and calibration. A rotor
+	// with bus 0 is put on the least loaded of CAN 1-4.
+	std::vector<RotorConfig> rotors(2);
+	rotors[0].servo_id = 1;
+	rotors[0].bus = 3;
+	rotors[0].thrust_channel = 2;
+	rotors[0].elevation_channel = 4;
+	rotors[0].azimuth_channel = 6;
+	rotors[0].calibration_file = calibration_file;
+	rotors[1].servo_id = 2;
+	rotors[1].bus = 3;
+	rotors[1].thrust_channel = 3;
+	rotors[1].elevation_channel = 27;
+	rotors[1].azimuth_channel = 25;
+	rotors[1].calibration_file = calibration_file;
+	// The rotation frames of the two rotors are opposite.
+	rotors[1].mirror_azimuth = true;
+
+	// With a shared memory segment name as the second argument, the
+	// setpoints are read from it instead of the PWM inputs, rotor i
+	// from channels 3i, 3i + 1 and 3i + 2.
+	std::unique_ptr<PulseWidthSource> inputs;
+	if (argc > 2)
+	{
+		for (size_t i = 0; i < rotors.size(); i++)
+		{
+			rotors[i].thrust_channel = 3 * i;
+			rotors[i].elevation_channel = 3 * i + 1;
+			rotors[i].azimuth_channel = 3 * i + 2;
+		}
+		inputs.reset(new SharedMemorySetpoints(argv[2]));
+	}
+	else
+	{
+		std::vector<unsigned int> pins;
+		for (const auto& rotor : rotors) {
+			pins.push_back(rotor.thrust_channel);
+			pins.push_back(rotor.elevation_channel);
+			pins.push_back(rotor.azimuth_channel);
+		}
+		// pigpio runs on the main core, the pi3hat's auxiliary
+		// functions are not used.
+		inputs.reset(new PWMInputs(pins, main_cpu));
+	}
+	ThrustVectorController controller(rotors, inputs.get());
+	for (const auto& servo : controller.servo_bus_map()) {
+		std::cout << "Servo " << servo.first << " on bus " << servo.second << std::endl;
+	}
+
 	MoteusMotorControl motor_controller(main_cpu, can_cpu, period_s,
-                    					servo_bus_map, "logs/flight");
+                    					controller.servo_bus_map(), "logs/flight");
 	// Lock memory for the whole process.
 	LockMemory();
 	motor_controller.run(&controller);
 	return 0;
 }
-
@@ -0,0 +1,50 @@
+// Copyright 2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../pi3hat/pi3hat.h"
+
+namespace mjbots {
+namespace moteus {
+
+/// Exchanges one cycle of CAN frames with the servos.
+///
+/// This is the seam between Pi3HatMoteusInterface and the hardware,
+/// so that the control loop can also be run against a simulation.
+/// The semantics of Cycle() are those of pi3hat::Pi3Hat::Cycle().
+class CanTransport {
+ public:
+  virtual ~CanTransport() {}
+
+  virtual pi3hat::Pi3Hat::Output Cycle(const pi3hat::Pi3Hat::Input& input) = 0;
+};
+
+/// The real transport, using the pi3hat.
+class Pi3HatTransport : public CanTransport {
+ public:
+  Pi3HatTransport(const pi3hat::Pi3Hat::Configuration& configuration =
+                  pi3hat::Pi3Hat::Configuration())
+      : pi3hat_(configuration) {}
+
+  pi3hat::Pi3Hat::Output Cycle(const pi3hat::Pi3Hat::Input& input) override {
+    return pi3hat_.Cycle(input);
+  }
+
+ private:
+  pi3hat::Pi3Hat pi3hat_;
+};
+
+}
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MOTEUS_BATCH_ENCODER_NEON 1
+#endif
+
+#include "moteus_protocol.h"
+
+namespace mjbots {
+namespace moteus {
+
+/// The PositionCommand fields of many servos, one array per field.
+struct PositionCommandArrays {
+  enum Field {
+    kPosition,
+    kVelocity,
+    kFeedforwardTorque,
+    kKpScale,
+    kKdScale,
+    kMaximumTorque,
+    kStopPosition,
+    kWatchdogTimeout,
+    kSinusoidalAmplitude,
+    kSinusoidalPhase,
+    kFieldCount,
+  };
+
+  /// Only allocates if @p size is larger than any size before.
+  void resize(size_t size) {
+    for (auto& values : fields) { values.resize(size); }
+  }
+
+  size_t size() const { return fields[0].size(); }
+
+  std::vector<float>& operator[](Field field) { return fields[field]; }
+  const std::vector<float>& operator[](Field field) const { return fields[field]; }
+
+  /// Store @p command as servo @p index.
+  void Set(size_t index, const PositionCommand& command) {
+    fields[kPosition][index] = command.position;
+    fields[kVelocity][index] = command.velocity;
+    fields[kFeedforwardTorque][index] = command.feedforward_torque;
+    fields[kKpScale][index] = command.kp_scale;
+    fields[kKdScale][index] = command.kd_scale;
+    fields[kMaximumTorque][index] = command.maximum_torque;
+    fields[kStopPosition][index] = command.stop_position;
+    fields[kWatchdogTimeout][index] = command.watchdog_timeout;
+    fields[kSinusoidalAmplitude][index] = command.sinusoidal_amplitude;
+    fields[kSinusoidalPhase][index] = command.sinusoidal_phase;
+  }
+
+  std::array<std::vector<float>, kFieldCount> fields;
+};
+
+/// Encodes the command frames for many servos which share a
+/// FrameFormat.
+///
+/// The frame is laid out once, by the same Emit functions the per
+/// servo path uses, and the offset of every command value within it
+/// is recorded.  Encoding a batch then copies that template into each
+/// frame and converts each field for all servos at once, with NEON
+/// where available, so there is no per register framing logic, double
+/// math or branching per servo.
+///
+/// The values are single precision, so formats with kInt32 command
+/// fields, which need more than a float's precision, are not
+/// supported.  With the scalar conversion the frames are identical to
+/// those from WriteCanFrame given the same float values.  The NEON
+/// conversion multiplies by the reciprocal of the scale, so an integer
+/// field can differ by one count when the value is within float
+/// rounding of a quantization step.
+class BatchFrameEncoder {
+ public:
+  /// Throws std::logic_error if Supported(format) is false.
+  BatchFrameEncoder(const FrameFormat& format) : format_(format) {
+    if (!Supported(format)) {
+      throw std::logic_error("unsupported format for batch encoding");
+    }
+
+    WriteCanFrame frame(template_, &size_);
+    EmitCommand(&frame, PositionCommand(), format);
+    EmitQueryCommand(&frame, format.query);
+    FindFields();
+  }
+
+  static bool Supported(const FrameFormat& format) {
+    switch (format.mode) {
+      case Mode::kStopped:
+      case Mode::kPosition:
+      case Mode::kZeroVelocity:
+      case Mode::kSinusoidal: {
+        break;
+      }
+      default: {
+        return false;
+      }
+    }
+    const auto& r = format.resolution;
+    for (const auto res : {r.position, r.velocity, r.feedforward_torque,
+                           r.kp_scale, r.kd_scale, r.maximum_torque,
+                           r.stop_position, r.watchdog_timeout,
+                           r.sinusoidal_amplitude, r.sinusoidal_phase}) {
+      if (res == Resolution::kInt32) { return false; }
+    }
+    return true;
+  }
+
+  /// The command part of the frame, as in
+  /// Pi3HatMoteusInterface::CHILD_Cycle.
+  static void EmitCommand(WriteCanFrame* frame,
+                          const PositionCommand& command,
+                          const FrameFormat& format) {
+    switch (format.mode) {
+      case Mode::kStopped: {
+        EmitStopCommand(frame);
+        break;
+      }
+      case Mode::kPosition:
+      case Mode::kZeroVelocity: {
+        EmitPositionCommand(frame, command, format.resolution);
+        break;
+      }
+      case Mode::kSinusoidal: {
+        EmitSinusoidalPositionCommand(frame, command, format.resolution);
+        break;
+      }
+      default: {
+        throw std::logic_error("unsupported mode");
+      }
+    }
+  }
+
+  const FrameFormat& format() const { return format_; }
+
+  /// The size of every frame.
+  uint8_t size() const { return size_; }
+
+  /// Fill in data and size of frames[0, commands.size()).  Frame can
+  /// be any type with "uint8_t data[64]" and "uint8_t size" members.
+  template <typename Frame>
+  void Encode(const PositionCommandArrays& commands, Frame* frames) const {
+    const size_t count = commands.size();
+    for (size_t i = 0; i < count; i++) {
+      std::memcpy(frames[i].data, template_, size_);
+      frames[i].size = size_;
+    }
+
+    for (size_t f = 0; f < field_count_; f++) {
+      const FieldLayout& field = fields_[f];
+      const float* values = commands[field.field].data();
+      switch (field.resolution) {
+        case Resolution::kInt8: {
+          EncodeInteger<int8_t>(values, count, field, frames);
+          break;
+        }
+        case Resolution::kInt16: {
+          EncodeInteger<int16_t>(values, count, field, frames);
+          break;
+        }
+        case Resolution::kFloat: {
+          for (size_t i = 0; i < count; i++) {
+            std::memcpy(&frames[i].data[field.offset], &values[i], sizeof(float));
+          }
+          break;
+        }
+        default: {
+          throw std::logic_error("unreachable");
+        }
+      }
+    }
+  }
+
+ private:
+  struct FieldLayout {
+    PositionCommandArrays::Field field;
+    Resolution resolution;
+    uint8_t offset;
+    // The scale of the integer encoding, as used by WriteCanFrame.
+    double scale;
+  };
+
+  // The scales for int8, int16 and int32, matching the WriteCanFrame
+  // method used for each field.
+  static std::array<double, 3> Scales(PositionCommandArrays::Field field) {
+    using F = PositionCommandArrays;
+    switch (field) {
+      case F::kPosition:
+      case F::kStopPosition: return {{0.01, 0.0001, 0.00001}};
+      case F::kVelocity: return {{0.1, 0.00025, 0.00001}};
+      case F::kFeedforwardTorque:
+      case F::kMaximumTorque: return {{0.5, 0.01, 0.001}};
+      case F::kKpScale:
+      case F::kKdScale:
+      case F::kSinusoidalAmplitude: {
+        return {{1.0 / 127.0, 1.0 / 32767.0, 1.0 / 2147483647.0}};
+      }
+      case F::kWatchdogTimeout: return {{0.01, 0.001, 0.000001}};
+      case F::kSinusoidalPhase: {
+        return {{k2Pi / 127.0, k2Pi / 32767.0, k2Pi/ 2147483647.0}};
+      }
+      case F::kFieldCount: break;
+    }
+    throw std::logic_error("unreachable");
+  }
+
+  static bool FieldForRegister(uint32_t reg, PositionCommandArrays::Field* field) {
+    using F = PositionCommandArrays;
+    switch (reg) {
+      case Register::kCommandPosition: *field = F::kPosition; return true;
+      case Register::kCommandVelocity: *field = F::kVelocity; return true;
+      case Register::kCommandFeedforwardTorque: *field = F::kFeedforwardTorque; return true;
+      case Register::kCommandKpScale: *field = F::kKpScale; return true;
+      case Register::kCommandKdScale: *field = F::kKdScale; return true;
+      case Register::kCommandPositionMaxTorque: *field = F::kMaximumTorque; return true;
+      case Register::kCommandStopPosition: *field = F::kStopPosition; return true;
+      case Register::kCommandTimeout: *field = F::kWatchdogTimeout; return true;
+      case Register::kCommandSinusoidalAmplitude: *field = F::kSinusoidalAmplitude; return true;
+      case Register::kCommandSinusoidalPhase: *field = F::kSinusoidalPhase; return true;
+    }
+    return false;
+  }
+
+  /// Walk the write and read commands of the template frame and
+  /// record where each command value is.
+  void FindFields() {
+    size_t offset = 0;
+    while (offset < size_) {
+      const uint8_t cmd = template_[offset++];
+      const bool write = cmd < kReadBase;
+      const bool read = cmd >= kReadBase && cmd < kReplyBase;
+      if (!write && !read) {
+        throw std::logic_error("unexpected command in template frame");
+      }
+      static const Resolution kResolutions[4] = {
+        Resolution::kInt8, Resolution::kInt16, Resolution::kInt32, Resolution::kFloat,
+      };
+      const Resolution resolution = kResolutions[(cmd >> 2) & 0x03];
+      int count = cmd & 0x03;
+      if (count == 0) { count = template_[offset++]; }
+      const uint32_t start_register = template_[offset++];
+      if (read) { continue; }
+
+      static const size_t kSizes[4] = {1, 2, 4, 4};
+      const size_t value_size = kSizes[(cmd >> 2) & 0x03];
+      for (int i = 0; i < count; i++) {
+        PositionCommandArrays::Field field;
+        if (FieldForRegister(start_register + i, &field)) {
+          FieldLayout& layout = fields_[field_count_++];
+          layout.field = field;
+          layout.resolution = resolution;
+          layout.offset = offset;
+          layout.scale = resolution == Resolution::kFloat ? 1.0 :
+              Scales(field)[resolution == Resolution::kInt8 ? 0 : 1];
+        }
+        offset += value_size;
+      }
+    }
+  }
+
+  template <typename T, typename Frame>
+  static void Store(Frame* frame, const FieldLayout& field, T value) {
+    std::memcpy(&frame->data[field.offset], &value, sizeof(T));
+  }
+
+  template <typename T, typename Frame>
+  static void EncodeInteger(const float* values, size_t count,
+                            const FieldLayout& field, Frame* frames) {
+    size_t i = 0;
+#ifdef MOTEUS_BATCH_ENCODER_NEON
+    // Saturate<T>, four servos at a time.
+    const float32x4_t reciprocal = vdupq_n_f32(static_cast<float>(1.0 / field.scale));
+    const float32x4_t infinity = vdupq_n_f32(std::numeric_limits<float>::infinity());
+    const int32x4_t max = vdupq_n_s32(std::numeric_limits<T>::max());
+    const int32x4_t nan_value = vdupq_n_s32(std::numeric_limits<T>::min());
+    for (; i + 4 <= count; i += 4) {
+      const float32x4_t value = vld1q_f32(&values[i]);
+      // False for NaN and infinity.
+      const uint32x4_t finite = vcltq_f32(vabsq_f32(value), infinity);
+      // The conversion truncates toward zero and saturates, as the
+      // cast in Saturate does within range.
+      int32x4_t scaled = vcvtq_s32_f32(vmulq_f32(value, reciprocal));
+      scaled = vminq_s32(vmaxq_s32(scaled, vnegq_s32(max)), max);
+      int32_t result[4];
+      vst1q_s32(result, vbslq_s32(finite, scaled, nan_value));
+      for (int lane = 0; lane < 4; lane++) {
+        Store<T>(&frames[i + lane], field, static_cast<T>(result[lane]));
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      Store<T>(&frames[i], field, Saturate<T>(values[i], field.scale));
+    }
+  }
+
+  const FrameFormat format_;
+  uint8_t template_[64] = {};
+  uint8_t size_ = 0;
+  FieldLayout fields_[PositionCommandArrays::kFieldCount] = {};
+  size_t field_count_ = 0;
+};
+
+}
+}
@@ -13,20 +13,28 @@
 // limitations under the License.
 #include "moteus_motor_control.h"
 #include <ctime>
-#include "date.h"
 #include <signal.h>
-//#include <fmt/core.h> 
-using namespace date;
 
 MoteusMotorControl::MoteusMotorControl(const int main_cpu, const int can_cpu, const float period_s,
-									   const std::vector<std::pair<int, int>> servo_bus_map, std::string log_file)
+									   const std::vector<std::pair<int, int>> servo_bus_map, std::string log_file,
+									   const int log_cpu,
+									   MoteusInterface::TransportFactory transport_factory,
+									   const moteus::WaitOptions& can_wait,
+									   const MotorControlLoopOptions& loop_options)
 	: main_cpu_(main_cpu)
 	, can_cpu_(can_cpu)
+	, log_cpu_(log_cpu)
 	, period_s_(period_s)
 	, servo_bus_map_(servo_bus_map)
-	, moteus_interface_{get_initialization_options(can_cpu)}
+	, loop_options_(loop_options)
+	, moteus_interface_{get_initialization_options(can_cpu, transport_factory, can_wait)}
+	, system_offset_ns_(get_system_offset_ns())
 	{
 		moteus::ConfigureRealtime(main_cpu);
+		if (log_file.empty()) {
+			// Logging is disabled.
+			return;
+		}
 		// Get current time
 		auto now_system_clock = std::chrono::system_clock::now();
 		std::time_t now_time = std::chrono::system_clock::to_time_t(now_system_clock);
@@ -35,8 +43,9 @@ MoteusMotorControl::MoteusMotorControl(const int main_cpu, const int can_cpu, co
 		std::stringstream ss;
 		ss << std::put_time(std::localtime(&now_time), "%Y-%m-%d-%H-%M-%S"); // The time format can be adjusted to your needs
 
-		// Append time string to filename
-		log_file_ = log_file + "-" + ss.str() + ".csv";
+		// Append time string to filename. The log is written in the binary
+		// flight log format, convert it to CSV with log_convert.
+		log_file_ = log_file + "-" + ss.str() + ".tvlog";
 		
 }
 
@@ -46,10 +55,30 @@ void MoteusMotorControl::stop(int signum) {
 	std::cout << "Stopping" << std::endl;
 	stop_ = true;
 }
-MoteusInterface::Options MoteusMotorControl::get_initialization_options(int can_cpu)
+int64_t MoteusMotorControl::get_system_offset_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch() -
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MoteusInterface::Options MoteusMotorControl::get_initialization_options(
+	int can_cpu, MoteusInterface::TransportFactory transport_factory,
+	const moteus::WaitOptions& can_wait)
 {
 	MoteusInterface::Options moteus_options;
 	moteus_options.cpu = can_cpu;
+	moteus_options.transport_factory = transport_factory;
+#ifndef PI3HAT_SIMULATION
+	// The pi3hat is only linked into the hardware targets, so it is
+	// the default here rather than in Pi3HatMoteusInterface.
+	if (!moteus_options.transport_factory) {
+		moteus_options.transport_factory = []() {
+			return std::unique_ptr<moteus::CanTransport>(new moteus::Pi3HatTransport());
+		};
+	}
+#endif
+	moteus_options.can_wait = can_wait;
 	return moteus_options;
 }
 
@@ -62,25 +91,80 @@ void MoteusMotorControl::run(Controller *controller) {
 		commands.back().bus = pair.second;
 	}
 
+	// Servo i has slot i of commands and both reply vectors.
+	const moteus::ServoSlotTable slots(servo_bus_map_);
 	std::vector<MoteusInterface::ServoReply> replies{commands.size()};
-	std::vector<MoteusInterface::ServoReply> saved_replies;
+	for (size_t i = 0; i < replies.size(); i++)
+	{
+		replies[i].id = commands[i].id;
+		replies[i].bus = commands[i].bus;
+		replies[i].valid = false;
+	}
+	std::vector<MoteusInterface::ServoReply> saved_replies = replies;
+	std::vector<int32_t> reply_ns(commands.size());
 
 	controller->initialize(&commands);
 	MoteusInterface::Data moteus_data;
 	moteus_data.commands = {commands.data(), commands.size()};
 	moteus_data.replies = {replies.data(), replies.size()};
+	moteus_data.slots = &slots;
+	moteus_data.codec = controller->frame_codec();
+	moteus_data.reply_ns = {reply_ns.data(), reply_ns.size()};
 
-	std::future<MoteusInterface::Output> can_result;
+	bool cycle_pending = false;
+	// When the CAN cycle in flight, and the one whose replies are
+	// saved, were started.
+	std::chrono::steady_clock::time_point cycle_start;
+	std::chrono::steady_clock::time_point saved_start;
 
 	const auto period =
 			std::chrono::microseconds(static_cast<int64_t>(period_s_ * 1e6));
 	auto next_cycle = std::chrono::steady_clock::now() + period;
+
+	// The clock is read after the sleep and, when pipelined, again
+	// after the reply wait.  The last read is handed to the controller,
+	// and log timestamps are derived from it rather than from another
+	// system_clock read.
+	SteadyControlClock clock;
+	ControlTime time;
 	
 	uint64_t cycle_count = 0;
-	double total_margin = 0.0;
 
-	std::vector<std::string> log_data{
-		"Time,ID,Bus,Mode,Velocity,Torque,ControlVelocity,VelocityCommand,AmplitudeCommand,PhaseCommand,Temperature,Voltage"};
+	// Stage durations are recorded into histograms, and reported from
+	// a background thread.
+	CycleTiming::Options timing_options;
+	timing_options.cpu = log_cpu_;
+	CycleTiming timing(timing_options);
+
+	// All log formatting and file IO happens on the writer thread, the
+	// control loop only copies records into its queue.
+	std::unique_ptr<MotorLogWriter> log_writer;
+	if (!log_file_.empty()) {
+		MotorLogWriter::Options log_options;
+		log_options.filename = log_file_;
+		log_options.cpu = log_cpu_;
+		log_writer.reset(new MotorLogWriter(log_options));
+	}
+
+	// Keep the replies of the CAN cycle which just completed for the
+	// controller.
+	const auto complete_cycle = [&](const MoteusInterface::Output& current_values) {
+		timing.Record(CycleTiming::kCanWakeup, current_values.wakeup_time);
+		timing.Record(CycleTiming::kCanCycle, current_values.transport_time);
+		for (const auto servo_reply_ns : reply_ns)
+		{
+			if (servo_reply_ns >= 0)
+			{
+				timing.Record(CycleTiming::kServoReply,
+							  std::chrono::nanoseconds(servo_reply_ns));
+			}
+		}
+
+		// We copy out the results we just got out.
+		std::copy(replies.begin(), replies.end(), saved_replies.begin());
+		saved_start = cycle_start;
+		cycle_pending = false;
+	};
 
 	int stop_next = false;
 
@@ -89,72 +173,76 @@ void MoteusMotorControl::run(Controller *controller) {
 	{
 		cycle_count++;
 		{
-			const auto now = std::chrono::steady_clock::now();
-			auto now_system_clock = std::chrono::system_clock::now();
-			std::time_t now_t = std::chrono::system_clock::to_time_t(now_system_clock);
-			// Push data to vector if logging is enabled
-			if (!log_file_.empty()) {
-				for (const auto &item : saved_replies)
+			// Push data to the log writer if logging is enabled
+			if (log_writer) {
+				const int64_t timestamp_ns = system_offset_ns_ +
+					std::chrono::duration_cast<std::chrono::nanoseconds>(
+						time.now.time_since_epoch()).count();
+				for (size_t slot = 0; slot < saved_replies.size(); slot++)
 				{
-					MoteusInterface::ServoCommand* current_command = nullptr;
-					for (auto &command : commands)
-					{
-						if (command.id == item.id && command.bus == item.bus)
-						{
-							current_command = &command;
-							break;
-						}
-					}
-					
-					if (current_command)
+					const auto &item = saved_replies[slot];
+					const MoteusInterface::ServoCommand* current_command = &commands[slot];
+					if (item.valid)
 					{
-						float velocity_cmd = current_command->position.velocity;
-						float amplitude_cmd = current_command->position.sinusoidal_amplitude;
-						float phase_cmd = current_command->position.sinusoidal_phase;
-
-						std::ostringstream result;
-						result.precision(5);
-						result << std::fixed;
-
-						result << now_system_clock << ","
-							<< item.id << ","
-							<< item.bus << ","
-							<< static_cast<int>(item.result.mode) << ","
-							<< item.result.velocity << ","
-							<< item.result.torque << ","
-							<< item.result.control_velocity << ","
-							<< velocity_cmd << ","
-							<< amplitude_cmd << ","
-							<< phase_cmd << ","
-							<< item.result.temperature << ","
-							<< item.result.voltage;
-
-						log_data.push_back(result.str());
+						MotorLogRecord record;
+						record.timestamp_ns = timestamp_ns;
+						record.id = item.id;
+						record.bus = item.bus;
+						record.mode = static_cast<int32_t>(item.result.mode);
+						record.velocity = item.result.velocity;
+						record.torque = item.result.torque;
+						record.control_velocity = item.result.control_velocity;
+						record.velocity_command = current_command->position.velocity;
+						record.amplitude_command = current_command->position.sinusoidal_amplitude;
+						record.phase_command = current_command->position.sinusoidal_phase;
+						record.temperature = item.result.temperature;
+						record.voltage = item.result.voltage;
+
+						log_writer->Push(record);
 					}
 				}
 			}
-
+		}
+		// Wait for the next control cycle to come up.
+		std::chrono::steady_clock::time_point wakeup;
+		{
+			const auto pre_sleep = std::chrono::steady_clock::now();
 			int skip_count = 0;
-			while (now > next_cycle)
+			while (pre_sleep > next_cycle)
 			{
 				skip_count++;
 				next_cycle += period;
 			}
 			if (skip_count)
 			{
-				std::cout << "\nSkipped " << skip_count << " cycles\n";
+				timing.RecordSkipped(skip_count);
 			}
-		}
-		// Wait for the next control cycle to come up.
-		{
-			const auto pre_sleep = std::chrono::steady_clock::now();
 			std::this_thread::sleep_until(next_cycle);
-			const auto post_sleep = std::chrono::steady_clock::now();
-			std::chrono::duration<double> elapsed = post_sleep - pre_sleep;
-			total_margin += elapsed.count();
+			wakeup = std::chrono::steady_clock::now();
+			timing.Record(CycleTiming::kSleepMargin, next_cycle - pre_sleep);
+			timing.Record(CycleTiming::kWakeup, wakeup - next_cycle);
 		}
 		next_cycle += period;
 
+		auto pre_controller = wakeup;
+		if (cycle_pending && loop_options_.pipelined)
+		{
+			// Give the cycle in flight a chance to complete, so that
+			// the controller sees the freshest replies.
+			const auto wait_end = wakeup + loop_options_.reply_wait;
+			MoteusInterface::Output current_values;
+			bool complete = false;
+			while (!(complete = moteus_interface_.Poll(&current_values)) &&
+				   std::chrono::steady_clock::now() < wait_end);
+			pre_controller = std::chrono::steady_clock::now();
+			timing.Record(CycleTiming::kReplyWait, pre_controller - wakeup);
+			if (complete)
+			{
+				complete_cycle(current_values);
+			}
+		}
+		time = clock.advance(pre_controller);
+
 		bool controller_stop = false;
 		if (cycle_count < 5) {
 			for (auto& cmd : commands) {
@@ -163,8 +251,13 @@ void MoteusMotorControl::run(Controller *controller) {
 			}
 		} else {
 			// Run the controller, which decides when to stop the loop
-			
-			controller_stop = controller->run(saved_replies, &commands);
+			if (saved_start != std::chrono::steady_clock::time_point())
+			{
+				timing.Record(CycleTiming::kReplyAge, pre_controller - saved_start);
+			}
+			controller_stop = controller->run(time, saved_replies, &commands);
+			timing.Record(CycleTiming::kController,
+						  std::chrono::steady_clock::now() - pre_controller);
 		}
 		
 		if (MoteusMotorControl::stop_ or controller_stop) {
@@ -175,36 +268,26 @@ void MoteusMotorControl::run(Controller *controller) {
 		}
 		
 
-		if (can_result.valid())
+		if (cycle_pending)
 		{
 			// Now we get the result of our last query and send off our new
 			// one.
-			const auto current_values = can_result.get();
-
-			// We copy out the results we just got out.
-			const auto rx_count = current_values.query_result_size;
-			saved_replies.resize(rx_count);
-			std::copy(replies.begin(), replies.begin() + rx_count,
-								saved_replies.begin());
+			complete_cycle(moteus_interface_.Wait());
 		}
 
 		// Then we can immediately ask them to be used again.
-		auto promise = std::make_shared<std::promise<MoteusInterface::Output>>();
-		moteus_interface_.Cycle(
-				moteus_data,
-				[promise](const MoteusInterface::Output &output)
-				{
-					// This is called from an arbitrary thread, so we just set
-					// the promise value here.
-					promise->set_value(output);
-				});
-		can_result = promise->get_future();
+		cycle_start = std::chrono::steady_clock::now();
+		moteus_interface_.Start(moteus_data);
+		cycle_pending = true;
 	}
 
-	//Save log file on exit
-	if (!log_file_.empty()) {
-		std::ofstream output_file(log_file_);
-		std::ostream_iterator<std::string> output_iterator(output_file, "\n");
-		std::copy(std::begin(log_data), std::end(log_data), output_iterator);
+	// The last cycle carries the stop command and still references
+	// commands and replies, so it has to complete before returning.
+	if (cycle_pending)
+	{
+		moteus_interface_.Wait();
 	}
+
+	// The log writer flushes any remaining records when it goes out
+	// of scope.
 }
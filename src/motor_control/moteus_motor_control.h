@@ -33,26 +33,60 @@
 #include "moteus_protocol.h"
 #include "pi3hat_moteus_interface.h"
 #include "../controller/controller.h"
+#include "../logging/cycle_timing.h"
+#include "../logging/motor_log_writer.h"
 using namespace mjbots;
 
 using MoteusInterface = moteus::Pi3HatMoteusInterface;
 
+/// How the control loop schedules the controller around the CAN
+/// cycle.
+struct MotorControlLoopOptions {
+	// If false, the controller runs while the previous CAN cycle is
+	// still in flight, so it sees the replies of the cycle before.
+	//
+	// If true, the loop first waits up to reply_wait for the cycle in
+	// flight, and the controller runs with its replies.  Should it
+	// take longer, the controller runs with the older replies, which
+	// overlaps it with the CAN cycle as above.  Either way the next
+	// cycle is started as soon as the commands are ready.  The
+	// controller's ControlTime is read at the end of the wait.
+	bool pipelined = false;
+	std::chrono::microseconds reply_wait{50};
+};
+
 class MoteusMotorControl {
 	private:
 		const int main_cpu_;
 		const int can_cpu_;
+		const int log_cpu_;
 		const float period_s_;
 		const std::vector<std::pair<int, int>> servo_bus_map_;
+		const MotorControlLoopOptions loop_options_;
 		MoteusInterface moteus_interface_;
 		std::string log_file_;
+		const int64_t system_offset_ns_;
 		static bool stop_;
-		MoteusInterface::Options get_initialization_options(int can_cpu);
+		MoteusInterface::Options get_initialization_options(
+			int can_cpu, MoteusInterface::TransportFactory transport_factory,
+			const moteus::WaitOptions& can_wait);
+		static int64_t get_system_offset_ns();
 	public:
 		MoteusMotorControl(const int main_cpu, const int can_cpu,
                     const float period_s,
-                    const std::vector<std::pair<int, int>> servo_bus_map, std::string log_file = "");
+                    const std::vector<std::pair<int, int>> servo_bus_map, std::string log_file = "",
+                    const int log_cpu = 1,
+                    MoteusInterface::TransportFactory transport_factory = {},
+                    const moteus::WaitOptions& can_wait = {},
+                    const MotorControlLoopOptions& loop_options = {});
 		static void stop(int signum);
 		void run(Controller *controller);
+		// The motor log being written, with its time suffix, empty if
+		// logging is disabled.
+		const std::string& log_file() const { return log_file_; }
+		// Added to a steady_clock time since its epoch, in nanoseconds,
+		// this gives the system_clock time of MotorLogRecord::timestamp_ns.
+		int64_t system_offset_ns() const { return system_offset_ns_; }
 };
 
 #endif
\ No newline at end of file
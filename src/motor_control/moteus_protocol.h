@@ -874,5 +874,340 @@ inline QueryResult ParseQueryResult(const uint8_t* data, size_t size) {
   return result;
 }
 
+/// Everything which determines the layout of a command frame.  Servos
+/// with the same FrameFormat get frames which differ only in the
+/// bytes holding the command values.
+struct FrameFormat {
+  Mode mode = Mode::kStopped;
+  PositionResolution resolution;
+  QueryCommand query;
+
+  bool operator==(const FrameFormat& other) const {
+    const auto& a = resolution;
+    const auto& b = other.resolution;
+    const auto& qa = query;
+    const auto& qb = other.query;
+    return mode == other.mode &&
+        a.position == b.position &&
+        a.velocity == b.velocity &&
+        a.feedforward_torque == b.feedforward_torque &&
+        a.sinusoidal_amplitude == b.sinusoidal_amplitude &&
+        a.sinusoidal_phase == b.sinusoidal_phase &&
+        a.kp_scale == b.kp_scale &&
+        a.kd_scale == b.kd_scale &&
+        a.maximum_torque == b.maximum_torque &&
+        a.stop_position == b.stop_position &&
+        a.watchdog_timeout == b.watchdog_timeout &&
+        qa.mode == qb.mode &&
+        qa.position == qb.position &&
+        qa.velocity == qb.velocity &&
+        qa.torque == qb.torque &&
+        qa.q_current == qb.q_current &&
+        qa.d_current == qb.d_current &&
+        qa.rezero_state == qb.rezero_state &&
+        qa.voltage == qb.voltage &&
+        qa.temperature == qb.temperature &&
+        qa.fault == qb.fault &&
+        qa.control_velocity == qb.control_velocity;
+  }
+  bool operator!=(const FrameFormat& other) const { return !(*this == other); }
+};
+
+/// A set of compile time encode and decode routines, see
+/// StaticFrameCodec.  Commands which have @p format, and replies
+/// to its query, can be handled by these in place of the generic
+/// Emit functions and ParseQueryResult.
+struct FrameCodec {
+  FrameFormat format;
+
+  /// Writes the same frame as the Emit functions for format.
+  void (*encode)(const PositionCommand& command, uint8_t* data, uint8_t* size);
+
+  /// Returns false, leaving @p result untouched, if the frame is not
+  /// laid out as the reply to format.query.
+  bool (*decode)(const uint8_t* data, size_t size, QueryResult* result);
+};
+
+namespace detail {
+
+/// The bytes of a frame whose layout is known at compile time.
+struct StaticLayout {
+  uint8_t data[64] = {};
+  uint8_t size = 0;
+
+  // For each field, the offset of its value, or -1 if it is not in
+  // the frame, and its resolution.
+  int8_t offset[16] = {};
+  Resolution resolution[16] = {};
+
+  // Offsets of the bytes which do not hold values.
+  uint8_t framing[64] = {};
+  uint8_t framing_size = 0;
+};
+
+constexpr uint8_t StaticResolutionSize(Resolution res) {
+  return res == Resolution::kInt8 ? 1 : res == Resolution::kInt16 ? 2 : 4;
+}
+
+constexpr uint8_t StaticResolutionCode(Resolution res) {
+  return res == Resolution::kInt8 ? 0x00 :
+      res == Resolution::kInt16 ? 0x04 :
+      res == Resolution::kInt32 ? 0x08 : 0x0c;
+}
+
+constexpr void PushFraming(StaticLayout& layout, uint8_t value) {
+  layout.framing[layout.framing_size++] = layout.size;
+  layout.data[layout.size++] = value;
+}
+
+/// The same grouping as WriteCombiner.  If @p values, space is left
+/// after each register header for the register values, and the offset
+/// of each is stored for fields[i].
+constexpr void StaticCombine(StaticLayout& layout, uint8_t base_command,
+                             uint32_t start_register,
+                             const Resolution* resolutions, const int* fields,
+                             int count, bool values) {
+  Resolution current = Resolution::kIgnore;
+  for (int i = 0; i < count; i++) {
+    const Resolution res = resolutions[i];
+    if (res != current) {
+      current = res;
+      if (res == Resolution::kIgnore) { continue; }
+
+      int run = 1;
+      while (i + run < count && resolutions[i + run] == res) { run++; }
+      const uint8_t write_command = base_command + StaticResolutionCode(res);
+      if (run <= 3) {
+        PushFraming(layout, write_command + run);
+      } else {
+        PushFraming(layout, write_command);
+        PushFraming(layout, run);
+      }
+      PushFraming(layout, start_register + i);
+    } else if (res == Resolution::kIgnore) {
+      continue;
+    }
+
+    if (values) {
+      layout.offset[fields[i]] = layout.size;
+      layout.resolution[fields[i]] = res;
+      layout.size += StaticResolutionSize(res);
+    }
+  }
+}
+
+/// The query part of a command, or with @p reply the reply to it.
+/// The reply fields are numbered as in StaticReplyField.
+constexpr void StaticQuery(StaticLayout& layout, const QueryCommand& query, bool reply) {
+  const uint8_t base = reply ? Multiplex::kReplyBase : Multiplex::kReadBase;
+  const Resolution first[6] = {
+    query.mode, query.position, query.velocity,
+    query.torque, query.q_current, query.d_current,
+  };
+  const int first_fields[6] = {0, 1, 2, 3, 4, 5};
+  StaticCombine(layout, base, Register::kMode, first, first_fields, 6, reply);
+
+  const Resolution second[4] = {
+    query.rezero_state, query.voltage, query.temperature, query.fault,
+  };
+  const int second_fields[4] = {6, 7, 8, 9};
+  StaticCombine(layout, base, Register::kRezeroState, second, second_fields, 4, reply);
+
+  const Resolution third[1] = {query.control_velocity};
+  const int third_fields[1] = {10};
+  StaticCombine(layout, base, Register::kControlVelocity, third, third_fields, 1, reply);
+}
+
+constexpr StaticLayout MakeStaticLayout(const FrameFormat& format, bool reply) {
+  StaticLayout layout;
+  for (int i = 0; i < 16; i++) { layout.offset[i] = -1; }
+  if (reply) {
+    StaticQuery(layout, format.query, true);
+    return layout;
+  }
+
+  // The mode is written as in EmitStopCommand, EmitPositionCommand
+  // and EmitSinusoidalPositionCommand.
+  PushFraming(layout, Multiplex::kWriteInt8 | 0x01);
+  PushFraming(layout, Register::kMode);
+  const auto& r = format.resolution;
+  if (format.mode == Mode::kStopped) {
+    PushFraming(layout, static_cast<uint8_t>(Mode::kStopped));
+  } else {
+    const bool sinusoidal = format.mode == Mode::kSinusoidal;
+    PushFraming(layout, static_cast<uint8_t>(
+        sinusoidal ? Mode::kSinusoidal : Mode::kPosition));
+    const Resolution position[8] = {
+      r.position, r.velocity, r.feedforward_torque, r.kp_scale,
+      r.kd_scale, r.maximum_torque, r.stop_position, r.watchdog_timeout,
+    };
+    const int position_fields[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    StaticCombine(layout, Multiplex::kWriteBase, Register::kCommandPosition,
+                  position, position_fields, 8, true);
+    if (sinusoidal) {
+      const Resolution sinusoid[2] = {r.sinusoidal_amplitude, r.sinusoidal_phase};
+      const int sinusoid_fields[2] = {8, 9};
+      StaticCombine(layout, Multiplex::kWriteBase,
+                    Register::kCommandSinusoidalAmplitude,
+                    sinusoid, sinusoid_fields, 2, true);
+    }
+  }
+  StaticQuery(layout, format.query, false);
+  return layout;
+}
+
+/// Reads and writes one value of a fixed resolution, the same as
+/// WriteCanFrame::WriteMapped and MultiplexParser::ReadMapped.
+template <Resolution R> struct StaticValue;
+
+template <typename T>
+struct StaticIntegerValue {
+  static void Write(uint8_t* data, double value, const double* scales) {
+    const T raw = Saturate<T>(value, scales[Index()]);
+    std::memcpy(data, &raw, sizeof(raw));
+  }
+  static double Read(const uint8_t* data, const double* scales) {
+    T raw;
+    std::memcpy(&raw, data, sizeof(raw));
+    if (raw == std::numeric_limits<T>::min()) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    return raw * scales[Index()];
+  }
+  static constexpr int Index() { return sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : 2; }
+};
+
+template <> struct StaticValue<Resolution::kInt8> : StaticIntegerValue<int8_t> {};
+template <> struct StaticValue<Resolution::kInt16> : StaticIntegerValue<int16_t> {};
+template <> struct StaticValue<Resolution::kInt32> : StaticIntegerValue<int32_t> {};
+
+template <> struct StaticValue<Resolution::kFloat> {
+  static void Write(uint8_t* data, double value, const double*) {
+    const float raw = static_cast<float>(value);
+    std::memcpy(data, &raw, sizeof(raw));
+  }
+  static double Read(const uint8_t* data, const double*) {
+    float raw;
+    std::memcpy(&raw, data, sizeof(raw));
+    return raw;
+  }
+};
+
+template <> struct StaticValue<Resolution::kIgnore> {
+  static void Write(uint8_t*, double, const double*) {}
+  static double Read(const uint8_t*, const double*) { return 0.0; }
+};
+
+}
+
+/// A frame codec for a FrameFormat which is fixed at compile time.
+///
+/// Format must provide
+///
+///   static constexpr FrameFormat format();
+///
+/// The command frame and the reply are laid out by constexpr code
+/// which mirrors WriteCombiner, so that Encode() is a copy of the
+/// framing bytes followed by a store of each value at a fixed offset,
+/// and Decode() checks the framing bytes and loads each value from a
+/// fixed offset.  The frames are byte for byte the same as those from
+/// the generic functions, and decoded values are the same as from
+/// ParseQueryResult.
+template <typename Format>
+class StaticFrameCodec {
+ public:
+  static constexpr FrameFormat kFormat = Format::format();
+  static constexpr detail::StaticLayout kCommand = detail::MakeStaticLayout(kFormat, false);
+  static constexpr detail::StaticLayout kReply = detail::MakeStaticLayout(kFormat, true);
+
+  static_assert(kFormat.mode == Mode::kStopped || kFormat.mode == Mode::kPosition ||
+                kFormat.mode == Mode::kZeroVelocity || kFormat.mode == Mode::kSinusoidal,
+                "StaticFrameCodec supports the stopped, position and sinusoidal modes");
+
+  static void Encode(const PositionCommand& command, uint8_t* data, uint8_t* size) {
+    static const double kPosition[3] = {0.01, 0.0001, 0.00001};
+    static const double kVelocity[3] = {0.1, 0.00025, 0.00001};
+    static const double kTorque[3] = {0.5, 0.01, 0.001};
+    static const double kPwm[3] = {1.0 / 127.0, 1.0 / 32767.0, 1.0 / 2147483647.0};
+    static const double kTime[3] = {0.01, 0.001, 0.000001};
+    static const double kPhase[3] = {k2Pi / 127.0, k2Pi / 32767.0, k2Pi/ 2147483647.0};
+
+    std::memcpy(data, kCommand.data, kCommand.size);
+    Write<0>(data, command.position, kPosition);
+    Write<1>(data, command.velocity, kVelocity);
+    Write<2>(data, command.feedforward_torque, kTorque);
+    Write<3>(data, command.kp_scale, kPwm);
+    Write<4>(data, command.kd_scale, kPwm);
+    Write<5>(data, command.maximum_torque, kTorque);
+    Write<6>(data, command.stop_position, kPosition);
+    // WriteTime takes a float.
+    Write<7>(data, static_cast<float>(command.watchdog_timeout), kTime);
+    Write<8>(data, command.sinusoidal_amplitude, kPwm);
+    Write<9>(data, command.sinusoidal_phase, kPhase);
+    *size = kCommand.size;
+  }
+
+  static bool Decode(const uint8_t* data, size_t size, QueryResult* result) {
+    static const double kInt[3] = {1.0, 1.0, 1.0};
+    static const double kPosition[3] = {0.01, 0.0001, 0.00001};
+    static const double kVelocity[3] = {0.1, 0.00025, 0.00001};
+    static const double kTorque[3] = {0.5, 0.01, 0.001};
+    static const double kCurrent[3] = {1.0, 0.1, 0.001};
+    static const double kVoltage[3] = {0.5, 0.1, 0.001};
+    static const double kTemperature[3] = {1.0, 0.1, 0.001};
+
+    // Anything after the expected registers, such as padding, is
+    // ignored.
+    if (size < kReply.size) { return false; }
+    for (int i = 0; i < kReply.framing_size; i++) {
+      if (data[kReply.framing[i]] != kReply.data[kReply.framing[i]]) { return false; }
+    }
+
+    QueryResult parsed;
+    if (Has(0)) { parsed.mode = static_cast<Mode>(static_cast<int>(Read<0>(data, kInt))); }
+    if (Has(1)) { parsed.position = Read<1>(data, kPosition); }
+    if (Has(2)) { parsed.velocity = Read<2>(data, kVelocity); }
+    if (Has(3)) { parsed.torque = Read<3>(data, kTorque); }
+    if (Has(4)) { parsed.q_current = Read<4>(data, kCurrent); }
+    if (Has(5)) { parsed.d_current = Read<5>(data, kCurrent); }
+    if (Has(6)) { parsed.rezero_state = static_cast<int>(Read<6>(data, kInt)) != 0; }
+    if (Has(7)) { parsed.voltage = Read<7>(data, kVoltage); }
+    if (Has(8)) { parsed.temperature = Read<8>(data, kTemperature); }
+    if (Has(9)) { parsed.fault = static_cast<int>(Read<9>(data, kInt)); }
+    if (Has(10)) { parsed.control_velocity = Read<10>(data, kVelocity); }
+    *result = parsed;
+    return true;
+  }
+
+  static const FrameCodec& codec() {
+    static const FrameCodec result = {kFormat, &Encode, &Decode};
+    return result;
+  }
+
+ private:
+  static constexpr bool Has(int field) { return kReply.offset[field] >= 0; }
+
+  template <int Field>
+  static void Write(uint8_t* data, double value, const double* scales) {
+    constexpr int offset = kCommand.offset[Field];
+    detail::StaticValue<offset < 0 ? Resolution::kIgnore : kCommand.resolution[Field]>::Write(
+        data + (offset < 0 ? 0 : offset), value, scales);
+  }
+
+  template <int Field>
+  static double Read(const uint8_t* data, const double* scales) {
+    constexpr int offset = kReply.offset[Field];
+    return detail::StaticValue<offset < 0 ? Resolution::kIgnore : kReply.resolution[Field]>::Read(
+        data + (offset < 0 ? 0 : offset), scales);
+  }
+};
+
+template <typename Format>
+constexpr FrameFormat StaticFrameCodec<Format>::kFormat;
+template <typename Format>
+constexpr detail::StaticLayout StaticFrameCodec<Format>::kCommand;
+template <typename Format>
+constexpr detail::StaticLayout StaticFrameCodec<Format>::kReply;
+
 }
 }
@@ -14,44 +14,116 @@
 
 #pragma once
 
-#include <condition_variable>
+#include <array>
+#include <chrono>
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
-#include <mutex>
 #include <stdexcept>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "../pi3hat/pi3hat.h"
 
+#include "can_transport.h"
+#include "moteus_batch_encoder.h"
 #include "moteus_protocol.h"
 #include "realtime.h"
+#include "sequence_signal.h"
 
 namespace mjbots {
 namespace moteus {
 
+/// Assigns each servo a fixed slot, the index of its command and
+/// reply, and finds the slot of a reply from its (id, bus) with a
+/// direct indexed array.
+class ServoSlotTable {
+ public:
+  static constexpr int kMaxId = 127;
+  static constexpr int kMaxBus = 5;
+
+  /// Servo i of @p servo_bus_map, given as (id, bus), has slot i.
+  /// Throws std::invalid_argument for an out of range or repeated
+  /// servo.
+  explicit ServoSlotTable(const std::vector<std::pair<int, int>>& servo_bus_map) {
+    slots_.fill(-1);
+    for (size_t i = 0; i < servo_bus_map.size(); i++) {
+      const int id = servo_bus_map[i].first;
+      const int bus = servo_bus_map[i].second;
+      if (id < 0 || id > kMaxId || bus < 0 || bus > kMaxBus) {
+        throw std::invalid_argument("servo id or bus out of range");
+      }
+      auto& slot = slots_[Index(id, bus)];
+      if (slot >= 0) {
+        throw std::invalid_argument("servo listed more than once");
+      }
+      slot = static_cast<int16_t>(i);
+    }
+    size_ = servo_bus_map.size();
+  }
+
+  /// The slot of the servo, or -1 if it has none.
+  int find(int id, int bus) const {
+    if (id < 0 || id > kMaxId || bus < 0 || bus > kMaxBus) { return -1; }
+    return slots_[Index(id, bus)];
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  static int Index(int id, int bus) { return bus * (kMaxId + 1) + id; }
+
+  std::array<int16_t, (kMaxBus + 1) * (kMaxId + 1)> slots_;
+  size_t size_ = 0;
+};
+
 /// This class represents the interface to the moteus controllers.
 /// Internally it uses a background thread to operate the pi3hat,
 /// enabling the main thread to perform work while servo communication
 /// is taking place.
+///
+/// The two threads hand off each cycle through a pair of sequence
+/// numbers, so that no memory is allocated and, when the other side
+/// is already waiting or busy polling, no system call is made.
 class Pi3HatMoteusInterface {
  public:
+  using TransportFactory = std::function<std::unique_ptr<CanTransport> ()>;
+
   struct Options {
     int cpu = -1;
+
+    /// Creates the transport used to talk to the servos, for instance a
+    /// Pi3HatTransport.  It is invoked from the CAN thread, and must be
+    /// set.
+    TransportFactory transport_factory;
+
+    /// How the CAN thread waits for the next Start().  If the CAN
+    /// thread has a core to itself, spinning removes the scheduler
+    /// wake-up from the start of each cycle, see Output::wakeup_time.
+    WaitOptions can_wait;
+
+    /// How Wait() waits for the cycle to complete.
+    WaitOptions completion_wait;
+
+    /// If true, a cycle ends as soon as every servo which was queried
+    /// has replied, see pi3hat::Pi3Hat::Input::return_when_replied.
+    /// Otherwise it lasts at least the pi3hat's minimum wait.
+    bool return_when_replied = true;
   };
 
+  /// Throws std::invalid_argument if options.transport_factory is empty.
   Pi3HatMoteusInterface(const Options& options)
-      : options_(options),
+      : options_(CheckOptions(options)),
         thread_(std::bind(&Pi3HatMoteusInterface::CHILD_Run, this)) {
   }
 
   ~Pi3HatMoteusInterface() {
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      done_ = true;
-      condition_.notify_one();
-    }
+    done_.store(true, std::memory_order_relaxed);
+    // Publishing a new request wakes the CAN thread, which then
+    // observes done_.
+    request_.Publish(issued_ + 1);
     thread_.join();
   }
 
@@ -72,6 +144,9 @@ class Pi3HatMoteusInterface {
     int id = 0;
     int bus = 0;
     moteus::QueryResult result;
+
+    // With Data::slots, whether the servo replied in the last cycle.
+    bool valid = true;
   };
 
   // This describes what you would like to do in a given control cycle
@@ -80,64 +155,140 @@ class Pi3HatMoteusInterface {
     pi3hat::Span<ServoCommand> commands;
 
     pi3hat::Span<ServoReply> replies;
+
+    /// If set, replies has the slots of the table, and each reply is
+    /// stored in the slot of the servo it came from, with valid
+    /// cleared for servos which did not reply.  Replies from servos
+    /// not in the table are dropped.  Otherwise replies are stored in
+    /// the order they were received.
+    const ServoSlotTable* slots = nullptr;
+
+    /// If set, commands with the codec's format are encoded, and
+    /// replies laid out as the reply to its query are decoded, with
+    /// the codec.  Everything else uses the generic encoding.
+    const FrameCodec* codec = nullptr;
+
+    /// If not empty, it has an entry for each command, which is set
+    /// to the nanoseconds from the start of the transport cycle until
+    /// that servo's reply was received, or -1 if none was.
+    pi3hat::Span<int32_t> reply_ns;
   };
 
   struct Output {
     size_t query_result_size = 0;
-  };
 
-  using CallbackFunction = std::function<void (const Output&)>;
+    // From Start() until the CAN thread woke up to handle it.
+    std::chrono::nanoseconds wakeup_time{0};
+
+    // Time spent in CanTransport::Cycle, the SPI and CAN round trip.
+    std::chrono::nanoseconds transport_time{0};
+  };
 
   /// When called, this will schedule a cycle of communication with
-  /// the servos.  The callback will be invoked from an arbitrary
-  /// thread when the communication cycle has completed.
+  /// the servos, and return immediately.  Use Wait() or Poll() to
+  /// find when it has completed.
   ///
-  /// All memory pointed to by @p data must remain valid until the
-  /// callback is invoked.
-  void Cycle(const Data& data, CallbackFunction callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (active_) {
+  /// All memory pointed to by @p data must remain valid until then.
+  /// Start() and Wait() must be called from the same thread.
+  void Start(const Data& data) {
+    if (busy()) {
       throw std::logic_error(
-          "Cycle cannot be called until the previous has completed");
+          "Start cannot be called until the previous cycle has completed");
     }
 
-    callback_ = std::move(callback);
-    active_ = true;
     data_ = data;
+    start_time_ = std::chrono::steady_clock::now();
+    request_.Publish(++issued_);
+  }
+
+  /// True from Start() until the cycle has completed.
+  bool busy() const { return complete_.Load() != issued_; }
 
-    condition_.notify_all();
+  /// If the last cycle has completed, store its result and return
+  /// true.  Never blocks.
+  bool Poll(Output* output) const {
+    if (busy()) { return false; }
+    *output = output_;
+    return true;
+  }
+
+  /// Block until the last cycle has completed, and return its result.
+  Output Wait() {
+    uint32_t complete = complete_.Load();
+    while (complete != issued_) {
+      complete = complete_.Wait(complete, options_.completion_wait);
+    }
+    return output_;
   }
 
  private:
   void CHILD_Run() {
     ConfigureRealtime(options_.cpu);
 
-    pi3hat_.reset(new pi3hat::Pi3Hat({}));
+    transport_ = options_.transport_factory();
 
+    uint32_t handled = 0;
     while (true) {
-      {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (!active_) {
-          condition_.wait(lock);
-          if (done_) { return; }
+      handled = request_.Wait(handled, options_.can_wait);
+      const auto wakeup_time = std::chrono::steady_clock::now() - start_time_;
+      if (done_.load(std::memory_order_relaxed)) { return; }
 
-          if (!active_) { continue; }
-        }
-      }
+      output_ = CHILD_Cycle();
+      output_.wakeup_time = wakeup_time;
+      complete_.Publish(handled);
+    }
+  }
 
-      auto output = CHILD_Cycle();
-      CallbackFunction callback_copy;
-      {
-        std::unique_lock<std::mutex> lock(mutex_);
-        active_ = false;
-        std::swap(callback_copy, callback_);
-      }
-      callback_copy(output);
+  static const Options& CheckOptions(const Options& options) {
+    if (!options.transport_factory) {
+      throw std::invalid_argument("A transport_factory must be set");
     }
+    return options;
   }
 
-  Output CHILD_Cycle() {
-    tx_can_.resize(data_.commands.size());
+  static FrameFormat GetFormat(const ServoCommand& command) {
+    FrameFormat format;
+    format.mode = command.mode;
+    format.resolution = command.resolution;
+    format.query = command.query;
+    return format;
+  }
+
+  /// If every command has the same frame format, encode all of them
+  /// with the batch encoder.  Returns false otherwise.
+  bool CHILD_EncodeBatch() {
+    const size_t count = data_.commands.size();
+    if (count == 0) { return false; }
+
+    const FrameFormat format = GetFormat(data_.commands[0]);
+    for (size_t i = 1; i < count; i++) {
+      if (GetFormat(data_.commands[i]) != format) { return false; }
+    }
+    if (!batch_encoder_ || batch_encoder_->format() != format) {
+      if (!BatchFrameEncoder::Supported(format)) { return false; }
+      // This only allocates when the format changes, such as when
+      // the servos are first commanded out of stop.
+      batch_encoder_.reset(new BatchFrameEncoder(format));
+    }
+
+    batch_commands_.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      batch_commands_.Set(i, data_.commands[i].position);
+    }
+    batch_encoder_->Encode(batch_commands_, tx_can_.data());
+
+    const bool expect_reply = format.query.any_set();
+    for (size_t i = 0; i < count; i++) {
+      const auto& cmd = data_.commands[i];
+      auto& can = tx_can_[i];
+      can.expect_reply = expect_reply;
+      can.id = cmd.id | (expect_reply ? 0x8000 : 0x0000);
+      can.bus = cmd.bus;
+    }
+    return true;
+  }
+
+  void CHILD_EncodeEach() {
     int out_idx = 0;
     for (const auto& cmd : data_.commands) {
       const auto& query = cmd.query;
@@ -170,50 +321,127 @@ class Pi3HatMoteusInterface {
       }
       moteus::EmitQueryCommand(&write_frame, cmd.query);
     }
+  }
+
+  /// If every command has the format of data_.codec, encode all of
+  /// them with it.  Returns false otherwise.
+  bool CHILD_EncodeStatic() {
+    const FrameCodec* codec = data_.codec;
+    if (codec == nullptr) { return false; }
+    for (const auto& cmd : data_.commands) {
+      if (GetFormat(cmd) != codec->format) { return false; }
+    }
+
+    const bool expect_reply = codec->format.query.any_set();
+    for (size_t i = 0; i < data_.commands.size(); i++) {
+      const auto& cmd = data_.commands[i];
+      auto& can = tx_can_[i];
+      can.expect_reply = expect_reply;
+      can.id = cmd.id | (expect_reply ? 0x8000 : 0x0000);
+      can.bus = cmd.bus;
+      codec->encode(cmd.position, can.data, &can.size);
+    }
+    return true;
+  }
+
+  Output CHILD_Cycle() {
+    tx_can_.resize(data_.commands.size());
+    if (!CHILD_EncodeStatic() && !CHILD_EncodeBatch()) {
+      CHILD_EncodeEach();
+    }
 
     rx_can_.resize(data_.commands.size() * 2);
 
     pi3hat::Pi3Hat::Input input;
     input.tx_can = { tx_can_.data(), tx_can_.size() };
     input.rx_can = { rx_can_.data(), rx_can_.size() };
+    input.return_when_replied = options_.return_when_replied;
+    input.tx_can_reply_ns = data_.reply_ns;
 
     Output result;
 
-    const auto output = pi3hat_->Cycle(input);
+    const auto transport_start = std::chrono::steady_clock::now();
+    const auto output = transport_->Cycle(input);
+    result.transport_time = std::chrono::steady_clock::now() - transport_start;
+    if (data_.slots) {
+      CHILD_StoreSlots(output.rx_can_size, &result);
+      return result;
+    }
+
     for (size_t i = 0; i < output.rx_can_size && i < data_.replies.size(); i++) {
       const auto& can = rx_can_[i];
 
       data_.replies[i].id = (can.id & 0x7f00) >> 8;
       data_.replies[i].bus = can.bus;
-      data_.replies[i].result = moteus::ParseQueryResult(can.data, can.size);
+      CHILD_Decode(can, &data_.replies[i]);
       result.query_result_size = i + 1;
     }
 
     return result;
   }
 
+  /// Store each reply in the slot of its servo, see Data::slots.
+  void CHILD_StoreSlots(size_t rx_can_size, Output* result) {
+    for (auto& reply : data_.replies) { reply.valid = false; }
+
+    for (size_t i = 0; i < rx_can_size; i++) {
+      const auto& can = rx_can_[i];
+      const int id = (can.id & 0x7f00) >> 8;
+      const int slot = data_.slots->find(id, can.bus);
+      if (slot < 0 || slot >= static_cast<int>(data_.replies.size())) {
+        continue;
+      }
+
+      auto& reply = data_.replies[slot];
+      reply.id = id;
+      reply.bus = can.bus;
+      reply.valid = true;
+      CHILD_Decode(can, &reply);
+      result->query_result_size++;
+    }
+  }
+
+  void CHILD_Decode(const pi3hat::CanFrame& can, ServoReply* reply) {
+    if (data_.codec == nullptr ||
+        !data_.codec->decode(can.data, can.size, &reply->result)) {
+      reply->result = moteus::ParseQueryResult(can.data, can.size);
+    }
+  }
+
   const Options options_;
 
 
-  /// This block of variables are all controlled by the mutex.
-  std::mutex mutex_;
-  std::condition_variable condition_;
-  bool active_ = false;;
-  bool done_ = false;
-  CallbackFunction callback_;
+  /// The request sequence number is published by the main thread,
+  /// after it has written data_.  The completion sequence number is
+  /// published by the CAN thread, after it has written output_ and
+  /// the replies.  Each side only touches the shared variables while
+  /// it owns them.
+  SequenceSignal request_;
+  SequenceSignal complete_;
   Data data_;
+  std::chrono::steady_clock::time_point start_time_;
+  Output output_;
+  std::atomic<bool> done_{false};
 
-  std::thread thread_;
+  // Only used from the thread calling Start().
+  uint32_t issued_ = 0;
 
 
-  /// All further variables are only used from within the child thread.
+  /// These variables are only used from within the child thread.
 
-  std::unique_ptr<pi3hat::Pi3Hat> pi3hat_;
+  std::unique_ptr<CanTransport> transport_;
 
   // These are kept persistently so that no memory allocation is
   // required in steady state.
   std::vector<pi3hat::CanFrame> tx_can_;
   std::vector<pi3hat::CanFrame> rx_can_;
+
+  std::unique_ptr<BatchFrameEncoder> batch_encoder_;
+  PositionCommandArrays batch_commands_;
+
+  // This is last, so that everything above is constructed before the
+  // child thread starts.
+  std::thread thread_;
 };
 
 
@@ -16,20 +16,31 @@
 
 #include <sched.h>
 
+#include <stdexcept>
+
 namespace mjbots {
 namespace moteus {
 
-inline void ConfigureRealtime(int cpu) {
-  {
-    cpu_set_t cpuset = {};
-    CPU_ZERO(&cpuset);
-    CPU_SET(cpu, &cpuset);
+/// A negative cpu leaves the calling thread's affinity unchanged.
+inline void ConfigureCpuAffinity(int cpu) {
+  if (cpu < 0) { return; }
 
-    const int r = ::sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
-    if (r < 0) {
-      throw std::runtime_error("Error setting CPU affinity");
-    }
+  cpu_set_t cpuset = {};
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+
+  const int r = ::sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+  if (r < 0) {
+    throw std::runtime_error("Error setting CPU affinity");
   }
+}
+
+/// A negative cpu leaves the calling thread's scheduling unchanged.
+/// This is intended for simulation builds, which may not run as root.
+inline void ConfigureRealtime(int cpu) {
+  if (cpu < 0) { return; }
+
+  ConfigureCpuAffinity(cpu);
 
   {
     struct sched_param params = {};
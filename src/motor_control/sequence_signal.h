@@ -0,0 +1,152 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace mjbots {
+namespace moteus {
+
+/// How a thread waits for a SequenceSignal to change.
+enum class WaitStrategy {
+  // Sleep in the kernel until woken.  Uses no CPU while waiting, but
+  // every wake-up goes through the scheduler.
+  kBlock,
+  // Poll the value as fast as possible.  Occupies the core.
+  kSpin,
+  // Poll, with a CPU hint between polls (yield on ARM, pause on x86),
+  // which is kinder to a sibling hardware thread and to power draw.
+  kSpinYield,
+  // On ARMv8, sleep the core with WFE until the value's cache line is
+  // written, which wakes within a few cycles of the store.  Elsewhere
+  // this is the same as kSpinYield.
+  kSpinWaitForEvent,
+  // Spin with yield for spin_count polls, then block.
+  kSpinThenBlock,
+};
+
+struct WaitOptions {
+  WaitStrategy strategy = WaitStrategy::kBlock;
+
+  // Only used by kSpinThenBlock.
+  int spin_count = 10000;
+};
+
+/// A hint to the CPU that this is a polling loop.
+inline void CpuRelax() {
+#if defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/// Signals a monotonically increasing sequence number from one thread
+/// to one waiting thread.
+///
+/// Publish() and a Wait() that finds the value already updated are
+/// plain atomic operations.  Only when the waiter has actually gone
+/// to sleep in the kernel does Publish() make a futex system call to
+/// wake it.
+///
+/// All writes made before Publish() are visible to the thread which
+/// returns from Wait() with that sequence number.
+class SequenceSignal {
+ public:
+  uint32_t Load() const { return value_.load(std::memory_order_acquire); }
+
+  void Publish(uint32_t value) {
+    // Both the store and the load below must be sequentially
+    // consistent, so that either the waiter sees the new value before
+    // sleeping, or this sees that it is waiting.
+    value_.store(value, std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_seq_cst)) {
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value_),
+                FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+  }
+
+  /// Return the first value which differs from @p last.
+  uint32_t Wait(uint32_t last, const WaitOptions& options) {
+    uint32_t value = value_.load(std::memory_order_acquire);
+    if (value != last) { return value; }
+
+    switch (options.strategy) {
+      case WaitStrategy::kBlock: {
+        break;
+      }
+      case WaitStrategy::kSpin: {
+        while ((value = value_.load(std::memory_order_acquire)) == last);
+        return value;
+      }
+      case WaitStrategy::kSpinYield: {
+        while ((value = value_.load(std::memory_order_acquire)) == last) {
+          CpuRelax();
+        }
+        return value;
+      }
+      case WaitStrategy::kSpinWaitForEvent: {
+        while ((value = WaitForEvent(last)) == last);
+        return value;
+      }
+      case WaitStrategy::kSpinThenBlock: {
+        for (int i = 0; i < options.spin_count; i++) {
+          value = value_.load(std::memory_order_acquire);
+          if (value != last) { return value; }
+          CpuRelax();
+        }
+        break;
+      }
+    }
+
+    return Block(last);
+  }
+
+ private:
+  uint32_t Block(uint32_t last) {
+    uint32_t value = 0;
+    waiting_.store(1, std::memory_order_seq_cst);
+    while ((value = value_.load(std::memory_order_seq_cst)) == last) {
+      // This returns immediately if the value has changed since it
+      // was checked.
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value_),
+                FUTEX_WAIT_PRIVATE, last, nullptr, nullptr, 0);
+    }
+    waiting_.store(0, std::memory_order_relaxed);
+    return value;
+  }
+
+  /// Load the value, and if it is still @p last, wait for an event.
+  ///
+  /// The exclusive load arms the exclusive monitor, so that a store to
+  /// the value by another core clears it and generates the event.
+  /// Interrupts also wake WFE, so this cannot sleep indefinitely.
+  uint32_t WaitForEvent(uint32_t last) {
+    uint32_t value = 0;
+#if defined(__aarch64__)
+    asm volatile("ldaxr %w0, [%1]"
+                 : "=&r"(value) : "r"(&value_) : "memory");
+    if (value == last) { asm volatile("wfe" ::: "memory"); }
+#elif defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 8
+    asm volatile("ldaex %0, [%1]"
+                 : "=&r"(value) : "r"(&value_) : "memory");
+    if (value == last) { asm volatile("wfe" ::: "memory"); }
+#else
+    value = value_.load(std::memory_order_acquire);
+    if (value == last) { CpuRelax(); }
+#endif
+    return value;
+  }
+
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "futex requires a plain 32 bit word");
+
+  std::atomic<uint32_t> value_{0};
+  std::atomic<uint32_t> waiting_{0};
+};
+
+}
+}
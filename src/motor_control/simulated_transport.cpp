@@ -0,0 +1,350 @@
+#include "simulated_transport.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace mjbots {
+namespace moteus {
+
+namespace {
+
+struct Scales {
+  double int8;
+  double int16;
+  double int32;
+};
+
+/// The scaling moteus applies to integer encodings of each register.
+Scales RegisterScales(uint32_t reg) {
+  switch (static_cast<Register>(reg)) {
+    case Register::kPosition:
+    case Register::kCommandPosition:
+    case Register::kCommandStopPosition:
+    case Register::kControlPosition: {
+      return {0.01, 0.0001, 0.00001};
+    }
+    case Register::kVelocity:
+    case Register::kCommandVelocity:
+    case Register::kControlVelocity: {
+      return {0.1, 0.00025, 0.00001};
+    }
+    case Register::kTorque:
+    case Register::kCommandFeedforwardTorque:
+    case Register::kCommandPositionMaxTorque:
+    case Register::kControlTorque: {
+      return {0.5, 0.01, 0.001};
+    }
+    case Register::kQCurrent:
+    case Register::kDCurrent: {
+      return {1.0, 0.1, 0.001};
+    }
+    case Register::kVoltage: {
+      return {0.5, 0.1, 0.001};
+    }
+    case Register::kTemperature: {
+      return {1.0, 0.1, 0.001};
+    }
+    case Register::kCommandKpScale:
+    case Register::kCommandKdScale:
+    case Register::kCommandSinusoidalAmplitude: {
+      return {1.0 / 127.0, 1.0 / 32767.0, 1.0 / 2147483647.0};
+    }
+    case Register::kCommandSinusoidalPhase: {
+      return {k2Pi / 127.0, k2Pi / 32767.0, k2Pi / 2147483647.0};
+    }
+    case Register::kCommandTimeout: {
+      return {0.01, 0.001, 0.000001};
+    }
+    default: {
+      break;
+    }
+  }
+  return {1.0, 1.0, 1.0};
+}
+
+Resolution ResolutionFromId(int id) {
+  switch (id) {
+    case 0: return Resolution::kInt8;
+    case 1: return Resolution::kInt16;
+    case 2: return Resolution::kInt32;
+    case 3: return Resolution::kFloat;
+  }
+  return Resolution::kInt8;
+}
+
+size_t ResolutionSize(Resolution res) {
+  switch (res) {
+    case Resolution::kInt8: return 1;
+    case Resolution::kInt16: return 2;
+    case Resolution::kInt32: return 4;
+    case Resolution::kFloat: return 4;
+    case Resolution::kIgnore: break;
+  }
+  return 0;
+}
+
+template <typename T>
+double ReadScaled(const uint8_t* data, double scale) {
+  T value = {};
+  std::memcpy(&value, data, sizeof(value));
+  if (value == std::numeric_limits<T>::min()) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  return value * scale;
+}
+
+double ReadValue(const uint8_t* data, Resolution res, const Scales& scales) {
+  switch (res) {
+    case Resolution::kInt8: return ReadScaled<int8_t>(data, scales.int8);
+    case Resolution::kInt16: return ReadScaled<int16_t>(data, scales.int16);
+    case Resolution::kInt32: return ReadScaled<int32_t>(data, scales.int32);
+    case Resolution::kFloat: {
+      float value = 0.0f;
+      std::memcpy(&value, data, sizeof(value));
+      return value;
+    }
+    case Resolution::kIgnore: break;
+  }
+  return 0.0;
+}
+
+void ApplyWrite(uint32_t reg, double value, SimulatedTransport::ServoState* servo) {
+  auto& command = servo->command;
+  switch (static_cast<Register>(reg)) {
+    case Register::kMode: {
+      servo->mode = static_cast<Mode>(static_cast<int>(value));
+      break;
+    }
+    case Register::kCommandPosition: { command.position = value; break; }
+    case Register::kCommandVelocity: { command.velocity = value; break; }
+    case Register::kCommandFeedforwardTorque: {
+      command.feedforward_torque = value;
+      break;
+    }
+    case Register::kCommandKpScale: { command.kp_scale = value; break; }
+    case Register::kCommandKdScale: { command.kd_scale = value; break; }
+    case Register::kCommandPositionMaxTorque: {
+      command.maximum_torque = value;
+      break;
+    }
+    case Register::kCommandStopPosition: { command.stop_position = value; break; }
+    case Register::kCommandTimeout: { command.watchdog_timeout = value; break; }
+    case Register::kCommandSinusoidalAmplitude: {
+      command.sinusoidal_amplitude = value;
+      break;
+    }
+    case Register::kCommandSinusoidalPhase: {
+      command.sinusoidal_phase = value;
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+double ReadRegister(uint32_t reg, const SimulatedTransport::ServoState& servo,
+                    const SimulatedTransport::Options& options,
+                    double velocity_noise) {
+  switch (static_cast<Register>(reg)) {
+    case Register::kMode: return static_cast<double>(servo.mode);
+    case Register::kPosition: return servo.position;
+    case Register::kVelocity: return servo.velocity + velocity_noise;
+    case Register::kTorque: return servo.torque;
+    case Register::kQCurrent: return servo.torque * 10.0;
+    case Register::kDCurrent: return 0.0;
+    case Register::kRezeroState: return 0.0;
+    case Register::kVoltage: return options.voltage;
+    case Register::kTemperature: return options.temperature;
+    case Register::kFault: return 0.0;
+    case Register::kControlVelocity: return servo.control_velocity;
+    default: break;
+  }
+  return 0.0;
+}
+
+}
+
+SimulatedTransport::SimulatedTransport(const Options& options)
+    : options_(options),
+      rng_(options.seed),
+      last_cycle_(std::chrono::steady_clock::now()) {}
+
+pi3hat::Pi3Hat::Output SimulatedTransport::Cycle(
+    const pi3hat::Pi3Hat::Input& input) {
+  const auto start = std::chrono::steady_clock::now();
+  // Bound the step, so that a long pause between cycles does not
+  // make the model jump.
+  const double dt = std::min(
+      0.01, std::chrono::duration<double>(start - last_cycle_).count());
+  last_cycle_ = start;
+
+  pi3hat::Pi3Hat::Output result;
+
+  for (const auto& frame : input.tx_can) {
+    auto& servo = servos_[std::make_pair(frame.bus, static_cast<int>(frame.id & 0x7f))];
+
+    pi3hat::CanFrame* reply = nullptr;
+    if (frame.expect_reply && result.rx_can_size < input.rx_can.size()) {
+      reply = &input.rx_can[result.rx_can_size];
+      *reply = {};
+    }
+
+    HandleFrame(frame, dt, &servo, reply);
+
+    if (reply) {
+      // Replies are addressed from the servo, to the host at id 0.
+      reply->id = (frame.id & 0x7f) << 8;
+      reply->bus = frame.bus;
+      result.rx_can_size++;
+    }
+  }
+
+  std::uniform_real_distribution<double> jitter(0.0, options_.jitter_us);
+  const auto end = start + std::chrono::nanoseconds(
+      static_cast<int64_t>((options_.latency_us + jitter(rng_)) * 1000.0));
+  if (options_.busy_wait) {
+    while (std::chrono::steady_clock::now() < end);
+  } else {
+    std::this_thread::sleep_until(end);
+  }
+
+  // Every reply arrives at the end of the cycle.
+  const int32_t reply_ns = static_cast<int32_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count());
+  for (size_t i = 0; i < input.tx_can_reply_ns.size() && i < input.tx_can.size(); i++) {
+    input.tx_can_reply_ns[i] = input.tx_can[i].expect_reply ? reply_ns : -1;
+  }
+
+  return result;
+}
+
+void SimulatedTransport::Update(ServoState* servo, double dt) {
+  const double drag_torque =
+      options_.drag * servo->velocity * std::abs(servo->velocity);
+
+  switch (servo->mode) {
+    case Mode::kPosition:
+    case Mode::kZeroVelocity:
+    case Mode::kSinusoidal: {
+      const auto& command = servo->command;
+      double target = servo->mode == Mode::kZeroVelocity ? 0.0 : command.velocity;
+      if (servo->mode == Mode::kPosition && std::isfinite(command.position)) {
+        target += (command.position - servo->position) /
+            options_.velocity_time_constant_s;
+      }
+
+      // The velocity loop is modeled as a first order response.
+      const double tau = options_.velocity_time_constant_s;
+      const double new_velocity =
+          target + (servo->velocity - target) * std::exp(-dt / tau);
+      const double acceleration =
+          dt > 0.0 ? (new_velocity - servo->velocity) / dt : 0.0;
+
+      servo->torque = options_.inertia * acceleration + drag_torque;
+      if (std::isfinite(command.maximum_torque) && command.maximum_torque > 0.0) {
+        servo->torque = std::max(-command.maximum_torque,
+                                 std::min(command.maximum_torque, servo->torque));
+      }
+      servo->velocity = new_velocity;
+      servo->control_velocity = target;
+
+      if (servo->mode == Mode::kSinusoidal) {
+        // The sinusoidal mode superimposes a once per revolution torque
+        // on the rotor, with an amplitude relative to the mean torque.
+        servo->torque += command.sinusoidal_amplitude * std::abs(drag_torque) *
+            std::sin(k2Pi * servo->position + command.sinusoidal_phase);
+      }
+      break;
+    }
+    default: {
+      // Anything else is treated as stopped, so the rotor coasts down.
+      servo->torque = 0.0;
+      servo->control_velocity = std::numeric_limits<double>::quiet_NaN();
+      servo->velocity /= 1.0 + options_.drag / options_.inertia *
+          std::abs(servo->velocity) * dt;
+      break;
+    }
+  }
+
+  servo->position += servo->velocity * dt;
+}
+
+void SimulatedTransport::HandleFrame(const pi3hat::CanFrame& frame,
+                                     double dt, ServoState* servo,
+                                     pi3hat::CanFrame* reply) {
+  std::normal_distribution<double> noise(0.0, options_.velocity_noise);
+  const double velocity_noise = options_.velocity_noise > 0.0 ? noise(rng_) : 0.0;
+
+  const uint8_t* const data = frame.data;
+  const size_t size = frame.size;
+  size_t offset = 0;
+  bool updated = false;
+
+  while (offset < size) {
+    const uint8_t cmd = data[offset++];
+    if (cmd == Multiplex::kNop) { continue; }
+
+    const bool is_write = cmd < Multiplex::kReadBase;
+    const bool is_read = cmd >= Multiplex::kReadBase && cmd < Multiplex::kReplyBase;
+    if (!is_write && !is_read) {
+      // Nothing else is emitted by the host, so stop parsing.
+      break;
+    }
+
+    const Resolution res = ResolutionFromId((cmd >> 2) & 0x03);
+    int count = cmd & 0x03;
+    if (count == 0) {
+      if (offset >= size) { break; }
+      count = data[offset++];
+    }
+    if (offset >= size) { break; }
+    const uint32_t start_register = data[offset++];
+
+    if (is_write) {
+      for (int i = 0; i < count; i++) {
+        const uint32_t reg = start_register + i;
+        if (offset + ResolutionSize(res) > size) { return; }
+        ApplyWrite(reg, ReadValue(&data[offset], res, RegisterScales(reg)), servo);
+        offset += ResolutionSize(res);
+      }
+      continue;
+    }
+
+    // The model is advanced once all writes preceding the first read
+    // have been applied, so replies already reflect a new command.
+    if (!updated) {
+      Update(servo, dt);
+      updated = true;
+    }
+
+    if (!reply || count == 0) { continue; }
+
+    WriteCanFrame write_frame(reply->data, &reply->size);
+    const auto reply_cmd = Multiplex::kReplyBase | (cmd & 0x0c);
+    if (count <= 3) {
+      write_frame.Write<int8_t>(reply_cmd | count);
+    } else {
+      write_frame.Write<int8_t>(reply_cmd);
+      write_frame.Write<int8_t>(count);
+    }
+    write_frame.Write<int8_t>(start_register);
+    for (int i = 0; i < count; i++) {
+      const uint32_t reg = start_register + i;
+      const auto scales = RegisterScales(reg);
+      write_frame.WriteMapped(
+          ReadRegister(reg, *servo, options_, velocity_noise),
+          scales.int8, scales.int16, scales.int32, res);
+    }
+  }
+
+  if (!updated) {
+    Update(servo, dt);
+  }
+}
+
+}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <utility>
+
+#include "can_transport.h"
+#include "moteus_protocol.h"
+
+namespace mjbots {
+namespace moteus {
+
+/// A CanTransport which needs no hardware.
+///
+/// Every transmitted frame is decoded as a moteus register
+/// write/read request.  A simple first order motor model is advanced
+/// for each addressed servo, and replies are encoded for all
+/// requested registers, exactly like a moteus would.  Each Cycle()
+/// takes a configurable latency plus random jitter, to stand in for
+/// the SPI and CAN round trip.
+///
+/// This makes it possible to run and benchmark the whole control
+/// loop on any Linux machine.
+class SimulatedTransport : public CanTransport {
+ public:
+  struct Options {
+    // Minimum duration of a cycle.
+    double latency_us = 150.0;
+    // A uniformly distributed random delay of up to this much is
+    // added to each cycle.
+    double jitter_us = 20.0;
+    // If true, the delay is busy waited like the pi3hat does.
+    // Otherwise the thread sleeps.
+    bool busy_wait = true;
+
+    // Motor model.
+    double velocity_time_constant_s = 0.05;
+    double inertia = 2e-4;  // torque = inertia * acceleration + drag
+    double drag = 8e-5;     // drag torque = drag * velocity * |velocity|
+    double velocity_noise = 0.2;  // standard deviation, rev/s
+    double voltage = 24.0;
+    double temperature = 30.0;
+
+    uint32_t seed = 0;
+
+    Options() {}
+  };
+
+  /// The simulated state of one servo.
+  struct ServoState {
+    Mode mode = Mode::kStopped;
+    double position = 0.0;
+    double velocity = 0.0;
+    double torque = 0.0;
+    double control_velocity = std::numeric_limits<double>::quiet_NaN();
+
+    PositionCommand command;
+  };
+
+  SimulatedTransport(const Options& options = Options());
+
+  pi3hat::Pi3Hat::Output Cycle(const pi3hat::Pi3Hat::Input& input) override;
+
+  /// The state of the servo with the given id and bus, which is
+  /// default constructed if that servo has never been addressed.
+  const ServoState& servo(int id, int bus) { return servos_[std::make_pair(bus, id)]; }
+
+ private:
+  void Update(ServoState* servo, double dt);
+  void HandleFrame(const pi3hat::CanFrame& frame, double dt,
+                   ServoState* servo, pi3hat::CanFrame* reply);
+
+  const Options options_;
+  std::mt19937 rng_;
+  std::map<std::pair<int, int>, ServoState> servos_;
+  std::chrono::steady_clock::time_point last_cycle_;
+};
+
+}
+}
@@ -0,0 +1,438 @@
+// Copyright 2019-2020 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _MJBOTS_PI3HAT_CAN_SPI_LANE_H_
+#define _MJBOTS_PI3HAT_CAN_SPI_LANE_H_
+
+/// @file
+///
+/// The CAN transfers of Pi3Hat::Cycle.  They only need an SPI
+/// peripheral with the interface of PrimarySpi and AuxSpi, so they
+/// can also be run against a simulated one.
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
+// We purposefully don't use the full path here so that this file can
+// be compiled in a wide range of build configurations.
+#include "pi3hat.h"
+
+namespace mjbots {
+namespace pi3hat {
+
+inline size_t RoundUpDlc(size_t value) {
+  if (value == 0) { return 0; }
+  if (value == 1) { return 1; }
+  if (value == 2) { return 2; }
+  if (value == 3) { return 3; }
+  if (value == 4) { return 4; }
+  if (value == 5) { return 5; }
+  if (value == 6) { return 6; }
+  if (value == 7) { return 7; }
+  if (value == 8) { return 8; }
+  if (value <= 12) { return 12; }
+  if (value <= 16) { return 16; }
+  if (value <= 20) { return 20; }
+  if (value <= 24) { return 24; }
+  if (value <= 32) { return 32; }
+  if (value <= 48) { return 48; }
+  if (value <= 64) { return 64; }
+  return 0;
+}
+
+inline int64_t GetNow() {
+  struct timespec ts = {};
+  ::clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000ll +
+      static_cast<int64_t>(ts.tv_nsec);
+}
+
+/// The received frames of one cycle, shared by the lanes.  A lane
+/// reserves a slot when it starts to read a frame, so that the frame
+/// has room when the read completes, however the lanes interleave.
+struct CanRxBuffer {
+  CanRxBuffer(const Span<CanFrame>* frames_in, Pi3Hat::Output* output_in)
+      : frames(frames_in), output(output_in) {}
+
+  /// Returns false if every slot is used or reserved.
+  bool Reserve() {
+    if (output->rx_can_size + reserved >= frames->size()) { return false; }
+    reserved++;
+    return true;
+  }
+
+  /// The next slot, for a reserved frame which was read.
+  CanFrame& Claim() {
+    reserved--;
+    return (*frames)[output->rx_can_size++];
+  }
+
+  /// For a reserved frame which turned out to be empty.
+  void Release() { reserved--; }
+
+  const Span<CanFrame>* const frames;
+  Pi3Hat::Output* const output;
+  size_t reserved = 0;
+};
+
+/// The CAN traffic of one cycle for the processors on one SPI
+/// peripheral: the AuxSpi, with CAN 1/2 on chip select 0 and CAN 3/4
+/// on chip select 1, or the PrimarySpi, with CAN 5.
+///
+/// Each SPI transfer is started without waiting and advanced by
+/// Poll(), so that the two peripherals can be driven at the same
+/// time.  All frames are written first, in the order they were
+/// added.  Then, once reading is started, the receive queue of each
+/// processor is polled in turn, each with its own backoff, so an idle
+/// processor does not delay reading from the other.
+///
+/// The firmware returns one frame per read of address 3, so each
+/// frame costs a complete transfer.  Consecutive reads take turns
+/// between the processors, and the SPI peripherals skip the chip
+/// select setup time when the chip select changes, so that wait is
+/// only paid when one processor is read twice in a row.
+///
+/// A received frame answers the frame with expect_reply set which was
+/// sent on the same bus to the source of the reply, as moteus
+/// addresses them: the reply's source is bits 8-14 of its ID, and the
+/// destination of a request is bits 0-6.  Frames which answer nothing
+/// are returned, but leave the replies outstanding.
+template <typename Spi>
+class CanSpiLane {
+ public:
+  /// Processor i is on chip select i, and its first bus is
+  /// bus_starts[i].
+  CanSpiLane(Spi* spi, std::initializer_list<int> bus_starts) : spi_(spi) {
+    for (const int bus_start : bus_starts) {
+      Processor processor;
+      processor.cs = processors_.size();
+      processor.bus_start = bus_start;
+      processors_.push_back(processor);
+    }
+  }
+
+  /// Forget the previous cycle, which started at @p start_ns.
+  /// Received frames are stored in @p rx, which may be shared with
+  /// other lanes.
+  void Begin(CanRxBuffer* rx, int64_t start_ns) {
+    rx_ = rx;
+    start_ns_ = start_ns;
+    writes_.resize(0);
+    replies_.resize(0);
+    write_index_ = 0;
+    reading_ = false;
+    for (auto& processor : processors_) {
+      processor.state = kIdle;
+      processor.check = false;
+      processor.expected = 0;
+      processor.next_poll = 0;
+    }
+  }
+
+  /// Queue @p can_frame, which is tx_can[@p tx_index] and whose bus
+  /// must be on this peripheral.
+  void AddFrame(const CanFrame& can_frame, int tx_index) {
+    Processor* const processor = Find(can_frame.bus);
+    if (processor == nullptr) { return; }
+    if (can_frame.expect_reply) {
+      processor->expected++;
+      Reply reply;
+      reply.bus = can_frame.bus;
+      reply.source = can_frame.id & 0x7f;
+      reply.tx_index = tx_index;
+      replies_.push_back(reply);
+    }
+
+    writes_.resize(writes_.size() + 1);
+    Write& write = writes_.back();
+    write.cs = processor->cs;
+
+    const int cpu_bus = can_frame.bus - processor->bus_start;
+    const auto size = RoundUpDlc(can_frame.size);
+    char* const buf = write.data;
+    buf[0] = ((cpu_bus == 1) ? 0x80 : 0x00) | (size & 0x7f);
+
+    if (can_frame.id <= 0xffff) {
+      // We'll use the 2 byte ID formulation, cmd 5
+      write.address = 5;
+      buf[1] = (can_frame.id >> 8) & 0xff;
+      buf[2] = can_frame.id & 0xff;
+      ::memcpy(&buf[3], can_frame.data, can_frame.size);
+      for (std::size_t i = 3 + can_frame.size; i < (3 + size); i++) {
+        buf[i] = 0x50;
+      }
+      write.size = 3 + size;
+    } else {
+      // 4 byte formulation, cmd 4
+      write.address = 4;
+
+      buf[1] = (can_frame.id >> 24) & 0xff;
+      buf[2] = (can_frame.id >> 16) & 0xff;
+      buf[3] = (can_frame.id >> 8) & 0xff;
+      buf[4] = (can_frame.id >> 0) & 0xff;
+      ::memcpy(&buf[5], can_frame.data, can_frame.size);
+      for (std::size_t i = 5 + can_frame.size; i < (5 + size); i++) {
+        buf[i] = 0x50;
+      }
+      write.size = 5 + size;
+    }
+  }
+
+  /// Poll the receive queues once all frames are written.  A
+  /// processor is polled if a reply is expected from it, or
+  /// @p force_can_check has the bit of one of its buses set.
+  void StartReading(uint32_t force_can_check) {
+    for (auto& processor : processors_) {
+      processor.check = processor.expected > 0 ||
+          ((force_can_check >> processor.bus_start) & 0x03) != 0;
+    }
+    reading_ = true;
+  }
+
+  /// Advance the current transfer, and start the next one if it is
+  /// complete.  Returns the number of frames received.
+  int Poll() {
+    if (!spi_->Poll()) { return 0; }
+    return Complete(true);
+  }
+
+  /// Complete any transfer in progress, and stop reading.
+  void Finish() {
+    reading_ = false;
+    while (!spi_->Poll());
+    Complete(false);
+  }
+
+  bool writes_done() const {
+    return write_index_ == writes_.size() && (active_ >= 0 || spi_->idle());
+  }
+
+  /// The number of expected replies not yet received.
+  int outstanding() const {
+    int result = 0;
+    for (const auto& processor : processors_) {
+      result += processor.expected;
+    }
+    return result;
+  }
+
+  /// Store the time each reply was received, relative to the start
+  /// of the cycle, in @p reply_ns, indexed as tx_can.
+  void ReportReplies(const Span<int32_t>& reply_ns) const {
+    for (const auto& reply : replies_) {
+      if (reply.tx_index >= static_cast<int>(reply_ns.size())) { continue; }
+      reply_ns[reply.tx_index] = reply.received_ns < 0 ? -1 :
+          static_cast<int32_t>(
+              std::min<int64_t>(reply.received_ns - start_ns_,
+                                std::numeric_limits<int32_t>::max()));
+    }
+  }
+
+ private:
+  enum State {
+    kIdle,
+    kQueueSizes,
+    kFrames,
+  };
+
+  struct Processor {
+    int cs = 0;
+    int bus_start = 0;
+    bool check = false;
+    int expected = 0;
+
+    State state = kIdle;
+    uint8_t queue_sizes[6] = {};
+    int frame = 0;
+    // Do not read the queue sizes again before this time.
+    int64_t next_poll = 0;
+  };
+
+  struct Reply {
+    int bus = 0;
+    int source = 0;
+    int tx_index = 0;
+    // When it was received, or -1.
+    int64_t received_ns = -1;
+  };
+
+  struct Write {
+    int cs = 0;
+    int address = 0;
+    int size = 0;
+    char data[70] = {};
+  };
+
+  Processor* Find(int bus) {
+    for (auto& processor : processors_) {
+      if (bus >= processor.bus_start && bus < processor.bus_start + 2) {
+        return &processor;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Handle the transfer which just completed, if any, and if
+  /// @p start_next, start the next one.  Returns the number of frames
+  /// received.
+  int Complete(bool start_next) {
+    if (active_ < 0) {
+      if (start_next) { StartNext(); }
+      return 0;
+    }
+
+    Processor* const processor = &processors_[active_];
+    active_ = -1;
+    if (processor->state == kQueueSizes) {
+      bool any = false;
+      for (const auto size : processor->queue_sizes) {
+        if (size != 0) { any = true; }
+      }
+      if (!any) {
+        // Give the controllers a chance to rest.
+        processor->state = kIdle;
+        processor->next_poll = GetNow() + 20000;
+      } else {
+        processor->state = kFrames;
+        processor->frame = 0;
+      }
+      if (start_next) { StartNext(); }
+      return 0;
+    }
+
+    // A frame was read.
+    processor->frame++;
+    const uint8_t* const buf = buf_;
+    if (buf[0] == 0) {
+      // Hmmm, this shouldn't happen, but indicates there isn't
+      // really a frame here.
+      rx_->Release();
+      if (start_next) { StartNext(); }
+      return 0;
+    }
+
+    // The slot was reserved when the read started.
+    auto& output_frame = rx_->Claim();
+    const int bus = processor->bus_start + ((buf[0] & 0x80) ? 1 : 0);
+    const int source = buf[3] & 0x7f;
+    Reply* const reply = FindReply(bus, source);
+    if (reply != nullptr) {
+      reply->received_ns = GetNow();
+      processor->expected--;
+    }
+
+    output_frame.bus = bus;
+    output_frame.id = (buf[1] << 24) |
+                      (buf[2] << 16) |
+                      (buf[3] << 8) |
+                      (buf[4] << 0);
+    output_frame.size = read_size_ - 5;
+    ::memcpy(output_frame.data, &buf[5], read_size_ - 5);
+
+    // The next read reuses buf_.
+    if (start_next) { StartNext(); }
+    return 1;
+  }
+
+  Reply* FindReply(int bus, int source) {
+    for (auto& reply : replies_) {
+      if (reply.received_ns < 0 && reply.bus == bus && reply.source == source) {
+        return &reply;
+      }
+    }
+    return nullptr;
+  }
+
+  void StartNext() {
+    if (write_index_ < writes_.size()) {
+      const auto& write = writes_[write_index_++];
+      spi_->StartWrite(write.cs, write.address, write.data, write.size);
+      return;
+    }
+
+    if (!reading_) { return; }
+
+    const int64_t now = GetNow();
+    for (size_t n = 0; n < processors_.size(); n++) {
+      // Take turns, starting after the processor served last.
+      const int index = (next_processor_ + n) % processors_.size();
+      Processor& processor = processors_[index];
+      if (!processor.check) { continue; }
+
+      if (processor.state == kFrames) {
+        while (processor.frame < 6 &&
+               processor.queue_sizes[processor.frame] == 0) {
+          processor.frame++;
+        }
+        if (processor.frame < 6) {
+          // Is there any room?  The frame stays queued otherwise.
+          if (!rx_->Reserve()) { return; }
+          // Larger sizes are malformed.  Lets just read the maximum size.
+          read_size_ =
+              std::min<int>(processor.queue_sizes[processor.frame], 64 + 5);
+          spi_->StartRead(processor.cs, 3,
+                          reinterpret_cast<char*>(&buf_[0]), read_size_);
+          active_ = index;
+          next_processor_ = index + 1;
+          return;
+        }
+        // Everything that was queued has been read, look for more
+        // straight away.
+        processor.state = kIdle;
+        processor.next_poll = now;
+      }
+
+      if (processor.state == kIdle && now >= processor.next_poll) {
+        spi_->StartRead(processor.cs, 2,
+                        reinterpret_cast<char*>(&processor.queue_sizes[0]),
+                        sizeof(processor.queue_sizes));
+        processor.state = kQueueSizes;
+        active_ = index;
+        next_processor_ = index + 1;
+        return;
+      }
+    }
+  }
+
+  Spi* const spi_;
+  std::vector<Processor> processors_;
+
+  CanRxBuffer* rx_ = nullptr;
+  int64_t start_ns_ = 0;
+
+  // This is a member variable purely so that in steady state we don't
+  // have to allocate memory.
+  std::vector<Write> writes_;
+  std::vector<Reply> replies_;
+  size_t write_index_ = 0;
+  bool reading_ = false;
+
+  // The processor whose read is in progress, or -1.
+  int active_ = -1;
+  size_t next_processor_ = 0;
+
+  // Purposefully not initialized for speed.
+  uint8_t buf_[70];
+  int read_size_ = 0;
+};
+
+}
+}
+
+#endif
@@ -15,19 +15,24 @@
 // We purposefully don't use the full path here so that this file can
 // be compiled in a wide range of build configurations.
 #include "pi3hat.h"
+#include "can_spi_lane.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdlib>
+#include <initializer_list>
+#include <limits>
 #include <fstream>
 #include <memory>
 #include <sstream>
@@ -49,26 +54,6 @@ namespace {
 ///////////////////////////////////////////////
 /// Random utility functions
 
-size_t RoundUpDlc(size_t value) {
-  if (value == 0) { return 0; }
-  if (value == 1) { return 1; }
-  if (value == 2) { return 2; }
-  if (value == 3) { return 3; }
-  if (value == 4) { return 4; }
-  if (value == 5) { return 5; }
-  if (value == 6) { return 6; }
-  if (value == 7) { return 7; }
-  if (value == 8) { return 8; }
-  if (value <= 12) { return 12; }
-  if (value <= 16) { return 16; }
-  if (value <= 20) { return 20; }
-  if (value <= 24) { return 24; }
-  if (value <= 32) { return 32; }
-  if (value <= 48) { return 48; }
-  if (value <= 64) { return 64; }
-  return 0;
-}
-
 char g_format_buf[2048] = {};
 
 const char* Format(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -101,18 +86,7 @@ void ThrowIfErrno(bool value, const std::string& message = "") {
   throw Error(message + " : " + std::string(g_error_buf));
 }
 
-int64_t GetNow() {
-  struct timespec ts = {};
-  ::clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-  return static_cast<int64_t>(ts.tv_sec) * 1000000000ll +
-      static_cast<int64_t>(ts.tv_nsec);
-}
-
-void BusyWaitUs(int64_t us) {
-  // We wait to ensure that setup and hold times are properly
-  // enforced.  Allowing data stores and loads to be re-ordered around
-  // the wait would defeat their purpose.  Thus, use barriers to force
-  // a complete synchronization event on either side of our waits.
+void MemoryBarrier() {
 #ifdef __ARM_ARCH_ISA_A64
   asm volatile("dsb sy");
 #elif defined(__ARM_ARCH_7A__)
@@ -122,22 +96,50 @@ void BusyWaitUs(int64_t us) {
 #else
 # error "Unknown architecture"
 #endif
+}
+
+void BusyWaitUs(int64_t us) {
+  // We wait to ensure that setup and hold times are properly
+  // enforced.  Allowing data stores and loads to be re-ordered around
+  // the wait would defeat their purpose.  Thus, use barriers to force
+  // a complete synchronization event on either side of our waits.
+  MemoryBarrier();
 
   const auto start = GetNow();
   const auto end = start + us * 1000;
   while (GetNow() <= end);
 
-#ifdef __ARM_ARCH_ISA_A64
-  asm volatile("dsb sy");
-#elif defined(__ARM_ARCH_7A__)
-  asm volatile("dsb");
-#elif defined(__ARM_ARCH_8A__)
-  asm volatile("dsb");
-#else
-# error "Unknown architecture"
-#endif
+  MemoryBarrier();
 }
 
+/// The time from deasserting to asserting a chip select, and from
+/// asserting it to sending the address, and from the address to the
+/// data.
+struct SpiHoldTimes {
+  int cs_hold_ns = 0;
+  int address_hold_ns = 0;
+};
+
+/// A setup or hold time which is waited out without blocking.  It
+/// has the same barriers as BusyWaitUs.
+class HoldTimer {
+ public:
+  void Start(int64_t ns) {
+    MemoryBarrier();
+    end_ = GetNow() + ns;
+  }
+
+  /// Returns true once the time has passed.
+  bool Expired() {
+    if (GetNow() <= end_) { return false; }
+    MemoryBarrier();
+    return true;
+  }
+
+ private:
+  int64_t end_ = 0;
+};
+
 std::string ReadContents(const std::string& filename) {
   std::ifstream inf(filename);
   std::ostringstream ostr;
@@ -301,6 +303,234 @@ constexpr uint32_t SPI_CS_TA = 1 << 7;
 constexpr uint32_t SPI_CS_DONE = 1 << 16;
 constexpr uint32_t SPI_CS_RXD = 1 << 17;
 constexpr uint32_t SPI_CS_TXD = 1 << 18;
+constexpr uint32_t SPI_CS_DMAEN = 1 << 8;
+
+/// The FIFO register of SPI0 as seen by the DMA engine.
+constexpr uint32_t kSpiFifoBusAddress = 0x7e000000 + SPI_BASE + 0x04;
+
+/// Memory allocated from the VideoCore through the mailbox property
+/// interface.  It is physically contiguous and not cached by the ARM,
+/// so that the DMA engine and the CPU see the same data.
+class VcMemory {
+ public:
+  VcMemory(int dev_mem_fd, uint32_t size) {
+    mbox_ = ::open("/dev/vcio", 0);
+    ThrowIfErrno(mbox_ < 0, "pi3hat: could not open /dev/vcio");
+
+    handle_ = Property(kAllocate, size, 4096, kMemFlagDirect);
+    ThrowIf(handle_ == 0, []() {
+        return "pi3hat: could not allocate VideoCore memory"; });
+    bus_address_ = Property(kLock, handle_);
+    ThrowIf(bus_address_ == 0, []() {
+        return "pi3hat: could not lock VideoCore memory"; });
+
+    mmap_ = SystemMmap(dev_mem_fd, size, bus_address_ & ~0xc0000000);
+  }
+
+  ~VcMemory() {
+    mmap_ = SystemMmap();
+    if (bus_address_ != 0) { Property(kUnlock, handle_); }
+    if (handle_ != 0) { Property(kRelease, handle_); }
+  }
+
+  VcMemory(const VcMemory&) = delete;
+  VcMemory& operator=(const VcMemory&) = delete;
+
+  /// The memory must only be accessed with aligned 32 bit loads and
+  /// stores, as it is mapped as device memory.
+  volatile uint32_t* word(uint32_t offset) {
+    return reinterpret_cast<volatile uint32_t*>(
+        static_cast<char*>(mmap_.ptr()) + offset);
+  }
+
+  uint32_t bus_address(uint32_t offset) const { return bus_address_ + offset; }
+
+ private:
+  static constexpr uint32_t kAllocate = 0x3000c;
+  static constexpr uint32_t kLock = 0x3000d;
+  static constexpr uint32_t kUnlock = 0x3000e;
+  static constexpr uint32_t kRelease = 0x3000f;
+
+  // Uncached, at the 0xc0000000 bus alias.
+  static constexpr uint32_t kMemFlagDirect = 1 << 2;
+
+  uint32_t Property(uint32_t tag, uint32_t a, uint32_t b = 0, uint32_t c = 0) {
+    uint32_t message[9] = {
+      sizeof(message),
+      0,  // process request
+      tag,
+      12,  // value buffer size
+      12,  // request size
+      a, b, c,
+      0,  // end tag
+    };
+    ThrowIfErrno(::ioctl(mbox_, _IOWR(100, 0, char*), message) < 0,
+                 "pi3hat: mailbox property request failed");
+    return message[5];
+  }
+
+  SystemFd mbox_;
+  uint32_t handle_ = 0;
+  uint32_t bus_address_ = 0;
+  SystemMmap mmap_;
+};
+
+/// Moves the data of a PrimarySpi transfer with two DMA channels, one
+/// feeding the TX FIFO and one draining the RX FIFO, as described in
+/// section 10.6.3 of the BCM2835 ARM Peripherals datasheet.
+class SpiDma {
+ public:
+  static constexpr size_t kMaxSize = 1024;
+
+  SpiDma(int dev_mem_fd, int tx_channel, int rx_channel)
+      : memory_(dev_mem_fd, 4096) {
+    // Channels 11 and up differ between the BCM2835/6/7 and the
+    // BCM2711, and 15 is elsewhere.
+    for (const int channel : {tx_channel, rx_channel}) {
+      ThrowIf(channel < 0 || channel > 10, [&]() {
+          return Format("pi3hat: DMA channel %d is not in 0-10", channel); });
+    }
+    ThrowIf(tx_channel == rx_channel, []() {
+        return "pi3hat: the SPI DMA channels must differ"; });
+
+    dma_mmap_ = SystemMmap(
+        dev_mem_fd, 4096, bcm_host_get_peripheral_address() + DMA_BASE);
+    char* const base = static_cast<char*>(dma_mmap_.ptr());
+    tx_ = reinterpret_cast<volatile Bcm2835DmaChannel*>(base + 0x100 * tx_channel);
+    rx_ = reinterpret_cast<volatile Bcm2835DmaChannel*>(base + 0x100 * rx_channel);
+
+    auto* const enable = reinterpret_cast<volatile uint32_t*>(base + 0xff0);
+    *enable = *enable | (1 << tx_channel) | (1 << rx_channel);
+    Reset(tx_);
+    Reset(rx_);
+  }
+
+  ~SpiDma() {
+    Reset(tx_);
+    Reset(rx_);
+  }
+
+  SpiDma(const SpiDma&) = delete;
+  SpiDma& operator=(const SpiDma&) = delete;
+
+  /// Start a transfer of @p size bytes, at most kMaxSize, sending
+  /// @p data, or zeros if it is null.  SPI0 must have DMAEN set and
+  /// TA clear, the first word sent sets DLEN and TA.
+  void Start(const char* data, size_t size) {
+    const uint32_t words = (size + 3) / 4;
+
+    volatile uint32_t* const tx = memory_.word(kTxOffset);
+    tx[0] = (size << 16) | SPI_CS_TA;
+    for (uint32_t i = 0; i < words; i++) {
+      uint32_t value = 0;
+      if (data) {
+        for (uint32_t j = 0; j < 4 && i * 4 + j < size; j++) {
+          value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i * 4 + j])) << (8 * j);
+        }
+      }
+      tx[1 + i] = value;
+    }
+
+    WriteControlBlock(
+        kTxControlBlock,
+        kTiWaitResp | kTiDestDreq | kTiSrcInc | kTiPermap(kPermapSpiTx),
+        memory_.bus_address(kTxOffset), kSpiFifoBusAddress, 4 * (words + 1));
+    WriteControlBlock(
+        kRxControlBlock,
+        kTiWaitResp | kTiSrcDreq | kTiDestInc | kTiPermap(kPermapSpiRx),
+        kSpiFifoBusAddress, memory_.bus_address(kRxOffset), 4 * words);
+
+    // The control blocks must be in memory before the engine reads
+    // them.
+    MemoryBarrier();
+    Activate(rx_, kRxControlBlock);
+    Activate(tx_, kTxControlBlock);
+  }
+
+  /// Returns true once everything has been received.
+  bool Done() {
+    if ((rx_->cs & kCsEnd) == 0) { return false; }
+    MemoryBarrier();
+    return true;
+  }
+
+  /// Copy the @p size bytes received into @p data.
+  void Received(char* data, size_t size) {
+    volatile uint32_t* const rx = memory_.word(kRxOffset);
+    for (size_t i = 0; i < size; i += 4) {
+      const uint32_t value = rx[i / 4];
+      for (size_t j = 0; j < 4 && i + j < size; j++) {
+        data[i + j] = (value >> (8 * j)) & 0xff;
+      }
+    }
+  }
+
+ private:
+  static constexpr uint32_t DMA_BASE = 0x00007000;
+
+  // Offsets into memory_.  Control blocks are 32 byte aligned.
+  static constexpr uint32_t kTxControlBlock = 0;
+  static constexpr uint32_t kRxControlBlock = 32;
+  static constexpr uint32_t kTxOffset = 256;
+  static constexpr uint32_t kRxOffset = 2048;
+
+  static constexpr uint32_t kCsActive = 1 << 0;
+  static constexpr uint32_t kCsEnd = 1 << 1;
+  static constexpr uint32_t kCsReset = 1u << 31;
+
+  static constexpr uint32_t kTiWaitResp = 1 << 3;
+  static constexpr uint32_t kTiDestInc = 1 << 4;
+  static constexpr uint32_t kTiDestDreq = 1 << 6;
+  static constexpr uint32_t kTiSrcInc = 1 << 8;
+  static constexpr uint32_t kTiSrcDreq = 1 << 10;
+  static constexpr uint32_t kTiPermap(uint32_t peripheral) { return peripheral << 16; }
+
+  static constexpr uint32_t kPermapSpiTx = 6;
+  static constexpr uint32_t kPermapSpiRx = 7;
+
+  // This is the memory layout of one DMA channel.
+  struct Bcm2835DmaChannel {
+    uint32_t cs;
+    uint32_t conblk_ad;
+    uint32_t ti;
+    uint32_t source_ad;
+    uint32_t dest_ad;
+    uint32_t txfr_len;
+    uint32_t stride;
+    uint32_t nextconbk;
+    uint32_t debug;
+  };
+
+  void WriteControlBlock(uint32_t offset, uint32_t ti, uint32_t source,
+                         uint32_t dest, uint32_t length) {
+    volatile uint32_t* const block = memory_.word(offset);
+    block[0] = ti;
+    block[1] = source;
+    block[2] = dest;
+    block[3] = length;
+    block[4] = 0;  // stride
+    block[5] = 0;  // next control block
+    block[6] = 0;
+    block[7] = 0;
+  }
+
+  void Activate(volatile Bcm2835DmaChannel* channel, uint32_t control_block) {
+    channel->debug = 7;  // clear errors
+    channel->conblk_ad = memory_.bus_address(control_block);
+    channel->cs = kCsEnd | kCsActive;  // writing END clears it
+  }
+
+  static void Reset(volatile Bcm2835DmaChannel* channel) {
+    channel->cs = kCsReset;
+    BusyWaitUs(10);
+    channel->cs = kCsEnd;
+  }
+
+  VcMemory memory_;
+  SystemMmap dma_mmap_;
+  volatile Bcm2835DmaChannel* tx_ = nullptr;
+  volatile Bcm2835DmaChannel* rx_ = nullptr;
+};
 
 
 /// This class interacts with the SPI0 device on a raspberry pi using
@@ -317,13 +547,29 @@ class PrimarySpi {
     // (and <1 us of wall clock time has actually passed as measured
     // by an oscilloscope).  This doesn't seem to be a problem on the
     // armv7l kernel.
-    int cs_hold_us = 3;
-    int address_hold_us = 3;
+    //
+    // These are the conservative values, which CalibrateHoldTimes can
+    // reduce, see set_hold_ns().
+    int cs_hold_ns = 3000;
+    int address_hold_ns = 3000;
+
+    // If true, the data after the address byte is moved by the DMA
+    // engine, leaving the CPU free while it is sent.  The channels
+    // must not be used by anything else.
+    bool dma = false;
+    int dma_tx_channel = 9;
+    int dma_rx_channel = 10;
+
+    // Shorter transfers use the FIFO directly, as setting up the DMA
+    // costs more than it saves.
+    size_t dma_min_size = 16;
 
     Options() {}
   };
 
-  PrimarySpi(const Options& options = Options()) {
+  PrimarySpi(const Options& options = Options())
+      : options_(options),
+        hold_times_{options.cs_hold_ns, options.address_hold_ns} {
     fd_ = ::open("/dev/mem", O_RDWR | O_SYNC);
     ThrowIfErrno(fd_ < 0, "pi3hat: could not open /dev/mem");
 
@@ -368,6 +614,11 @@ class PrimarySpi {
     const int clkdiv =
         std::max(0, std::min(65535, 400000000 / options.speed_hz));
     spi_->clk = clkdiv;
+
+    if (options_.dma) {
+      dma_.reset(new SpiDma(
+          fd_, options_.dma_tx_channel, options_.dma_rx_channel));
+    }
   }
 
   ~PrimarySpi() {}
@@ -380,81 +631,100 @@ class PrimarySpi {
   }
 
   void Write(int cs, int address, const char* data, size_t size) {
-    BusyWaitUs(options_.cs_hold_us);
-    Rpi3Gpio::ActiveLow cs_holder(gpio_.get(), kSpi0CS[cs]);
-    BusyWaitUs(options_.cs_hold_us);
-
-    spi_->cs = (spi_->cs | (SPI_CS_TA | (3 << 4)));  // CLEAR
-
-    spi_->fifo = address & 0xff;
+    StartWrite(cs, address, data, size);
+    while (!Poll());
+  }
 
-    // We are done when we have received one byte back.
-    while ((spi_->cs & SPI_CS_RXD) == 0);
-    (void) spi_->fifo;
+  void Read(int cs, int address, char* data, size_t size) {
+    StartRead(cs, address, data, size);
+    while (!Poll());
+  }
 
-    if (size != 0) {
-      // Wait our address hold time.
-      BusyWaitUs(options_.address_hold_us);
+  /// Begin a transfer, which is advanced by Poll().  @p data must
+  /// remain valid until it is complete.
+  void StartWrite(int cs, int address, const char* data, size_t size) {
+    Start(false, cs, address, data, nullptr, size);
+  }
 
-      size_t offset = 0;
-      while (offset < size) {
-        while ((spi_->cs & SPI_CS_TXD) == 0);
-        spi_->fifo =  data[offset];
-        offset++;
-      }
+  void StartRead(int cs, int address, char* data, size_t size) {
+    Start(true, cs, address, nullptr, data, size);
+  }
 
-      // Wait until we are no longer busy.
-      while ((spi_->cs & SPI_CS_DONE) == 0) {
-        if (spi_->cs & SPI_CS_RXD) {
+  /// Do as much of the current transfer as can be done without
+  /// waiting.  Returns true once it is complete, or if there is none.
+  bool Poll() {
+    while (true) {
+      switch (state_) {
+        case kIdle: {
+          return true;
+        }
+        case kCsSetup: {
+          // Only the processor which was just deselected needs to
+          // see its chip select high for the setup time.
+          if (cs_ == released_cs_ && !hold_.Expired()) { return false; }
+          gpio_->SetGpioOutput(kSpi0CS[cs_], false);
+          hold_.Start(hold_times_.cs_hold_ns);
+          state_ = kCsHold;
+          break;
+        }
+        case kCsHold: {
+          if (!hold_.Expired()) { return false; }
+          spi_->cs = (spi_->cs | (SPI_CS_TA | (3 << 4)));  // CLEAR
+          spi_->fifo = address_ & 0xff;
+          state_ = kAddress;
+          break;
+        }
+        case kAddress: {
+          // We are done when we have received one byte back.
+          if ((spi_->cs & SPI_CS_RXD) == 0) { return false; }
           (void) spi_->fifo;
+          if (size_ == 0) {
+            Finish();
+            return true;
+          }
+          // Wait our address hold time.
+          hold_.Start(hold_times_.address_hold_ns);
+          state_ = kAddressHold;
+          break;
+        }
+        case kAddressHold: {
+          if (!hold_.Expired()) { return false; }
+          if (dma_ && size_ >= options_.dma_min_size &&
+              size_ <= SpiDma::kMaxSize) {
+            // The first word from the DMA engine sets TA again.
+            spi_->cs = ((spi_->cs & (~SPI_CS_TA)) |
+                        SPI_CS_DMAEN | (3 << 4));  // CLEAR
+            dma_->Start(read_ ? nullptr : write_data_, size_);
+            state_ = kDmaData;
+          } else {
+            state_ = kData;
+          }
+          break;
+        }
+        case kData: {
+          if (!(read_ ? PollReadData() : PollWriteData())) {
+            return false;
+          }
+          Finish();
+          return true;
+        }
+        case kDmaData: {
+          if (!dma_->Done()) { return false; }
+          if (read_) { dma_->Received(read_data_, size_); }
+          Finish();
+          return true;
         }
       }
     }
-
-    spi_->cs = (spi_->cs & (~SPI_CS_TA));
   }
 
-  void Read(int cs, int address, char* data, size_t size) {
-    BusyWaitUs(options_.cs_hold_us);
-    Rpi3Gpio::ActiveLow cs_holder(gpio_.get(), kSpi0CS[cs]);
-    BusyWaitUs(options_.cs_hold_us);
-
-    spi_->cs = (spi_->cs | (SPI_CS_TA | (3 << 4)));  // CLEAR
-
-    spi_->fifo = (address & 0x00ff);
-
-    // We are done when we have received one byte back.
-    while ((spi_->cs & SPI_CS_RXD) == 0);
-    (void) spi_->fifo;
-
-    if (size != 0) {
-      // Wait our address hold time.
-      BusyWaitUs(options_.address_hold_us);
-
-      // Now we write out dummy values, reading values in.
-      std::size_t remaining_read = size;
-      std::size_t remaining_write = remaining_read;
-      char* ptr = data;
-      while (remaining_read) {
-        // Make sure we don't write more than we have read spots remaining
-        // so that we can never overflow the RX fifo.
-        const bool can_write = (remaining_read - remaining_write) < 16;
-        if (can_write &&
-            remaining_write && (spi_->cs & SPI_CS_TXD) != 0) {
-          spi_->fifo = 0x00;
-          remaining_write--;
-        }
+  bool idle() const { return state_ == kIdle; }
 
-        if (remaining_read && (spi_->cs & SPI_CS_RXD) != 0) {
-          *ptr = spi_->fifo & 0xff;
-          ptr++;
-          remaining_read--;
-        }
-      }
-    }
+  const Options& options() const { return options_; }
 
-    spi_->cs = (spi_->cs & (~SPI_CS_TA));
-  }
+  /// Replace the hold times from Options.
+  void set_hold_times(const SpiHoldTimes& hold_times) { hold_times_ = hold_times; }
+  const SpiHoldTimes& hold_times() const { return hold_times_; }
 
  private:
   // This is the memory layout of the SPI peripheral.
@@ -467,12 +737,107 @@ class PrimarySpi {
     uint32_t dc;
   };
 
+  enum State {
+    kIdle,
+    kCsSetup,
+    kCsHold,
+    kAddress,
+    kAddressHold,
+    kData,
+    kDmaData,
+  };
+
+  void Start(bool read, int cs, int address,
+             const char* write_data, char* read_data, size_t size) {
+    if (state_ != kIdle) {
+      throw Error("pi3hat: SPI transfer already in progress");
+    }
+    read_ = read;
+    cs_ = cs;
+    address_ = address;
+    write_data_ = write_data;
+    read_data_ = read_data;
+    size_ = size;
+    remaining_read_ = size;
+    remaining_write_ = size;
+    // The setup time started when the previous transfer finished.
+    state_ = kCsSetup;
+  }
+
+  bool PollWriteData() {
+    while (remaining_write_) {
+      if ((spi_->cs & SPI_CS_TXD) == 0) { return false; }
+      spi_->fifo = write_data_[size_ - remaining_write_];
+      remaining_write_--;
+    }
+
+    // Wait until we are no longer busy.
+    while ((spi_->cs & SPI_CS_DONE) == 0) {
+      if ((spi_->cs & SPI_CS_RXD) == 0) { return false; }
+      (void) spi_->fifo;
+    }
+    return true;
+  }
+
+  bool PollReadData() {
+    // Now we write out dummy values, reading values in.
+    while (remaining_read_) {
+      bool progress = false;
+
+      // Make sure we don't write more than we have read spots remaining
+      // so that we can never overflow the RX fifo.
+      const bool can_write = (remaining_read_ - remaining_write_) < 16;
+      if (can_write &&
+          remaining_write_ && (spi_->cs & SPI_CS_TXD) != 0) {
+        spi_->fifo = 0x00;
+        remaining_write_--;
+        progress = true;
+      }
+
+      if ((spi_->cs & SPI_CS_RXD) != 0) {
+        read_data_[size_ - remaining_read_] = spi_->fifo & 0xff;
+        remaining_read_--;
+        progress = true;
+      }
+
+      if (!progress) { return false; }
+    }
+    return true;
+  }
+
+  void Finish() {
+    spi_->cs = (spi_->cs & (~(SPI_CS_TA | SPI_CS_DMAEN)));
+    gpio_->SetGpioOutput(kSpi0CS[cs_], true);
+    released_cs_ = cs_;
+    hold_.Start(hold_times_.cs_hold_ns);
+    state_ = kIdle;
+  }
+
   const Options options_;
   SystemFd fd_;
   SystemMmap spi_mmap_;
   volatile Bcm2835Spi* spi_ = nullptr;
 
   std::unique_ptr<Rpi3Gpio> gpio_;
+  std::unique_ptr<SpiDma> dma_;
+
+  SpiHoldTimes hold_times_;
+
+  // The transfer in progress.
+  State state_ = kIdle;
+  HoldTimer hold_;
+  bool read_ = false;
+  int cs_ = 0;
+  int address_ = 0;
+  const char* write_data_ = nullptr;
+  char* read_data_ = nullptr;
+  size_t size_ = 0;
+  size_t remaining_read_ = 0;
+  size_t remaining_write_ = 0;
+
+  // The chip select most recently deasserted, whose setup time hold_
+  // measures while idle.
+  int released_cs_ = -1;
 };
 
 constexpr uint32_t AUX_BASE           = 0x00215000;
@@ -500,15 +865,17 @@ class AuxSpi {
     int speed_hz = 10000000;
     // We actually only need hold times of around 3us, these are
     // larger for the same reasons as in PrimarySpi.
-    int cs_hold_us = 3;
-    int address_hold_us = 3;
+    int cs_hold_ns = 3000;
+    int address_hold_ns = 3000;
 
     Options() {}
   };
 
   static constexpr int kPack = 3;
 
-  AuxSpi(const Options& options = Options()) {
+  AuxSpi(const Options& options = Options())
+      : options_(options),
+        hold_times_{options.cs_hold_ns, options.address_hold_ns} {
     fd_ = ::open("/dev/mem", O_RDWR | O_SYNC);
     ThrowIfErrno(fd_ < 0, "rpi3_aux_spi: could not open /dev/mem");
 
@@ -579,36 +946,150 @@ class AuxSpi {
   AuxSpi& operator=(const AuxSpi&) = delete;
 
   void Write(int cs, int address, const char* data, size_t size) {
-    BusyWaitUs(options_.cs_hold_us);
-    Rpi3Gpio::ActiveLow cs_holder(gpio_.get(), kSpi1CS[cs]);
-    BusyWaitUs(options_.cs_hold_us);
+    StartWrite(cs, address, data, size);
+    while (!Poll());
+  }
 
-    const uint32_t value =
-        0
-        | (0 << 29) // CS
-        | (8 << 24) // data width
-        | ((address & 0xff) << 16) // data
-        ;
+  void Read(int cs, int address, char* data, size_t size) {
+    StartRead(cs, address, data, size);
+    while (!Poll());
+  }
 
-    if (size != 0) {
-      spi_->txhold = value;
-    } else {
-      spi_->io = value;
+  /// Begin a transfer, which is advanced by Poll().  @p data must
+  /// remain valid until it is complete.
+  void StartWrite(int cs, int address, const char* data, size_t size) {
+    Start(false, cs, address, data, nullptr, size);
+  }
+
+  void StartRead(int cs, int address, char* data, size_t size) {
+    Start(true, cs, address, nullptr, data, size);
+  }
+
+  /// Do as much of the current transfer as can be done without
+  /// waiting.  Returns true once it is complete, or if there is none.
+  bool Poll() {
+    while (true) {
+      switch (state_) {
+        case kIdle: {
+          return true;
+        }
+        case kCsSetup: {
+          // Only the processor which was just deselected needs to
+          // see its chip select high for the setup time.
+          if (cs_ == released_cs_ && !hold_.Expired()) { return false; }
+          gpio_->SetGpioOutput(kSpi1CS[cs_], false);
+          hold_.Start(hold_times_.cs_hold_ns);
+          state_ = kCsHold;
+          break;
+        }
+        case kCsHold: {
+          if (!hold_.Expired()) { return false; }
+          const uint32_t value =
+              0
+              | (0 << 29) // CS
+              | (8 << 24) // data width
+              | ((address_ & 0xff) << 16) // data
+              ;
+
+          if (size_ != 0) {
+            spi_->txhold = value;
+          } else {
+            spi_->io = value;
+          }
+          state_ = kAddress;
+          break;
+        }
+        case kAddress: {
+          const auto stat = spi_->stat;
+          if ((stat & AUXSPI_STAT_TX_EMPTY) == 0) { return false; }
+          if (read_ && (stat & AUXSPI_STAT_BUSY) != 0) { return false; }
+          if (size_ == 0) {
+            Finish();
+            return true;
+          }
+          // Wait our address hold time.
+          hold_.Start(hold_times_.address_hold_ns);
+          state_ = kAddressHold;
+          break;
+        }
+        case kAddressHold: {
+          if (!hold_.Expired()) { return false; }
+          if (read_) {
+            // Discard the rx fifo.
+            while ((spi_->stat & AUXSPI_STAT_RX_EMPTY) == 0) {
+              (void) spi_->io;
+            }
+          }
+          state_ = kData;
+          break;
+        }
+        case kData: {
+          if (!(read_ ? PollReadData() : PollWriteData())) {
+            return false;
+          }
+          Finish();
+          return true;
+        }
+      }
     }
+  }
 
-    while ((spi_->stat & AUXSPI_STAT_TX_EMPTY) == 0);
+  bool idle() const { return state_ == kIdle; }
 
-    if (size == 0) { return; }
+  const Options& options() const { return options_; }
 
-    // Wait our address hold time.
-    BusyWaitUs(options_.address_hold_us);
+  /// Replace the hold times from Options.
+  void set_hold_times(const SpiHoldTimes& hold_times) { hold_times_ = hold_times; }
+  const SpiHoldTimes& hold_times() const { return hold_times_; }
 
-    size_t offset = 0;
-    while (offset < size) {
-      while (spi_->stat & AUXSPI_STAT_TX_FULL);
+ private:
+  // This is the memory layout of the SPI peripheral.
+  struct Bcm2835AuxSpi {
+    uint32_t cntl0;
+    uint32_t cntl1;
+    uint32_t stat;
+    uint32_t peek;
+    uint32_t ign1[4];
+    uint32_t io;
+    uint32_t ign2;
+    uint32_t ign3;
+    uint32_t ign4;
+    uint32_t txhold;
+  };
 
-      const size_t remaining = size - offset;
-      const size_t to_write = std::min<size_t>(remaining, kPack);
+  enum State {
+    kIdle,
+    kCsSetup,
+    kCsHold,
+    kAddress,
+    kAddressHold,
+    kData,
+  };
+
+  void Start(bool read, int cs, int address,
+             const char* write_data, char* read_data, size_t size) {
+    if (state_ != kIdle) {
+      throw Error("rpi3_aux_spi: SPI transfer already in progress");
+    }
+    read_ = read;
+    cs_ = cs;
+    address_ = address;
+    write_data_ = write_data;
+    read_data_ = read_data;
+    size_ = size;
+    remaining_read_ = size;
+    remaining_write_ = size;
+    // The setup time started when the previous transfer finished.
+    state_ = kCsSetup;
+  }
+
+  bool PollWriteData() {
+    while (remaining_write_) {
+      if (spi_->stat & AUXSPI_STAT_TX_FULL) { return false; }
+
+      const size_t offset = size_ - remaining_write_;
+      const size_t to_write = std::min<size_t>(remaining_write_, kPack);
+      const char* const data = write_data_;
 
       // The Auxiliary SPI controller inserts a small dead time
       // between each FIFO entry, even if the FIFO is all full up.
@@ -630,12 +1111,12 @@ class AuxSpi {
         return 0;
       }();
 
-      if (offset + to_write == size) {
+      remaining_write_ -= to_write;
+      if (remaining_write_ == 0) {
         spi_->io = data_value;
       } else {
         spi_->txhold = data_value;
       }
-      offset += to_write;
     }
 
     // Discard anything in the RX fifo.
@@ -644,74 +1125,42 @@ class AuxSpi {
     }
 
     // Wait until we are no longer busy.
-    while (spi_->stat & AUXSPI_STAT_BUSY);
+    return (spi_->stat & AUXSPI_STAT_BUSY) == 0;
   }
 
-  void Read(int cs, int address, char* data, size_t size) {
-    BusyWaitUs(options_.cs_hold_us);
-    Rpi3Gpio::ActiveLow cs_holder(gpio_.get(), kSpi1CS[cs]);
-    BusyWaitUs(options_.cs_hold_us);
-
-    const uint32_t value = 0
-                           | (0 << 29) // CS
-                           | (8 << 24) // data width
-                           | ((address & 0xff) << 16) // data
-                           ;
-    if (size != 0) {
-      spi_->txhold = value;
-    } else {
-      spi_->io = value;
-    }
-
-    while (true) {
-      const auto stat = spi_->stat;
-      if ((stat & AUXSPI_STAT_BUSY) == 0 &&
-          (stat & AUXSPI_STAT_TX_EMPTY) != 0) {
-        break;
-      }
-    }
-
-    if (size == 0) { return; }
-
-    // Wait our address hold time.
-    BusyWaitUs(options_.address_hold_us);
-
-    // Discard the rx fifo.
-    while ((spi_->stat & AUXSPI_STAT_RX_EMPTY) == 0) {
-      (void) spi_->io;
-    }
-
+  bool PollReadData() {
     // Now we write out dummy values, reading values in.
-    std::size_t remaining_read = size;
-    std::size_t remaining_write = remaining_read;
-    char* ptr = data;
-    while (remaining_read) {
+    while (remaining_read_) {
+      bool progress = false;
+
       // Make sure we don't write more than we have read spots remaining
       // so that we can never overflow the RX fifo.
-      const bool can_write = (remaining_read - remaining_write) < (3 * kPack);
+      const bool can_write = (remaining_read_ - remaining_write_) < (3 * kPack);
       const uint32_t cur_stat = spi_->stat;
       const bool tx_full = (cur_stat & AUXSPI_STAT_TX_FULL) != 0;
 
-      if (can_write && remaining_write && !tx_full) {
-        const size_t to_read = std::min<size_t>(remaining_write, kPack);
+      if (can_write && remaining_write_ && !tx_full) {
+        const size_t to_read = std::min<size_t>(remaining_write_, kPack);
         const uint32_t to_write =
             0
             | (0 << 29) // CS
             | ((8 * to_read) << 24) // data width
             | (0) // data
             ;
-        remaining_write -= to_read;
-        if (remaining_write == 0) {
+        remaining_write_ -= to_read;
+        if (remaining_write_ == 0) {
           spi_->io = to_write;
         } else {
           spi_->txhold = to_write;
         }
+        progress = true;
       }
 
-      if (remaining_read && (spi_->stat & AUXSPI_STAT_RX_EMPTY) == 0) {
+      if ((spi_->stat & AUXSPI_STAT_RX_EMPTY) == 0) {
         const uint32_t value = spi_->io;
 
-        const size_t byte_count = std::min<size_t>(remaining_read, kPack);
+        char* ptr = &read_data_[size_ - remaining_read_];
+        const size_t byte_count = std::min<size_t>(remaining_read_, kPack);
         switch (byte_count) {
           case 3:
             *ptr++ = (value >> 16) & 0xff;
@@ -722,25 +1171,21 @@ class AuxSpi {
           case 1:
             *ptr++ = (value >> 0) & 0xff;
         }
-        remaining_read -= byte_count;
+        remaining_read_ -= byte_count;
+        progress = true;
       }
+
+      if (!progress) { return false; }
     }
+    return true;
   }
 
- private:
-  // This is the memory layout of the SPI peripheral.
-  struct Bcm2835AuxSpi {
-    uint32_t cntl0;
-    uint32_t cntl1;
-    uint32_t stat;
-    uint32_t peek;
-    uint32_t ign1[4];
-    uint32_t io;
-    uint32_t ign2;
-    uint32_t ign3;
-    uint32_t ign4;
-    uint32_t txhold;
-  };
+  void Finish() {
+    gpio_->SetGpioOutput(kSpi1CS[cs_], true);
+    released_cs_ = cs_;
+    hold_.Start(hold_times_.cs_hold_ns);
+    state_ = kIdle;
+  }
 
   const Options options_;
   SystemFd fd_;
@@ -749,6 +1194,24 @@ class AuxSpi {
   volatile Bcm2835AuxSpi* spi_ = nullptr;
 
   std::unique_ptr<Rpi3Gpio> gpio_;
+
+  SpiHoldTimes hold_times_;
+
+  // The transfer in progress.
+  State state_ = kIdle;
+  HoldTimer hold_;
+  bool read_ = false;
+  int cs_ = 0;
+  int address_ = 0;
+  const char* write_data_ = nullptr;
+  char* read_data_ = nullptr;
+  size_t size_ = 0;
+  size_t remaining_read_ = 0;
+  size_t remaining_write_ = 0;
+
+  // The chip select most recently deasserted, whose setup time hold_
+  // measures while idle.
+  int released_cs_ = -1;
 };
 
 ///////////////////////////////////////////////
@@ -894,6 +1357,129 @@ Pi3Hat::PerformanceInfo GetPerformance(Spi* spi, int cs) {
   result.min_cycles_per_ms = dp.min_cycles_per_ms;
   return result;
 }
+
+/// Finds the smallest hold times with which the processors on
+/// @p chip_selects of @p spi return their device info unchanged, and
+/// adds a margin.
+///
+/// The info read with the hold times from Options, which are
+/// conservative, is the reference.  Each hold time is reduced in
+/// steps, with the other at its conservative value, until a read
+/// differs.  The combination, with the margin, must then pass again,
+/// otherwise the conservative values are kept.
+template <typename Spi>
+class HoldTimeCalibration {
+ public:
+  HoldTimeCalibration(Spi* spi, std::initializer_list<int> chip_selects)
+      : spi_(spi),
+        conservative_{spi->options().cs_hold_ns, spi->options().address_hold_ns} {
+    spi_->set_hold_times(conservative_);
+    for (const int cs : chip_selects) {
+      Reference reference;
+      reference.cs = cs;
+      spi_->Read(cs, 97, reinterpret_cast<char*>(&reference.info),
+                 sizeof(reference.info));
+      references_.push_back(reference);
+    }
+  }
+
+  /// The firmware and serial numbers of the processors, to know if
+  /// cached hold times still apply.
+  std::string key() const {
+    std::string result;
+    for (const auto& reference : references_) {
+      const auto* const bytes = reinterpret_cast<const uint8_t*>(&reference.info);
+      for (size_t i = 0; i < sizeof(reference.info); i++) {
+        result += Format("%02x", bytes[i]);
+      }
+    }
+    return result;
+  }
+
+  /// Returns true if every processor returns the reference with
+  /// @p hold_times, leaving them in use.
+  ///
+  /// Each processor is read @p trials times back to back.  The SPI
+  /// peripherals skip the chip select setup time when the chip select
+  /// changes, so alternating between processors would not exercise it.
+  bool Verify(const SpiHoldTimes& hold_times, int trials) {
+    spi_->set_hold_times(hold_times);
+    for (const auto& reference : references_) {
+      for (int i = 0; i < trials; i++) {
+        DeviceDeviceInfo info;
+        spi_->Read(reference.cs, 97, reinterpret_cast<char*>(&info), sizeof(info));
+        if (::memcmp(&info, &reference.info, sizeof(info)) != 0) {
+          spi_->set_hold_times(conservative_);
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /// Measure, apply and return the hold times.
+  SpiHoldTimes Calibrate() {
+    if (!Verifiable()) { return conservative_; }
+
+    SpiHoldTimes measured = conservative_;
+    measured.cs_hold_ns = Smallest([&](int ns) {
+        return SpiHoldTimes{ns, conservative_.address_hold_ns}; },
+      conservative_.cs_hold_ns);
+    measured.address_hold_ns = Smallest([&](int ns) {
+        return SpiHoldTimes{conservative_.cs_hold_ns, ns}; },
+      conservative_.address_hold_ns);
+
+    const SpiHoldTimes result = {
+      WithMargin(measured.cs_hold_ns, conservative_.cs_hold_ns),
+      WithMargin(measured.address_hold_ns, conservative_.address_hold_ns),
+    };
+    if (!Verify(result, kTrials)) { return conservative_; }
+    return result;
+  }
+
+ private:
+  static constexpr int kTrials = 50;
+  static constexpr int kStepNs = 250;
+
+  struct Reference {
+    int cs = 0;
+    DeviceDeviceInfo info;
+  };
+
+  /// A reply with every byte the same is what an idle bus returns, so
+  /// would not show a failed read.
+  bool Verifiable() const {
+    for (const auto& reference : references_) {
+      const auto* const bytes = reinterpret_cast<const uint8_t*>(&reference.info);
+      bool uniform = true;
+      for (size_t i = 1; i < sizeof(reference.info); i++) {
+        if (bytes[i] != bytes[0]) { uniform = false; }
+      }
+      if (uniform) { return false; }
+    }
+    return !references_.empty();
+  }
+
+  template <typename MakeHoldTimes>
+  int Smallest(MakeHoldTimes make_hold_times, int conservative_ns) {
+    int result = conservative_ns;
+    for (int ns = conservative_ns - kStepNs; ns >= 0; ns -= kStepNs) {
+      if (!Verify(make_hold_times(ns), kTrials)) { break; }
+      result = ns;
+    }
+    spi_->set_hold_times(conservative_);
+    return result;
+  }
+
+  static int WithMargin(int measured_ns, int conservative_ns) {
+    return std::min(conservative_ns, 2 * measured_ns + 2 * kStepNs);
+  }
+
+  Spi* const spi_;
+  const SpiHoldTimes conservative_;
+  std::vector<Reference> references_;
+};
+
 }
 
 
@@ -904,13 +1490,18 @@ class Pi3Hat::Impl {
         primary_spi_{[&]() {
             PrimarySpi::Options options;
             options.speed_hz = configuration.spi_speed_hz;
+            options.dma = configuration.spi_dma;
+            options.dma_tx_channel = configuration.spi_dma_channels[0];
+            options.dma_rx_channel = configuration.spi_dma_channels[1];
             return options;
     }()},
         aux_spi_{[&]() {
             AuxSpi::Options options;
             options.speed_hz = configuration.spi_speed_hz;
             return options;
-          }()} {
+          }()},
+        aux_lane_(&aux_spi_, {1, 3}),
+        primary_lane_(&primary_spi_, {5}) {
 
     // First, look to see if we have a pi3hat attached by looking for
     // the eeprom data.  This will prevent us from stomping on the SPI
@@ -936,6 +1527,10 @@ class Pi3Hat::Impl {
     // Verify the versions of all peripherals we will use.
     VerifyVersions();
 
+    if (config_.calibrate_spi_hold) {
+      CalibrateSpiHold();
+    }
+
     if (config_.enable_aux) {
       ConfigureAux();
     }
@@ -1144,6 +1739,59 @@ class Pi3Hat::Impl {
     }
   }
 
+  /// Reduce the SPI hold times to what the processors need, see
+  /// HoldTimeCalibration.  Hold times from a previous run are checked
+  /// and used if the firmware and SPI speed are unchanged.
+  void CalibrateSpiHold() {
+    HoldTimeCalibration<AuxSpi> aux(&aux_spi_, {0, 1});
+    std::unique_ptr<HoldTimeCalibration<PrimarySpi>> primary;
+    if (config_.enable_aux) {
+      primary.reset(new HoldTimeCalibration<PrimarySpi>(&primary_spi_, {0}));
+    }
+
+    const std::string key = std::to_string(config_.spi_speed_hz) + "/" +
+        aux.key() + "/" + (primary ? primary->key() : std::string());
+
+    constexpr int kCheckTrials = 10;
+    SpiHoldTimes cached[2];
+    if (ReadHoldCache(key, cached) &&
+        aux.Verify(cached[0], kCheckTrials) &&
+        (!primary || primary->Verify(cached[1], kCheckTrials))) {
+      return;
+    }
+
+    const SpiHoldTimes aux_hold = aux.Calibrate();
+    const SpiHoldTimes primary_hold =
+        primary ? primary->Calibrate() : primary_spi_.hold_times();
+    aux_spi_.set_hold_times(aux_hold);
+    primary_spi_.set_hold_times(primary_hold);
+    WriteHoldCache(key, aux_hold, primary_hold);
+  }
+
+  bool ReadHoldCache(const std::string& key, SpiHoldTimes hold_times[2]) {
+    if (config_.spi_hold_cache.empty()) { return false; }
+    std::ifstream inf(config_.spi_hold_cache);
+    std::string cached_key;
+    if (!std::getline(inf, cached_key) || cached_key != key) { return false; }
+    for (int i = 0; i < 2; i++) {
+      if (!(inf >> hold_times[i].cs_hold_ns >> hold_times[i].address_hold_ns)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void WriteHoldCache(const std::string& key, const SpiHoldTimes& aux_hold,
+                      const SpiHoldTimes& primary_hold) {
+    if (config_.spi_hold_cache.empty()) { return; }
+    // Who cares about errors here?  The hold times are measured again
+    // next time.
+    std::ofstream of(config_.spi_hold_cache);
+    of << key << "\n"
+       << aux_hold.cs_hold_ns << " " << aux_hold.address_hold_ns << "\n"
+       << primary_hold.cs_hold_ns << " " << primary_hold.address_hold_ns << "\n";
+  }
+
   DeviceInfo device_info() {
     DeviceInfo result;
     // Now get the device information from all three processors.
@@ -1183,17 +1831,17 @@ class Pi3Hat::Impl {
     if (wait) {
       char buf[2] = {};
       do {
-        primary_spi_.Read(0, 96, buf, sizeof(buf));
+        PrimaryRead(96, buf, sizeof(buf));
         if (buf[1] == 1) { break; }
         // If we spam the STM32 too hard, then it doesn't have any
         // cycles left to actually work on the IMU.
-        BusyWaitUs(20);
+        PrimaryWaitUs(20);
       } while (true);
     }
 
     do {
-      primary_spi_.Read(
-          0, 34,
+      PrimaryRead(
+          34,
           reinterpret_cast<char*>(&device_attitude_),
           detail ? sizeof(device_attitude_) : 42);
     } while (wait && ((device_attitude_.present & 0x01) == 0));
@@ -1223,92 +1871,22 @@ class Pi3Hat::Impl {
     return true;
   }
 
-  template <typename Spi>
-  void SendCanPacketSpi(Spi& spi,
-                        int cs, int cpu_bus,
-                        const CanFrame& can_frame) {
-    const auto size = RoundUpDlc(can_frame.size);
-    char buf[70] = {};
-
-    int spi_address = 0;
-    int spi_size = 0;
-
-    buf[0] = ((cpu_bus == 1) ? 0x80 : 0x00) | (size & 0x7f);
-
-    if (can_frame.id <= 0xffff) {
-      // We'll use the 2 byte ID formulation, cmd 5
-      spi_address = 5;
-      buf[1] = (can_frame.id >> 8) & 0xff;
-      buf[2] = can_frame.id & 0xff;
-      ::memcpy(&buf[3], can_frame.data, can_frame.size);
-      for (std::size_t i = 3 + can_frame.size; i < (3 + size); i++) {
-        buf[i] = 0x50;
-      }
-      spi_size = 3 + size;
-    } else {
-      // 4 byte formulation, cmd 4
-      spi_address = 4;
-
-      buf[1] = (can_frame.id >> 24) & 0xff;
-      buf[2] = (can_frame.id >> 16) & 0xff;
-      buf[3] = (can_frame.id >> 8) & 0xff;
-      buf[4] = (can_frame.id >> 0) & 0xff;
-      ::memcpy(&buf[5], can_frame.data, can_frame.size);
-      for (std::size_t i = 5 + can_frame.size; i < (5 + size); i++) {
-        buf[i] = 0x50;
-      }
-      spi_size = 5 + size;
-    }
-
-    spi.Write(cs, spi_address, buf, spi_size);
-  }
-
-  void SendCanPacket(const CanFrame& can_frame) {
-    switch (can_frame.bus) {
-      case 1: {
-        SendCanPacketSpi(aux_spi_, 0, 0, can_frame);
-        break;
-      }
-      case 2: {
-        SendCanPacketSpi(aux_spi_, 0, 1, can_frame);
-        break;
-      }
-      case 3: {
-        SendCanPacketSpi(aux_spi_, 1, 0, can_frame);
-        break;
-      }
-      case 4: {
-        SendCanPacketSpi(aux_spi_, 1, 1, can_frame);
-        break;
-      }
-      case 5: {
-        if (config_.enable_aux) {
-          SendCanPacketSpi(primary_spi_, 0, 0, can_frame);
-        }
-        break;
-      }
-    }
-  }
-
-  struct ExpectedReply {
-    std::array<int, 6> count = { {} };
-  };
-
-  ExpectedReply SendCan(const Input& input) {
-    ExpectedReply result;
+  void QueueCan(const Input& input, CanRxBuffer* rx_can) {
+    const int64_t start_ns = GetNow();
+    aux_lane_.Begin(rx_can, start_ns);
+    primary_lane_.Begin(rx_can, start_ns);
 
     // We try to send packets on alternating buses if possible, so we
     // can reduce the average latency before the first data goes out
-    // on any bus.  Always send data on the low speed bus out last.
+    // on any bus.  The low speed bus is on its own SPI peripheral, so
+    // is sent in parallel.
     for (auto& bus_packets : can_packets_) {
       bus_packets.resize(0);
     }
     for (size_t i = 0; i < input.tx_can.size(); i++) {
       const auto bus = input.tx_can[i].bus;
+      if (bus < 1 || bus > 5) { continue; }
       can_packets_[bus].push_back(i);
-      if (input.tx_can[i].expect_reply) {
-        result.count[bus]++;
-      }
     }
 
     int bus_offset[5] = {};
@@ -1321,22 +1899,45 @@ class Pi3Hat::Impl {
         if (offset >= static_cast<int>(can_packets_[bus].size())) {
           continue;
         }
-        const auto& can_packet = input.tx_can[can_packets_[bus][offset]];
+        const int index = can_packets_[bus][offset];
+        aux_lane_.AddFrame(input.tx_can[index], index);
         offset++;
-
-        SendCanPacket(can_packet);
         any_sent = true;
       }
 
       if (!any_sent) { break; }
     }
 
-    // Now send out all the low speed packets.
-    for (const auto index : can_packets_[5]) {
-      SendCanPacket(input.tx_can[index]);
+    if (config_.enable_aux) {
+      for (const auto index : can_packets_[5]) {
+        primary_lane_.AddFrame(input.tx_can[index], index);
+      }
     }
+  }
 
-    return result;
+  /// Poll the CAN lanes until both have written all their frames.
+  void SendCan() {
+    while (!aux_lane_.writes_done() || !primary_lane_.writes_done()) {
+      aux_lane_.Poll();
+      primary_lane_.Poll();
+    }
+  }
+
+  /// Transfers on the PrimarySpi once its CAN frames are sent.  The
+  /// AuxSpi lane is advanced while they are in progress.
+  void PrimaryWrite(int address, const char* data, size_t size) {
+    primary_spi_.StartWrite(0, address, data, size);
+    while (!primary_spi_.Poll()) { aux_lane_.Poll(); }
+  }
+
+  void PrimaryRead(int address, char* data, size_t size) {
+    primary_spi_.StartRead(0, address, data, size);
+    while (!primary_spi_.Poll()) { aux_lane_.Poll(); }
+  }
+
+  void PrimaryWaitUs(int64_t us) {
+    const auto end = GetNow() + us * 1000;
+    while (GetNow() <= end) { aux_lane_.Poll(); }
   }
 
   void SendRf(const Span<RfSlot>& slots) {
@@ -1355,8 +1956,8 @@ class Pi3Hat::Impl {
       buf[4] = (slot.priority >> 24) & 0xff;
       ::memcpy(&buf[kHeaderSize], slot.data, slot.size);
 
-      primary_spi_.Write(
-          0, 51, reinterpret_cast<const char*>(&buf[0]),
+      PrimaryWrite(
+          51, reinterpret_cast<const char*>(&buf[0]),
           kHeaderSize + slot.size);
     }
   }
@@ -1365,8 +1966,8 @@ class Pi3Hat::Impl {
     if (!config_.enable_aux) { return; }
 
     DeviceRfStatus rf_status;
-    primary_spi_.Read(
-        0, 52, reinterpret_cast<char*>(&rf_status), sizeof(rf_status));
+    PrimaryRead(
+        52, reinterpret_cast<char*>(&rf_status), sizeof(rf_status));
 
     output->rf_lock_age_ms = rf_status.lock_age_ms;
 
@@ -1387,8 +1988,8 @@ class Pi3Hat::Impl {
 
       last_bitfield_ ^= (bitfield_delta & (3 << (i * 2)));
 
-      primary_spi_.Read(
-          0, 64 + i, reinterpret_cast<char*>(&slot_data), sizeof(slot_data));
+      PrimaryRead(
+          64 + i, reinterpret_cast<char*>(&slot_data), sizeof(slot_data));
       auto& output_slot = input.rx_rf[output->rx_rf_size++];
       output_slot.slot = i;
       output_slot.age_ms = slot_data.age_ms;
@@ -1397,152 +1998,76 @@ class Pi3Hat::Impl {
     }
   }
 
-  template <typename Spi>
-  int ReadCanFrames(Spi& spi, int cs, int bus_start,
-                    const Span<CanFrame>* rx_can, Output* output) {
-    // Is there any room?
-    if (output->rx_can_size >= rx_can->size()) { return 0; }
-
-    int count = 0;
-
-    // Purposefully not initialized for speed.
-    uint8_t buf[70];
-
-    while (true) {
-      // Read until no more frames are available or until the output
-      // buffer is full.
-      uint8_t queue_sizes[6] = {};
-      spi.Read(cs, 2,
-               reinterpret_cast<char*>(&queue_sizes[0]), sizeof(queue_sizes));
-
-      bool any_read = false;
-
-      // Read all we can until our buffer is full.
-      for (int size : queue_sizes) {
-        if (output->rx_can_size >= rx_can->size()) {
-          // We're full and can't read any more.
-          break;
-        }
-
-        if (size == 0) { continue; }
-        if (size > (64 + 5)) {
-          // This is malformed.  Lets just set it to the maximum size for now.
-          size = 64 + 5;
-        }
-
-        spi.Read(cs, 3, reinterpret_cast<char*>(&buf[0]), size);
-
-        if (buf[0] == 0) {
-          // Hmmm, this shouldn't happen, but indicates there isn't
-          // really a frame here.
-          continue;
-        }
-
-        auto& output_frame = (*rx_can)[output->rx_can_size++];
-        count++;
-
-        output_frame.bus = bus_start + ((buf[0] & 0x80) ? 1 : 0);
-        output_frame.id = (buf[1] << 24) |
-                          (buf[2] << 16) |
-                          (buf[3] << 8) |
-                          (buf[4] << 0);
-        output_frame.size = size - 5;
-        ::memcpy(output_frame.data, &buf[5], size - 5);
-      }
-
-      if (!any_read) {
-        break;
-      }
-    }
-
-    return count;
-  }
-
-  void ReadCan(const Input& input, const ExpectedReply& expected_replies,
-               Output* output) {
-    int bus_replies[] = {
-      expected_replies.count[1] + expected_replies.count[2],
-      expected_replies.count[3] + expected_replies.count[4],
-      expected_replies.count[5],
-    };
-
-    const bool to_check[] = {
-      bus_replies[0] || input.force_can_check & 0x06,
-      bus_replies[1] || input.force_can_check & 0x18,
-      bus_replies[2] || input.force_can_check & 0x20,
-    };
+  void ReadCan(const Input& input, Output* output) {
+    primary_lane_.StartReading(config_.enable_aux ? input.force_can_check : 0);
 
     const auto start_now = GetNow();
     int64_t last_reply = start_now;
 
     while (true) {
-      bool any_found = false;
-      // Then check for CAN responses as necessary.
-      if (to_check[0]) {
-        const int count = ReadCanFrames(aux_spi_, 0, 1, &input.rx_can, output);
-        bus_replies[0] -= count;
-        if (count) {
-          last_reply = GetNow();
-          any_found = true;
-        }
-      }
-      if (to_check[1]) {
-        const int count = ReadCanFrames(aux_spi_, 1, 3, &input.rx_can, output);
-        bus_replies[1] -= count;
-        if (count) {
-          last_reply = GetNow();
-          any_found = true;
-        }
-      }
-      if (to_check[2] && config_.enable_aux) {
-        const int count = ReadCanFrames(primary_spi_, 0, 5, &input.rx_can, output);
-        bus_replies[2] -= count;
-        if (count) {
-          last_reply = GetNow();
-          any_found = true;
-        }
+      // Both lanes are polled every time around.
+      const int aux_count = aux_lane_.Poll();
+      const int primary_count = primary_lane_.Poll();
+      if (aux_count || primary_count) {
+        last_reply = GetNow();
       }
 
       if (output->rx_can_size >= input.rx_can.size()) {
         // Our buffer is full, so no more frames could have been
         // returned.
-        return;
+        break;
       }
 
       const auto cur_now = GetNow();
       const auto delta_ns = cur_now - start_now;
       const auto since_last_ns = cur_now - last_reply;
 
-      if (bus_replies[0] <= 0 &&
-          bus_replies[1] <= 0 &&
-          bus_replies[2] <= 0 &&
+      const bool all_replied =
+          aux_lane_.outstanding() == 0 && primary_lane_.outstanding() == 0;
+      if (all_replied && input.return_when_replied) {
+        break;
+      }
+
+      if (all_replied &&
           delta_ns > input.min_tx_wait_ns &&
           since_last_ns > input.rx_extra_wait_ns) {
         // We've read all the replies we are expecting and have polled
         // everything at least once if requested.
-        return;
+        break;
       }
 
       if (delta_ns > input.timeout_ns && !
           (delta_ns < input.min_tx_wait_ns ||
            since_last_ns < input.rx_extra_wait_ns)) {
         // The timeout has expired.
-        return;
+        break;
       }
+    }
+
+    aux_lane_.Finish();
+    primary_lane_.Finish();
 
-      if (!any_found) {
-        // Give the controllers a chance to rest.
-        BusyWaitUs(20);
+    if (input.tx_can_reply_ns.size()) {
+      for (size_t i = 0; i < input.tx_can_reply_ns.size(); i++) {
+        input.tx_can_reply_ns[i] = -1;
       }
+      aux_lane_.ReportReplies(input.tx_can_reply_ns);
+      primary_lane_.ReportReplies(input.tx_can_reply_ns);
     }
   }
 
   Output Cycle(const Input& input) {
-    // Send off all our CAN data to all buses.
-    auto expected_replies = SendCan(input);
-
     Output result;
 
+    // Send off all our CAN data to all buses.  Replies on CAN 1-4 are
+    // read as soon as the AuxSpi is done writing, while the rest of
+    // the cycle uses the PrimarySpi.  Both lanes store the frames
+    // they receive in rx_can.
+    CanRxBuffer rx_can(&input.rx_can, &result);
+    QueueCan(input, &rx_can);
+    aux_lane_.StartReading(input.force_can_check);
+    SendCan();
+
     // While those are sending, do our other work.
     if (input.tx_rf.size()) {
       SendRf(input.tx_rf);
@@ -1558,7 +2083,7 @@ class Pi3Hat::Impl {
                       input.request_attitude_detail);
     }
 
-    ReadCan(input, expected_replies, &result);
+    ReadCan(input, &result);
 
     primary_spi_.gpio()->SetGpioMode(13, Rpi3Gpio::OUTPUT);
     static bool debug_toggle = false;
@@ -1575,6 +2100,9 @@ class Pi3Hat::Impl {
   PrimarySpi primary_spi_;
   AuxSpi aux_spi_;
 
+  CanSpiLane<AuxSpi> aux_lane_;
+  CanSpiLane<PrimarySpi> primary_lane_;
+
   DeviceAttitudeData device_attitude_;
 
   // This is a member variable purely so that in steady state we don't
@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <stdexcept>
+#include <string>
 
 namespace mjbots {
 namespace pi3hat {
@@ -172,6 +173,22 @@ class Pi3Hat {
 
     bool enable_aux = true;
 
+    // If true, transfers with the auxiliary processor (CAN 5, the IMU
+    // and RF) are moved by the DMA engine, so the CPU can work on the
+    // other CAN buses while they are in progress.  The TX and RX DMA
+    // channels, from 0 to 10, must not be used by anything else.
+    bool spi_dma = false;
+    int spi_dma_channels[2] = {9, 10};
+
+    // If true, the SPI setup and hold times are reduced at startup to
+    // what the processors need, plus a margin, instead of the
+    // conservative defaults.  The result is kept in spi_hold_cache,
+    // if not empty, and reused after a quick check while the firmware
+    // and SPI speed are unchanged.  This has not yet been verified on
+    // hardware, so is off by default.
+    bool calibrate_spi_hold = false;
+    std::string spi_hold_cache = "/var/tmp/pi3hat-spi-hold";
+
     CanConfiguration can[5] = {};
 
     // If true, nothing is guaranteed to work but ReadSpi.
@@ -212,6 +229,15 @@ class Pi3Hat {
     /// After each successful receipt, wait this much longer for more.
     uint32_t rx_extra_wait_ns = 40000;
 
+    /// If true, return as soon as every frame in tx_can with
+    /// expect_reply set has been answered, without waiting for
+    /// min_tx_wait_ns and rx_extra_wait_ns.  The timeouts still apply
+    /// while any reply is missing.
+    ///
+    /// A reply answers a frame on the same bus if bits 8-14 of its ID
+    /// equal bits 0-6 of the frame's ID, as with moteus.
+    bool return_when_replied = false;
+
     bool request_attitude = false;
 
     // If true, then the bias and uncertainty information will be
@@ -230,6 +256,10 @@ class Pi3Hat {
 
     // These are data to store results in.
     Span<CanFrame> rx_can;
+    // If not empty, this has an entry for each frame of tx_can, which
+    // is set to the nanoseconds from the start of the cycle until its
+    // reply was received, or -1 if none was.
+    Span<int32_t> tx_can_reply_ns;
     Span<RfSlot> rx_rf;
     Attitude* attitude = nullptr;
   };
@@ -0,0 +1,36 @@
+#include "pwm_inputs.h"
+#include <pigpio.h>
+#include <iostream>
+#include "../motor_control/realtime.h"
+
+PWMInputs::PWMInputs(const std::vector<unsigned int>& pins, int cpu) {
+    mjbots::moteus::ConfigureRealtime(cpu);
+    // Set gpio sampling rate(first parameter in us). Seconds parameter is PWM or PCM,
+    // didn't see any difference in performance
+    if (gpioCfgClock(1,1,1) < 0) {
+        std::cerr << "pgpio clock set failed\n";
+    }
+    if (gpioInitialise() < 0) {
+        std::cerr << "pigpio initialization failed\n";
+    }
+    for (const auto pin : pins) {
+        if (pin >= readers_.size()) {
+            readers_.resize(pin + 1);
+        }
+        if (!readers_[pin]) {
+            readers_[pin].reset(new PWMReader(pin));
+        }
+    }
+}
+
+PWMInputs::~PWMInputs() {
+    // There are still ISR callbacks active, as the PWMReaders haven't gone out of scope yet
+    gpioTerminate();
+}
+
+float PWMInputs::pulse_width(unsigned int pin) const {
+    if (pin >= readers_.size() || !readers_[pin]) {
+        return 0;
+    }
+    return readers_[pin]->pulse_width();
+}
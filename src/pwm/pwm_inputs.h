@@ -0,0 +1,27 @@
+#ifndef PWM_INPUTS_H
+#define PWM_INPUTS_H
+
+#include <memory>
+#include <vector>
+
+#include "../controller/thrust_vector_controller.h"
+#include "pwm_reader.h"
+
+/// Reads the pulse widths of RC inputs on GPIO pins with pigpio.  The
+/// channel of a pulse width is its pin.
+class PWMInputs : public PulseWidthSource {
+public:
+    /// Configures the calling thread as realtime on @p cpu before
+    /// pigpio is initialised, so that pigpio's threads inherit both.
+    PWMInputs(const std::vector<unsigned int>& pins, int cpu);
+    ~PWMInputs();
+
+    /// Zero for a pin which was not given.
+    float pulse_width(unsigned int pin) const override;
+
+private:
+    // Indexed by pin.
+    std::vector<std::unique_ptr<PWMReader>> readers_;
+};
+
+#endif // PWM_INPUTS_H
@@ -0,0 +1,150 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include "shared_memory_setpoints.h"
+
+using namespace shared_setpoints;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "The setpoint segment needs lock free atomics to be shared between processes");
+
+namespace {
+
+// A few retries are plenty, a read only fails if the writer laps the
+// whole ring meanwhile.
+constexpr int kReadAttempts = 4;
+
+std::runtime_error system_error(const std::string& what, const std::string& name) {
+    return std::runtime_error(what + " " + name + ": " + std::strerror(errno));
+}
+
+}
+
+int64_t shared_setpoints::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SharedMemorySetpointWriter::SharedMemorySetpointWriter(const std::string& name) {
+    const int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR, 0660);
+    if (fd < 0) {
+        throw system_error("Could not open setpoint segment", name);
+    }
+    if (::ftruncate(fd, sizeof(Segment)) < 0) {
+        ::close(fd);
+        throw system_error("Could not size setpoint segment", name);
+    }
+    void* address = ::mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        throw system_error("Could not map setpoint segment", name);
+    }
+    segment_ = new (address) Segment();
+    segment_->magic = kMagic;
+    segment_->version = kVersion;
+}
+
+SharedMemorySetpointWriter::~SharedMemorySetpointWriter() {
+    ::munmap(segment_, sizeof(Segment));
+}
+
+void SharedMemorySetpointWriter::write(const float* values, size_t count, int64_t timestamp_ns) {
+    if (count > kChannelCount) {
+        throw std::invalid_argument("Too many setpoint channels");
+    }
+    const uint64_t published = segment_->published.load(std::memory_order_relaxed);
+    Slot& slot = segment_->slots[published % kSlotCount];
+
+    const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.channel_count.store(count, std::memory_order_relaxed);
+    slot.timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        slot.values[i].store(values[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    segment_->published.store(published + 1, std::memory_order_release);
+}
+
+void SharedMemorySetpointWriter::remove(const std::string& name) {
+    ::shm_unlink(name.c_str());
+}
+
+SharedMemorySetpoints::SharedMemorySetpoints(const std::string& name, Options options)
+    : options_(options)
+{
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw system_error("Could not open setpoint segment", name);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) < 0 || static_cast<size_t>(status.st_size) < sizeof(Segment)) {
+        ::close(fd);
+        throw std::runtime_error("Setpoint segment " + name + " is too small");
+    }
+    void* address = ::mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        throw system_error("Could not map setpoint segment", name);
+    }
+    segment_ = static_cast<const Segment*>(address);
+    if (segment_->magic != kMagic || segment_->version != kVersion) {
+        ::munmap(address, sizeof(Segment));
+        throw std::runtime_error("Setpoint segment " + name + " has an unknown format");
+    }
+}
+
+SharedMemorySetpoints::~SharedMemorySetpoints() {
+    ::munmap(const_cast<Segment*>(segment_), sizeof(Segment));
+}
+
+void SharedMemorySetpoints::read_newest() {
+    for (int attempt = 0; attempt < kReadAttempts; attempt++) {
+        const uint64_t published = segment_->published.load(std::memory_order_acquire);
+        if (published == 0) {
+            return;
+        }
+        const Slot& slot = segment_->slots[(published - 1) % kSlotCount];
+
+        const uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before % 2 == 0) {
+            const uint32_t count = std::min<uint32_t>(
+                slot.channel_count.load(std::memory_order_relaxed), kChannelCount);
+            const int64_t timestamp_ns = slot.timestamp_ns.load(std::memory_order_relaxed);
+            float values[kChannelCount];
+            for (uint32_t i = 0; i < count; i++) {
+                values[i] = slot.values[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                channel_count_ = count;
+                timestamp_ns_ = timestamp_ns;
+                std::copy(values, values + count, values_);
+                return;
+            }
+        }
+        torn_reads_++;
+    }
+}
+
+void SharedMemorySetpoints::sample() {
+    // If the newest slot could not be read, the previous setpoint is
+    // used until it becomes too old.
+    read_newest();
+    fresh_ = timestamp_ns_ != 0 &&
+        now_ns() - timestamp_ns_ <= std::chrono::nanoseconds(options_.max_age).count();
+}
+
+float SharedMemorySetpoints::pulse_width(unsigned int channel) const {
+    if (!fresh_ || channel >= channel_count_) {
+        return 0;
+    }
+    return values_[channel];
+}
@@ -0,0 +1,119 @@
+#ifndef SHARED_MEMORY_SETPOINTS_H
+#define SHARED_MEMORY_SETPOINTS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../controller/thrust_vector_controller.h"
+
+/// The layout of a POSIX shared memory segment through which another
+/// process on the same machine, e.g. a PX4 or MAVLink bridge, hands the
+/// thrust vector setpoints to the controller.
+///
+/// The writer publishes each setpoint into the next of kSlotCount
+/// slots, each a seqlock: its sequence is odd while the slot is being
+/// written.  A reader takes the newest slot, and retries if its
+/// sequence was odd or changed while it was being read, which can only
+/// happen if the writer lapped the whole ring meanwhile.  Neither side
+/// ever blocks or enters the kernel.  All fields are atomics, so the
+/// segment is only valid between processes where they are lock free.
+namespace shared_setpoints {
+
+constexpr uint32_t kMagic = 0x50535654;  // "TVSP"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kChannelCount = 32;
+constexpr size_t kSlotCount = 8;
+
+struct Slot {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> channel_count;
+    // When the writer took the setpoint, in steady_clock (on Linux
+    // CLOCK_MONOTONIC) nanoseconds.
+    std::atomic<int64_t> timestamp_ns;
+    // Pulse widths in microseconds, see PulseWidthSource.
+    std::atomic<float> values[kChannelCount];
+};
+
+struct Segment {
+    uint32_t magic;
+    uint32_t version;
+    // The number of setpoints published, the newest is in slot
+    // (published - 1) % kSlotCount.
+    std::atomic<uint64_t> published;
+    Slot slots[kSlotCount];
+};
+
+int64_t now_ns();
+
+}
+
+/// Publishes setpoints into a shared memory segment, which is created
+/// if it does not exist.  For a single writer.
+class SharedMemorySetpointWriter {
+public:
+    /// @p name is a shm_open() name, e.g. "/thrust_vector_setpoints".
+    explicit SharedMemorySetpointWriter(const std::string& name);
+    ~SharedMemorySetpointWriter();
+
+    SharedMemorySetpointWriter(const SharedMemorySetpointWriter&) = delete;
+    SharedMemorySetpointWriter& operator=(const SharedMemorySetpointWriter&) = delete;
+
+    /// Publish @p count, at most kChannelCount, channel values taken at
+    /// @p timestamp_ns.
+    void write(const float* values, size_t count,
+               int64_t timestamp_ns = shared_setpoints::now_ns());
+
+    /// Remove the segment name, mapped segments stay valid.
+    static void remove(const std::string& name);
+
+private:
+    shared_setpoints::Segment* segment_ = nullptr;
+};
+
+/// Reads the newest setpoint of a shared memory segment once per
+/// control cycle.  When there is none, or it is older than max_age,
+/// all channels read 0, which disarms the controller.
+class SharedMemorySetpoints : public PulseWidthSource {
+public:
+    struct Options {
+        std::chrono::microseconds max_age{50000};
+    };
+
+    /// Throws std::runtime_error if the segment does not exist or is not
+    /// a setpoint segment.
+    SharedMemorySetpoints(const std::string& name, Options options);
+    explicit SharedMemorySetpoints(const std::string& name)
+        : SharedMemorySetpoints(name, Options()) {}
+    ~SharedMemorySetpoints();
+
+    SharedMemorySetpoints(const SharedMemorySetpoints&) = delete;
+    SharedMemorySetpoints& operator=(const SharedMemorySetpoints&) = delete;
+
+    void sample() override;
+    /// From the last sample(), zero for a channel which was not written.
+    float pulse_width(unsigned int channel) const override;
+
+    /// Whether the last sample() found a new enough setpoint.
+    bool fresh() const { return fresh_; }
+    /// The timestamp of the last setpoint sample() read, or 0.
+    int64_t timestamp_ns() const { return timestamp_ns_; }
+    /// How often a slot changed while it was being read.
+    uint64_t torn_reads() const { return torn_reads_; }
+
+private:
+    void read_newest();
+
+    const Options options_;
+    const shared_setpoints::Segment* segment_ = nullptr;
+
+    bool fresh_ = false;
+    int64_t timestamp_ns_ = 0;
+    uint32_t channel_count_ = 0;
+    float values_[shared_setpoints::kChannelCount] = {};
+    uint64_t torn_reads_ = 0;
+};
+
+#endif
@@ -0,0 +1,256 @@
+// calibration_analysis_test.cpp
+#include "../analysis/calibration_analysis.h"
+#include "../logging/motor_log_csv.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+bool near(double a, double b, double tolerance) {
+    return std::abs(a - b) <= tolerance;
+}
+
+void test_elevation_azimuth() {
+    // Same cases as scripts/tests/test_analyze_thrust_vectoring.py
+    const double forces[6][3] = {
+        {1, 0, 0}, {0, 1, 0}, {0, 0, -1}, {-1, 0, 0}, {0, -1, 0}, {1, 1, -1}};
+    const double elevations[6] = {90, 90, 0, 90, 90, 54.7356};
+    const double azimuths[6] = {0, 90, 0, 180, -90, 45};
+    for (int i = 0; i < 6; i++) {
+        double elevation = 0.0;
+        double azimuth = 0.0;
+        ElevationAzimuth(forces[i], &elevation, &azimuth);
+        assert(near(elevation, elevations[i], 1e-3));
+        assert(near(azimuth, azimuths[i], 1e-3));
+    }
+}
+
+// A calibration run against a rotor which follows a known model.  The
+// force is wrong during most of the transient around each command
+// change.
+struct SyntheticRun {
+    CalibrationModel model;
+    std::vector<MotorLogRecord> motor;
+    std::vector<ForceSample> force;
+    int step_count = 0;
+
+    SyntheticRun() {
+        model.thrust_coefficient = 0.0012f;
+        model.elevation_coefficient = 58.0f;
+        model.phase_offset[0] = 0.4f;
+        model.phase_offset[1] = 0.01f;
+        model.phase_offset[2] = -5e-5f;
+
+        const double startup_time = 1.0;
+        const double step_duration = 1.5;
+        const int64_t start_ns = 1686225475000000000;
+        struct Command { float velocity, amplitude, phase; };
+        std::vector<Command> commands;
+        for (float velocity : {30.0f, 50.0f, 70.0f, 90.0f}) {
+            for (float amplitude : {0.0f, 0.1f, 0.2f}) {
+                for (float phase : {0.0f, 2.0f, -2.5f}) {
+                    commands.push_back({velocity, amplitude, phase});
+                }
+            }
+        }
+        step_count = commands.size();
+
+        // The motor log runs at 1 kHz, starting idle.
+        const double end_time = startup_time + commands.size() * step_duration;
+        for (int i = 0; i * 1e-3 < end_time; i++) {
+            const double time = i * 1e-3;
+            MotorLogRecord record;
+            record.timestamp_ns = start_ns + i * 1000000LL;
+            record.id = 3;
+            record.bus = 3;
+            if (time >= startup_time) {
+                const Command& command = commands[static_cast<size_t>((time - startup_time) / step_duration)];
+                record.velocity_command = command.velocity;
+                record.amplitude_command = command.amplitude;
+                record.phase_command = command.phase;
+            }
+            motor.push_back(record);
+            // Another servo on the bus, which is ignored.
+            record.id = 4;
+            record.velocity_command = 10.0f;
+            motor.push_back(record);
+        }
+
+        // The force log starts before the motor log's startup time
+        // ends, and runs at 50 Hz.
+        for (int i = 0; i * 0.02 - 0.5 < end_time - startup_time + 0.5; i++) {
+            ForceSample sample;
+            sample.time = i * 0.02 - 0.5;
+            const int index = std::floor(sample.time / step_duration);
+            if (index >= 0 && index < static_cast<int>(commands.size())) {
+                const Command& command = commands[index];
+                const double v = command.velocity;
+                const double thrust = model.thrust_coefficient * v * v;
+                const double elevation = model.elevation_coefficient * command.amplitude * M_PI / 180;
+                const double azimuth = command.phase - (model.phase_offset[0] +
+                    model.phase_offset[1] * v + model.phase_offset[2] * v * v);
+                const double into_step = sample.time - index * step_duration;
+                const double transient = (into_step < 0.15 || into_step > step_duration - 0.05) ? 3.0 : 1.0;
+                sample.force[0] = transient * thrust * std::sin(elevation) * std::cos(azimuth);
+                sample.force[1] = transient * thrust * std::sin(elevation) * std::sin(azimuth);
+                sample.force[2] = -transient * thrust * std::cos(elevation);
+                sample.torque[2] = 0.02 * thrust;
+            }
+            force.push_back(sample);
+        }
+    }
+};
+
+void test_process_steps_and_fit() {
+    const SyntheticRun run;
+    size_t motor_index = 0;
+    size_t force_index = 0;
+    std::vector<StepResult> steps;
+    CalibrationFit fit{CalibrationFit::Options()};
+    const int count = ProcessSteps(
+        StepOptions(),
+        [&](MotorLogRecord* record) {
+            if (motor_index == run.motor.size()) { return false; }
+            *record = run.motor[motor_index++];
+            return true;
+        },
+        [&](ForceSample* sample) {
+            if (force_index == run.force.size()) { return false; }
+            *sample = run.force[force_index++];
+            return true;
+        },
+        [&](const StepResult& step) {
+            steps.push_back(step);
+            fit.Add(step);
+        });
+
+    assert(count == run.step_count);
+    assert(static_cast<int>(steps.size()) == run.step_count);
+    for (size_t i = 0; i < steps.size(); i++) {
+        const StepResult& step = steps[i];
+        assert(near(step.start_time, i * 1.5, 2e-3));
+        assert(near(step.end_time, (i + 1) * 1.5, 2e-3));
+        // 1.2 s of the 1.5 s step at 50 Hz
+        assert(step.sample_count >= 59 && step.sample_count <= 61);
+        const double thrust = run.model.thrust_coefficient *
+            step.velocity_command * step.velocity_command;
+        assert(near(step.torque[2], 0.02 * thrust, 1e-6));
+        assert(near(step.elevation_deg,
+                    run.model.elevation_coefficient * step.amplitude_command, 1e-3));
+    }
+
+    const CalibrationModel fitted = fit.Solve(CalibrationModel());
+    assert(near(fitted.thrust_coefficient, run.model.thrust_coefficient, 1e-8));
+    assert(near(fitted.elevation_coefficient, run.model.elevation_coefficient, 1e-3));
+    for (int i = 0; i < 3; i++) {
+        assert(near(fitted.phase_offset[i], run.model.phase_offset[i],
+                    1e-4 * std::pow(0.02, i)));
+    }
+    // Limits are taken from the base model.
+    assert(fitted.max_velocity == CalibrationModel().max_velocity);
+}
+
+void test_phase_fit_with_one_velocity() {
+    CalibrationFit fit{CalibrationFit::Options()};
+    for (float phase : {0.0f, 1.0f, 3.0f}) {
+        StepResult step;
+        step.velocity_command = 60.0f;
+        step.amplitude_command = 0.2f;
+        step.phase_command = phase;
+        step.force[2] = -5.0;
+        // Offsets close to pi are not split by wrapping.
+        step.azimuth_deg = std::remainder(phase - 3.1, 2 * M_PI) * 180 / M_PI;
+        step.elevation_deg = 12.0;
+        fit.Add(step);
+    }
+    const CalibrationModel fitted = fit.Solve(CalibrationModel());
+    assert(near(std::remainder(fitted.phase_offset[0] - 3.1, 2 * M_PI), 0.0, 1e-6));
+    assert(fitted.phase_offset[1] == 0.0f && fitted.phase_offset[2] == 0.0f);
+    assert(near(fitted.elevation_coefficient, 60.0, 1e-4));
+}
+
+void test_force_log_reader() {
+    std::istringstream input(
+        "\"Force X (N)\",\"Force Y (N)\",\"Force Z (N)\",\"Torque X (N-m)\",\"Torque Y (N-m)\","
+        "\"Torque Z (N-m)\",\"Frequency = 5000\",\"Averaging Level = 100\","
+        "\"F/T Serial Number = FT38684\",\"Time Started = 08/06/2023 11:57:52\","
+        "Force Time Offset = 3.90\r\n"
+        "\"1.5\",\"2\",\"-3.25E-01\",\"0.1\",\"0.2\",\"0.3\"\r\n"
+        "\"1\",\"1\",\"1\",\"0\",\"0\",\"0\"\r\n");
+    ForceLogReader reader(input, false);
+    assert(reader.sample_rate() == 50.0);
+    assert(near(reader.time_offset(), 3.9, 1e-12));
+
+    ForceSample sample;
+    assert(reader.Next(&sample));
+    assert(near(sample.time, -3.9, 1e-12));
+    assert(sample.force[0] == -1.5f && sample.force[1] == 2.0f && sample.force[2] == 0.325f);
+    assert(sample.torque[0] == 0.1f && sample.torque[2] == 0.3f);
+    assert(reader.Next(&sample));
+    assert(near(sample.time, 0.02 - 3.9, 1e-12));
+    assert(!reader.Next(&sample));
+
+    std::istringstream inverted_input(
+        "Force X (N),Force Y (N),Force Z (N),Torque X (N-m),Torque Y (N-m),Torque Z (N-m),"
+        "Frequency = 1000,Averaging Level = 10\n"
+        "1,2,3,0,0,0\n");
+    ForceLogReader inverted(inverted_input, true);
+    assert(inverted.time_offset() == 0.0);
+    assert(inverted.Next(&sample));
+    assert(sample.force[0] == -1.0f && sample.force[1] == -2.0f && sample.force[2] == 3.0f);
+
+    std::istringstream no_frequency("Force X (N),Force Y (N),Force Z (N)\n");
+    bool threw = false;
+    try {
+        ForceLogReader reader(no_frequency, false);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_motor_log_csv_round_trip() {
+    MotorLogRecord record;
+    record.timestamp_ns = 1686225475288853035;
+    record.id = 3;
+    record.bus = 3;
+    record.mode = 10;
+    record.velocity = 89.45332f;
+    record.control_velocity = NAN;
+    record.velocity_command = 60.0f;
+    record.amplitude_command = 0.15f;
+    record.phase_command = -1.5f;
+    record.voltage = 22.5f;
+
+    std::stringstream stream;
+    WriteMotorLogCsvHeader(stream);
+    WriteMotorLogCsvRow(stream, record);
+    record.timestamp_ns += 1000000;
+    WriteMotorLogCsvRow(stream, record);
+
+    MotorLogCsvReader reader(stream);
+    MotorLogRecord read;
+    assert(reader.Next(&read));
+    assert(read.timestamp_ns == 1686225475288853035);
+    assert(read.id == 3 && read.bus == 3 && read.mode == 10);
+    assert(near(read.velocity, 89.45332, 1e-5));
+    assert(std::isnan(read.control_velocity));
+    assert(read.velocity_command == 60.0f);
+    assert(near(read.amplitude_command, 0.15, 1e-6));
+    assert(near(read.phase_command, -1.5, 1e-6));
+    assert(near(read.voltage, 22.5, 1e-6));
+    assert(reader.Next(&read));
+    assert(read.timestamp_ns == 1686225475289853035);
+    assert(!reader.Next(&read));
+}
+
+int main() {
+    test_elevation_azimuth();
+    test_process_steps_and_fit();
+    test_phase_fit_with_one_velocity();
+    test_force_log_reader();
+    test_motor_log_csv_round_trip();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,209 @@
+// calibration_controller_test.cpp
+#include "../controller/calibration_controller.h"
+#include "../controller/thrust_vector_sequence_generator.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+
+// A full calibration schedule runs in virtual time, and every step is
+// commanded for its whole length.
+void test_schedule_in_virtual_time() {
+    std::vector<float> velocities;
+    std::vector<float> amplitudes;
+    std::vector<float> phases;
+    generateThrustVectorSequence(50.0, 80.0, 2.5, 0.0, 0.35, 0.08, 0.0, 0.0, 1.0, true,
+                                 velocities, amplitudes, phases);
+    assert(velocities.size() >= 100);
+
+    const double step_length = 1.5;
+    const double startup_length = 1.0;
+    const double experiment_length = step_length * velocities.size();
+    CalibrationController controller(velocities, amplitudes, phases, experiment_length,
+                                     startup_length);
+    std::vector<MoteusInterface::ServoCommand> commands(1);
+    controller.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(1);
+
+    const double period_s = 0.0003;
+    VirtualControlClock clock(std::chrono::nanoseconds(300000));
+    size_t cycles = 0;
+    size_t last_step = 0;
+    bool stopped = false;
+    while (!stopped) {
+        const ControlTime time = clock.tick();
+        stopped = controller.run(time, replies, &commands);
+        const double elapsed = cycles * period_s;
+        cycles++;
+        assert(cycles < 10 * (startup_length + experiment_length) / period_s);
+
+        if (elapsed < startup_length) {
+            // The velocity ramps up to the first step.
+            assert(commands[0].mode == moteus::Mode::kSinusoidal);
+            assert(std::abs(commands[0].position.velocity - velocities[0] * elapsed / startup_length) < 1e-3);
+            continue;
+        }
+        if (elapsed > startup_length + experiment_length) {
+            continue;
+        }
+        // Away from the step boundaries, the step is the one at this time.
+        const double step_time = (elapsed - startup_length) / step_length;
+        const size_t step = static_cast<size_t>(step_time);
+        const double within = step_time - step;
+        if (within > 0.01 && within < 0.99) {
+            assert(commands[0].position.velocity == velocities[step]);
+            assert(commands[0].position.sinusoidal_amplitude == amplitudes[step]);
+            assert(commands[0].position.sinusoidal_phase == phases[step]);
+            assert(step >= last_step);
+            last_step = step;
+        }
+    }
+    // Every step was run, and the schedule ended on time.
+    assert(last_step == velocities.size() - 1);
+    const double end = (cycles - 1) * period_s;
+    assert(end > startup_length + experiment_length);
+    assert(end < startup_length + experiment_length + 2 * period_s);
+
+    // With the boundaries of every step.
+    const auto& steps = controller.steps();
+    assert(steps.size() == velocities.size());
+    for (size_t i = 0; i < steps.size(); i++) {
+        assert(steps[i].index == i);
+        assert(steps[i].velocity == velocities[i]);
+        assert(!steps[i].settled);
+        assert(std::abs(steps[i].start_time - i * step_length) < 2 * period_s);
+        assert(std::abs(steps[i].end_time - (i + 1) * step_length) < 2 * period_s);
+    }
+}
+
+// Replies of a rotor whose velocity follows the command with a first
+// order response and a once per revolution ripple.
+class RotorModel {
+public:
+    void update(const MoteusInterface::ServoCommand& command, double dt,
+                MoteusInterface::ServoReply* reply) {
+        time_ += dt;
+        velocity_ = command.position.velocity +
+            (velocity_ - command.position.velocity) * std::exp(-dt / 0.05);
+        reply->valid = true;
+        reply->result.velocity = velocity_ + 0.5 * std::sin(2 * M_PI * 55 * time_);
+        reply->result.control_velocity = command.position.velocity;
+        reply->result.torque = 0.05 * std::sin(2 * M_PI * 55 * time_);
+    }
+
+private:
+    double time_ = 0.0;
+    double velocity_ = 0.0;
+};
+
+// Steps end once the rotor settles.
+void test_settling_steps() {
+    std::vector<float> velocities;
+    std::vector<float> amplitudes;
+    std::vector<float> phases;
+    generateThrustVectorSequence(50.0, 80.0, 5.0, 0.0, 0.35, 0.08, 0.0, 0.0, 1.0, true,
+                                 velocities, amplitudes, phases);
+    CalibrationController::SettlingOptions settling;
+    CalibrationController controller(velocities, amplitudes, phases, settling);
+    std::vector<MoteusInterface::ServoCommand> commands(1);
+    controller.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(1);
+
+    const double period_s = 0.0003;
+    VirtualControlClock clock(std::chrono::nanoseconds(300000));
+    RotorModel rotor;
+    size_t cycles = 0;
+    while (!controller.run(clock.tick(), replies, &commands)) {
+        // The reply arrives in the next cycle.
+        rotor.update(commands[0], period_s, &replies[0]);
+        cycles++;
+        assert(cycles < 1e6);
+    }
+
+    const auto& steps = controller.steps();
+    assert(steps.size() == velocities.size());
+    for (size_t i = 0; i < steps.size(); i++) {
+        assert(steps[i].index == i);
+        assert(steps[i].amplitude == amplitudes[i]);
+        if (i > 0) {
+            assert(steps[i].start_time == steps[i - 1].end_time);
+        }
+        const double length = steps[i].end_time - steps[i].start_time;
+        assert(length >= settling.min_step_length);
+        assert(length < settling.max_step_length);
+        // Steps without a velocity change settle at the minimum length.
+        if (i > 0 && velocities[i] == velocities[i - 1]) {
+            assert(steps[i].settled);
+            assert(length < settling.min_step_length + 2 * period_s);
+        }
+    }
+    // Much shorter than with fixed 1.5 s steps.
+    const double experiment_length = steps.back().end_time;
+    assert(experiment_length < 0.5 * 1.5 * velocities.size());
+
+    // The virtual clock starts at the steady_clock epoch, so the
+    // timestamps are the offset, the startup sequence and the step time.
+    const int64_t system_offset_ns = 1700000000000000000;
+    std::ostringstream csv;
+    controller.write_steps(csv, system_offset_ns);
+    std::istringstream lines(csv.str());
+    std::string line;
+    std::getline(lines, line);
+    assert(line == "Step,VelocityCommand,AmplitudeCommand,PhaseCommand,StartTime,EndTime,"
+                   "StartTimestamp,EndTimestamp,Settled");
+    size_t rows = 0;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::vector<std::string> row;
+        std::string field;
+        while (std::getline(fields, field, ',')) { row.push_back(field); }
+        assert(row.size() == 9);
+        const auto& step = steps[rows];
+        assert(std::stoll(row[6]) ==
+               system_offset_ns + 1000000000 + std::llround(step.start_time * 1e9));
+        assert(std::stoll(row[7]) ==
+               system_offset_ns + 1000000000 + std::llround(step.end_time * 1e9));
+        rows++;
+    }
+    assert(rows == steps.size());
+
+    // The maximum step length ends steps which never settle.
+    settling.detector.max_deviation[SteadyStateDetector::kVelocity] = 0.1;
+    CalibrationController unsettled(velocities, amplitudes, phases, settling);
+    unsettled.initialize(&commands);
+    VirtualControlClock unsettled_clock(std::chrono::nanoseconds(300000));
+    while (!unsettled.run(unsettled_clock.tick(), replies, &commands)) {
+        rotor.update(commands[0], period_s, &replies[0]);
+    }
+    assert(unsettled.steps().size() == velocities.size());
+    for (const auto& step : unsettled.steps()) {
+        assert(!step.settled);
+        assert(std::abs(step.end_time - step.start_time - settling.max_step_length) < 2 * period_s);
+    }
+}
+
+void test_starts_at_first_run() {
+    std::vector<float> values = {50.0f};
+    CalibrationController controller(values, {0.1f}, {0.0f}, 1.0, 0.5);
+    std::vector<MoteusInterface::ServoCommand> commands(1);
+    controller.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(1);
+
+    // The schedule is relative to the first run, not the clock's epoch.
+    VirtualControlClock clock(std::chrono::milliseconds(100),
+                              std::chrono::steady_clock::time_point(std::chrono::hours(1)));
+    assert(!controller.run(clock.tick(), replies, &commands));
+    assert(commands[0].position.velocity == 0.0);
+    for (int i = 0; i < 5; i++) {
+        assert(!controller.run(clock.tick(), replies, &commands));
+    }
+    assert(commands[0].position.velocity == 50.0);
+}
+
+int main() {
+    test_schedule_in_virtual_time();
+    test_starts_at_first_run();
+    test_settling_steps();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,171 @@
+// calibration_planner_test.cpp
+#include "../analysis/calibration_planner.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <set>
+
+// A rotor on a force/torque sensor, which is read live: samples at
+// 1 kHz of the command in effect, up to the current time.
+class SyntheticRotor {
+public:
+    static constexpr double kThrust = 0.0015;
+    static constexpr double kElevation = 65.0;
+    static double phase_offset(double v) { return 1.2 + 0.004 * v; }
+
+    bool next(ForceSample* sample) {
+        const double t = index_ * 0.001;
+        if (t > now_) { return false; }
+        index_++;
+
+        std::normal_distribution<double> noise(0.0, 0.02);
+        const double v = command_.position.velocity;
+        const double thrust = kThrust * v * v * (1.0 + noise(rng_));
+        const double elevation =
+            (kElevation * command_.position.sinusoidal_amplitude + 20 * noise(rng_)) * M_PI / 180;
+        const double azimuth = command_.position.sinusoidal_phase - phase_offset(v) + noise(rng_);
+        sample->time = t;
+        sample->force[0] = thrust * std::sin(elevation) * std::cos(azimuth);
+        sample->force[1] = thrust * std::sin(elevation) * std::sin(azimuth);
+        sample->force[2] = -thrust * std::cos(elevation);
+        return true;
+    }
+
+    // After each cycle, @p now in seconds after the startup sequence.
+    void update(double now, const MoteusInterface::ServoCommand& command,
+                MoteusInterface::ServoReply* reply) {
+        now_ = now;
+        command_ = command;
+        reply->valid = true;
+        reply->result.velocity = command.position.velocity;
+        reply->result.control_velocity = command.position.velocity;
+        reply->result.torque = 0.0;
+    }
+
+private:
+    double now_ = -1.0;
+    MoteusInterface::ServoCommand command_;
+    int64_t index_ = 0;
+    std::mt19937 rng_{7};
+};
+
+constexpr double SyntheticRotor::kThrust;
+constexpr double SyntheticRotor::kElevation;
+
+struct Session {
+    std::vector<CalibrationStep> steps;
+    CalibrationEstimate estimate;
+    CalibrationModel model;
+    bool converged = false;
+};
+
+Session run_session(const CalibrationPlanner::Options& options) {
+    CalibrationController::SettlingOptions settling;
+    CalibrationController controller({}, {}, {}, settling);
+    SyntheticRotor rotor;
+    OnlineCalibration fit(&controller, OnlineCalibration::Options(),
+                          [&](ForceSample* sample) { return rotor.next(sample); },
+                          OnlineCalibration::PublishCallback());
+    CalibrationPlanner planner(&controller, &fit, options);
+    assert(controller.step_count() == planner.seed().size());
+
+    std::vector<MoteusInterface::ServoCommand> commands(1);
+    planner.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(1);
+    const double period_s = 0.0005;
+    VirtualControlClock clock(std::chrono::microseconds(500));
+    int cycles = 0;
+    while (!planner.run(clock.tick(), replies, &commands)) {
+        rotor.update(cycles * period_s - controller.startup_sequence_length(), commands[0],
+                     &replies[0]);
+        cycles++;
+        assert(cycles < 1000000);
+    }
+
+    Session session;
+    session.steps = controller.steps();
+    session.estimate = fit.estimate();
+    session.model = fit.Apply(CalibrationModel());
+    session.converged = planner.converged();
+    return session;
+}
+
+void test_candidates_and_seed() {
+    CalibrationPlanner::Options options;
+    options.phases = {0.0f, 1.0f};
+    CalibrationController controller({}, {}, {}, CalibrationController::SettlingOptions());
+    OnlineCalibration fit(&controller, OnlineCalibration::Options(), ForceLogSource(),
+                          OnlineCalibration::PublishCallback());
+    CalibrationPlanner planner(&controller, &fit, options);
+    // 7 velocities, 5 amplitudes and 2 phases.
+    assert(planner.candidates().size() == 70);
+    const auto seed = planner.seed();
+    assert(seed.size() == 5);
+    assert(controller.step_count() == 5);
+    std::set<float> velocities;
+    for (const auto& point : seed) {
+        velocities.insert(point.velocity);
+        assert(point.phase == 0.0f);
+        assert(point.amplitude == 0.0f || std::abs(point.amplitude - 0.32f) < 1e-6);
+    }
+    assert(velocities.size() == 3 && *velocities.begin() == 50.0f && *velocities.rbegin() == 80.0f);
+
+    // A controller of its own steps cannot be planned.
+    CalibrationController fixed({50.0f}, {0.0f}, {0.0f}, 1.0);
+    bool threw = false;
+    try {
+        CalibrationPlanner bad(&fixed, &fit, options);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+// Reaches the tolerances with a fraction of the 70 steps of the grid of
+// main_calibration.cpp.
+void test_converges_with_few_steps() {
+    CalibrationPlanner::Options options;
+    const Session session = run_session(options);
+    assert(session.converged);
+    assert(session.steps.size() < 70 / 3);
+    for (const auto& step : session.steps) {
+        assert(step.settled);
+    }
+
+    const CalibrationEstimate& estimate = session.estimate;
+    assert(estimate.thrust_interval <= options.thrust_tolerance * estimate.thrust_coefficient);
+    assert(std::abs(estimate.thrust_coefficient - SyntheticRotor::kThrust) <
+           options.thrust_tolerance * SyntheticRotor::kThrust);
+    assert(std::abs(estimate.elevation_coefficient - SyntheticRotor::kElevation) <
+           options.elevation_tolerance * SyntheticRotor::kElevation);
+    for (float v = 50; v <= 80; v += 5) {
+        const CalibrationModel& m = session.model;
+        const double offset = m.phase_offset[0] + m.phase_offset[1] * v + m.phase_offset[2] * v * v;
+        assert(std::abs(offset - SyntheticRotor::phase_offset(v)) < options.phase_tolerance);
+    }
+}
+
+// Without reachable tolerances the plan runs max_steps, and still
+// spreads over the grid.
+void test_max_steps() {
+    CalibrationPlanner::Options options;
+    options.thrust_tolerance = 0.0;
+    options.max_steps = 30;
+    const Session session = run_session(options);
+    assert(!session.converged);
+    assert(session.steps.size() == 30);
+    std::set<std::pair<float, float>> points;
+    for (const auto& step : session.steps) {
+        points.insert({step.velocity, step.amplitude});
+    }
+    assert(points.size() > 10);
+}
+
+int main() {
+    test_candidates_and_seed();
+    test_converges_with_few_steps();
+    test_max_steps();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+// calibration_table_test.cpp
+#include "../controller/calibration_table.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+bool near(float a, float b, float tolerance) {
+    return std::abs(a - b) <= tolerance;
+}
+
+void test_matches_model() {
+    CalibrationModel model;
+    model.phase_offset[1] = 0.01f;
+    model.phase_offset[2] = 1e-4f;
+    const CalibrationTable table(model);
+    // The largest velocity step between the thrust nodes, and the
+    // phase error it gives, see CalibrationTable.
+    const float velocity_step =
+        (std::sqrt(model.max_thrust) - std::sqrt(model.min_thrust)) /
+        (CalibrationTable::Size().thrust - 1) / std::sqrt(model.thrust_coefficient);
+    const float phase_error = model.phase_offset[2] * velocity_step * velocity_step / 4;
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> thrust(model.min_thrust, model.max_thrust);
+    std::uniform_real_distribution<float> elevation(0.0f, model.max_elevation);
+    std::uniform_real_distribution<float> azimuth(-M_PI, M_PI);
+    for (int i = 0; i < 10000; i++) {
+        const float t = thrust(rng);
+        const float e = elevation(rng);
+        const float a = azimuth(rng);
+        const RotorCommand expected = CalibrationTable::evaluate(model, t, e, a);
+        const RotorCommand actual = table.lookup(t, e, a);
+        // Velocity is linear in sqrt(thrust), the thrust axis.
+        assert(near(actual.velocity, expected.velocity, 1e-5f * expected.velocity));
+        assert(near(actual.amplitude, expected.amplitude, 1e-5f));
+        assert(near(actual.phase, expected.phase, phase_error + 1e-5f));
+    }
+}
+
+// The default model, as PWMInputController computed it, is reproduced
+// between the nodes as well as on them.
+void test_default_model_is_exact() {
+    const CalibrationModel model;
+    const CalibrationTable table(model);
+    for (float t = 0.3f; t <= 11.0f; t += 0.0137f) {
+        for (float e = 0.0f; e <= 0.3f; e += 0.0071f) {
+            const float a = std::fmod(t * 7.0f, 2 * M_PI) - M_PI;
+            const RotorCommand expected = CalibrationTable::evaluate(model, t, e, a);
+            const RotorCommand actual = table.lookup(t, e, a);
+            assert(near(actual.velocity, expected.velocity, 1e-5f * expected.velocity));
+            assert(near(actual.amplitude, expected.amplitude, 1e-5f));
+            assert(near(actual.phase, expected.phase, 1e-5f));
+        }
+    }
+}
+
+void test_default_model_matches_previous_mapping() {
+    const CalibrationModel model;
+    // thrust 6 N, 10 deg elevation, azimuth 0.5 rad
+    const RotorCommand command = CalibrationTable::evaluate(model, 6.0f, 10 * M_PI / 180, 0.5f);
+    assert(near(command.velocity, std::sqrt(6.0f / 0.0015f), 1e-3f));
+    assert(near(command.amplitude, 10.0f / 65.0f, 1e-6f));
+    assert(near(command.phase, 0.5f + M_PI / 2, 1e-6f));
+}
+
+void test_clamping() {
+    const CalibrationModel model;
+    const CalibrationTable table(model);
+
+    // Grid corners are reproduced exactly, and inputs beyond them are
+    // clamped.
+    const RotorCommand low = table.lookup(-100.0f, -1.0f, -10.0f);
+    const RotorCommand min = CalibrationTable::evaluate(model, model.min_thrust, 0.0f, -M_PI);
+    assert(near(low.velocity, min.velocity, 1e-4f));
+    assert(near(low.amplitude, 0.0f, 1e-6f));
+    assert(near(low.phase, min.phase, 1e-5f));
+
+    const RotorCommand high = table.lookup(100.0f, 1.0f, 10.0f);
+    const RotorCommand max = CalibrationTable::evaluate(
+        model, model.max_thrust, model.max_elevation, M_PI);
+    assert(near(high.velocity, max.velocity, 1e-3f));
+    assert(near(high.amplitude, max.amplitude, 1e-6f));
+    assert(near(high.phase, M_PI + M_PI / 2, 1e-5f));
+
+    // Commands are limited even if the model allows more.
+    const RotorCommand limited = CalibrationTable::evaluate(model, 1e4f, 1.0f, 0.0f);
+    assert(limited.velocity <= model.max_velocity);
+    assert(limited.amplitude <= model.max_amplitude);
+
+    assert(!std::isnan(table.lookup(NAN, 0.0f, 0.0f).amplitude));
+}
+
+void test_file_round_trip() {
+    const std::string filename = "calibration_table_test.cal";
+    CalibrationModel model;
+    model.thrust_coefficient = 0.0012f;
+    model.elevation_coefficient = 58.5f;
+    model.phase_offset[0] = 1.2f;
+    model.phase_offset[2] = -1e-4f;
+    model.max_velocity = 85.0f;
+    save_calibration_model(filename, model);
+
+    const CalibrationModel loaded = load_calibration_model(filename);
+    assert(loaded.thrust_coefficient == model.thrust_coefficient);
+    assert(loaded.elevation_coefficient == model.elevation_coefficient);
+    for (int i = 0; i < 3; i++) {
+        assert(loaded.phase_offset[i] == model.phase_offset[i]);
+    }
+    assert(loaded.max_velocity == model.max_velocity);
+    assert(loaded.max_elevation == model.max_elevation);
+
+    // Missing keys and phase_offset terms keep their defaults or zero.
+    {
+        std::ofstream output(filename);
+        output << "# partial\nthrust_coefficient = 0.002\nphase_offset = 1.0\n";
+    }
+    const CalibrationModel partial = load_calibration_model(filename);
+    assert(partial.thrust_coefficient == 0.002f);
+    assert(partial.elevation_coefficient == CalibrationModel().elevation_coefficient);
+    assert(partial.phase_offset[0] == 1.0f && partial.phase_offset[1] == 0.0f);
+
+    {
+        std::ofstream output(filename);
+        output << "thrust_coefficient = abc\n";
+    }
+    bool threw = false;
+    try {
+        load_calibration_model(filename);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    std::remove(filename.c_str());
+}
+
+int main() {
+    test_matches_model();
+    test_default_model_is_exact();
+    test_default_model_matches_previous_mapping();
+    test_clamping();
+    test_file_round_trip();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,139 @@
+// can_spi_lane_test.cpp
+#include "../pi3hat/can_spi_lane.h"
+#include <iostream>
+#include <cassert>
+#include <deque>
+#include <vector>
+
+using namespace mjbots::pi3hat;
+
+// An SPI peripheral whose chip selects each have a CAN processor with
+// received frames queued.  A transfer completes at the first Poll()
+// after it starts.
+class FakeSpi {
+public:
+    // A frame received on the first bus of @p cs from @p source.
+    void queue_frame(int cs, int source, int size) {
+        std::vector<uint8_t> frame(5 + size);
+        frame[0] = size;
+        frame[3] = source;
+        for (int i = 0; i < size; i++) { frame[5 + i] = source + i; }
+        queues_[cs].push_back(frame);
+    }
+
+    size_t queued(int cs) const { return queues_[cs].size(); }
+    int frame_reads() const { return frame_reads_; }
+
+    void StartWrite(int, int, const char*, size_t) { active_ = true; }
+
+    void StartRead(int cs, int address, char* data, size_t size) {
+        active_ = true;
+        const auto& queue = queues_[cs];
+        if (address == 2) {
+            for (size_t i = 0; i < size; i++) {
+                data[i] = i < queue.size() ? queue[i].size() : 0;
+            }
+        } else if (address == 3) {
+            frame_reads_++;
+            assert(!queue.empty());
+            const auto frame = queue.front();
+            queues_[cs].pop_front();
+            for (size_t i = 0; i < size; i++) {
+                data[i] = i < frame.size() ? frame[i] : 0;
+            }
+        }
+    }
+
+    bool Poll() {
+        active_ = false;
+        return true;
+    }
+
+    bool idle() const { return !active_; }
+
+private:
+    std::deque<std::vector<uint8_t>> queues_[2];
+    bool active_ = false;
+    int frame_reads_ = 0;
+};
+
+// Both lanes read from their processors into one buffer.
+void test_two_lanes() {
+    FakeSpi aux_spi;
+    FakeSpi primary_spi;
+    CanSpiLane<FakeSpi> aux(&aux_spi, {1, 3});
+    CanSpiLane<FakeSpi> primary(&primary_spi, {5});
+    aux_spi.queue_frame(0, 1, 8);
+    aux_spi.queue_frame(1, 2, 12);
+    primary_spi.queue_frame(0, 3, 4);
+
+    CanFrame frames[4];
+    const Span<CanFrame> span(frames, 4);
+    Pi3Hat::Output output;
+    CanRxBuffer rx(&span, &output);
+    aux.Begin(&rx, 0);
+    primary.Begin(&rx, 0);
+    aux.StartReading(0x3e);
+    primary.StartReading(0x3e);
+    for (int i = 0; i < 20; i++) {
+        aux.Poll();
+        primary.Poll();
+    }
+    aux.Finish();
+    primary.Finish();
+
+    assert(output.rx_can_size == 3);
+    assert(rx.reserved == 0);
+    int buses = 0;
+    for (size_t i = 0; i < output.rx_can_size; i++) {
+        buses |= 1 << frames[i].bus;
+        assert(frames[i].data[0] == ((frames[i].id >> 8) & 0x7f));
+    }
+    assert(buses == ((1 << 1) | (1 << 3) | (1 << 5)));
+}
+
+// A lane which starts to read a frame has its slot, even if the other
+// lane completes a frame first.
+void test_one_slot_for_two_lanes() {
+    FakeSpi aux_spi;
+    FakeSpi primary_spi;
+    CanSpiLane<FakeSpi> aux(&aux_spi, {1});
+    CanSpiLane<FakeSpi> primary(&primary_spi, {5});
+    aux_spi.queue_frame(0, 1, 8);
+    primary_spi.queue_frame(0, 2, 8);
+
+    // The span has one slot, the second must not be written.
+    CanFrame frames[2];
+    frames[1].id = 0x1234;
+    const Span<CanFrame> span(frames, 1);
+    Pi3Hat::Output output;
+    CanRxBuffer rx(&span, &output);
+    aux.Begin(&rx, 0);
+    primary.Begin(&rx, 0);
+    aux.StartReading(0x3e);
+    primary.StartReading(0x3e);
+
+    // Each lane reads its queue sizes, then the aux lane starts to read
+    // its frame, before the primary lane can.
+    for (int i = 0; i < 5; i++) {
+        aux.Poll();
+        primary.Poll();
+    }
+    aux.Finish();
+    primary.Finish();
+
+    assert(output.rx_can_size == 1);
+    assert(rx.reserved == 0);
+    assert(frames[0].bus == 1);
+    assert(frames[1].id == 0x1234 && frames[1].bus == 0);
+    // The primary lane's frame is left queued for the next cycle.
+    assert(primary_spi.frame_reads() == 0);
+    assert(primary_spi.queued(0) == 1);
+}
+
+int main() {
+    test_two_lanes();
+    test_one_slot_for_two_lanes();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
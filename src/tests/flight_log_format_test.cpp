@@ -0,0 +1,123 @@
+// flight_log_format_test.cpp
+#include "../logging/flight_log_format.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+MotorLogRecord make_record(int i, int id) {
+    MotorLogRecord record;
+    record.timestamp_ns = 1686225475288853035LL + (i / 2) * 300000LL;
+    record.id = id;
+    record.bus = 3;
+    record.mode = 16;
+    record.velocity = 80.0f + 0.01f * (i % 17);
+    record.torque = -0.64f + 0.01f * (i % 5);
+    record.control_velocity = (i % 7 == 0) ? std::numeric_limits<float>::quiet_NaN() : 80.5f;
+    record.velocity_command = 80.0f;
+    record.amplitude_command = 0.08f * (i / 1000);
+    record.phase_command = -1.5f;
+    record.temperature = 42.0f;
+    record.voltage = 22.5f;
+    return record;
+}
+
+bool same_value(float a, float b) {
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::isnan(a) && std::isnan(b);
+    }
+    return std::abs(a - b) <= 0.5e-5f * std::max(1.0f, std::abs(a));
+}
+
+bool same_record(const MotorLogRecord& a, const MotorLogRecord& b) {
+    return a.timestamp_ns == b.timestamp_ns &&
+        a.id == b.id &&
+        a.bus == b.bus &&
+        a.mode == b.mode &&
+        same_value(a.velocity, b.velocity) &&
+        same_value(a.torque, b.torque) &&
+        same_value(a.control_velocity, b.control_velocity) &&
+        same_value(a.velocity_command, b.velocity_command) &&
+        same_value(a.amplitude_command, b.amplitude_command) &&
+        same_value(a.phase_command, b.phase_command) &&
+        same_value(a.temperature, b.temperature) &&
+        same_value(a.voltage, b.voltage);
+}
+
+// Encode records for two interleaved servos, spanning several blocks.
+std::string encode(int count) {
+    std::string result;
+    const auto header = flight_log::Encoder::FileHeader();
+    result.append(header.begin(), header.end());
+
+    flight_log::Encoder encoder;
+    for (int i = 0; i < count; i++) {
+        const auto record = make_record(i, 1 + i % 2);
+        if (!encoder.Append(record)) {
+            const auto& block = encoder.block();
+            assert(block.size() <= flight_log::kMaxBlockSize);
+            result.append(block.begin(), block.end());
+            encoder.Reset();
+            assert(encoder.Append(record));
+        }
+    }
+    const auto& block = encoder.block();
+    result.append(block.begin(), block.end());
+    return result;
+}
+
+void test_round_trip() {
+    const int count = 5000;
+    const std::string data = encode(count);
+    // Each record would be roughly 105 bytes as CSV.
+    assert(data.size() < count * 20);
+
+    std::istringstream input(data);
+    flight_log::Reader reader(input);
+    MotorLogRecord record;
+    for (int i = 0; i < count; i++) {
+        assert(reader.Next(&record));
+        assert(same_record(record, make_record(i, 1 + i % 2)));
+    }
+    assert(!reader.Next(&record));
+    assert(!reader.truncated());
+}
+
+void test_truncated_block() {
+    const int count = 5000;
+    std::string data = encode(count);
+    data.resize(data.size() - 10);
+
+    std::istringstream input(data);
+    flight_log::Reader reader(input);
+    MotorLogRecord record;
+    int read = 0;
+    while (reader.Next(&record)) {
+        assert(same_record(record, make_record(read, 1 + read % 2)));
+        read++;
+    }
+    // Every complete block is still readable.
+    assert(read > 0);
+    assert(read < count);
+    assert(reader.truncated());
+}
+
+void test_bad_header() {
+    std::istringstream input("Time,ID,Bus,Mode\n");
+    bool threw = false;
+    try {
+        flight_log::Reader reader(input);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+int main() {
+    test_round_trip();
+    test_truncated_block();
+    test_bad_header();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
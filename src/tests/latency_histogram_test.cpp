@@ -0,0 +1,105 @@
+// latency_histogram_test.cpp
+#include "../logging/latency_histogram.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <thread>
+
+void test_bucket_boundaries() {
+    // Every value lies within its bucket, and buckets are contiguous.
+    int64_t expected_lowest = 0;
+    for (size_t i = 0; i < LatencyHistogram::kBucketCount; i++) {
+        const int64_t lowest = LatencyHistogram::LowestEquivalentValue(i);
+        const int64_t highest = LatencyHistogram::HighestEquivalentValue(i);
+        assert(lowest == expected_lowest);
+        assert(highest >= lowest);
+        assert(LatencyHistogram::BucketIndex(lowest) == i);
+        assert(LatencyHistogram::BucketIndex(highest) == i);
+        // The relative width of a bucket bounds the error.
+        assert(highest - lowest <= lowest / 32);
+        expected_lowest = highest + 1;
+    }
+    assert(LatencyHistogram::BucketIndex(uint64_t(1) << 62) ==
+           LatencyHistogram::kBucketCount - 1);
+}
+
+void test_percentiles() {
+    LatencyHistogram histogram;
+    // 1..100000 ns, uniformly.
+    for (int64_t i = 1; i <= 100000; i++) {
+        histogram.Record(i);
+    }
+    histogram.Record(-5);
+
+    LatencyHistogram::Snapshot snapshot;
+    histogram.Read(&snapshot);
+    assert(snapshot.count == 100001);
+    assert(snapshot.max == 100000);
+    assert(snapshot.counts[0] == 1);
+
+    const double fractions[] = {0.5, 0.99, 0.999};
+    for (const double fraction : fractions) {
+        const double expected = fraction * 100000;
+        const double actual = snapshot.Percentile(fraction);
+        assert(std::abs(actual - expected) <= expected * 0.035);
+    }
+    assert(snapshot.Percentile(1.0) == 100000);
+
+    LatencyHistogram::Snapshot empty;
+    assert(empty.Percentile(0.5) == 0);
+}
+
+void test_difference() {
+    LatencyHistogram histogram;
+    LatencyHistogram::Snapshot first;
+    LatencyHistogram::Snapshot second;
+    LatencyHistogram::Snapshot interval;
+
+    for (int i = 0; i < 1000; i++) {
+        histogram.Record(1000000);
+    }
+    histogram.Read(&first);
+    for (int i = 0; i < 10; i++) {
+        histogram.Record(200);
+    }
+    histogram.Read(&second);
+
+    interval.Difference(second, first);
+    assert(interval.count == 10);
+    assert(interval.Percentile(0.5) >= 200 && interval.Percentile(0.5) < 207);
+    assert(interval.max >= 200 && interval.max < 207);
+}
+
+void test_concurrent_read() {
+    LatencyHistogram histogram;
+    const int count = 200000;
+    std::thread writer([&]() {
+        for (int i = 0; i < count; i++) {
+            histogram.Record(i % 5000);
+        }
+    });
+
+    LatencyHistogram::Snapshot snapshot;
+    uint64_t last_count = 0;
+    do {
+        histogram.Read(&snapshot);
+        uint64_t sum = 0;
+        for (const auto value : snapshot.counts) {
+            sum += value;
+        }
+        assert(snapshot.count >= last_count);
+        assert(sum >= snapshot.count);
+        last_count = snapshot.count;
+        std::this_thread::yield();
+    } while (last_count < count);
+    writer.join();
+}
+
+int main() {
+    test_bucket_boundaries();
+    test_percentiles();
+    test_difference();
+    test_concurrent_read();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,179 @@
+// moteus_batch_encoder_test.cpp
+#include "../motor_control/moteus_batch_encoder.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace mjbots::moteus;
+
+// The value of every register written by a frame, as the raw integer
+// or float.
+std::map<uint32_t, double> decode_writes(const CanFrame& frame) {
+    std::map<uint32_t, double> result;
+    size_t offset = 0;
+    while (offset < frame.size) {
+        const uint8_t cmd = frame.data[offset++];
+        int count = cmd & 0x03;
+        if (count == 0) { count = frame.data[offset++]; }
+        const uint32_t start = frame.data[offset++];
+        if (cmd >= kReadBase) { continue; }
+        for (int i = 0; i < count; i++) {
+            double value = 0.0;
+            switch ((cmd >> 2) & 0x03) {
+                case 0: { int8_t v; std::memcpy(&v, &frame.data[offset], 1); value = v; offset += 1; break; }
+                case 1: { int16_t v; std::memcpy(&v, &frame.data[offset], 2); value = v; offset += 2; break; }
+                case 2: { int32_t v; std::memcpy(&v, &frame.data[offset], 4); value = v; offset += 4; break; }
+                case 3: { float v; std::memcpy(&v, &frame.data[offset], 4); value = v; offset += 4; break; }
+            }
+            result[start + i] = value;
+        }
+    }
+    return result;
+}
+
+CanFrame encode_one(const PositionCommand& command, const FrameFormat& format) {
+    CanFrame frame;
+    WriteCanFrame writer(&frame);
+    BatchFrameEncoder::EmitCommand(&writer, command, format);
+    EmitQueryCommand(&writer, format.query);
+    return frame;
+}
+
+float random_value(std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    switch (rng() % 8) {
+        case 0: return std::numeric_limits<float>::quiet_NaN();
+        case 1: return (rng() % 2 ? 1 : -1) * std::numeric_limits<float>::infinity();
+        case 2: return uniform(rng) * 1e6f;
+        case 3: return 0.0f;
+        default: return uniform(rng) * std::pow(10.0f, static_cast<int>(rng() % 4) - 1);
+    }
+}
+
+void check_matches_scalar(const FrameFormat& format) {
+    std::mt19937 rng(7);
+    // Not a multiple of the vector width, so the remainder is covered.
+    const size_t count = 103;
+    PositionCommandArrays arrays;
+    arrays.resize(count);
+    std::vector<PositionCommand> commands(count);
+    for (size_t i = 0; i < count; i++) {
+        PositionCommand& command = commands[i];
+        command.position = random_value(rng);
+        command.velocity = random_value(rng);
+        command.feedforward_torque = random_value(rng);
+        command.kp_scale = random_value(rng);
+        command.kd_scale = random_value(rng);
+        command.maximum_torque = random_value(rng);
+        command.stop_position = random_value(rng);
+        command.watchdog_timeout = random_value(rng);
+        command.sinusoidal_amplitude = random_value(rng);
+        command.sinusoidal_phase = random_value(rng);
+        arrays.Set(i, command);
+    }
+
+    const BatchFrameEncoder encoder(format);
+    std::vector<CanFrame> frames(count);
+    encoder.Encode(arrays, frames.data());
+
+    for (size_t i = 0; i < count; i++) {
+        const CanFrame expected = encode_one(commands[i], format);
+        assert(frames[i].size == expected.size);
+        assert(encoder.size() == expected.size);
+#ifdef MOTEUS_BATCH_ENCODER_NEON
+        // Integer fields may differ by one count, see BatchFrameEncoder.
+        const auto actual_writes = decode_writes(frames[i]);
+        const auto expected_writes = decode_writes(expected);
+        assert(actual_writes.size() == expected_writes.size());
+        for (const auto& item : expected_writes) {
+            const double actual = actual_writes.at(item.first);
+            assert((std::isnan(actual) && std::isnan(item.second)) ||
+                   actual == item.second || std::abs(actual - item.second) <= 1.0);
+        }
+#else
+        assert(std::memcmp(frames[i].data, expected.data, expected.size) == 0);
+#endif
+    }
+}
+
+void test_formats() {
+    // As used by the calibration and thrust vector controllers.
+    FrameFormat sinusoidal;
+    sinusoidal.mode = Mode::kSinusoidal;
+    sinusoidal.resolution.position = Resolution::kInt8;
+    sinusoidal.resolution.velocity = Resolution::kFloat;
+    sinusoidal.resolution.sinusoidal_amplitude = Resolution::kInt16;
+    sinusoidal.resolution.sinusoidal_phase = Resolution::kInt16;
+    sinusoidal.query.torque = Resolution::kInt16;
+    check_matches_scalar(sinusoidal);
+
+    // Every field, with runs of each resolution.
+    FrameFormat position;
+    position.mode = Mode::kPosition;
+    position.resolution.position = Resolution::kInt16;
+    position.resolution.velocity = Resolution::kInt16;
+    position.resolution.feedforward_torque = Resolution::kInt8;
+    position.resolution.kp_scale = Resolution::kInt8;
+    position.resolution.kd_scale = Resolution::kInt8;
+    position.resolution.maximum_torque = Resolution::kInt8;
+    position.resolution.stop_position = Resolution::kFloat;
+    position.resolution.watchdog_timeout = Resolution::kInt16;
+    check_matches_scalar(position);
+
+    FrameFormat stopped;
+    stopped.query = QueryCommand();
+    check_matches_scalar(stopped);
+
+    FrameFormat no_query = sinusoidal;
+    no_query.query.mode = Resolution::kIgnore;
+    no_query.query.velocity = Resolution::kIgnore;
+    no_query.query.torque = Resolution::kIgnore;
+    no_query.query.rezero_state = Resolution::kIgnore;
+    no_query.query.voltage = Resolution::kIgnore;
+    no_query.query.temperature = Resolution::kIgnore;
+    no_query.query.fault = Resolution::kIgnore;
+    no_query.query.control_velocity = Resolution::kIgnore;
+    check_matches_scalar(no_query);
+}
+
+void test_unsupported() {
+    FrameFormat format;
+    format.mode = Mode::kPosition;
+    format.resolution.position = Resolution::kInt32;
+    assert(!BatchFrameEncoder::Supported(format));
+    bool threw = false;
+    try {
+        BatchFrameEncoder encoder(format);
+    } catch (const std::logic_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    format.resolution.position = Resolution::kInt8;
+    assert(BatchFrameEncoder::Supported(format));
+    format.mode = Mode::kBrake;
+    assert(!BatchFrameEncoder::Supported(format));
+}
+
+void test_format_equality() {
+    FrameFormat a;
+    FrameFormat b;
+    assert(a == b);
+    b.query.control_velocity = Resolution::kInt8;
+    assert(a != b);
+    b = a;
+    b.resolution.sinusoidal_phase = Resolution::kInt16;
+    assert(a != b);
+}
+
+int main() {
+    test_formats();
+    test_unsupported();
+    test_format_equality();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
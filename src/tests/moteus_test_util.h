@@ -0,0 +1,25 @@
+// moteus_test_util.h
+#ifndef MOTEUS_TEST_UTIL_H
+#define MOTEUS_TEST_UTIL_H
+
+#include "../motor_control/moteus_protocol.h"
+
+// A query of no registers, so the servo does not reply.
+constexpr mjbots::moteus::QueryCommand no_query() {
+    using mjbots::moteus::Resolution;
+    mjbots::moteus::QueryCommand result;
+    result.mode = Resolution::kIgnore;
+    result.position = Resolution::kIgnore;
+    result.velocity = Resolution::kIgnore;
+    result.torque = Resolution::kIgnore;
+    result.q_current = Resolution::kIgnore;
+    result.d_current = Resolution::kIgnore;
+    result.rezero_state = Resolution::kIgnore;
+    result.voltage = Resolution::kIgnore;
+    result.temperature = Resolution::kIgnore;
+    result.fault = Resolution::kIgnore;
+    result.control_velocity = Resolution::kIgnore;
+    return result;
+}
+
+#endif
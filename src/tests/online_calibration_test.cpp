@@ -0,0 +1,242 @@
+// online_calibration_test.cpp
+#include "../analysis/online_calibration.h"
+#include "../controller/thrust_vector_sequence_generator.h"
+#include <iostream>
+#include <memory>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+void test_recursive_least_squares() {
+    // y = 2 + 3 x with residuals of +-0.1, against the closed form fit.
+    RecursiveLeastSquares<2> fit(1e6);
+    double sx = 0, sxx = 0, sy = 0, sxy = 0;
+    const int n = 20;
+    for (int i = 0; i < n; i++) {
+        const double x = 0.5 * i;
+        const double y = 2.0 + 3.0 * x + (i % 2 ? 0.1 : -0.1);
+        fit.Add({1.0, x}, y);
+        sx += x; sxx += x * x; sy += y; sxy += x * y;
+    }
+    const double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    const double intercept = (sy - slope * sx) / n;
+    assert(fit.count() == n);
+    assert(std::abs(fit.coefficient(1) - slope) < 1e-6);
+    assert(std::abs(fit.coefficient(0) - intercept) < 1e-6);
+
+    double residuals = 0;
+    for (int i = 0; i < n; i++) {
+        const double x = 0.5 * i;
+        const double r = 2.0 + 3.0 * x + (i % 2 ? 0.1 : -0.1) - intercept - slope * x;
+        residuals += r * r;
+    }
+    const double variance = residuals / (n - 2);
+    // Up to the prior, which adds theta . theta / 1e6 to the residuals.
+    assert(std::abs(fit.residual_variance() - variance) < 1e-3 * variance);
+    const double slope_error = std::sqrt(variance * n / (n * sxx - sx * sx));
+    assert(std::abs(fit.standard_error(1) - slope_error) < 1e-3 * slope_error);
+    assert(std::abs(fit.interval95(1) - 2.101 * slope_error) < 1e-3 * slope_error);
+
+    RecursiveLeastSquares<1> single(1.0);
+    single.Add({2.0}, 4.0);
+    assert(std::isinf(single.interval95(0)));
+    assert(std::isnan(single.residual_variance()));
+
+    assert(StudentT95(0) == INFINITY);
+    assert(StudentT95(1) == 12.706);
+    assert(std::abs(StudentT95(31) - 2.0395) < 1e-3);
+    assert(std::abs(StudentT95(120) - 1.9799) < 1e-3);
+    assert(std::abs(StudentT95(100000) - 1.96) < 1e-3);
+}
+
+// Force samples at 1 kHz of a rotor with the given coefficients, which
+// follows the fixed length steps of a calibration, with a wrong force
+// during the transient after each change.
+class SyntheticForceLog {
+public:
+    SyntheticForceLog(const std::vector<float>& velocities, const std::vector<float>& amplitudes,
+                      const std::vector<float>& phases, double step_length)
+        : velocities_(velocities), amplitudes_(amplitudes), phases_(phases),
+          step_length_(step_length) {}
+
+    bool next(ForceSample* sample) {
+        const double t = index_ * 0.001;
+        const size_t step = static_cast<size_t>(t / step_length_);
+        if (step >= velocities_.size()) { return false; }
+        index_++;
+
+        std::normal_distribution<double> noise(0.0, 0.02);
+        const double v = velocities_[step];
+        double thrust = kThrust * v * v * (1.0 + noise(rng_));
+        double elevation = (kElevation * amplitudes_[step] + 20 * noise(rng_)) * M_PI / 180;
+        if (t - step * step_length_ < 0.1) {
+            thrust *= 0.5;
+            elevation = 0.0;
+        }
+        const double azimuth = phases_[step] - M_PI / 2;
+        sample->time = t;
+        sample->force[0] = thrust * std::sin(elevation) * std::cos(azimuth);
+        sample->force[1] = thrust * std::sin(elevation) * std::sin(azimuth);
+        sample->force[2] = -thrust * std::cos(elevation);
+        return true;
+    }
+
+    static constexpr double kThrust = 0.0015;
+    static constexpr double kElevation = 65.0;
+
+private:
+    const std::vector<float> velocities_;
+    const std::vector<float> amplitudes_;
+    const std::vector<float> phases_;
+    const double step_length_;
+    int64_t index_ = 0;
+    std::mt19937 rng_{42};
+};
+
+constexpr double SyntheticForceLog::kThrust;
+constexpr double SyntheticForceLog::kElevation;
+
+void test_online_fit() {
+    std::vector<float> velocities;
+    std::vector<float> amplitudes;
+    std::vector<float> phases;
+    generateThrustVectorSequence(50.0, 80.0, 5.0, 0.0, 0.35, 0.08, 0.0, 0.0, 1.0, true,
+                                 velocities, amplitudes, phases);
+    const double step_length = 1.5;
+    CalibrationController controller(velocities, amplitudes, phases,
+                                     step_length * velocities.size());
+
+    SyntheticForceLog force_log(velocities, amplitudes, phases, step_length);
+    int published = 0;
+    CalibrationEstimate final_estimate;
+    OnlineCalibration online(
+        &controller, OnlineCalibration::Options(),
+        [&](ForceSample* sample) { return force_log.next(sample); },
+        [&](const CalibrationEstimate& estimate) {
+            published++;
+            final_estimate = estimate;
+        });
+    // The same steps fitted by the offline analysis.
+    CalibrationFit offline(CalibrationFit::Options{});
+    std::vector<StepResult> results;
+    online.set_step_callback([&](const StepResult& step) {
+        offline.Add(step);
+        results.push_back(step);
+    });
+
+    std::vector<MoteusInterface::ServoCommand> commands(1);
+    online.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(1);
+    VirtualControlClock clock(std::chrono::microseconds(300));
+    CalibrationEstimate halfway;
+    while (!online.run(clock.tick(), replies, &commands)) {
+        if (online.estimate().step_count == static_cast<int>(velocities.size() / 2)) {
+            halfway = online.estimate();
+        }
+    }
+
+    assert(published == 1);
+    const CalibrationEstimate estimate = online.estimate();
+    assert(estimate.step_count == static_cast<int>(velocities.size()));
+    assert(final_estimate.step_count == estimate.step_count);
+    assert(estimate.thrust_steps == estimate.step_count);
+    int amplitude_steps = 0;
+    for (float amplitude : amplitudes) { amplitude_steps += amplitude > 0; }
+    assert(estimate.elevation_steps == amplitude_steps);
+
+    // Each step averages the samples after its transient, and before
+    // half of it ahead of the next step.
+    for (const auto& step : results) {
+        assert(std::abs(step.sample_count - (step_length - 0.3) * 1000) <= 2);
+    }
+
+    // Within the confidence intervals, which shrink as steps are added.
+    assert(std::abs(estimate.thrust_coefficient - SyntheticForceLog::kThrust) <
+           estimate.thrust_interval);
+    assert(std::abs(estimate.elevation_coefficient - SyntheticForceLog::kElevation) <
+           estimate.elevation_interval);
+    assert(estimate.thrust_interval < 0.01 * SyntheticForceLog::kThrust);
+    assert(estimate.elevation_interval < 0.05 * SyntheticForceLog::kElevation);
+    assert(estimate.thrust_interval < halfway.thrust_interval);
+    assert(estimate.elevation_interval < halfway.elevation_interval);
+
+    // As the offline fit.
+    const CalibrationModel model = offline.Solve(CalibrationModel());
+    const CalibrationModel online_model = online.Apply(CalibrationModel());
+    assert(std::abs(online_model.thrust_coefficient - model.thrust_coefficient) <
+           1e-6 * model.thrust_coefficient);
+    assert(std::abs(online_model.elevation_coefficient - model.elevation_coefficient) <
+           1e-6 * model.elevation_coefficient);
+    for (float v = 50; v <= 80; v += 5) {
+        const auto offset = [v](const CalibrationModel& m) {
+            return m.phase_offset[0] + m.phase_offset[1] * v + m.phase_offset[2] * v * v;
+        };
+        assert(std::abs(offset(online_model) - offset(model)) < 1e-4);
+        // The synthetic rotor's azimuth is the phase - pi / 2.
+        assert(std::abs(offset(online_model) - M_PI / 2) < 0.01);
+    }
+    assert(estimate.phase_steps > 3 && std::isfinite(estimate.phase_interval[2]));
+}
+
+void test_without_force_samples() {
+    std::vector<float> values = {50.0f, 60.0f};
+    CalibrationController controller(values, {0.0f, 0.1f}, {0.0f, 0.0f}, 1.0, 0.5);
+    int published = 0;
+    OnlineCalibration online(&controller, OnlineCalibration::Options(),
+                             [](ForceSample*) { return false; },
+                             [&](const CalibrationEstimate&) { published++; });
+    std::vector<MoteusInterface::ServoCommand> commands(1);
+    online.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(1);
+    VirtualControlClock clock(std::chrono::milliseconds(1));
+    while (!online.run(clock.tick(), replies, &commands)) {}
+    assert(published == 1);
+    assert(online.estimate().step_count == 0);
+    assert(std::isinf(online.estimate().thrust_interval));
+    // The base model is kept.
+    CalibrationModel base;
+    base.thrust_coefficient = 0.002f;
+    assert(online.Apply(base).thrust_coefficient == 0.002f);
+}
+
+// A second session on the same instance starts from scratch, without
+// the force sample buffered at the end of the first.
+void test_second_session() {
+    std::vector<float> velocities = {50.0f, 60.0f, 70.0f, 80.0f, 60.0f};
+    std::vector<float> amplitudes = {0.0f, 0.3f, 0.3f, 0.3f, 0.2f};
+    std::vector<float> phases = {0.0f, 0.0f, 1.0f, 2.0f, 3.0f};
+    const double step_length = 1.0;
+    CalibrationController controller(velocities, amplitudes, phases,
+                                     step_length * velocities.size());
+    std::unique_ptr<SyntheticForceLog> force_log;
+    OnlineCalibration online(&controller, OnlineCalibration::Options(),
+                             [&](ForceSample* sample) { return force_log->next(sample); },
+                             OnlineCalibration::PublishCallback());
+
+    CalibrationEstimate estimates[2];
+    for (auto& estimate : estimates) {
+        force_log.reset(new SyntheticForceLog(velocities, amplitudes, phases, step_length));
+        std::vector<MoteusInterface::ServoCommand> commands(1);
+        online.initialize(&commands);
+        std::vector<MoteusInterface::ServoReply> replies(1);
+        VirtualControlClock clock(std::chrono::microseconds(500));
+        while (!online.run(clock.tick(), replies, &commands)) {}
+        estimate = online.estimate();
+    }
+    assert(estimates[0].step_count == static_cast<int>(velocities.size()));
+    assert(estimates[1].step_count == estimates[0].step_count);
+    assert(estimates[1].thrust_coefficient == estimates[0].thrust_coefficient);
+    assert(estimates[1].elevation_coefficient == estimates[0].elevation_coefficient);
+    for (int i = 0; i < 3; i++) {
+        assert(estimates[1].phase_offset[i] == estimates[0].phase_offset[i]);
+    }
+}
+
+int main() {
+    test_recursive_least_squares();
+    test_online_fit();
+    test_without_force_samples();
+    test_second_session();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,142 @@
+// pi3hat_moteus_interface_test.cpp
+#include "../motor_control/pi3hat_moteus_interface.h"
+#include "../motor_control/simulated_transport.h"
+#include "moteus_test_util.h"
+#include <iostream>
+#include <cassert>
+#include <vector>
+
+using namespace mjbots;
+using MoteusInterface = moteus::Pi3HatMoteusInterface;
+
+MoteusInterface::Options make_options(moteus::WaitStrategy strategy) {
+    MoteusInterface::Options options;
+    options.can_wait.strategy = strategy;
+    options.can_wait.spin_count = 100;
+    options.completion_wait = options.can_wait;
+    options.transport_factory = []() {
+        moteus::SimulatedTransport::Options sim_options;
+        sim_options.latency_us = 50.0;
+        sim_options.jitter_us = 0.0;
+        return std::unique_ptr<moteus::CanTransport>(
+            new moteus::SimulatedTransport(sim_options));
+    };
+    return options;
+}
+
+void test_cycles(moteus::WaitStrategy strategy) {
+    std::vector<MoteusInterface::ServoCommand> commands(2);
+    commands[0].id = 1;
+    commands[0].bus = 1;
+    commands[1].id = 2;
+    commands[1].bus = 3;
+    std::vector<MoteusInterface::ServoReply> replies(commands.size());
+    std::vector<int32_t> reply_ns(commands.size(), -2);
+
+    MoteusInterface::Data data;
+    data.commands = {commands.data(), commands.size()};
+    data.replies = {replies.data(), replies.size()};
+    data.reply_ns = {reply_ns.data(), reply_ns.size()};
+
+    // Constructed last, so that it is destroyed before the data it
+    // may still be using.
+    MoteusInterface interface(make_options(strategy));
+
+    MoteusInterface::Output output;
+    assert(!interface.busy());
+    for (int i = 0; i < 200; i++) {
+        interface.Start(data);
+        output = interface.Wait();
+        assert(!interface.busy());
+        assert(output.query_result_size == 2);
+        assert(replies[0].id == 1 && replies[0].bus == 1);
+        assert(replies[1].id == 2 && replies[1].bus == 3);
+        assert(replies[0].result.mode == moteus::Mode::kStopped);
+        assert(output.wakeup_time.count() > 0);
+        // The simulation takes at least 50 us to reply.
+        assert(reply_ns[0] >= 50000 && reply_ns[1] >= 50000);
+    }
+
+    // A cycle can only be started once the previous has completed.
+    interface.Start(data);
+    bool threw = false;
+    try {
+        interface.Start(data);
+    } catch (const std::logic_error&) {
+        threw = true;
+    }
+    assert(threw);
+    while (!interface.Poll(&output));
+    assert(output.query_result_size == 2);
+    assert(output.transport_time.count() > 0);
+
+    // Destroying with a cycle in flight must not hang.
+    interface.Start(data);
+}
+
+void test_slots() {
+    const std::vector<std::pair<int, int>> servo_bus_map = {{5, 2}, {1, 1}, {3, 5}};
+    const moteus::ServoSlotTable slots(servo_bus_map);
+    assert(slots.size() == 3);
+    assert(slots.find(5, 2) == 0 && slots.find(1, 1) == 1 && slots.find(3, 5) == 2);
+    assert(slots.find(5, 1) == -1 && slots.find(200, 1) == -1 && slots.find(1, 9) == -1);
+
+    bool threw = false;
+    try {
+        moteus::ServoSlotTable duplicate({{1, 1}, {1, 1}});
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::vector<MoteusInterface::ServoCommand> commands(servo_bus_map.size());
+    for (size_t i = 0; i < commands.size(); i++) {
+        commands[i].id = servo_bus_map[i].first;
+        commands[i].bus = servo_bus_map[i].second;
+    }
+    // The last servo is not queried, so does not reply.
+    commands[2].query = no_query();
+    std::vector<MoteusInterface::ServoReply> replies(commands.size());
+
+    MoteusInterface::Data data;
+    data.commands = {commands.data(), commands.size()};
+    data.replies = {replies.data(), replies.size()};
+    data.slots = &slots;
+
+    MoteusInterface interface(make_options(moteus::WaitStrategy::kBlock));
+    for (int i = 0; i < 3; i++) {
+        interface.Start(data);
+        const auto output = interface.Wait();
+        assert(output.query_result_size == 2);
+        assert(replies[0].valid && replies[0].id == 5 && replies[0].bus == 2);
+        assert(replies[1].valid && replies[1].id == 1 && replies[1].bus == 1);
+        assert(!replies[2].valid);
+    }
+}
+
+void test_requires_transport() {
+    MoteusInterface::Options options = make_options(moteus::WaitStrategy::kBlock);
+    options.transport_factory = nullptr;
+    bool threw = false;
+    try {
+        MoteusInterface moteus_interface(options);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+int main() {
+    test_requires_transport();
+    test_slots();
+    test_cycles(moteus::WaitStrategy::kBlock);
+    test_cycles(moteus::WaitStrategy::kSpinThenBlock);
+    // These never sleep, so they need a core for each thread.
+    if (std::thread::hardware_concurrency() >= 2) {
+        test_cycles(moteus::WaitStrategy::kSpin);
+        test_cycles(moteus::WaitStrategy::kSpinYield);
+        test_cycles(moteus::WaitStrategy::kSpinWaitForEvent);
+    }
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,215 @@
+// replay_test.cpp
+#include "../analysis/replay.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+void test_pwm_log_reader() {
+    std::istringstream input("Timestamp_us,Pin0,Pin1\n100,900,1500\n\n250,1000,2000\n");
+    PwmLogReader reader(input);
+    assert(reader.channel_count() == 2);
+    PwmSample sample;
+    assert(reader.Next(&sample));
+    assert(sample.timestamp_ns == 100000);
+    assert(sample.pulse_widths.size() == 2);
+    assert(sample.pulse_widths[0] == 900.0f && sample.pulse_widths[1] == 1500.0f);
+    assert(reader.Next(&sample));
+    assert(sample.timestamp_ns == 250000);
+    assert(sample.pulse_widths[1] == 2000.0f);
+    assert(!reader.Next(&sample));
+
+    std::istringstream nanoseconds("Timestamp,Pin0\n1683137418929192964,1000\n");
+    PwmLogReader ns_reader(nanoseconds);
+    assert(ns_reader.Next(&sample));
+    assert(sample.timestamp_ns == 1683137418929192964LL);
+
+    std::istringstream bad_header("Time,Pin0\n");
+    bool threw = false;
+    try {
+        PwmLogReader bad_reader(bad_header);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::istringstream short_row("Timestamp_us,Pin0,Pin1\n100,900\n");
+    PwmLogReader short_reader(short_row);
+    threw = false;
+    try {
+        short_reader.Next(&sample);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+// A PWM log from samples given as (time in ms, pulse width of every
+// channel).
+PwmLogSource pwm_source(const std::vector<std::pair<int, float>>& samples, size_t* index) {
+    return [samples, index](PwmSample* sample) {
+        if (*index >= samples.size()) { return false; }
+        sample->timestamp_ns = 5000000000LL + samples[*index].first * 1000000LL;
+        sample->pulse_widths.assign(3, samples[*index].second);
+        (*index)++;
+        return true;
+    };
+}
+
+void test_thrust_vector_replay() {
+    ReplayPulseWidths pulse_widths;
+    std::vector<RotorConfig> rotors(1);
+    rotors[0].servo_id = 1;
+    rotors[0].bus = 3;
+    rotors[0].thrust_channel = 0;
+    rotors[0].elevation_channel = 1;
+    rotors[0].azimuth_channel = 2;
+    ThrustVectorController controller(rotors, &pulse_widths);
+
+    ReplayOptions options;
+    options.period_s = 0.001;
+    std::vector<MotorLogRecord> commands;
+    size_t index = 0;
+    const ReplayStats stats = ReplayController(
+        &controller, controller.servo_bus_map(), options, MotorLogSource(),
+        pwm_source({{0, 900.0f}, {10, 1500.0f}}, &index), &pulse_widths,
+        [&](const MotorLogRecord& record) { commands.push_back(record); });
+
+    // Until the virtual time of the last sample.
+    assert(stats.cycles == 11);
+    assert(stats.pwm_samples == 2);
+    assert(commands.size() == 11);
+    const RotorCommand expected = controller.command(0, 1500, 1500, 1500);
+    for (size_t i = 0; i < commands.size(); i++) {
+        assert(commands[i].id == 1 && commands[i].bus == 3);
+        assert(commands[i].timestamp_ns == 5000000000LL + static_cast<int64_t>(i) * 1000000);
+        if (i < 10) {
+            assert(commands[i].mode == static_cast<int32_t>(moteus::Mode::kStopped));
+        } else {
+            assert(commands[i].mode == static_cast<int32_t>(moteus::Mode::kSinusoidal));
+            assert(commands[i].velocity_command == expected.velocity);
+            assert(commands[i].amplitude_command == expected.amplitude);
+            assert(commands[i].phase_command == expected.phase);
+        }
+    }
+
+    // The same logs give the same commands, and an offset delays the
+    // PWM log.
+    options.pwm_offset_s = 0.005;
+    options.duration_s = 0.020;
+    index = 0;
+    std::vector<MotorLogRecord> delayed;
+    ReplayController(
+        &controller, controller.servo_bus_map(), options, MotorLogSource(),
+        pwm_source({{0, 900.0f}, {10, 1500.0f}}, &index), &pulse_widths,
+        [&](const MotorLogRecord& record) { delayed.push_back(record); });
+    assert(delayed.size() == 20);
+    assert(delayed[14].mode == static_cast<int32_t>(moteus::Mode::kStopped));
+    assert(delayed[15].mode == commands[10].mode);
+    assert(delayed[15].velocity_command == commands[10].velocity_command);
+    assert(delayed[19].phase_command == commands[10].phase_command);
+}
+
+// Records the velocity replied by the first servo each cycle, and asks
+// to stop after stop_after cycles.
+class RecordingController : public Controller {
+public:
+    void initialize(std::vector<MoteusInterface::ServoCommand>* commands) override {
+        initialized = commands->size();
+    }
+
+    bool run(const ControlTime& time,
+             const std::vector<MoteusInterface::ServoReply>& status,
+             std::vector<MoteusInterface::ServoCommand>* /*output*/) override {
+        times.push_back(time);
+        velocities.push_back(status[0].valid ? status[0].result.velocity : NAN);
+        return velocities.size() == stop_after;
+    }
+
+    size_t initialized = 0;
+    size_t stop_after = 0;
+    std::vector<double> velocities;
+    std::vector<ControlTime> times;
+};
+
+void test_motor_log_replies() {
+    const std::vector<MotorLogRecord> log = [] {
+        std::vector<MotorLogRecord> records(4);
+        const int64_t times_us[4] = {0, 1500, 1600, 3000};
+        const int ids[4] = {2, 2, 7, 2};
+        for (int i = 0; i < 4; i++) {
+            records[i].timestamp_ns = 1000000000LL + times_us[i] * 1000;
+            records[i].id = ids[i];
+            records[i].bus = 1;
+            records[i].velocity = 10.0f * (i + 1);
+        }
+        return records;
+    }();
+    size_t index = 0;
+    const MotorLogSource motor_log = [&](MotorLogRecord* record) {
+        if (index >= log.size()) { return false; }
+        *record = log[index++];
+        return true;
+    };
+
+    RecordingController controller;
+    ReplayOptions options;
+    options.period_s = 0.001;
+    size_t rows = 0;
+    const ReplayStats stats = ReplayController(
+        &controller, {{2, 1}}, options, motor_log, PwmLogSource(), nullptr,
+        [&](const MotorLogRecord&) { rows++; });
+    assert(controller.initialized == 1);
+    assert(stats.cycles == 4 && rows == 4);
+    assert(stats.motor_records == 4);
+    // The newest reply of servo 2 at 0, 1, 2 and 3 ms, servo 7 is not
+    // in the map.
+    assert(controller.velocities[0] == 10.0);
+    assert(controller.velocities[1] == 10.0);
+    assert(controller.velocities[2] == 20.0);
+    assert(controller.velocities[3] == 40.0);
+    // In the virtual time of the motor log.
+    assert(controller.times[0].now.time_since_epoch() == std::chrono::seconds(1));
+    assert(controller.times[0].dt.count() == 0);
+    assert(controller.times[3].now - controller.times[0].now == std::chrono::milliseconds(3));
+    assert(controller.times[3].dt == std::chrono::milliseconds(1));
+
+    // The controller can end the replay.
+    RecordingController stopping;
+    stopping.stop_after = 2;
+    index = 0;
+    const ReplayStats stopped = ReplayController(
+        &stopping, {{2, 1}}, options, motor_log, PwmLogSource(), nullptr,
+        [](const MotorLogRecord&) {});
+    assert(stopped.cycles == 2);
+}
+
+void test_nothing_to_replay() {
+    RecordingController controller;
+    bool threw = false;
+    try {
+        ReplayController(&controller, {{1, 1}}, ReplayOptions(), MotorLogSource(),
+                         PwmLogSource(), nullptr, [](const MotorLogRecord&) {});
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // A duration alone runs the controller without inputs.
+    ReplayOptions options;
+    options.duration_s = 0.01;
+    const ReplayStats stats = ReplayController(
+        &controller, {{1, 1}}, options, MotorLogSource(), PwmLogSource(), nullptr,
+        [](const MotorLogRecord&) {});
+    assert(stats.cycles == 10);
+}
+
+int main() {
+    test_pwm_log_reader();
+    test_thrust_vector_replay();
+    test_motor_log_replies();
+    test_nothing_to_replay();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,158 @@
+// rotor_setpoint_kernel_test.cpp
+#include "../controller/rotor_setpoint_kernel.h"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+bool same_bits(const std::vector<float>& a, const std::vector<float>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+// The mapping of the controller before the kernel, one rotor at a time.
+float legacy_map(float x, float out_min, float out_max) {
+    const float value = (x - 1000) * (out_max - out_min) / (2000 - 1000) + out_min;
+    return std::max(out_min, std::min(value, out_max));
+}
+
+void test_matches_legacy_mapping() {
+    RotorSetpointKernel::Rotor rotor;
+    rotor.min_thrust = 0.2f;
+    rotor.max_thrust = 1.1f;
+    rotor.max_elevation = 0.35f;
+    RotorSetpointKernel::Rotor mirrored = rotor;
+    mirrored.mirror_azimuth = true;
+    const RotorSetpointKernel kernel({rotor, mirrored});
+    const float pi = M_PI;
+
+    RotorSetpointArrays pulse_widths;
+    RotorSetpointArrays setpoints;
+    pulse_widths.resize(2);
+    setpoints.resize(2);
+    for (uint32_t us = 0; us <= 3000; us++) {
+        for (int i = 0; i < 2; i++) {
+            pulse_widths.thrust[i] = us;
+            pulse_widths.elevation[i] = us;
+            pulse_widths.azimuth[i] = us;
+        }
+        kernel.map(pulse_widths, &setpoints);
+        const float azimuth = legacy_map(us, -pi, pi);
+        for (int i = 0; i < 2; i++) {
+            assert(setpoints.thrust[i] == legacy_map(us, 0.2f, 1.1f));
+            assert(setpoints.elevation[i] == legacy_map(us, 0.0f, 0.35f));
+        }
+        assert(setpoints.azimuth[0] == azimuth);
+        assert(setpoints.azimuth[1] == -azimuth);
+    }
+}
+
+void test_bounds() {
+    RotorSetpointKernel::Rotor rotor;
+    rotor.min_thrust = 0.2f;
+    rotor.max_thrust = 1.1f;
+    rotor.max_elevation = 0.35f;
+    const RotorSetpointKernel kernel(std::vector<RotorSetpointKernel::Rotor>(9, rotor));
+    RotorSetpointArrays pulse_widths;
+    RotorSetpointArrays setpoints;
+    pulse_widths.resize(9);
+    setpoints.resize(9);
+    const float inputs[9] = {
+        0.0f, 999.0f, 1000.0f, 2000.0f, 2001.0f, 1e30f,
+        std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::quiet_NaN()};
+    for (int i = 0; i < 9; i++) {
+        pulse_widths.thrust[i] = inputs[i];
+        pulse_widths.elevation[i] = inputs[i];
+        pulse_widths.azimuth[i] = inputs[i];
+    }
+    kernel.map(pulse_widths, &setpoints);
+    for (int i = 0; i < 9; i++) {
+        assert(setpoints.thrust[i] >= 0.2f && setpoints.thrust[i] <= 1.1f);
+        assert(setpoints.elevation[i] >= 0.0f && setpoints.elevation[i] <= 0.35f);
+        assert(std::abs(setpoints.azimuth[i]) <= static_cast<float>(M_PI));
+    }
+    // NaN is clamped to the lower bound, like std::max(lo, std::min(NaN, hi)).
+    assert(setpoints.thrust[8] == 0.2f);
+    assert(setpoints.azimuth[8] == static_cast<float>(-M_PI));
+}
+
+float random_value(std::mt19937* rng) {
+    const float special[] = {
+        0.0f, -0.0f, 1000.0f, 2000.0f, 1e-40f, -1e-40f, 3e38f, -3e38f,
+        std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN()};
+    std::uniform_int_distribution<int> pick(0, 3);
+    if (pick(*rng) == 0) {
+        std::uniform_int_distribution<int> index(0, sizeof(special) / sizeof(special[0]) - 1);
+        return special[index(*rng)];
+    }
+    std::uniform_real_distribution<float> value(-500.0f, 3500.0f);
+    return value(*rng);
+}
+
+void test_vector_matches_scalar() {
+    std::mt19937 rng(19);
+    for (size_t size = 0; size <= 37; size++) {
+        for (int trial = 0; trial < 50; trial++) {
+            std::vector<RotorSetpointKernel::Rotor> rotors(size);
+            for (auto& rotor : rotors) {
+                // Including empty, inverted and infinite ranges.
+                rotor.min_thrust = random_value(&rng) / 1000.0f;
+                rotor.max_thrust = random_value(&rng) / 1000.0f;
+                rotor.max_elevation = random_value(&rng) / 1000.0f;
+                rotor.mirror_azimuth = rng() % 2;
+            }
+            const RotorSetpointKernel kernel(rotors);
+
+            RotorSetpointArrays pulse_widths;
+            pulse_widths.resize(size);
+            for (size_t i = 0; i < size; i++) {
+                pulse_widths.thrust[i] = random_value(&rng);
+                pulse_widths.elevation[i] = random_value(&rng);
+                pulse_widths.azimuth[i] = random_value(&rng);
+            }
+            RotorSetpointArrays vector;
+            RotorSetpointArrays scalar;
+            vector.resize(size);
+            scalar.resize(size);
+            kernel.map(pulse_widths, &vector);
+            kernel.map_scalar(pulse_widths, &scalar);
+            assert(same_bits(vector.thrust, scalar.thrust));
+            assert(same_bits(vector.elevation, scalar.elevation));
+            assert(same_bits(vector.azimuth, scalar.azimuth));
+            for (size_t i = 0; i < size; i++) {
+                const float value = kernel.map_value(RotorSetpointKernel::kThrust, i,
+                                                     pulse_widths.thrust[i]);
+                assert(std::memcmp(&value, &scalar.thrust[i], sizeof(value)) == 0);
+            }
+        }
+    }
+}
+
+void test_size_mismatch() {
+    const RotorSetpointKernel kernel(std::vector<RotorSetpointKernel::Rotor>(3));
+    RotorSetpointArrays pulse_widths;
+    RotorSetpointArrays setpoints;
+    pulse_widths.resize(3);
+    setpoints.resize(2);
+    bool threw = false;
+    try {
+        kernel.map(pulse_widths, &setpoints);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+int main() {
+    test_matches_legacy_mapping();
+    test_bounds();
+    test_vector_matches_scalar();
+    test_size_mismatch();
+    std::cout << "All tests passed (" << RotorSetpointKernel::isa() << ")!" << std::endl;
+    return 0;
+}
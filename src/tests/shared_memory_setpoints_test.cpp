@@ -0,0 +1,131 @@
+// shared_memory_setpoints_test.cpp
+#include "../setpoint/shared_memory_setpoints.h"
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Unique per process, so parallel test runs don't share a segment.
+std::string segment_name(const char* test) {
+    return std::string("/shared_memory_setpoints_test_") + test + "_" + std::to_string(::getpid());
+}
+
+void test_missing_segment() {
+    bool threw = false;
+    try {
+        SharedMemorySetpoints setpoints(segment_name("missing"));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_read() {
+    const std::string name = segment_name("read");
+    SharedMemorySetpointWriter writer(name);
+    SharedMemorySetpoints setpoints(name);
+
+    // Nothing written yet reads as disarmed.
+    setpoints.sample();
+    assert(!setpoints.fresh());
+    assert(setpoints.pulse_width(0) == 0);
+
+    const float values[3] = {1000.0f, 1500.25f, 1999.5f};
+    writer.write(values, 3);
+    // Values are only taken by sample().
+    assert(setpoints.pulse_width(1) == 0);
+    setpoints.sample();
+    assert(setpoints.fresh());
+    assert(setpoints.pulse_width(0) == 1000.0f);
+    assert(setpoints.pulse_width(1) == 1500.25f);
+    assert(setpoints.pulse_width(2) == 1999.5f);
+    assert(setpoints.pulse_width(3) == 0);
+    assert(setpoints.pulse_width(1000) == 0);
+
+    // The newest of several writes is read, also after the ring wraps.
+    for (int i = 0; i < 20; i++) {
+        const float value = 1000.0f + i;
+        writer.write(&value, 1);
+    }
+    setpoints.sample();
+    assert(setpoints.pulse_width(0) == 1019.0f);
+    assert(setpoints.pulse_width(1) == 0);
+    assert(setpoints.torn_reads() == 0);
+
+    SharedMemorySetpointWriter::remove(name);
+}
+
+void test_stale() {
+    const std::string name = segment_name("stale");
+    SharedMemorySetpointWriter writer(name);
+    SharedMemorySetpoints::Options options;
+    options.max_age = std::chrono::milliseconds(10);
+    SharedMemorySetpoints setpoints(name, options);
+
+    const float value = 1500.0f;
+    writer.write(&value, 1, shared_setpoints::now_ns() - 20000000);
+    setpoints.sample();
+    assert(!setpoints.fresh());
+    assert(setpoints.pulse_width(0) == 0);
+
+    writer.write(&value, 1);
+    setpoints.sample();
+    assert(setpoints.fresh());
+    assert(setpoints.pulse_width(0) == 1500.0f);
+
+    // A writer which stops disarms the controller.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    setpoints.sample();
+    assert(!setpoints.fresh());
+    assert(setpoints.pulse_width(0) == 0);
+
+    SharedMemorySetpointWriter::remove(name);
+}
+
+void test_concurrent_writer() {
+    const std::string name = segment_name("concurrent");
+    SharedMemorySetpointWriter writer(name);
+    SharedMemorySetpoints setpoints(name);
+
+    // Every write has all channels equal, so a torn read shows up as
+    // channels which differ.
+    std::atomic<bool> done{false};
+    std::thread writer_thread([&]() {
+        float values[shared_setpoints::kChannelCount];
+        for (int i = 1; i <= 200000; i++) {
+            for (auto& value : values) {
+                value = i;
+            }
+            writer.write(values, shared_setpoints::kChannelCount);
+        }
+        done = true;
+    });
+
+    float last = 0;
+    while (!done) {
+        setpoints.sample();
+        const float first = setpoints.pulse_width(0);
+        for (unsigned int channel = 1; channel < shared_setpoints::kChannelCount; channel++) {
+            assert(setpoints.pulse_width(channel) == first);
+        }
+        assert(first >= last);
+        last = first;
+    }
+    writer_thread.join();
+    setpoints.sample();
+    assert(setpoints.pulse_width(0) == 200000.0f);
+
+    SharedMemorySetpointWriter::remove(name);
+}
+
+int main() {
+    test_missing_segment();
+    test_read();
+    test_stale();
+    test_concurrent_writer();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
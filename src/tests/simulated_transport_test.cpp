@@ -0,0 +1,92 @@
+// simulated_transport_test.cpp
+#include "../motor_control/simulated_transport.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <thread>
+
+using namespace mjbots;
+
+moteus::SimulatedTransport::Options make_options() {
+    moteus::SimulatedTransport::Options options;
+    options.latency_us = 0.0;
+    options.jitter_us = 0.0;
+    options.velocity_noise = 0.0;
+    return options;
+}
+
+// Sends one command to servo 3 on bus 2, and returns the parsed reply.
+moteus::QueryResult cycle(moteus::SimulatedTransport* transport, bool stop,
+                          double velocity) {
+    pi3hat::CanFrame tx;
+    tx.id = 3 | 0x8000;
+    tx.bus = 2;
+    tx.expect_reply = true;
+
+    moteus::WriteCanFrame frame(tx.data, &tx.size);
+    if (stop) {
+        moteus::EmitStopCommand(&frame);
+    } else {
+        moteus::PositionCommand command;
+        command.position = std::numeric_limits<double>::quiet_NaN();
+        command.maximum_torque = std::numeric_limits<double>::quiet_NaN();
+        command.velocity = velocity;
+        command.sinusoidal_amplitude = 0.1;
+        moteus::PositionResolution resolution;
+        resolution.sinusoidal_amplitude = moteus::Resolution::kInt16;
+        resolution.sinusoidal_phase = moteus::Resolution::kInt16;
+        moteus::EmitSinusoidalPositionCommand(&frame, command, resolution);
+    }
+    moteus::QueryCommand query;
+    query.torque = moteus::Resolution::kInt16;
+    moteus::EmitQueryCommand(&frame, query);
+
+    pi3hat::CanFrame rx[2];
+    pi3hat::Pi3Hat::Input input;
+    input.tx_can = {&tx, 1};
+    input.rx_can = {rx, 2};
+    const auto output = transport->Cycle(input);
+
+    assert(output.rx_can_size == 1);
+    assert(((rx[0].id >> 8) & 0x7f) == 3);
+    assert(rx[0].bus == 2);
+    return moteus::ParseQueryResult(rx[0].data, rx[0].size);
+}
+
+void test_velocity_command() {
+    moteus::SimulatedTransport transport(make_options());
+    moteus::QueryResult result;
+    for (int i = 0; i < 100; i++) {
+        result = cycle(&transport, false, 20.0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    assert(result.mode == moteus::Mode::kSinusoidal);
+    assert(result.control_velocity == 20.0);
+    assert(result.velocity > 15.0 && result.velocity < 20.5);
+    assert(result.torque > 0.0);
+    assert(result.voltage == 24.0);
+    assert(result.temperature == 30.0);
+
+    const auto& servo = transport.servo(3, 2);
+    assert(servo.command.velocity == 20.0);
+    assert(std::abs(servo.command.sinusoidal_amplitude - 0.1) < 1e-4);
+}
+
+void test_stop_command() {
+    moteus::SimulatedTransport transport(make_options());
+    for (int i = 0; i < 10; i++) {
+        cycle(&transport, false, 20.0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    const auto result = cycle(&transport, true, 0.0);
+    assert(result.mode == moteus::Mode::kStopped);
+    assert(std::isnan(result.control_velocity));
+    assert(result.torque == 0.0);
+}
+
+int main() {
+    test_velocity_command();
+    test_stop_command();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,74 @@
+// spsc_ring_buffer_test.cpp
+#include "../logging/spsc_ring_buffer.h"
+#include <iostream>
+#include <cassert>
+#include <cstdint>
+#include <thread>
+
+void test_push_pop_and_wrap() {
+    SpscRingBuffer<int> queue(4);
+    int value = 0;
+
+    assert(queue.capacity() == 4);
+    assert(!queue.TryPop(&value));
+
+    // Fill, drain and refill a few times so the indices wrap around.
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            assert(queue.TryPush(round * 10 + i));
+        }
+        assert(!queue.TryPush(-1));
+        assert(queue.size() == 4);
+
+        for (int i = 0; i < 4; i++) {
+            assert(queue.TryPop(&value));
+            assert(value == round * 10 + i);
+        }
+        assert(!queue.TryPop(&value));
+        assert(queue.size() == 0);
+    }
+}
+
+void test_invalid_capacity() {
+    bool threw = false;
+    try {
+        SpscRingBuffer<int> queue(3);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_threaded_order() {
+    const uint64_t count = 100000;
+    SpscRingBuffer<uint64_t> queue(1024);
+
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < count; i++) {
+            while (!queue.TryPush(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint64_t expected = 0;
+    uint64_t value = 0;
+    while (expected < count) {
+        if (queue.TryPop(&value)) {
+            assert(value == expected);
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    assert(!queue.TryPop(&value));
+}
+
+int main() {
+    test_push_pop_and_wrap();
+    test_invalid_capacity();
+    test_threaded_order();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,250 @@
+// static_frame_codec_test.cpp
+#include "../motor_control/moteus_protocol.h"
+#include "../controller/sinusoidal_frame_format.h"
+#include "moteus_test_util.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using namespace mjbots::moteus;
+
+// Every command field, with runs of each resolution and a run long
+// enough to need a separate count byte.
+struct PositionFormat {
+    static constexpr FrameFormat format() {
+        FrameFormat result;
+        result.mode = Mode::kPosition;
+        result.resolution.position = Resolution::kInt32;
+        result.resolution.velocity = Resolution::kInt32;
+        result.resolution.feedforward_torque = Resolution::kInt16;
+        result.resolution.kp_scale = Resolution::kInt8;
+        result.resolution.kd_scale = Resolution::kInt8;
+        result.resolution.maximum_torque = Resolution::kInt8;
+        result.resolution.stop_position = Resolution::kInt8;
+        result.resolution.watchdog_timeout = Resolution::kFloat;
+        result.query.mode = Resolution::kInt8;
+        result.query.position = Resolution::kInt32;
+        result.query.velocity = Resolution::kInt32;
+        result.query.torque = Resolution::kInt32;
+        result.query.q_current = Resolution::kInt32;
+        result.query.d_current = Resolution::kInt16;
+        result.query.rezero_state = Resolution::kInt16;
+        result.query.voltage = Resolution::kFloat;
+        result.query.temperature = Resolution::kInt32;
+        result.query.fault = Resolution::kInt32;
+        result.query.control_velocity = Resolution::kInt16;
+        return result;
+    }
+};
+
+struct ZeroVelocityFormat {
+    static constexpr FrameFormat format() {
+        FrameFormat result;
+        result.mode = Mode::kZeroVelocity;
+        result.resolution.position = Resolution::kIgnore;
+        result.resolution.velocity = Resolution::kIgnore;
+        result.resolution.feedforward_torque = Resolution::kIgnore;
+        result.resolution.kp_scale = Resolution::kIgnore;
+        result.resolution.kd_scale = Resolution::kIgnore;
+        result.resolution.stop_position = Resolution::kIgnore;
+        result.resolution.watchdog_timeout = Resolution::kInt16;
+        return result;
+    }
+};
+
+// The default query.
+struct StoppedFormat {
+    static constexpr FrameFormat format() { return FrameFormat(); }
+};
+
+struct NoQueryFormat {
+    static constexpr FrameFormat format() {
+        FrameFormat result = SinusoidalFrameFormat::format();
+        result.query = no_query();
+        return result;
+    }
+};
+
+double random_value(std::mt19937& rng) {
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    switch (rng() % 8) {
+        case 0: return std::numeric_limits<double>::quiet_NaN();
+        case 1: return (rng() % 2 ? 1 : -1) * std::numeric_limits<double>::infinity();
+        case 2: return uniform(rng) * 1e6;
+        case 3: return 0.0;
+        default: return uniform(rng) * std::pow(10.0, static_cast<int>(rng() % 4) - 1);
+    }
+}
+
+CanFrame encode_generic(const PositionCommand& command, const FrameFormat& format) {
+    CanFrame frame;
+    WriteCanFrame writer(&frame);
+    switch (format.mode) {
+        case Mode::kStopped: EmitStopCommand(&writer); break;
+        case Mode::kSinusoidal: EmitSinusoidalPositionCommand(&writer, command, format.resolution); break;
+        default: EmitPositionCommand(&writer, command, format.resolution); break;
+    }
+    EmitQueryCommand(&writer, format.query);
+    return frame;
+}
+
+template <typename Format>
+void test_encode() {
+    using Codec = StaticFrameCodec<Format>;
+    const FrameFormat format = Format::format();
+    std::mt19937 rng(3);
+    for (int i = 0; i < 1000; i++) {
+        PositionCommand command;
+        command.position = random_value(rng);
+        command.velocity = random_value(rng);
+        command.feedforward_torque = random_value(rng);
+        command.kp_scale = random_value(rng);
+        command.kd_scale = random_value(rng);
+        command.maximum_torque = random_value(rng);
+        command.stop_position = random_value(rng);
+        command.watchdog_timeout = random_value(rng);
+        command.sinusoidal_amplitude = random_value(rng);
+        command.sinusoidal_phase = random_value(rng);
+
+        const CanFrame expected = encode_generic(command, format);
+        CanFrame frame;
+        Codec::Encode(command, frame.data, &frame.size);
+        assert(frame.size == expected.size);
+        assert(std::memcmp(frame.data, expected.data, expected.size) == 0);
+    }
+}
+
+// A reply to @p query as the servo sends it, with random values.
+CanFrame make_reply(const QueryCommand& query, std::mt19937& rng) {
+    CanFrame frame;
+    WriteCanFrame writer(&frame);
+    auto integer = [&](Resolution res) {
+        // Small values, as casting NaN to an integer is undefined.
+        writer.WriteMapped(rng() % 16, 1.0, 1.0, 1.0, res);
+    };
+    {
+        WriteCombiner<6> combiner(&writer, Multiplex::kReplyBase, Register::kMode, {
+            query.mode, query.position, query.velocity,
+            query.torque, query.q_current, query.d_current});
+        if (combiner.MaybeWrite()) { integer(query.mode); }
+        if (combiner.MaybeWrite()) { writer.WritePosition(random_value(rng), query.position); }
+        if (combiner.MaybeWrite()) { writer.WriteVelocity(random_value(rng), query.velocity); }
+        if (combiner.MaybeWrite()) { writer.WriteTorque(random_value(rng), query.torque); }
+        if (combiner.MaybeWrite()) { writer.WriteMapped(random_value(rng), 1.0, 0.1, 0.001, query.q_current); }
+        if (combiner.MaybeWrite()) { writer.WriteMapped(random_value(rng), 1.0, 0.1, 0.001, query.d_current); }
+    }
+    {
+        WriteCombiner<4> combiner(&writer, Multiplex::kReplyBase, Register::kRezeroState, {
+            query.rezero_state, query.voltage, query.temperature, query.fault});
+        if (combiner.MaybeWrite()) { integer(query.rezero_state); }
+        if (combiner.MaybeWrite()) { writer.WriteVoltage(random_value(rng), query.voltage); }
+        if (combiner.MaybeWrite()) { writer.WriteTemperature(random_value(rng), query.temperature); }
+        if (combiner.MaybeWrite()) { integer(query.fault); }
+    }
+    {
+        WriteCombiner<1> combiner(&writer, Multiplex::kReplyBase, Register::kControlVelocity, {
+            query.control_velocity});
+        if (combiner.MaybeWrite()) { writer.WriteVelocity(random_value(rng), query.control_velocity); }
+    }
+    return frame;
+}
+
+bool same(double a, double b) {
+    return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+void assert_same(const QueryResult& a, const QueryResult& b) {
+    assert(a.mode == b.mode);
+    assert(same(a.position, b.position));
+    assert(same(a.velocity, b.velocity));
+    assert(same(a.torque, b.torque));
+    assert(same(a.q_current, b.q_current));
+    assert(same(a.d_current, b.d_current));
+    assert(a.rezero_state == b.rezero_state);
+    assert(same(a.voltage, b.voltage));
+    assert(same(a.temperature, b.temperature));
+    assert(a.fault == b.fault);
+    assert(same(a.control_velocity, b.control_velocity));
+}
+
+template <typename Format>
+void test_decode() {
+    using Codec = StaticFrameCodec<Format>;
+    const FrameFormat format = Format::format();
+    std::mt19937 rng(5);
+    for (int i = 0; i < 1000; i++) {
+        CanFrame frame = make_reply(format.query, rng);
+        QueryResult result;
+        const bool decoded = Codec::Decode(frame.data, frame.size, &result);
+        assert(decoded);
+        assert_same(result, ParseQueryResult(frame.data, frame.size));
+
+        // CAN-FD frames are padded to a valid length.
+        const uint8_t size = frame.size;
+        while (frame.size < 64 && frame.size % 4 != 0) { frame.data[frame.size++] = 0x50; }
+        const bool padded_decoded = Codec::Decode(frame.data, frame.size, &result);
+        assert(padded_decoded);
+        assert_same(result, ParseQueryResult(frame.data, size));
+    }
+}
+
+void test_decode_mismatch() {
+    using Codec = SinusoidalFrameCodec;
+    std::mt19937 rng(9);
+    const CanFrame frame = make_reply(SinusoidalFrameFormat::format().query, rng);
+
+    QueryResult result;
+    result.fault = 123;
+    // Too short.
+    const bool short_decoded = Codec::Decode(frame.data, frame.size - 1, &result);
+    assert(!short_decoded);
+    assert(result.fault == 123);
+
+    // A reply to a different query.
+    QueryCommand other = SinusoidalFrameFormat::format().query;
+    other.velocity = Resolution::kInt16;
+    CanFrame other_frame = make_reply(other, rng);
+    while (other_frame.size < frame.size) { other_frame.data[other_frame.size++] = 0x50; }
+    const bool other_decoded = Codec::Decode(other_frame.data, other_frame.size, &result);
+    assert(!other_decoded);
+    assert(result.fault == 123);
+
+    // A frame which does not contain a reply at all.
+    CanFrame error = frame;
+    error.data[0] = 0x31;
+    const bool error_decoded = Codec::Decode(error.data, error.size, &result);
+    assert(!error_decoded);
+}
+
+void test_codec() {
+    const FrameCodec& codec = SinusoidalFrameCodec::codec();
+    assert(codec.format == SinusoidalFrameFormat::format());
+    assert(&codec == &SinusoidalFrameCodec::codec());
+
+    PositionCommand command;
+    command.velocity = 42.0;
+    command.sinusoidal_amplitude = 0.2;
+    command.sinusoidal_phase = -1.0;
+    CanFrame frame;
+    codec.encode(command, frame.data, &frame.size);
+    const CanFrame expected = encode_generic(command, codec.format);
+    assert(frame.size == expected.size);
+    assert(std::memcmp(frame.data, expected.data, expected.size) == 0);
+}
+
+int main() {
+    test_encode<SinusoidalFrameFormat>();
+    test_encode<PositionFormat>();
+    test_encode<ZeroVelocityFormat>();
+    test_encode<StoppedFormat>();
+    test_encode<NoQueryFormat>();
+    test_decode<SinusoidalFrameFormat>();
+    test_decode<PositionFormat>();
+    test_decode<StoppedFormat>();
+    test_decode_mismatch();
+    test_codec();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+// steady_state_detector_test.cpp
+#include "../controller/steady_state_detector.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using Clock = std::chrono::steady_clock;
+
+Clock::time_point at(double seconds) {
+    return Clock::time_point(std::chrono::nanoseconds(static_cast<int64_t>(seconds * 1e9)));
+}
+
+void test_statistics() {
+    SteadyStateDetector detector;
+    // A line over the last 150 ms of 300 ms.
+    for (int i = 0; i <= 300; i++) {
+        const double t = i * 0.001;
+        const double values[] = {10.0 + 2.0 * t, 5.0, -0.1 * t};
+        detector.add(at(1.0 + t), values);
+    }
+    assert(detector.size() == 150);
+    assert(std::abs(detector.slope(SteadyStateDetector::kVelocity) - 2.0) < 1e-6);
+    assert(std::abs(detector.slope(SteadyStateDetector::kTorque) + 0.1) < 1e-6);
+    assert(std::abs(detector.slope(SteadyStateDetector::kControlVelocity)) < 1e-6);
+    assert(std::abs(detector.mean(SteadyStateDetector::kVelocity) - (10.0 + 2.0 * 0.2255)) < 1e-6);
+    assert(detector.deviation(SteadyStateDetector::kControlVelocity) < 1e-6);
+    // 2 rev/s^2 drifts 0.3 rev/s over the window, within the default,
+    // 0.1 Nm/s 0.015 Nm.
+    assert(detector.settled());
+}
+
+void test_first_order_response() {
+    SteadyStateDetector detector;
+    // A 50 ms time constant response from 50 to 60 rev/s, with a once
+    // per revolution ripple.
+    double settled_at = -1.0;
+    for (int i = 0; i < 3000; i++) {
+        const double t = i * 0.0003;
+        const double velocity = 60.0 - 10.0 * std::exp(-t / 0.05);
+        const double values[] = {velocity + 0.5 * std::sin(2 * M_PI * 55 * t), 60.0,
+                                 0.1 * std::sin(2 * M_PI * 55 * t)};
+        detector.add(at(t), values);
+        if (t < 0.15) {
+            assert(!detector.settled());
+        }
+        if (settled_at < 0 && detector.settled()) {
+            settled_at = t;
+        }
+        if (settled_at >= 0) {
+            assert(detector.settled());
+        }
+    }
+    // Once the drift across the window is below 0.5 rev/s.
+    assert(settled_at > 0.15 && settled_at < 0.4);
+}
+
+void test_unsteady() {
+    SteadyStateDetector::Options options;
+    options.max_deviation[SteadyStateDetector::kTorque] = 0.05;
+    SteadyStateDetector detector(options);
+    for (int i = 0; i < 2000; i++) {
+        const double t = i * 0.0003;
+        // A torque noisier than allowed.
+        const double values[] = {60.0, 60.0, 0.2 * std::sin(2 * M_PI * 55 * t)};
+        detector.add(at(t), values);
+        assert(!detector.settled());
+    }
+
+    // Limits of infinity disable their tests.
+    options.max_deviation[SteadyStateDetector::kTorque] = std::numeric_limits<double>::infinity();
+    options.max_drift[SteadyStateDetector::kTorque] = std::numeric_limits<double>::infinity();
+    SteadyStateDetector permissive(options);
+    for (int i = 0; i < 2000; i++) {
+        const double t = i * 0.0003;
+        const double values[] = {60.0, 60.0, 0.2 * std::sin(2 * M_PI * 55 * t)};
+        permissive.add(at(t), values);
+    }
+    assert(permissive.settled());
+}
+
+void test_reset_and_invalid_replies() {
+    SteadyStateDetector detector;
+    mjbots::moteus::QueryResult reply;
+    reply.velocity = 60.0;
+    reply.torque = 0.1;
+    // Without a control velocity, e.g. while stopped.
+    for (int i = 0; i < 1000; i++) {
+        detector.add(at(i * 0.0003), reply);
+    }
+    assert(detector.size() == 0);
+    assert(!detector.settled());
+
+    reply.control_velocity = 60.0;
+    for (int i = 0; i < 1000; i++) {
+        detector.add(at(i * 0.0003), reply);
+    }
+    assert(detector.settled());
+    assert(std::abs(detector.mean(SteadyStateDetector::kTorque) - 0.1) < 1e-9);
+
+    // After a reset the window must fill again.
+    detector.reset();
+    assert(!detector.settled());
+    for (int i = 1000; i < 1400; i++) {
+        detector.add(at(i * 0.0003), reply);
+    }
+    assert(!detector.settled());
+    for (int i = 1400; i < 1600; i++) {
+        detector.add(at(i * 0.0003), reply);
+    }
+    assert(detector.settled());
+}
+
+int main() {
+    test_statistics();
+    test_first_order_response();
+    test_unsteady();
+    test_reset_and_invalid_replies();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
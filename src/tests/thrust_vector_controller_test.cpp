@@ -0,0 +1,116 @@
+// thrust_vector_controller_test.cpp
+#include "../controller/thrust_vector_controller.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <map>
+
+class FakeSource : public PulseWidthSource {
+public:
+    void sample() override { samples++; }
+
+    float pulse_width(unsigned int channel) const override {
+        const auto it = values.find(channel);
+        return it == values.end() ? 0 : it->second;
+    }
+
+    std::map<unsigned int, uint32_t> values;
+    int samples = 0;
+};
+
+std::vector<RotorConfig> make_rotors(int count) {
+    std::vector<RotorConfig> rotors(count);
+    for (int i = 0; i < count; i++) {
+        rotors[i].servo_id = i + 1;
+        rotors[i].thrust_channel = 3 * i;
+        rotors[i].elevation_channel = 3 * i + 1;
+        rotors[i].azimuth_channel = 3 * i + 2;
+    }
+    return rotors;
+}
+
+void test_balance_buses() {
+    std::vector<RotorConfig> rotors = make_rotors(9);
+    rotors[0].bus = 1;
+    rotors[1].bus = 1;
+    rotors[2].bus = 5;
+    balance_buses(&rotors);
+    int load[6] = {};
+    for (const auto& rotor : rotors) {
+        load[rotor.bus]++;
+    }
+    // The fixed buses are kept, the rest fill CAN 2-4 first.
+    assert(rotors[0].bus == 1 && rotors[1].bus == 1 && rotors[2].bus == 5);
+    assert(load[1] == 2 && load[2] == 2 && load[3] == 2 && load[4] == 2 && load[5] == 1);
+}
+
+void test_commands() {
+    FakeSource source;
+    std::vector<RotorConfig> rotors = make_rotors(5);
+    rotors[3].mirror_azimuth = true;
+    ThrustVectorController controller(rotors, &source);
+
+    const auto servo_bus_map = controller.servo_bus_map();
+    assert(servo_bus_map.size() == 5);
+    for (int i = 0; i < 5; i++) {
+        assert(servo_bus_map[i].first == i + 1);
+        assert(servo_bus_map[i].second == (i % 4) + 1);
+    }
+
+    std::vector<MoteusInterface::ServoCommand> commands(5);
+    controller.initialize(&commands);
+    std::vector<MoteusInterface::ServoReply> replies(5);
+
+    const CalibrationTable table{CalibrationModel()};
+    const CalibrationModel& model = table.model();
+    for (int i = 0; i < 5; i++) {
+        source.values[3 * i] = 1000 + 100 * i;
+        source.values[3 * i + 1] = 1500;
+        source.values[3 * i + 2] = 1750;
+    }
+    assert(!controller.run(ControlTime(), replies, &commands));
+    assert(source.samples == 1);
+    for (int i = 0; i < 5; i++) {
+        const float thrust = model.min_thrust + (model.max_thrust - model.min_thrust) * 0.1f * i;
+        const float azimuth = (i == 3 ? -1.0f : 1.0f) * M_PI / 2;
+        const RotorCommand expected = table.lookup(thrust, model.max_elevation / 2, azimuth);
+        assert(commands[i].mode == moteus::Mode::kSinusoidal);
+        assert(std::abs(commands[i].position.velocity - expected.velocity) < 1e-4);
+        assert(std::abs(commands[i].position.sinusoidal_amplitude - expected.amplitude) < 1e-5);
+        assert(std::abs(commands[i].position.sinusoidal_phase - expected.phase) < 1e-4);
+    }
+
+    // Out of range inputs are clamped.
+    source.values[0] = 2500;
+    controller.run(ControlTime(), replies, &commands);
+    const RotorCommand clamped = table.lookup(model.max_thrust, model.max_elevation / 2, M_PI / 2);
+    assert(std::abs(commands[0].position.velocity - clamped.velocity) < 1e-4);
+
+    // Disarming any rotor stops all of them.
+    source.values[3 * 4] = 900;
+    controller.run(ControlTime(), replies, &commands);
+    for (const auto& command : commands) {
+        assert(command.mode == moteus::Mode::kStopped);
+    }
+}
+
+void test_servo_count_mismatch() {
+    FakeSource source;
+    ThrustVectorController controller(make_rotors(2), &source);
+    std::vector<MoteusInterface::ServoCommand> commands(3);
+    bool threw = false;
+    try {
+        controller.initialize(&commands);
+    } catch (const std::logic_error&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+int main() {
+    test_balance_buses();
+    test_commands();
+    test_servo_count_mismatch();
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}